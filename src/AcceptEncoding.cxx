@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Content-Encoding negotiation.
+ */
+
+#include "AcceptEncoding.hxx"
+#include "util/IterableSplitString.hxx"
+#include "util/StringStrip.hxx"
+#include "util/StringSplit.hxx"
+
+#include <optional>
+#include <utility>
+
+using std::string_view_literals::operator""sv;
+
+/**
+ * Is the given "q" parameter zero (i.e. not acceptable)?
+ */
+[[gnu::pure]]
+static bool
+IsQualityZero(std::string_view params) noexcept
+{
+	for (std::string_view param : IterableSplitString(params, ';')) {
+		auto [name, value] = Split(Strip(param), '=');
+		name = Strip(name);
+		if (name != "q"sv && name != "Q"sv)
+			continue;
+
+		value = Strip(value);
+		/* "0", "0.", "0.0", "0.00", "0.000" */
+		if (value.empty() || value.front() != '0')
+			return false;
+
+		value.remove_prefix(1);
+		if (value.empty())
+			return true;
+
+		return value.front() == '.' &&
+			value.substr(1).find_first_not_of('0') == value.npos;
+	}
+
+	return false;
+}
+
+ContentEncoding
+NegotiateContentEncoding(const char *accept_encoding, bool zstd) noexcept
+{
+	if (accept_encoding == nullptr)
+		return ContentEncoding::IDENTITY;
+
+	/* std::nullopt means "not mentioned" */
+	std::optional<bool> gzip, zstd_, wildcard;
+
+	for (std::string_view item : IterableSplitString(accept_encoding, ',')) {
+		auto [coding, params] = Split(item, ';');
+		coding = Strip(coding);
+
+		const bool acceptable = !IsQualityZero(params);
+
+		if (coding == "gzip"sv || coding == "x-gzip"sv)
+			gzip = acceptable;
+		else if (coding == "zstd"sv)
+			zstd_ = acceptable;
+		else if (coding == "*"sv)
+			wildcard = acceptable;
+	}
+
+	const bool any = wildcard.value_or(false);
+
+	if (zstd && zstd_.value_or(any))
+		return ContentEncoding::ZSTD;
+
+	if (gzip.value_or(any))
+		return ContentEncoding::GZIP;
+
+	return ContentEncoding::IDENTITY;
+}
+
+std::string_view
+ToString(ContentEncoding encoding) noexcept
+{
+	switch (encoding) {
+	case ContentEncoding::IDENTITY:
+		return "identity"sv;
+
+	case ContentEncoding::GZIP:
+		return "gzip"sv;
+
+	case ContentEncoding::ZSTD:
+		return "zstd"sv;
+	}
+
+	std::unreachable();
+}
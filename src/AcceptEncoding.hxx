@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Content-Encoding negotiation.
+ */
+
+#pragma once
+
+#include <string_view>
+
+enum class ContentEncoding {
+	IDENTITY,
+	GZIP,
+	ZSTD,
+};
+
+/**
+ * Choose the best content encoding from the "Accept-Encoding"
+ * request header (RFC 9110 12.5.3).  Codings with "q=0" are not
+ * acceptable; otherwise, "zstd" is preferred over "gzip".
+ *
+ * @param accept_encoding the header value (may be nullptr)
+ * @param zstd is "zstd" supported by this build?
+ */
+[[gnu::pure]]
+ContentEncoding
+NegotiateContentEncoding(const char *accept_encoding, bool zstd) noexcept;
+
+[[gnu::const]]
+std::string_view
+ToString(ContentEncoding encoding) noexcept;
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Page cache hints for large sequential transfers.
+ */
+
+#include "CachePolicy.hxx"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+ * Check whether most of the given file range is already in the page
+ * cache.
+ */
+static bool
+IsCached(FileDescriptor fd, off_t offset, off_t size) noexcept
+{
+	const off_t page_size = sysconf(_SC_PAGESIZE);
+
+	/* mmap() requires a page-aligned offset */
+	const off_t aligned = offset - offset % page_size;
+	size += offset - aligned;
+
+	void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd.Get(), aligned);
+	if (p == MAP_FAILED)
+		return false;
+
+	const std::size_t n_pages = (size + page_size - 1) / page_size;
+	unsigned char vec[4096];
+	std::size_t n_cached = 0;
+
+	if (n_pages <= sizeof(vec) && mincore(p, size, vec) == 0)
+		n_cached = std::count_if(vec, vec + n_pages,
+					 [](unsigned char i){ return i & 1; });
+
+	munmap(p, size);
+	return n_cached * 2 > n_pages;
+}
+
+ReadCachePolicy::ReadCachePolicy(FileDescriptor _fd,
+				 off_t start, off_t _end) noexcept
+	:fd(_fd), end(_end), advised(start), dropped(start)
+{
+	if (end - start < LARGE_TRANSFER)
+		return;
+
+	enabled = true;
+	posix_fadvise(fd.Get(), start, end - start, POSIX_FADV_SEQUENTIAL);
+
+	/* sample the first window; if it's already in the page cache,
+	   somebody else is using this file, and we must not evict it */
+	hot = IsCached(fd, start, WINDOW);
+}
+
+void
+ReadCachePolicy::Update(off_t position) noexcept
+{
+	if (!enabled)
+		return;
+
+	const off_t advise_end = std::min(position + 2 * WINDOW, end);
+	while (advised < advise_end) {
+		const off_t n = std::min(WINDOW, end - advised);
+		posix_fadvise(fd.Get(), advised, n, POSIX_FADV_WILLNEED);
+		advised += n;
+	}
+
+	/* keep one window behind the current position, because the
+	   pipe may still reference those pages */
+	if (!hot && position - dropped >= 2 * WINDOW) {
+		const off_t drop_end = position - WINDOW;
+		posix_fadvise(fd.Get(), dropped, drop_end - dropped,
+			      POSIX_FADV_DONTNEED);
+		dropped = drop_end;
+	}
+}
+
+void
+WriteCachePolicy::Update(off_t position) noexcept
+{
+	if (!enabled || position - flushed < WINDOW)
+		return;
+
+	/* start writeback for the new window */
+	sync_file_range(fd.Get(), flushed, position - flushed,
+			SYNC_FILE_RANGE_WRITE);
+
+	/* wait for the previous window to be written, and drop it
+	   from the page cache; this throttles the upload to the
+	   speed of the disk instead of filling memory */
+	if (flushed > dropped) {
+		sync_file_range(fd.Get(), dropped, flushed - dropped,
+				SYNC_FILE_RANGE_WAIT_BEFORE|
+				SYNC_FILE_RANGE_WRITE|
+				SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(fd.Get(), dropped, flushed - dropped,
+			      POSIX_FADV_DONTNEED);
+		dropped = flushed;
+	}
+
+	flushed = position;
+}
+
+void
+WriteCachePolicy::Finish(off_t position) noexcept
+{
+	if (!enabled || position <= flushed)
+		return;
+
+	sync_file_range(fd.Get(), flushed, position - flushed,
+			SYNC_FILE_RANGE_WRITE);
+	flushed = position;
+}
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Page cache hints for large sequential transfers.
+ */
+
+#pragma once
+
+#include "io/FileDescriptor.hxx"
+
+#include <sys/types.h>
+
+/**
+ * Transfers smaller than this are left to the kernel's default
+ * page cache behavior.
+ */
+static constexpr off_t LARGE_TRANSFER = 8 * 1024 * 1024;
+
+/**
+ * Manages readahead and eviction while a large file is being sent.
+ * Pages ahead of the current position are requested with
+ * POSIX_FADV_WILLNEED, and pages behind it are dropped with
+ * POSIX_FADV_DONTNEED, so a big download does not evict the hot
+ * working set of small files.  Files which are already mostly
+ * cached are not dropped.
+ */
+class ReadCachePolicy {
+	static constexpr off_t WINDOW = 2 * 1024 * 1024;
+
+	const FileDescriptor fd;
+
+	const off_t end;
+
+	/**
+	 * WILLNEED was requested up to this offset.
+	 */
+	off_t advised;
+
+	/**
+	 * DONTNEED was requested up to this offset.
+	 */
+	off_t dropped;
+
+	bool enabled = false, hot = false;
+
+public:
+	ReadCachePolicy(FileDescriptor _fd, off_t start, off_t _end) noexcept;
+
+	/**
+	 * Notify the policy that everything before the given offset
+	 * has been transferred.
+	 */
+	void Update(off_t position) noexcept;
+};
+
+/**
+ * Limits the amount of dirty page cache a large upload can build up.
+ * Writeback is started with sync_file_range() for each completed
+ * window, and the window before it is waited for and dropped from the
+ * page cache, so dirty memory stays capped at roughly two windows per
+ * request.
+ */
+class WriteCachePolicy {
+	static constexpr off_t WINDOW = 8 * 1024 * 1024;
+
+	const FileDescriptor fd;
+
+	/**
+	 * Writeback was started up to this offset.
+	 */
+	off_t flushed = 0;
+
+	/**
+	 * Writeback was completed and the page cache dropped up to
+	 * this offset.
+	 */
+	off_t dropped = 0;
+
+	const bool enabled;
+
+public:
+	/**
+	 * @param size the expected size of the upload or -1 if unknown
+	 */
+	WriteCachePolicy(FileDescriptor _fd, off_t size) noexcept
+		:fd(_fd), enabled(size < 0 || size >= LARGE_TRANSFER) {}
+
+	void Update(off_t position) noexcept;
+
+	/**
+	 * The upload is complete; start writeback for the tail, but
+	 * don't wait for it.
+	 */
+	void Finish(off_t position) noexcept;
+};
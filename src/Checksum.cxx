@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Parsers for request body checksum headers.
+ */
+
+#include "Checksum.hxx"
+#include "util/IterableSplitString.hxx"
+#include "util/StringStrip.hxx"
+#include "util/StringSplit.hxx"
+
+#include <strings.h>
+
+[[gnu::const]]
+static std::size_t
+GetDigestSize(ChecksumAlgorithm algorithm) noexcept
+{
+	switch (algorithm) {
+	case ChecksumAlgorithm::NONE:
+		break;
+
+	case ChecksumAlgorithm::MD5:
+		return 16;
+
+	case ChecksumAlgorithm::SHA1:
+		return 20;
+
+	case ChecksumAlgorithm::SHA256:
+		return 32;
+
+	case ChecksumAlgorithm::SHA512:
+		return 64;
+	}
+
+	return 0;
+}
+
+[[gnu::pure]]
+static bool
+IsEqualIgnoreCase(std::string_view a, std::string_view b) noexcept
+{
+	return a.size() == b.size() &&
+		strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+[[gnu::const]]
+static int
+DecodeBase64Char(char ch) noexcept
+{
+	if (ch >= 'A' && ch <= 'Z')
+		return ch - 'A';
+	if (ch >= 'a' && ch <= 'z')
+		return ch - 'a' + 26;
+	if (ch >= '0' && ch <= '9')
+		return ch - '0' + 52;
+	if (ch == '+')
+		return 62;
+	if (ch == '/')
+		return 63;
+	return -1;
+}
+
+/**
+ * Decode a base64 string into #result, which must have the expected
+ * size.
+ */
+static bool
+DecodeBase64(std::string_view s, ExpectedChecksum &result) noexcept
+{
+	while (!s.empty() && s.back() == '=')
+		s.remove_suffix(1);
+
+	std::size_t n = 0;
+	unsigned bits = 0, value = 0;
+
+	for (const char ch : s) {
+		const int i = DecodeBase64Char(ch);
+		if (i < 0)
+			return false;
+
+		value = (value << 6) | unsigned(i);
+		bits += 6;
+
+		if (bits >= 8) {
+			bits -= 8;
+			if (n >= result.size)
+				return false;
+
+			result.buffer[n++] = std::byte(value >> bits);
+		}
+	}
+
+	return n == result.size;
+}
+
+[[gnu::const]]
+static int
+DecodeHexChar(char ch) noexcept
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	if (ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 10;
+	if (ch >= 'A' && ch <= 'F')
+		return ch - 'A' + 10;
+	return -1;
+}
+
+static bool
+DecodeHex(std::string_view s, ExpectedChecksum &result) noexcept
+{
+	if (s.size() != result.size * 2)
+		return false;
+
+	for (std::size_t i = 0; i < result.size; ++i) {
+		const int hi = DecodeHexChar(s[i * 2]);
+		const int lo = DecodeHexChar(s[i * 2 + 1]);
+		if (hi < 0 || lo < 0)
+			return false;
+
+		result.buffer[i] = std::byte((hi << 4) | lo);
+	}
+
+	return true;
+}
+
+static void
+SetAlgorithm(ExpectedChecksum &result, ChecksumAlgorithm algorithm) noexcept
+{
+	result.algorithm = algorithm;
+	result.size = GetDigestSize(algorithm);
+}
+
+/**
+ * Parse an algorithm name from the HTTP Digest Algorithm Values
+ * registry.
+ */
+[[gnu::pure]]
+static ChecksumAlgorithm
+ParseDigestAlgorithm(std::string_view name) noexcept
+{
+	if (IsEqualIgnoreCase(name, "MD5"))
+		return ChecksumAlgorithm::MD5;
+	else if (IsEqualIgnoreCase(name, "SHA"))
+		return ChecksumAlgorithm::SHA1;
+	else if (IsEqualIgnoreCase(name, "SHA-256"))
+		return ChecksumAlgorithm::SHA256;
+	else if (IsEqualIgnoreCase(name, "SHA-512"))
+		return ChecksumAlgorithm::SHA512;
+	else
+		return ChecksumAlgorithm::NONE;
+}
+
+bool
+ParseDigestHeader(std::string_view s, ExpectedChecksum &result) noexcept
+{
+	for (std::string_view item : IterableSplitString(s, ',')) {
+		auto [name, value] = Split(Strip(item), '=');
+		const auto algorithm = ParseDigestAlgorithm(Strip(name));
+		if (algorithm == ChecksumAlgorithm::NONE)
+			continue;
+
+		SetAlgorithm(result, algorithm);
+		return DecodeBase64(Strip(value), result);
+	}
+
+	return true;
+}
+
+bool
+ParseContentMD5Header(std::string_view s, ExpectedChecksum &result) noexcept
+{
+	SetAlgorithm(result, ChecksumAlgorithm::MD5);
+	return DecodeBase64(Strip(s), result);
+}
+
+[[gnu::pure]]
+static ChecksumAlgorithm
+ParseOcChecksumAlgorithm(std::string_view name) noexcept
+{
+	if (IsEqualIgnoreCase(name, "MD5"))
+		return ChecksumAlgorithm::MD5;
+	else if (IsEqualIgnoreCase(name, "SHA1"))
+		return ChecksumAlgorithm::SHA1;
+	else if (IsEqualIgnoreCase(name, "SHA256"))
+		return ChecksumAlgorithm::SHA256;
+	else
+		return ChecksumAlgorithm::NONE;
+}
+
+bool
+ParseOcChecksumHeader(std::string_view s, ExpectedChecksum &result) noexcept
+{
+	auto [name, value] = Split(Strip(s), ':');
+	if (value.data() == nullptr)
+		return false;
+
+	const auto algorithm = ParseOcChecksumAlgorithm(name);
+	if (algorithm == ChecksumAlgorithm::NONE)
+		return true;
+
+	SetAlgorithm(result, algorithm);
+	return DecodeHex(value, result);
+}
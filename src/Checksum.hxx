@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Parsers for request body checksum headers.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+enum class ChecksumAlgorithm : uint8_t {
+	NONE,
+	MD5,
+	SHA1,
+	SHA256,
+	SHA512,
+};
+
+/**
+ * A checksum announced by the client which the request body must
+ * match.
+ */
+struct ExpectedChecksum {
+	ChecksumAlgorithm algorithm = ChecksumAlgorithm::NONE;
+
+	std::size_t size = 0;
+
+	std::array<std::byte, 64> buffer;
+
+	bool IsDefined() const noexcept {
+		return algorithm != ChecksumAlgorithm::NONE;
+	}
+
+	std::span<const std::byte> GetValue() const noexcept {
+		return std::span{buffer}.first(size);
+	}
+};
+
+/**
+ * Parse a "Digest" header (RFC 3230), e.g. "SHA-256=base64".  The
+ * first supported algorithm is used.  If there is none,
+ * ExpectedChecksum::algorithm remains #ChecksumAlgorithm::NONE.
+ *
+ * @return false if the header is malformed
+ */
+bool
+ParseDigestHeader(std::string_view s, ExpectedChecksum &result) noexcept;
+
+/**
+ * Parse a "Content-MD5" header (RFC 1864).
+ *
+ * @return false if the header is malformed
+ */
+bool
+ParseContentMD5Header(std::string_view s, ExpectedChecksum &result) noexcept;
+
+/**
+ * Parse an "OC-Checksum" header (ownCloud/Nextcloud), e.g.
+ * "SHA1:hex".  Unsupported algorithms (e.g. "ADLER32") are ignored.
+ *
+ * @return false if the header is malformed
+ */
+bool
+ParseOcChecksumHeader(std::string_view s, ExpectedChecksum &result) noexcept;
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Collection ETags which change whenever anything below the
+ * collection changes.
+ */
+
+#include "CollectionTag.hxx"
+#include "util/Base32.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+std::optional<uint64_t>
+LoadCollectionTag(const char *path) noexcept
+{
+	uint64_t value;
+	if (getxattr(path, COLLECTION_TAG_XATTR, &value, sizeof(value)) != sizeof(value))
+		return std::nullopt;
+
+	return value;
+}
+
+StringBuffer<64>
+MakeCollectionETag(const struct statx &st, uint64_t tag) noexcept
+{
+	StringBuffer<64> result;
+
+	char *p = result.data();
+	*p++ = '"';
+	*p++ = 'c';
+
+	/* the inode number distinguishes a directory from one which
+	   replaced it, and the modification time covers changes to
+	   its members which were not made by davos */
+	p = FormatIntBase32(p, st.stx_ino);
+
+	*p++ = '-';
+
+	p = FormatIntBase32(p, tag);
+
+	*p++ = '-';
+
+	p = FormatIntBase32(p, st.stx_mtime.tv_sec);
+	p = FormatIntBase32(p, st.stx_mtime.tv_nsec);
+
+	*p++ = '"';
+	*p = 0;
+
+	return result;
+}
+
+std::optional<StringBuffer<64>>
+GetCollectionETag(const char *path, const struct statx &st) noexcept
+{
+	if (!S_ISDIR(st.stx_mode))
+		return std::nullopt;
+
+	const auto tag = LoadCollectionTag(path);
+	if (!tag)
+		return std::nullopt;
+
+	return MakeCollectionETag(st, *tag);
+}
+
+/**
+ * Increase the #COLLECTION_TAG_XATTR attribute of one directory.
+ *
+ * Unlike the usage accounting, this needs no lock: the new value is
+ * always larger than the old one, so even if concurrent updates get
+ * lost, the tag still differs from all values which were seen before.
+ */
+static void
+BumpCollectionTag(const char *path, uint64_t now) noexcept
+{
+	/* the clock keeps the tag of a directory which was deleted
+	   and created again from repeating old values */
+	uint64_t value = now;
+	if (const auto old = LoadCollectionTag(path))
+		value = std::max(value, *old + 1);
+
+	setxattr(path, COLLECTION_TAG_XATTR, &value, sizeof(value), 0);
+}
+
+void
+BumpCollectionTags(std::string_view root, std::string_view directory) noexcept
+{
+	while (root.size() > 1 && root.back() == '/')
+		root.remove_suffix(1);
+
+	const uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+
+	std::string path{directory};
+
+	while (true) {
+		while (path.size() > 1 && path.back() == '/')
+			path.pop_back();
+
+		BumpCollectionTag(path.c_str(), now);
+
+		if (path.size() <= root.size())
+			break;
+
+		const auto slash = path.rfind('/');
+		if (slash == path.npos || slash < root.size())
+			break;
+
+		path.erase(slash);
+	}
+}
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Collection ETags which change whenever anything below the
+ * collection changes.
+ */
+
+#pragma once
+
+#include "util/StringBuffer.hxx"
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+struct statx;
+
+/**
+ * The name of the extended attribute of a directory which contains
+ * its tag (a native 64 bit integer).  It is increased by each
+ * modification below the directory.
+ */
+static constexpr char COLLECTION_TAG_XATTR[] = "user.davos.ctag";
+
+/**
+ * Load the tag of a directory from its #COLLECTION_TAG_XATTR
+ * attribute.
+ *
+ * @return the tag or std::nullopt if the directory has none
+ */
+std::optional<uint64_t>
+LoadCollectionTag(const char *path) noexcept;
+
+[[gnu::pure]]
+StringBuffer<64>
+MakeCollectionETag(const struct statx &st, uint64_t tag) noexcept;
+
+/**
+ * Determine the ETag of a directory.  This costs one getxattr() and
+ * never reads the directory.
+ *
+ * @param st the current status of the directory
+ * @return the ETag or std::nullopt if the directory has no tag (yet)
+ */
+std::optional<StringBuffer<64>>
+GetCollectionETag(const char *path, const struct statx &st) noexcept;
+
+/**
+ * Increase the tag of the given directory and all of its ancestors
+ * up to the document root.  Directories without a tag get one.
+ *
+ * @param root the document root
+ * @param directory the directory below (or equal to) #root whose
+ * contents have been modified
+ */
+void
+BumpCollectionTags(std::string_view root, std::string_view directory) noexcept;
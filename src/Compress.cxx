@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Streaming compression of response bodies.
+ */
+
+#include "Compress.hxx"
+#include "Parameter.hxx"
+#include "was/WasOutputStream.hxx"
+#include "config.h"
+
+#include <was/simple.h>
+
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <stdio.h>
+
+bool
+CompressConfig::Setup(was_simple *w) noexcept
+{
+	uint64_t _level = 6, _threshold = 4096;
+	if (!GetUnsignedParameter(w, "DAVOS_COMPRESS_LEVEL", _level) ||
+	    !GetUnsignedParameter(w, "DAVOS_COMPRESS_THRESHOLD", _threshold))
+		return false;
+
+	if (_level > 9) {
+		fprintf(stderr, "Malformed DAVOS_COMPRESS_LEVEL\n");
+		return false;
+	}
+
+	level = _level;
+	threshold = _threshold;
+	return true;
+}
+
+ContentEncoding
+CompressConfig::Negotiate(was_simple *w) const noexcept
+{
+	if (level == 0)
+		return ContentEncoding::IDENTITY;
+
+#ifdef HAVE_ZSTD
+	constexpr bool have_zstd = true;
+#else
+	constexpr bool have_zstd = false;
+#endif
+
+	return NegotiateContentEncoding(was_simple_get_header(w, "accept-encoding"),
+					have_zstd);
+}
+
+namespace {
+
+class GzipCompressor final : public Compressor {
+	OutputStream &next;
+
+	z_stream z{};
+
+public:
+	GzipCompressor(OutputStream &_next, unsigned level)
+		:next(_next)
+	{
+		/* 16 = gzip header instead of zlib */
+		if (deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8,
+				 Z_DEFAULT_STRATEGY) != Z_OK)
+			throw std::runtime_error("deflateInit2() failed");
+	}
+
+	~GzipCompressor() noexcept override {
+		deflateEnd(&z);
+	}
+
+	void Finish() override {
+		Deflate({}, Z_FINISH);
+	}
+
+	void Write(std::span<const std::byte> src) override {
+		Deflate(src, Z_NO_FLUSH);
+	}
+
+private:
+	void Deflate(std::span<const std::byte> src, int flush) {
+		z.next_in = const_cast<Bytef *>(reinterpret_cast<const Bytef *>(src.data()));
+		z.avail_in = src.size();
+
+		while (true) {
+			std::byte buffer[16384];
+			z.next_out = reinterpret_cast<Bytef *>(buffer);
+			z.avail_out = sizeof(buffer);
+
+			int result = deflate(&z, flush);
+			if (result != Z_OK && result != Z_STREAM_END &&
+			    result != Z_BUF_ERROR)
+				throw std::runtime_error("deflate() failed");
+
+			const std::size_t n = sizeof(buffer) - z.avail_out;
+			if (n > 0)
+				next.Write({buffer, n});
+
+			if (flush == Z_FINISH
+			    ? result == Z_STREAM_END
+			    : z.avail_in == 0 && z.avail_out > 0)
+				break;
+		}
+	}
+};
+
+#ifdef HAVE_ZSTD
+
+class ZstdCompressor final : public Compressor {
+	OutputStream &next;
+
+	ZSTD_CCtx *const cctx;
+
+public:
+	ZstdCompressor(OutputStream &_next, unsigned level)
+		:next(_next), cctx(ZSTD_createCCtx())
+	{
+		if (cctx == nullptr)
+			throw std::bad_alloc{};
+
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+	}
+
+	~ZstdCompressor() noexcept override {
+		ZSTD_freeCCtx(cctx);
+	}
+
+	void Finish() override {
+		Compress({}, ZSTD_e_end);
+	}
+
+	void Write(std::span<const std::byte> src) override {
+		Compress(src, ZSTD_e_continue);
+	}
+
+private:
+	void Compress(std::span<const std::byte> src, ZSTD_EndDirective mode) {
+		ZSTD_inBuffer in{src.data(), src.size(), 0};
+
+		while (true) {
+			std::byte buffer[16384];
+			ZSTD_outBuffer out{buffer, sizeof(buffer), 0};
+
+			const std::size_t remaining =
+				ZSTD_compressStream2(cctx, &out, &in, mode);
+			if (ZSTD_isError(remaining))
+				throw std::runtime_error(ZSTD_getErrorName(remaining));
+
+			if (out.pos > 0)
+				next.Write({buffer, out.pos});
+
+			if (mode == ZSTD_e_end
+			    ? remaining == 0
+			    : in.pos == in.size)
+				break;
+		}
+	}
+};
+
+#endif
+
+} // anonymous namespace
+
+CompressOutputStream::CompressOutputStream(was_simple *_w, OutputStream &_next,
+					   ContentEncoding _encoding,
+					   const CompressConfig &config) noexcept
+	:w(_w), next(_next), encoding(_encoding),
+	 level(config.level), threshold(config.threshold)
+{
+}
+
+CompressOutputStream::~CompressOutputStream() noexcept = default;
+
+inline void
+CompressOutputStream::Start()
+{
+	if (!was_simple_set_header(w, "content-encoding",
+				   std::string{ToString(encoding)}.c_str()))
+		throw WasOutputStream::WriteFailed{};
+
+	switch (encoding) {
+	case ContentEncoding::IDENTITY:
+		std::unreachable();
+
+	case ContentEncoding::GZIP:
+		compressor = std::make_unique<GzipCompressor>(next, level);
+		break;
+
+	case ContentEncoding::ZSTD:
+#ifdef HAVE_ZSTD
+		compressor = std::make_unique<ZstdCompressor>(next, level);
+		break;
+#else
+		std::unreachable();
+#endif
+	}
+
+	compressor->Write(pending);
+	pending = {};
+}
+
+void
+CompressOutputStream::Write(std::span<const std::byte> src)
+{
+	if (compressor) {
+		compressor->Write(src);
+		return;
+	}
+
+	if (encoding == ContentEncoding::IDENTITY) {
+		next.Write(src);
+		return;
+	}
+
+	pending.insert(pending.end(), src.begin(), src.end());
+	if (pending.size() >= threshold)
+		Start();
+}
+
+void
+CompressOutputStream::Finish()
+{
+	if (compressor)
+		compressor->Finish();
+	else if (!pending.empty())
+		/* too small, send it uncompressed */
+		next.Write(pending);
+}
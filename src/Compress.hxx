@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Streaming compression of response bodies.
+ */
+
+#pragma once
+
+#include "AcceptEncoding.hxx"
+#include "io/OutputStream.hxx"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+struct was_simple;
+
+struct CompressConfig {
+	/**
+	 * The compression level; 0 disables compression.
+	 */
+	unsigned level = 6;
+
+	/**
+	 * Responses smaller than this are not compressed.
+	 */
+	std::size_t threshold = 4096;
+
+	/**
+	 * Parse the WAS parameters.
+	 *
+	 * @return false on error (after printing an error message)
+	 */
+	bool Setup(was_simple *w) noexcept;
+
+	/**
+	 * Is compression enabled?  Then all responses which may be
+	 * compressed vary on "Accept-Encoding", even those which are
+	 * not.
+	 */
+	bool IsEnabled() const noexcept {
+		return level > 0;
+	}
+
+	/**
+	 * Negotiate the content encoding for the current request.
+	 */
+	[[gnu::pure]]
+	ContentEncoding Negotiate(was_simple *w) const noexcept;
+};
+
+/**
+ * A compressor which writes to another #OutputStream.
+ */
+class Compressor : public OutputStream {
+public:
+	virtual ~Compressor() noexcept = default;
+
+	/**
+	 * Flush all pending data and finish the compressed stream.
+	 */
+	virtual void Finish() = 0;
+};
+
+/**
+ * An #OutputStream which compresses the response body if it grows
+ * beyond the configured threshold.  Data is held back until the
+ * threshold is reached; only then the "Content-Encoding" header is
+ * sent and the compressor is started.  Smaller responses are sent
+ * uncompressed by Finish().
+ */
+class CompressOutputStream final : public OutputStream {
+	was_simple *const w;
+	OutputStream &next;
+
+	const ContentEncoding encoding;
+	const unsigned level;
+	const std::size_t threshold;
+
+	std::vector<std::byte> pending;
+
+	std::unique_ptr<Compressor> compressor;
+
+public:
+	/**
+	 * @param _encoding the negotiated content encoding; with
+	 * #ContentEncoding::IDENTITY, all data is passed through
+	 */
+	CompressOutputStream(was_simple *_w, OutputStream &_next,
+			     ContentEncoding _encoding,
+			     const CompressConfig &config) noexcept;
+
+	~CompressOutputStream() noexcept;
+
+	/**
+	 * Submit all pending data to the next #OutputStream.
+	 */
+	void Finish();
+
+	/**
+	 * Return the content encoding which was actually applied;
+	 * this is #ContentEncoding::IDENTITY if the response was too
+	 * small.  Only valid after Finish().
+	 */
+	[[gnu::pure]]
+	ContentEncoding GetContentEncoding() const noexcept {
+		return compressor ? encoding : ContentEncoding::IDENTITY;
+	}
+
+	/* virtual methods from class OutputStream */
+	void Write(std::span<const std::byte> src) override;
+
+private:
+	void Start();
+};
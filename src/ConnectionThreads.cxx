@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Keep track of the connection threads of a Multi-WAS process.
+ */
+
+#include "ConnectionThreads.hxx"
+#include "util/PrintException.hxx"
+
+ConnectionThreads::~ConnectionThreads() noexcept
+{
+	JoinAll();
+}
+
+void
+ConnectionThreads::JoinFinished(std::unique_lock<std::mutex> &lock) noexcept
+{
+	auto threads = std::move(finished);
+	finished.clear();
+
+	lock.unlock();
+
+	for (auto &i : threads)
+		i.join();
+
+	lock.lock();
+}
+
+void
+ConnectionThreads::WaitSlot() noexcept
+{
+	std::unique_lock lock{mutex};
+	cond.wait(lock, [this]{ return running.size() < max_threads; });
+	JoinFinished(lock);
+}
+
+void
+ConnectionThreads::Start(std::move_only_function<void()> f)
+{
+	/* the new thread moves its own list item to #finished;
+	   holding the mutex until the std::thread object has been
+	   assigned ensures that it finds a valid one */
+	const std::scoped_lock lock{mutex};
+
+	const auto i = running.emplace(running.end());
+
+	try {
+		*i = std::thread{&ConnectionThreads::Run, this, i,
+				 std::move(f)};
+	} catch (...) {
+		running.erase(i);
+		throw;
+	}
+}
+
+void
+ConnectionThreads::Run(std::list<std::thread>::iterator i,
+		       std::move_only_function<void()> f) noexcept
+{
+	try {
+		f();
+	} catch (...) {
+		PrintException(std::current_exception());
+	}
+
+	const std::scoped_lock lock{mutex};
+	finished.splice(finished.end(), running, i);
+	cond.notify_all();
+}
+
+void
+ConnectionThreads::JoinAll() noexcept
+{
+	std::unique_lock lock{mutex};
+	cond.wait(lock, [this]{ return running.empty(); });
+	JoinFinished(lock);
+}
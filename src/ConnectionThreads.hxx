@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Keep track of the connection threads of a Multi-WAS process.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+
+/**
+ * Runs each connection in its own thread, limits the number of
+ * concurrent connections and joins all threads before the process
+ * exits, so no request is interrupted half-way.
+ */
+class ConnectionThreads {
+	const unsigned max_threads;
+
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	/**
+	 * Threads which are still running their connection.
+	 */
+	std::list<std::thread> running;
+
+	/**
+	 * Threads which are done, but have not yet been joined.
+	 */
+	std::list<std::thread> finished;
+
+public:
+	explicit ConnectionThreads(unsigned _max_threads) noexcept
+		:max_threads(_max_threads) {}
+
+	/**
+	 * Joins all threads.
+	 */
+	~ConnectionThreads() noexcept;
+
+	ConnectionThreads(const ConnectionThreads &) = delete;
+	ConnectionThreads &operator=(const ConnectionThreads &) = delete;
+
+	/**
+	 * Wait until another thread may be started, and join the
+	 * threads which have finished meanwhile.
+	 */
+	void WaitSlot() noexcept;
+
+	/**
+	 * Start a new thread running the given function.  Throws
+	 * std::system_error if the thread cannot be created.
+	 */
+	void Start(std::move_only_function<void()> f);
+
+	/**
+	 * Wait until all threads have finished, and join them.
+	 */
+	void JoinAll() noexcept;
+
+private:
+	void Run(std::list<std::thread>::iterator i,
+		 std::move_only_function<void()> f) noexcept;
+
+	/**
+	 * Join all threads in #finished.  The caller must hold the
+	 * mutex; it is released while joining.
+	 */
+	void JoinFinished(std::unique_lock<std::mutex> &lock) noexcept;
+};
@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Content hashes of files, persisted in an extended attribute.
+ */
+
+#include "ContentHash.hxx"
+#include "system/Error.hxx"
+
+#include <openssl/evp.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+static_assert(Digest::MAX_SIZE == EVP_MAX_MD_SIZE);
+
+Digest::Digest(const EVP_MD *md)
+	:ctx(EVP_MD_CTX_new())
+{
+	if (ctx == nullptr)
+		throw std::bad_alloc{};
+
+	if (!EVP_DigestInit_ex(ctx, md, nullptr)) {
+		EVP_MD_CTX_free(ctx);
+		throw std::runtime_error("EVP_DigestInit_ex() failed");
+	}
+}
+
+Digest::~Digest() noexcept
+{
+	EVP_MD_CTX_free(ctx);
+}
+
+void
+Digest::Update(std::span<const std::byte> src)
+{
+	if (!EVP_DigestUpdate(ctx, src.data(), src.size()))
+		throw std::runtime_error("EVP_DigestUpdate() failed");
+}
+
+std::span<const std::byte>
+Digest::Final(std::span<std::byte, MAX_SIZE> dest)
+{
+	unsigned size;
+	if (!EVP_DigestFinal_ex(ctx, reinterpret_cast<unsigned char *>(dest.data()),
+				&size))
+		throw std::runtime_error("EVP_DigestFinal_ex() failed");
+
+	return dest.first(size);
+}
+
+ContentHasher::ContentHasher()
+	:Digest(EVP_sha256())
+{
+}
+
+ContentHash
+ContentHasher::Final()
+{
+	std::array<std::byte, MAX_SIZE> buffer;
+	const auto result = Digest::Final(buffer);
+	assert(result.size() == sizeof(ContentHash));
+
+	ContentHash hash;
+	std::copy(result.begin(), result.end(), hash.begin());
+	return hash;
+}
+
+TeeHasher::TeeHasher(std::span<Digest *const> _digests)
+	:digests(_digests)
+{
+	if (!UniqueFileDescriptor::CreatePipe(r, w))
+		throw MakeErrno("pipe() failed");
+
+	/* a larger pipe allows tee() to duplicate a whole chunk at a
+	   time; errors are not fatal */
+	fcntl(w.Get(), F_SETPIPE_SZ, 1024 * 1024);
+
+	thread = std::thread{&TeeHasher::Run, this};
+}
+
+TeeHasher::~TeeHasher() noexcept
+{
+	Join();
+}
+
+inline void
+TeeHasher::Join() noexcept
+{
+	if (thread.joinable()) {
+		/* closing the write end lets the thread see the end
+		   of the stream */
+		w.Close();
+		thread.join();
+	}
+}
+
+void
+TeeHasher::Run() noexcept
+try {
+	std::byte buffer[65536];
+
+	while (true) {
+		const ssize_t nbytes = r.Read(buffer);
+		if (nbytes <= 0) {
+			failed = nbytes < 0;
+			break;
+		}
+
+		for (Digest *digest : digests)
+			digest->Update(std::span{buffer}.first(nbytes));
+	}
+} catch (...) {
+	failed = true;
+}
+
+bool
+TeeHasher::Finish() noexcept
+{
+	Join();
+	return !failed;
+}
+
+/**
+ * The layout of the #CONTENT_HASH_XATTR value.
+ */
+struct ContentHashAttribute {
+	uint64_t ino;
+	int64_t mtime_sec;
+	uint32_t mtime_nsec;
+	uint32_t reserved;
+	uint64_t size;
+	ContentHash hash;
+
+	bool Matches(const struct statx &st) const noexcept {
+		return ino == st.stx_ino &&
+			mtime_sec == st.stx_mtime.tv_sec &&
+			mtime_nsec == st.stx_mtime.tv_nsec &&
+			size == st.stx_size;
+	}
+};
+
+static_assert(sizeof(ContentHashAttribute) == 64);
+
+std::optional<ContentHash>
+LoadContentHash(FileDescriptor fd, const struct statx &st) noexcept
+{
+	ContentHashAttribute a;
+	if (fgetxattr(fd.Get(), CONTENT_HASH_XATTR, &a, sizeof(a)) != sizeof(a) ||
+	    !a.Matches(st))
+		return std::nullopt;
+
+	return a.hash;
+}
+
+std::optional<ContentHash>
+LoadContentHash(const char *path, const struct statx &st) noexcept
+{
+	ContentHashAttribute a;
+	if (getxattr(path, CONTENT_HASH_XATTR, &a, sizeof(a)) != sizeof(a) ||
+	    !a.Matches(st))
+		return std::nullopt;
+
+	return a.hash;
+}
+
+bool
+StoreContentHash(FileDescriptor fd, const struct statx &st,
+		 const ContentHash &hash) noexcept
+{
+	const ContentHashAttribute a{
+		.ino = st.stx_ino,
+		.mtime_sec = st.stx_mtime.tv_sec,
+		.mtime_nsec = st.stx_mtime.tv_nsec,
+		.reserved = 0,
+		.size = st.stx_size,
+		.hash = hash,
+	};
+
+	return fsetxattr(fd.Get(), CONTENT_HASH_XATTR, &a, sizeof(a), 0) == 0;
+}
+
+ContentHash
+CalculateContentHash(FileDescriptor fd)
+{
+	posix_fadvise(fd.Get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	ContentHasher hasher;
+
+	std::byte buffer[65536];
+	off_t offset = 0;
+
+	while (true) {
+		const ssize_t nbytes = fd.ReadAt(offset, buffer);
+		if (nbytes < 0)
+			throw MakeErrno("Failed to read file");
+
+		if (nbytes == 0)
+			break;
+
+		hasher.Update(std::span{buffer}.first(nbytes));
+		offset += nbytes;
+	}
+
+	return hasher.Final();
+}
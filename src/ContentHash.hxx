@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Content hashes of files, persisted in an extended attribute.
+ */
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <thread>
+
+struct statx;
+struct evp_md_st;
+struct evp_md_ctx_st;
+
+/**
+ * The SHA-256 digest of a file's contents.
+ */
+using ContentHash = std::array<std::byte, 32>;
+
+/**
+ * The name of the extended attribute which stores the
+ * #ContentHash, together with the inode number, modification time
+ * and size it is valid for.
+ */
+static constexpr char CONTENT_HASH_XATTR[] = "user.davos.hash";
+
+/**
+ * Incremental calculation of a message digest (OpenSSL EVP).  Throws
+ * on error.
+ */
+class Digest {
+	evp_md_ctx_st *const ctx;
+
+public:
+	/**
+	 * The maximum digest size (EVP_MAX_MD_SIZE).
+	 */
+	static constexpr std::size_t MAX_SIZE = 64;
+
+	explicit Digest(const evp_md_st *md);
+	~Digest() noexcept;
+
+	Digest(const Digest &) = delete;
+	Digest &operator=(const Digest &) = delete;
+
+	void Update(std::span<const std::byte> src);
+
+	/**
+	 * @return the digest (a part of the given buffer)
+	 */
+	std::span<const std::byte> Final(std::span<std::byte, MAX_SIZE> dest);
+};
+
+/**
+ * Incremental calculation of a #ContentHash.  Throws on error.
+ */
+class ContentHasher : public Digest {
+public:
+	ContentHasher();
+
+	ContentHash Final();
+};
+
+/**
+ * Feeds data into one or more #Digest instances in a separate
+ * thread.  The caller duplicates data into the pipe returned by
+ * GetPipe() with tee(), so the data is never copied to userspace on
+ * the caller's side, and hashing runs in parallel with the disk
+ * writes.  Throws on error.
+ */
+class TeeHasher {
+	UniqueFileDescriptor r, w;
+
+	const std::span<Digest *const> digests;
+
+	std::thread thread;
+
+	/**
+	 * Set by the thread if reading from the pipe has failed.
+	 */
+	bool failed = false;
+
+public:
+	/**
+	 * @param _digests the digests to be updated; they must
+	 * remain valid until Finish() has returned
+	 */
+	explicit TeeHasher(std::span<Digest *const> _digests);
+	~TeeHasher() noexcept;
+
+	TeeHasher(const TeeHasher &) = delete;
+	TeeHasher &operator=(const TeeHasher &) = delete;
+
+	/**
+	 * The (blocking) write end of the pipe.
+	 */
+	FileDescriptor GetPipe() const noexcept {
+		return w;
+	}
+
+	/**
+	 * Close the pipe and wait for the thread to hash the
+	 * remaining data.  After that, the caller may finalize the
+	 * digests.
+	 *
+	 * @return false on error
+	 */
+	bool Finish() noexcept;
+
+private:
+	void Run() noexcept;
+	void Join() noexcept;
+};
+
+/**
+ * Load the #ContentHash from the extended attribute.
+ *
+ * @param st the current status of the file
+ * @return the hash or std::nullopt if there is none or if it is
+ * outdated
+ */
+std::optional<ContentHash>
+LoadContentHash(FileDescriptor fd, const struct statx &st) noexcept;
+
+std::optional<ContentHash>
+LoadContentHash(const char *path, const struct statx &st) noexcept;
+
+/**
+ * Store the #ContentHash in the extended attribute.  Callers which
+ * can do without it may ignore errors.
+ *
+ * @param st the status of the file after it was written
+ * @return false on error (with errno set)
+ */
+bool
+StoreContentHash(FileDescriptor fd, const struct statx &st,
+		 const ContentHash &hash) noexcept;
+
+/**
+ * Read the file and calculate its #ContentHash.  Throws on error.
+ */
+ContentHash
+CalculateContentHash(FileDescriptor fd);
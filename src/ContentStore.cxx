@@ -0,0 +1,423 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * A content-addressed object store which deduplicates files.
+ */
+
+#include "ContentStore.hxx"
+#include "DirectoryScanner.hxx"
+#include "file.hxx"
+#include "system/Error.hxx"
+#include "io/FileWriter.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <was/simple.h>
+
+#include <string_view>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <linux/fs.h> // for FICLONE
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+bool
+ContentStore::Setup(was_simple *w) noexcept
+{
+	const char *p = was_simple_get_parameter(w, "DAVOS_STORE");
+	if (p == nullptr) {
+		fprintf(stderr, "No DAVOS_STORE\n");
+		return false;
+	}
+
+	if (*p != '/') {
+		fprintf(stderr, "Malformed DAVOS_STORE\n");
+		return false;
+	}
+
+	/* copy the string, because this object is reused for later
+	   requests (see #SiteCache) */
+	directory = p;
+	return true;
+}
+
+std::string
+ContentStore::GetObjectPath(const ContentHash &hash) const noexcept
+{
+	static constexpr char hex_digits[] = "0123456789abcdef";
+
+	std::string path;
+	path.reserve(directory.size() + 2 + hash.size() * 2);
+	path.append(directory);
+	path.push_back('/');
+
+	for (std::size_t i = 0; i < hash.size(); ++i) {
+		if (i == 1)
+			path.push_back('/');
+
+		const auto b = static_cast<unsigned>(hash[i]);
+		path.push_back(hex_digits[b >> 4]);
+		path.push_back(hex_digits[b & 0xf]);
+	}
+
+	return path;
+}
+
+/**
+ * Return the directory part of the given path.
+ */
+[[gnu::pure]]
+static std::string_view
+DirectoryOf(std::string_view path) noexcept
+{
+	const auto slash = path.rfind('/');
+	return slash == path.npos ? "."
+		: slash == 0 ? "/"
+		: path.substr(0, slash);
+}
+
+/**
+ * Atomically replace the file with a link to the object.
+ *
+ * @return false if the object does not exist (anymore)
+ */
+static bool
+ReplaceWithLink(const char *object, const char *path)
+{
+	/* the temporary name is in the same directory and unique
+	   for this thread */
+	const std::string tmp = std::string{path} + ".davos-link." +
+		std::to_string(gettid());
+
+	if (link(object, tmp.c_str()) < 0) {
+		if (errno == ENOENT)
+			return false;
+
+		throw MakeErrno("Failed to link object");
+	}
+
+	if (rename(tmp.c_str(), path) < 0) {
+		const int e = errno;
+		unlink(tmp.c_str());
+		throw MakeErrno(e, "Failed to replace file with object");
+	}
+
+	return true;
+}
+
+static constexpr unsigned METADATA_MASK =
+	STATX_TYPE|STATX_MODE|STATX_UID|STATX_GID|STATX_MTIME|
+	STATX_INO|STATX_SIZE;
+
+/**
+ * Would a link to the object look the same as the file itself?  A
+ * link shares the inode's metadata; if the object is older, a file
+ * which was just uploaded would report an old "Last-Modified", and
+ * clients might consider their outdated copies fresh.
+ */
+[[gnu::pure]]
+static bool
+IsSameMetadata(const struct statx &a, const struct statx &b) noexcept
+{
+	return a.stx_mode == b.stx_mode &&
+		a.stx_uid == b.stx_uid && a.stx_gid == b.stx_gid &&
+		a.stx_mtime.tv_sec == b.stx_mtime.tv_sec &&
+		a.stx_mtime.tv_nsec == b.stx_mtime.tv_nsec;
+}
+
+/**
+ * Let the file share the extents of the other one (FICLONE).
+ *
+ * @return false if the filesystem does not support this
+ */
+static bool
+CloneFile(FileDescriptor dest, FileDescriptor src)
+{
+	if (ioctl(dest.Get(), FICLONE, src.Get()) == 0)
+		return true;
+
+	if (errno != EOPNOTSUPP && errno != ENOTTY &&
+	    errno != EXDEV && errno != EINVAL)
+		throw MakeErrno("FICLONE failed");
+
+	return false;
+}
+
+/**
+ * Deduplicate the data of a file which cannot be linked to the
+ * object: the file keeps its inode (and its metadata), but its
+ * extents are replaced with the object's.  On filesystems without
+ * reflinks, the file is left alone.
+ *
+ * @param file the status of the file when it was added
+ */
+static void
+CloneObject(const char *object, const char *path, const struct statx &file,
+	    const ContentHash &hash)
+{
+	UniqueFileDescriptor in;
+	if (!in.Open(object, O_RDONLY|O_NOFOLLOW)) {
+		if (errno == ENOENT)
+			return;
+
+		throw MakeErrno("Failed to open object");
+	}
+
+	UniqueFileDescriptor out;
+	if (!out.Open(path, O_WRONLY|O_NOFOLLOW))
+		throw MakeErrno("Failed to open file");
+
+	/* the file may have been replaced meanwhile; its data must
+	   not be overwritten with other contents */
+	struct statx st;
+	if (statx(out.Get(), "", AT_EMPTY_PATH|AT_STATX_SYNC_AS_STAT,
+		  STATX_TYPE|STATX_ATIME|STATX_MTIME|STATX_INO|STATX_SIZE,
+		  &st) < 0)
+		throw MakeErrno("Failed to stat file");
+
+	if (st.stx_ino != file.stx_ino || st.stx_size != file.stx_size ||
+	    st.stx_mtime.tv_sec != file.stx_mtime.tv_sec ||
+	    st.stx_mtime.tv_nsec != file.stx_mtime.tv_nsec)
+		return;
+
+	if (!CloneFile(out, in))
+		return;
+
+	/* FICLONE updates the modification time, but the contents
+	   are the same */
+	const struct timespec times[2] = {
+		{st.stx_atime.tv_sec, st.stx_atime.tv_nsec},
+		{st.stx_mtime.tv_sec, st.stx_mtime.tv_nsec},
+	};
+
+	if (futimens(out.Get(), times) < 0)
+		throw MakeErrno("Failed to restore modification time");
+
+	if (statx(out.Get(), "", AT_EMPTY_PATH|AT_STATX_SYNC_AS_STAT,
+		  STATX_MTIME|STATX_INO|STATX_SIZE, &st) == 0)
+		StoreContentHash(out, st, hash);
+}
+
+/**
+ * May the file be replaced with a link to the object?
+ */
+static bool
+CanLink(const char *object, const struct statx &file)
+{
+	struct statx st;
+	if (statx(-1, object, AT_STATX_SYNC_AS_STAT, METADATA_MASK, &st) < 0) {
+		if (errno == ENOENT)
+			/* collected meanwhile; the next attempt adds
+			   the file as a new object */
+			return true;
+
+		throw MakeErrno("Failed to stat object");
+	}
+
+	return IsSameMetadata(st, file);
+}
+
+void
+ContentStore::Add(const char *path, const ContentHash &hash) const
+{
+	const auto object = GetObjectPath(hash);
+
+	struct statx st;
+	if (statx(-1, path, AT_SYMLINK_NOFOLLOW|AT_STATX_SYNC_AS_STAT,
+		  METADATA_MASK, &st) < 0)
+		throw MakeErrno("Failed to stat file");
+
+	/* two attempts: the subdirectory may be missing, and an
+	   existing object may be collected before it could be
+	   linked */
+	for (unsigned i = 0; i < 2; ++i) {
+		if (link(path, object.c_str()) == 0)
+			/* this is the first file with this content;
+			   it becomes the object */
+			return;
+
+		switch (errno) {
+		case ENOENT:
+			/* the subdirectory is missing (or the file was
+			   deleted meanwhile; then the next attempt
+			   fails again) */
+			if (mkdir(std::string{DirectoryOf(object)}.c_str(), 0700) < 0 &&
+			    errno != EEXIST)
+				throw MakeErrno("Failed to create object directory");
+			break;
+
+		case EEXIST:
+			if (!CanLink(object.c_str(), st)) {
+				/* the file keeps its own inode */
+				CloneObject(object.c_str(), path, st, hash);
+				return;
+			}
+
+			/* deduplicate */
+			if (ReplaceWithLink(object.c_str(), path))
+				return;
+			break;
+
+		default:
+			throw MakeErrno("Failed to add file to the content store");
+		}
+	}
+}
+
+void
+ContentStore::Ingest(const char *path) const
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open(path, O_RDONLY|O_NOFOLLOW))
+		throw MakeErrno("Failed to open file");
+
+	struct statx st;
+	if (statx(fd.Get(), "", AT_EMPTY_PATH|AT_STATX_SYNC_AS_STAT,
+		  STATX_TYPE|STATX_NLINK|STATX_MTIME|STATX_INO|STATX_SIZE,
+		  &st) < 0)
+		throw MakeErrno("Failed to stat file");
+
+	if (!S_ISREG(st.stx_mode) || st.stx_nlink > 1)
+		/* not a file or already in the store */
+		return;
+
+	auto hash = LoadContentHash(fd, st);
+	if (!hash) {
+		hash = CalculateContentHash(fd);
+		StoreContentHash(fd, st, *hash);
+	}
+
+	Add(path, *hash);
+}
+
+std::optional<ContentHash>
+ContentStore::Lookup(const FileResource &resource) const noexcept
+{
+	if (!resource.Exists() || !resource.IsFile() ||
+	    resource.GetLinkCount() < 2)
+		return std::nullopt;
+
+	/* the object has the same inode, and PUT has stored the
+	   hash there */
+	return LoadContentHash(resource.GetPath(), resource.GetStat());
+}
+
+void
+ContentStore::Release(const ContentHash &hash) const noexcept
+{
+	const auto object = GetObjectPath(hash);
+
+	struct stat st;
+	if (stat(object.c_str(), &st) == 0 &&
+	    S_ISREG(st.st_mode) && st.st_nlink == 1)
+		unlink(object.c_str());
+}
+
+void
+BreakLink(const char *path)
+{
+	UniqueFileDescriptor in;
+	if (!in.Open(path, O_RDONLY|O_NOFOLLOW))
+		throw MakeErrno("Failed to open file");
+
+	struct statx st;
+	if (statx(in.Get(), "", AT_EMPTY_PATH|AT_STATX_SYNC_AS_STAT,
+		  STATX_TYPE|STATX_MODE|STATX_NLINK|STATX_ATIME|STATX_MTIME|STATX_INO|STATX_SIZE,
+		  &st) < 0)
+		throw MakeErrno("Failed to stat file");
+
+	if (!S_ISREG(st.stx_mode) || st.stx_nlink < 2)
+		return;
+
+	const auto hash = LoadContentHash(in, st);
+
+	FileWriter fw(path);
+	const FileDescriptor out = fw.GetFileDescriptor();
+
+	if (!CloneFile(out, in)) {
+		/* this filesystem can't share extents; copy the
+		   data */
+		for (uint64_t remaining = st.stx_size; remaining > 0;) {
+			const ssize_t nbytes = copy_file_range(in.Get(), nullptr,
+							       out.Get(), nullptr,
+							       remaining, 0);
+			if (nbytes < 0)
+				throw MakeErrno("Failed to copy file");
+
+			if (nbytes == 0)
+				throw MakeErrno(ESTALE, "File was truncated");
+
+			remaining -= nbytes;
+		}
+	}
+
+	const struct timespec times[2] = {
+		{st.stx_atime.tv_sec, st.stx_atime.tv_nsec},
+		{st.stx_mtime.tv_sec, st.stx_mtime.tv_nsec},
+	};
+
+	if (fchmod(out.Get(), st.stx_mode & 07777) < 0 ||
+	    futimens(out.Get(), times) < 0)
+		throw MakeErrno("Failed to copy file attributes");
+
+	/* keep the content hash valid for the new inode */
+	if (hash &&
+	    statx(out.Get(), "", AT_EMPTY_PATH|AT_STATX_SYNC_AS_STAT,
+		  STATX_MTIME|STATX_INO|STATX_SIZE, &st) == 0)
+		StoreContentHash(out, st, *hash);
+
+	fw.Commit();
+}
+
+GarbageStats
+CollectGarbage(const char *directory)
+{
+	UniqueFileDescriptor root;
+	if (!root.Open(directory, O_DIRECTORY|O_RDONLY))
+		throw MakeErrno("Failed to open content store");
+
+	GarbageStats stats;
+
+	DirectoryScanner scanner, sub_scanner;
+	if (!scanner.Scan(root))
+		throw MakeErrno("Failed to read content store");
+
+	for (const auto &i : scanner.GetEntries()) {
+		const char *name = scanner.GetName(i);
+
+		UniqueFileDescriptor sub;
+		if (!sub.Open(root, name, O_DIRECTORY|O_RDONLY|O_NOFOLLOW)) {
+			if (errno == ENOTDIR)
+				continue;
+
+			throw MakeErrno("Failed to open object directory");
+		}
+
+		if (!sub_scanner.Scan(sub))
+			throw MakeErrno("Failed to read object directory");
+
+		/* stat in inode order, which is cheaper if the inodes
+		   are not cached */
+		sub_scanner.SortByInode();
+
+		for (const auto &j : sub_scanner.GetEntries()) {
+			const char *object = sub_scanner.GetName(j);
+
+			struct stat st;
+			if (fstatat(sub.Get(), object, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+			    !S_ISREG(st.st_mode) || st.st_nlink != 1)
+				continue;
+
+			if (unlinkat(sub.Get(), object, 0) == 0) {
+				++stats.objects;
+				stats.bytes += st.st_size;
+			}
+		}
+	}
+
+	return stats;
+}
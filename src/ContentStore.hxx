@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * A content-addressed object store which deduplicates files: each
+ * distinct content is stored once as a file named after its
+ * #ContentHash, and the files in the document root are hard links
+ * to it.  The link count is the reference count; an object whose
+ * only remaining link is the one in the store is garbage.
+ *
+ * Files sharing an inode must never be modified in place; davos
+ * replaces files on PUT and calls BreakLink() before changing their
+ * metadata.
+ */
+
+#pragma once
+
+#include "ContentHash.hxx"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+struct was_simple;
+class FileResource;
+
+class ContentStore {
+	/**
+	 * The store directory; it must be on the same filesystem as
+	 * the document root.
+	 */
+	std::string directory;
+
+public:
+	ContentStore() = default;
+
+	explicit ContentStore(std::string_view _directory) noexcept
+		:directory(_directory) {}
+
+	/**
+	 * Parse the WAS parameters.
+	 *
+	 * @return false on error (after printing an error message)
+	 */
+	bool Setup(was_simple *w) noexcept;
+
+	/**
+	 * Construct the path of the object with the given hash:
+	 * the first two hex digits are a subdirectory.
+	 */
+	[[gnu::pure]]
+	std::string GetObjectPath(const ContentHash &hash) const noexcept;
+
+	/**
+	 * Add a new file (which has just been written) to the
+	 * store.  If the store already contains an object with this
+	 * hash and the same modification time, mode and owner, the
+	 * file is replaced by a link to that object.  If the metadata
+	 * differs, the file keeps its inode, but shares the object's
+	 * extents (if the filesystem supports reflinks).  Throws on
+	 * error.
+	 */
+	void Add(const char *path, const ContentHash &hash) const;
+
+	/**
+	 * Like Add(), but determine the hash first.  Throws on
+	 * error.
+	 */
+	void Ingest(const char *path) const;
+
+	/**
+	 * Find the object which the given resource links to.
+	 *
+	 * @return the hash or std::nullopt if the resource is not a
+	 * regular file in the store
+	 */
+	[[gnu::pure]]
+	std::optional<ContentHash> Lookup(const FileResource &resource) const noexcept;
+
+	/**
+	 * Delete the object if no file links to it anymore.  Call
+	 * this after removing a file whose hash was obtained with
+	 * Lookup().  A concurrent Add() may lose its deduplication,
+	 * but never its data.
+	 */
+	void Release(const ContentHash &hash) const noexcept;
+};
+
+/**
+ * Give the file its own inode (a copy of the shared one, with
+ * shared extents if the filesystem supports it), so its metadata
+ * can be modified without affecting other links.  Does nothing if
+ * the file has only one link.  Throws on error.
+ */
+void
+BreakLink(const char *path);
+
+struct GarbageStats {
+	uint64_t objects = 0, bytes = 0;
+};
+
+/**
+ * Delete all objects of the store which no file links to anymore.
+ * This is necessary after deleting or overwriting directory trees,
+ * which does not release the objects.  Throws on error.
+ */
+GarbageStats
+CollectGarbage(const char *directory);
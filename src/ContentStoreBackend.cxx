@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ContentStoreBackend.hxx"
+#include "util/PrintException.hxx"
+
+#include <was/simple.h>
+
+bool
+ContentStoreBackend::Setup(was_simple *w) noexcept
+{
+	if (!PlainBackend::Setup(w) || !store.Setup(w))
+		return false;
+
+	tree.link = true;
+	return true;
+}
+
+void
+ContentStoreBackend::HandlePut(was_simple *w, Resource &resource)
+{
+	/* the old file's object may become garbage */
+	const auto old = store.Lookup(resource);
+
+	PlainBackend::HandlePut(w, resource, &store);
+
+	if (old)
+		store.Release(*old);
+}
+
+void
+ContentStoreBackend::HandleDelete(was_simple *w, const char *uri,
+				  Resource &resource)
+{
+	/* objects of deleted collections are left to
+	   CollectGarbage(), because finding them would require
+	   reading all files' hashes */
+	const auto old = store.Lookup(resource);
+
+	PlainBackend::HandleDelete(w, uri, resource);
+
+	if (old)
+		store.Release(*old);
+}
+
+void
+ContentStoreBackend::HandleProppatch(was_simple *w, const char *uri,
+				     Resource &resource)
+{
+	/* the modification time is an attribute of the inode, which
+	   is shared with all other links to the object */
+	if (resource.Exists() && resource.IsFile() &&
+	    resource.GetLinkCount() > 1) {
+		try {
+			BreakLink(resource.GetPath());
+		} catch (...) {
+			PrintException(std::current_exception());
+			was_simple_status(w, HTTP_STATUS_INTERNAL_SERVER_ERROR);
+			return;
+		}
+
+		resource = Resource{std::string{resource.GetPathView()}};
+	}
+
+	PlainBackend::HandleProppatch(w, uri, resource);
+}
+
+void
+ContentStoreBackend::HandleMove(was_simple *w, Resource &src, Resource &dest)
+{
+	const auto upload_path = GetUploadPath(src);
+	const auto old = store.Lookup(dest);
+
+	PlainBackend::HandleMove(w, src, dest);
+
+	if (old)
+		store.Release(*old);
+
+	if (upload_path != UploadPath::SESSION &&
+	    upload_path != UploadPath::ASSEMBLE)
+		return;
+
+	/* an assembled upload: hash it now, so identical uploads are
+	   deduplicated no matter how they were sent */
+	if (const Resource after{std::string{dest.GetPathView()}};
+	    after.Exists() && after.IsFile()) {
+		try {
+			store.Ingest(after.GetPath());
+		} catch (...) {
+			PrintException(std::current_exception());
+		}
+	}
+}
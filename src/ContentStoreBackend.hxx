@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "PlainBackend.hxx"
+#include "ContentStore.hxx"
+
+/**
+ * Like #PlainBackend, but file contents are deduplicated in a
+ * #ContentStore: PUT adds the new file to the store, and COPY links
+ * files instead of copying them.  GET is unchanged, because the
+ * files in the document root are the objects.
+ */
+class ContentStoreBackend : public PlainBackend {
+	ContentStore store;
+
+public:
+	bool Setup(was_simple *w) noexcept;
+
+	void HandlePut(was_simple *w, Resource &resource);
+	void HandleDelete(was_simple *w, const char *uri, Resource &resource);
+
+	void HandleProppatch(was_simple *w, const char *uri,
+			     Resource &resource);
+
+	void HandleMove(was_simple *w, Resource &src, Resource &dest);
+};
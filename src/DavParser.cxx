@@ -0,0 +1,368 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Parser for the XML request bodies of PROPFIND, PROPPATCH, LOCK and
+ * REPORT.
+ */
+
+#include "DavParser.hxx"
+
+#include <was/simple.h>
+
+#include <algorithm>
+
+#include <stdio.h>
+
+using std::string_view_literals::operator""sv;
+
+/**
+ * The limit for DavParser::storage.
+ */
+static constexpr std::size_t MAX_STORAGE = 4 * DAV_MAX_BODY;
+
+/**
+ * Read the request body in chunks of this size unless its length is
+ * known.
+ */
+static constexpr std::size_t READ_CHUNK = 16384;
+
+static constexpr struct {
+	std::string_view name;
+	DavName id;
+} dav_names[] = {
+	{ "DAV:|prop"sv, DavName::PROP },
+	{ "DAV:|owner"sv, DavName::OWNER },
+	{ "DAV:|href"sv, DavName::HREF },
+	{ "DAV:|sync-collection"sv, DavName::SYNC_COLLECTION },
+	{ "DAV:|sync-token"sv, DavName::SYNC_TOKEN },
+	{ "DAV:|sync-level"sv, DavName::SYNC_LEVEL },
+	{ "DAV:|getlastmodified"sv, DavName::GETLASTMODIFIED },
+	{ "DAV:|quota-available-bytes"sv, DavName::QUOTA_AVAILABLE_BYTES },
+	{ "DAV:|quota-used-bytes"sv, DavName::QUOTA_USED_BYTES },
+	{ "urn:schemas-microsoft-com:|Win32LastAccessTime"sv, DavName::WIN32_LAST_ACCESS_TIME },
+	{ "urn:schemas-microsoft-com:|Win32LastModifiedTime"sv, DavName::WIN32_LAST_MODIFIED_TIME },
+};
+
+DavName
+InternDavName(std::string_view name) noexcept
+{
+	for (const auto &i : dav_names)
+		if (i.name == name)
+			return i.id;
+
+	return DavName::UNKNOWN;
+}
+
+DavParser::DavParser() noexcept
+	:parser(XML_ParserCreateNS(nullptr, '|'))
+{
+	Reset();
+}
+
+DavParser::~DavParser() noexcept
+{
+	XML_ParserFree(parser);
+}
+
+void
+DavParser::Reset() noexcept
+{
+	/* this clears all handlers, but keeps the namespace
+	   separator */
+	XML_ParserReset(parser, nullptr);
+	XML_SetUserData(parser, this);
+	XML_SetElementHandler(parser, StartElement, EndElement);
+	XML_SetCharacterDataHandler(parser, CharacterData);
+
+	state = State::ROOT;
+	root = DavName::UNKNOWN;
+	has_root = false;
+	depth = 0;
+	storage.clear();
+	entries.clear();
+	properties.clear();
+	owner_href = {};
+	sync_token = sync_level = {};
+	overflow = false;
+}
+
+inline void
+DavParser::Finish() noexcept
+{
+	properties.reserve(entries.size());
+	for (const auto &i : entries)
+		properties.push_back({i.id, View(i.name), View(i.value)});
+}
+
+inline bool
+DavParser::CheckStorage(std::size_t add) noexcept
+{
+	if (storage.size() + add + 1 <= MAX_STORAGE)
+		return true;
+
+	overflow = true;
+	XML_StopParser(parser, false);
+	return false;
+}
+
+inline DavParser::Range
+DavParser::Store(std::string_view s) noexcept
+{
+	Range r{static_cast<uint32_t>(storage.size()),
+		static_cast<uint32_t>(s.size())};
+	storage.append(s);
+	storage.push_back('\0');
+	return r;
+}
+
+inline void
+DavParser::AppendText(Range &r, std::string_view s) noexcept
+{
+	/* the text is always the last string in the storage, so
+	   chunks can simply be appended */
+	storage.append(s);
+	r.length += s.size();
+}
+
+inline void
+DavParser::EndText() noexcept
+{
+	storage.push_back('\0');
+}
+
+inline void
+DavParser::OnStartElement(const XML_Char *name) noexcept
+{
+	if (!has_root) {
+		root = InternDavName(name);
+		has_root = true;
+	}
+
+	switch (state) {
+	case State::ROOT:
+		switch (InternDavName(name)) {
+		case DavName::PROP:
+			state = State::PROP;
+			break;
+
+		case DavName::OWNER:
+			state = State::OWNER;
+			depth = 0;
+			break;
+
+		case DavName::SYNC_TOKEN:
+			sync_token = {static_cast<uint32_t>(storage.size()), 0};
+			state = State::SYNC_TOKEN;
+			depth = 0;
+			break;
+
+		case DavName::SYNC_LEVEL:
+			sync_level = {static_cast<uint32_t>(storage.size()), 0};
+			state = State::SYNC_LEVEL;
+			depth = 0;
+			break;
+
+		default:
+			break;
+		}
+
+		break;
+
+	case State::PROP:
+		{
+			const std::string_view s{name};
+			if (!CheckStorage(s.size()))
+				return;
+
+			Entry &entry = entries.emplace_back();
+			entry.id = InternDavName(s);
+			entry.name = Store(s);
+			entry.value.offset = storage.size();
+		}
+
+		state = State::PROPERTY;
+		depth = 0;
+		break;
+
+	case State::OWNER:
+		if (depth == 0 && InternDavName(name) == DavName::HREF) {
+			/* only the last one counts */
+			owner_href = {static_cast<uint32_t>(storage.size()), 0};
+			state = State::OWNER_HREF;
+		} else
+			++depth;
+		break;
+
+	case State::PROPERTY:
+	case State::OWNER_HREF:
+	case State::SYNC_TOKEN:
+	case State::SYNC_LEVEL:
+		++depth;
+		break;
+	}
+}
+
+inline void
+DavParser::OnEndElement() noexcept
+{
+	if (depth > 0) {
+		--depth;
+		return;
+	}
+
+	switch (state) {
+	case State::ROOT:
+		break;
+
+	case State::PROP:
+	case State::OWNER:
+		state = State::ROOT;
+		break;
+
+	case State::PROPERTY:
+		EndText();
+		state = State::PROP;
+		break;
+
+	case State::OWNER_HREF:
+		EndText();
+		state = State::OWNER;
+		break;
+
+	case State::SYNC_TOKEN:
+	case State::SYNC_LEVEL:
+		EndText();
+		state = State::ROOT;
+		break;
+	}
+}
+
+inline void
+DavParser::OnCharacterData(std::string_view s) noexcept
+{
+	switch (state) {
+	case State::ROOT:
+	case State::PROP:
+	case State::OWNER:
+		break;
+
+	case State::PROPERTY:
+		if (CheckStorage(s.size()))
+			AppendText(entries.back().value, s);
+		break;
+
+	case State::OWNER_HREF:
+		if (CheckStorage(s.size()))
+			AppendText(owner_href, s);
+		break;
+
+	case State::SYNC_TOKEN:
+		if (CheckStorage(s.size()))
+			AppendText(sync_token, s);
+		break;
+
+	case State::SYNC_LEVEL:
+		if (CheckStorage(s.size()))
+			AppendText(sync_level, s);
+		break;
+	}
+}
+
+void XMLCALL
+DavParser::StartElement(void *user_data, const XML_Char *name,
+			[[maybe_unused]] const XML_Char **atts) noexcept
+{
+	auto &p = *(DavParser *)user_data;
+	p.OnStartElement(name);
+}
+
+void XMLCALL
+DavParser::EndElement(void *user_data,
+		      [[maybe_unused]] const XML_Char *name) noexcept
+{
+	auto &p = *(DavParser *)user_data;
+	p.OnEndElement();
+}
+
+void XMLCALL
+DavParser::CharacterData(void *user_data, const XML_Char *s, int len) noexcept
+{
+	auto &p = *(DavParser *)user_data;
+	p.OnCharacterData({s, static_cast<std::size_t>(len)});
+}
+
+bool
+DavParser::Parse(std::string_view body) noexcept
+{
+	Reset();
+
+	if (XML_Parse(parser, body.data(), body.size(), true) != XML_STATUS_OK)
+		return false;
+
+	Finish();
+	return true;
+}
+
+http_status_t
+DavParser::Parse(was_simple *w) noexcept
+{
+	if (!was_simple_has_body(w))
+		return HTTP_STATUS_BAD_REQUEST;
+
+	/* if the length is announced, check it before reading
+	   anything, and read the whole body at once */
+	std::size_t chunk = READ_CHUNK;
+	if (const int64_t remaining = was_simple_input_remaining(w);
+	    remaining >= 0) {
+		if (static_cast<uint64_t>(remaining) > DAV_MAX_BODY)
+			return HTTP_STATUS_REQUEST_ENTITY_TOO_LARGE;
+
+		chunk = std::max<std::size_t>(remaining, 1);
+	}
+
+	Reset();
+
+	std::size_t total = 0;
+
+	while (true) {
+		/* let was_simple_read() write directly into Expat's
+		   buffer, which saves one copy */
+		void *buffer = XML_GetBuffer(parser, chunk);
+		if (buffer == nullptr)
+			return HTTP_STATUS_INTERNAL_SERVER_ERROR;
+
+		ssize_t nbytes = was_simple_read(w, buffer, chunk);
+		if (nbytes < 0) {
+			fprintf(stderr, "Error reading HTTP request body\n");
+			return HTTP_STATUS_BAD_REQUEST;
+		}
+
+		total += nbytes;
+		if (total > DAV_MAX_BODY)
+			return HTTP_STATUS_REQUEST_ENTITY_TOO_LARGE;
+
+		if (XML_ParseBuffer(parser, nbytes, nbytes == 0) != XML_STATUS_OK) {
+			if (overflow)
+				return HTTP_STATUS_REQUEST_ENTITY_TOO_LARGE;
+
+			fprintf(stderr, "XML parser failed on HTTP request body\n");
+			return HTTP_STATUS_BAD_REQUEST;
+		}
+
+		if (nbytes == 0)
+			break;
+	}
+
+	Finish();
+	return HTTP_STATUS_OK;
+}
+
+static thread_local DavParser thread_dav_parser;
+
+DavParser &
+GetThreadDavParser() noexcept
+{
+	return thread_dav_parser;
+}
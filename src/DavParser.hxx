@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Parser for the XML request bodies of PROPFIND, PROPPATCH, LOCK and
+ * REPORT.
+ */
+
+#pragma once
+
+#include <http/status.h>
+
+#include <expat.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct was_simple;
+
+/**
+ * Request bodies larger than this are rejected with "413 Request
+ * Entity Too Large".
+ */
+static constexpr std::size_t DAV_MAX_BODY = 1024 * 1024;
+
+/**
+ * The element names this program knows about, interned to integers
+ * so the request handlers don't need to compare strings.
+ */
+enum class DavName : uint8_t {
+	UNKNOWN,
+
+	PROP,
+	OWNER,
+	HREF,
+
+	SYNC_COLLECTION,
+	SYNC_TOKEN,
+	SYNC_LEVEL,
+
+	GETLASTMODIFIED,
+	QUOTA_AVAILABLE_BYTES,
+	QUOTA_USED_BYTES,
+
+	WIN32_LAST_ACCESS_TIME,
+	WIN32_LAST_MODIFIED_TIME,
+};
+
+/**
+ * Look up a name in the "NAMESPACE|LOCAL" form generated by Expat.
+ */
+[[gnu::pure]]
+DavName
+InternDavName(std::string_view name) noexcept;
+
+/**
+ * A child element of "DAV:prop".  Both strings are null-terminated
+ * and point into the #DavParser, which means they are only valid
+ * until it parses the next request.
+ */
+struct DavProperty {
+	DavName id;
+
+	/**
+	 * The name in the "NAMESPACE|LOCAL" form.
+	 */
+	std::string_view name;
+
+	/**
+	 * The character data inside the element.
+	 */
+	std::string_view value;
+};
+
+/**
+ * A reusable Expat parser for the small subset of the WebDAV
+ * grammar needed here: the children of all "DAV:prop" elements
+ * (with their text), the "DAV:href" inside "DAV:owner", and the
+ * "DAV:sync-token" and "DAV:sync-level" of a "sync-collection"
+ * REPORT (RFC 6578).  The
+ * result is stored in flat arrays which keep their capacity for the
+ * next request.
+ */
+class DavParser {
+	XML_Parser parser;
+
+	enum class State : uint8_t {
+		ROOT,
+		PROP,
+		PROPERTY,
+		OWNER,
+		OWNER_HREF,
+		SYNC_TOKEN,
+		SYNC_LEVEL,
+	} state;
+
+	/**
+	 * The document element.
+	 */
+	DavName root;
+
+	bool has_root;
+
+	/**
+	 * The nesting level of unknown elements inside the current
+	 * #State.
+	 */
+	unsigned depth;
+
+	/**
+	 * A location in #storage.
+	 */
+	struct Range {
+		uint32_t offset = 0, length = 0;
+	};
+
+	struct Entry {
+		DavName id;
+		Range name, value;
+	};
+
+	/**
+	 * All strings, each followed by a null byte.  Offsets are
+	 * stored while parsing, because this buffer may be
+	 * reallocated.
+	 */
+	std::string storage;
+
+	std::vector<Entry> entries;
+
+	std::vector<DavProperty> properties;
+
+	Range owner_href;
+
+	Range sync_token, sync_level;
+
+	/**
+	 * Set if #storage has grown beyond its limit; this can
+	 * happen because Expat expands namespace prefixes.
+	 */
+	bool overflow;
+
+public:
+	DavParser() noexcept;
+	~DavParser() noexcept;
+
+	DavParser(const DavParser &) = delete;
+	DavParser &operator=(const DavParser &) = delete;
+
+	/**
+	 * Parse the request body.
+	 *
+	 * @return #HTTP_STATUS_OK on success, otherwise the status
+	 * which shall be sent to the client
+	 */
+	http_status_t Parse(was_simple *w) noexcept;
+
+	/**
+	 * Parse a complete document from memory.
+	 *
+	 * @return false if the document is malformed
+	 */
+	bool Parse(std::string_view body) noexcept;
+
+	std::span<const DavProperty> GetProperties() const noexcept {
+		return properties;
+	}
+
+	/**
+	 * Returns the "DAV:href" inside "DAV:owner" (null-terminated)
+	 * or an empty string.
+	 */
+	std::string_view GetOwnerHref() const noexcept {
+		return View(owner_href);
+	}
+
+	DavName GetRoot() const noexcept {
+		return root;
+	}
+
+	/**
+	 * Returns the "DAV:sync-token" (null-terminated) or an empty
+	 * string.
+	 */
+	std::string_view GetSyncToken() const noexcept {
+		return View(sync_token);
+	}
+
+	/**
+	 * Returns the "DAV:sync-level" (null-terminated) or an empty
+	 * string.
+	 */
+	std::string_view GetSyncLevel() const noexcept {
+		return View(sync_level);
+	}
+
+private:
+	std::string_view View(Range r) const noexcept {
+		return {storage.data() + r.offset, r.length};
+	}
+
+	bool CheckStorage(std::size_t add) noexcept;
+	Range Store(std::string_view s) noexcept;
+	void AppendText(Range &r, std::string_view s) noexcept;
+	void EndText() noexcept;
+
+	void Reset() noexcept;
+	void Finish() noexcept;
+
+	void OnStartElement(const XML_Char *name) noexcept;
+	void OnEndElement() noexcept;
+	void OnCharacterData(std::string_view s) noexcept;
+
+	static void XMLCALL StartElement(void *user_data, const XML_Char *name,
+					 const XML_Char **atts) noexcept;
+	static void XMLCALL EndElement(void *user_data,
+				       const XML_Char *name) noexcept;
+	static void XMLCALL CharacterData(void *user_data,
+					  const XML_Char *s, int len) noexcept;
+};
+
+/**
+ * Returns the #DavParser of the current thread.
+ */
+DavParser &
+GetThreadDavParser() noexcept;
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Reading directories with getdents64().
+ */
+
+#include "DirectoryScanner.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <algorithm>
+#include <memory>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+
+/**
+ * The size of the getdents64() buffer.  glibc's readdir() uses
+ * 32 kB; a larger buffer means fewer system calls for large
+ * directories.
+ */
+static constexpr std::size_t BUFFER_SIZE = 128 * 1024;
+
+static std::byte *
+GetBuffer() noexcept
+{
+	/* allocated on first use, because most threads never list
+	   a directory */
+	static thread_local std::unique_ptr<std::byte[]> buffer;
+	if (!buffer)
+		buffer = std::make_unique_for_overwrite<std::byte[]>(BUFFER_SIZE);
+	return buffer.get();
+}
+
+[[gnu::pure]]
+static bool
+IsSpecialFilename(const char *name) noexcept
+{
+	return name[0] == '.' &&
+		(name[1] == 0 || (name[1] == '.' && name[2] == 0));
+}
+
+bool
+DirectoryScanner::Scan(FileDescriptor fd, off_t start,
+		       std::size_t max_entries) noexcept
+{
+	entries.clear();
+	names.clear();
+	next = -1;
+
+	if (fd.Seek(start) < 0)
+		return false;
+
+	std::byte *const buffer = GetBuffer();
+
+	/* the offset of the next entry, i.e. what telldir() would
+	   return */
+	off_t position = start;
+
+	while (true) {
+		const ssize_t nbytes = getdents64(fd.Get(), buffer, BUFFER_SIZE);
+		if (nbytes < 0)
+			return false;
+
+		if (nbytes == 0)
+			return true;
+
+		for (ssize_t i = 0; i < nbytes;) {
+			const auto &d = *reinterpret_cast<const struct dirent64 *>(buffer + i);
+			i += d.d_reclen;
+
+			if (!IsSpecialFilename(d.d_name)) {
+				if (entries.size() >= max_entries) {
+					next = position;
+					return true;
+				}
+
+				entries.push_back({
+					d.d_ino,
+					static_cast<uint32_t>(names.size()),
+					d.d_type,
+				});
+				names.append(d.d_name);
+				names.push_back('\0');
+			}
+
+			position = d.d_off;
+		}
+	}
+}
+
+bool
+DirectoryScanner::Scan(const char *path, off_t start,
+		       std::size_t max_entries) noexcept
+{
+	UniqueFileDescriptor fd;
+	return fd.Open(path, O_DIRECTORY|O_RDONLY) &&
+		Scan(fd, start, max_entries);
+}
+
+void
+DirectoryScanner::SortByInode() noexcept
+{
+	std::sort(entries.begin(), entries.end(),
+		  [](const Entry &a, const Entry &b){
+			  return a.ino < b.ino;
+		  });
+}
+
+void
+DirectoryScanner::SortByName() noexcept
+{
+	std::sort(entries.begin(), entries.end(),
+		  [this](const Entry &a, const Entry &b){
+			  return strcmp(GetName(a), GetName(b)) < 0;
+		  });
+}
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Reading directories with getdents64().
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+class FileDescriptor;
+
+/**
+ * Reads directory entries with getdents64() into a large buffer
+ * (shared by all scanners of a thread), and keeps the inode number
+ * and the file type (DT_*) of each entry, which readdir() users
+ * usually throw away.  The entries "." and ".." are omitted.
+ *
+ * The object can be reused; it keeps the capacity of its arrays.
+ */
+class DirectoryScanner {
+public:
+	struct Entry {
+		uint64_t ino;
+
+		/**
+		 * The offset of this entry's name in the name
+		 * buffer; use GetName().
+		 */
+		uint32_t name;
+
+		/**
+		 * One of the DT_* constants; may be DT_UNKNOWN if
+		 * the filesystem doesn't provide it.
+		 */
+		uint8_t type;
+	};
+
+private:
+	std::vector<Entry> entries;
+
+	/**
+	 * All names, each followed by a null byte.
+	 */
+	std::string names;
+
+	/**
+	 * The directory offset (a telldir() cookie) of the first
+	 * entry which was not read because of the limit, or -1.
+	 */
+	off_t next = -1;
+
+public:
+	/**
+	 * Read (a part of) the directory.  This replaces all
+	 * entries of the previous call.
+	 *
+	 * @param fd the directory; its file offset is modified
+	 * @param start the directory offset to start at (0 is the
+	 * beginning; other values are returned by GetNext())
+	 * @param max_entries read at most this number of entries
+	 * @return false on error (with errno set)
+	 */
+	bool Scan(FileDescriptor fd, off_t start=0,
+		  std::size_t max_entries=SIZE_MAX) noexcept;
+
+	/**
+	 * Open the directory and read it (see above).
+	 */
+	bool Scan(const char *path, off_t start=0,
+		  std::size_t max_entries=SIZE_MAX) noexcept;
+
+	/**
+	 * Sort the entries by their inode number.  On most
+	 * filesystems, this approximates the order of the inodes on
+	 * disk, which makes a following statx() on each entry much
+	 * cheaper if the inodes are not cached.
+	 */
+	void SortByInode() noexcept;
+
+	/**
+	 * Sort the entries by their name.
+	 */
+	void SortByName() noexcept;
+
+	std::span<const Entry> GetEntries() const noexcept {
+		return entries;
+	}
+
+	std::size_t size() const noexcept {
+		return entries.size();
+	}
+
+	bool empty() const noexcept {
+		return entries.empty();
+	}
+
+	const char *GetName(const Entry &entry) const noexcept {
+		return names.data() + entry.name;
+	}
+
+	/**
+	 * Was the scan stopped by the limit?
+	 */
+	bool IsTruncated() const noexcept {
+		return next >= 0;
+	}
+
+	/**
+	 * Returns the directory offset to pass to the next Scan()
+	 * call to continue, or -1 if the directory was read
+	 * completely.
+	 */
+	off_t GetNext() const noexcept {
+		return next;
+	}
+};
@@ -3,9 +3,28 @@
 // author: Max Kellermann <max.kellermann@ionos.com>
 
 #include "ETag.hxx"
+#include "Parameter.hxx"
+#include "io/UniqueFileDescriptor.hxx"
 #include "util/Base32.hxx"
 
+#include <algorithm>
+#include <cerrno>
+#include <mutex>
+#include <set>
+#include <tuple>
+
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+bool
+ETagConfig::Setup(was_simple *w) noexcept
+{
+	return GetBooleanParameter(w, "DAVOS_CONTENT_ETAG", content_hash) &&
+		GetUnsignedParameter(w, "DAVOS_CONTENT_ETAG_MAX_SIZE",
+				     max_hash_size) &&
+		GetBooleanParameter(w, "DAVOS_COLLECTION_ETAG", collection_tag);
+}
 
 StringBuffer<64>
 MakeETag(const struct statx &st) noexcept
@@ -35,3 +54,171 @@ MakeETag(const struct statx &st) noexcept
 
 	return result;
 }
+
+static char *
+FormatHex(char *p, std::span<const std::byte> src) noexcept
+{
+	static constexpr char digits[] = "0123456789abcdef";
+
+	for (const std::byte b : src) {
+		*p++ = digits[std::to_integer<unsigned>(b) >> 4];
+		*p++ = digits[std::to_integer<unsigned>(b) & 0xf];
+	}
+
+	return p;
+}
+
+StringBuffer<64>
+MakeETag(const ContentHash &hash) noexcept
+{
+	StringBuffer<64> result;
+
+	char *p = result.data();
+	*p++ = '"';
+
+	/* 128 bits are plenty for an ETag */
+	p = FormatHex(p, std::span{hash}.first<16>());
+
+	*p++ = '"';
+	*p = 0;
+
+	return result;
+}
+
+StringBuffer<80>
+FormatChecksum(const ContentHash &hash) noexcept
+{
+	StringBuffer<80> result;
+
+	char *p = std::copy_n("SHA256:", 7, result.data());
+	p = FormatHex(p, hash);
+	*p = 0;
+
+	return result;
+}
+
+/**
+ * Remembers where content hashes cannot be stored (e.g. filesystems
+ * without extended attributes), so files there are not hashed again
+ * on every request; they get the classic ETag instead.  This is
+ * shared by all connection threads.
+ */
+class UnstorableHashes {
+	using FileKey = std::tuple<dev_t, uint64_t, int64_t, uint32_t>;
+
+	/**
+	 * Forget all files when there are this many, to bound the
+	 * memory usage.
+	 */
+	static constexpr std::size_t MAX_FILES = 4096;
+
+	std::mutex mutex;
+
+	/**
+	 * Filesystems which do not support the attribute or which
+	 * are read-only.
+	 */
+	std::set<dev_t> devices;
+
+	/**
+	 * Single files whose attribute could not be written
+	 * (e.g. because of their permissions).  The modification
+	 * time is part of the key, so a modified file gets another
+	 * chance.
+	 */
+	std::set<FileKey> files;
+
+	static dev_t GetDevice(const struct statx &st) noexcept {
+		return makedev(st.stx_dev_major, st.stx_dev_minor);
+	}
+
+	static FileKey GetFileKey(const struct statx &st) noexcept {
+		return {GetDevice(st), st.stx_ino,
+			st.stx_mtime.tv_sec, st.stx_mtime.tv_nsec};
+	}
+
+public:
+	bool Contains(const struct statx &st) noexcept {
+		const std::scoped_lock lock{mutex};
+		return devices.contains(GetDevice(st)) ||
+			files.contains(GetFileKey(st));
+	}
+
+	void Add(const struct statx &st, int error) noexcept {
+		const std::scoped_lock lock{mutex};
+
+		if (error == EOPNOTSUPP || error == EROFS) {
+			devices.insert(GetDevice(st));
+			return;
+		}
+
+		if (files.size() >= MAX_FILES)
+			files.clear();
+
+		files.insert(GetFileKey(st));
+	}
+};
+
+static UnstorableHashes unstorable_hashes;
+
+/**
+ * Load the stored #ContentHash or calculate a new one.
+ */
+static std::optional<ContentHash>
+GetContentHash(const ETagConfig &config, FileDescriptor fd,
+	       const struct statx &st)
+{
+	if (auto hash = LoadContentHash(fd, st))
+		return hash;
+
+	if (st.stx_size > config.max_hash_size ||
+	    unstorable_hashes.Contains(st))
+		return std::nullopt;
+
+	const auto hash = CalculateContentHash(fd);
+
+	/* don't store the hash if the file was modified while we
+	   were reading it */
+	struct statx st2;
+	if (statx(fd.Get(), "", AT_EMPTY_PATH|AT_STATX_SYNC_AS_STAT,
+		  STATX_MTIME|STATX_INO|STATX_SIZE, &st2) < 0 ||
+	    st2.stx_ino != st.stx_ino ||
+	    st2.stx_size != st.stx_size ||
+	    st2.stx_mtime.tv_sec != st.stx_mtime.tv_sec ||
+	    st2.stx_mtime.tv_nsec != st.stx_mtime.tv_nsec)
+		return std::nullopt;
+
+	if (!StoreContentHash(fd, st, hash)) {
+		/* without the attribute, the next request would
+		   calculate the hash again; use the classic ETag
+		   from the start, so it does not change */
+		unstorable_hashes.Add(st, errno);
+		return std::nullopt;
+	}
+
+	return hash;
+}
+
+StringBuffer<64>
+GetETag(const ETagConfig &config, FileDescriptor fd, const char *path,
+	const struct statx &st) noexcept
+try {
+	if (!config.content_hash || !S_ISREG(st.stx_mode))
+		return MakeETag(st);
+
+	UniqueFileDescriptor new_fd;
+	if (!fd.IsDefined()) {
+		if (!new_fd.Open(path, O_RDONLY))
+			return MakeETag(st);
+
+		fd = new_fd;
+	}
+
+	if (const auto hash = GetContentHash(config, fd, st))
+		return MakeETag(*hash);
+
+	return MakeETag(st);
+} catch (...) {
+	/* I/O error while hashing; fall back to the classic ETag */
+	return MakeETag(st);
+}
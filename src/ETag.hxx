@@ -4,10 +4,67 @@
 
 #pragma once
 
+#include "ContentHash.hxx"
 #include "util/StringBuffer.hxx"
 
+#include <cstdint>
+
 struct statx;
+struct was_simple;
+class FileDescriptor;
+
+struct ETagConfig {
+	/**
+	 * Derive the ETag of regular files from a hash of their
+	 * contents instead of device, inode and modification time?
+	 */
+	bool content_hash = false;
+
+	/**
+	 * Files without a (valid) stored hash which are larger than
+	 * this get a classic ETag, because hashing them while the
+	 * client waits would take too long.
+	 */
+	uint64_t max_hash_size = 64 * 1024 * 1024;
+
+	/**
+	 * Maintain collection tags (see CollectionTag.hxx) and report
+	 * them as the ETag of collections?
+	 */
+	bool collection_tag = false;
+
+	/**
+	 * Parse the WAS parameters.
+	 *
+	 * @return false on error (after printing an error message)
+	 */
+	bool Setup(was_simple *w) noexcept;
+};
 
 [[gnu::pure]]
 StringBuffer<64>
 MakeETag(const struct statx &st) noexcept;
+
+[[gnu::pure]]
+StringBuffer<64>
+MakeETag(const ContentHash &hash) noexcept;
+
+/**
+ * Format a #ContentHash for the "checksum" property.
+ */
+[[gnu::pure]]
+StringBuffer<80>
+FormatChecksum(const ContentHash &hash) noexcept;
+
+/**
+ * Determine the ETag of a file according to the #ETagConfig.  If
+ * content hashes are enabled and the file has no valid hash yet, it
+ * is calculated and stored.
+ *
+ * @param fd the file, or FileDescriptor::Undefined() to open the
+ * path
+ * @param st the current status of the file
+ */
+StringBuffer<64>
+GetETag(const ETagConfig &config, FileDescriptor fd, const char *path,
+	const struct statx &st) noexcept;
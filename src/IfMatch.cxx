@@ -6,6 +6,7 @@
 #include "ETag.hxx"
 #include "file.hxx"
 #include "http/List.hxx"
+#include "io/FileDescriptor.hxx"
 
 #include <was/simple.h>
 
@@ -13,7 +14,8 @@
 #include <sys/stat.h>
 
 PreconditionResult
-CheckIfMatch(const struct was_simple &was, const struct statx *st) noexcept
+CheckIfMatch(const struct was_simple &was, const ETagConfig &config,
+	     const char *path, const struct statx *st) noexcept
 {
 	const char *p = was_simple_get_header(&was, "if-match");
 	if (p == nullptr)
@@ -25,13 +27,15 @@ CheckIfMatch(const struct was_simple &was, const struct statx *st) noexcept
 	if (strcmp(p, "*") == 0)
 		return PreconditionResult::SUCCESS;
 
-	return http_list_contains(p, MakeETag(*st).c_str())
+	return http_list_contains(p, GetETag(config, FileDescriptor::Undefined(),
+					      path, *st).c_str())
 		? PreconditionResult::SUCCESS
 		: PreconditionResult::FAILURE;
 }
 
 PreconditionResult
-CheckIfNoneMatch(const struct was_simple &was, const struct statx *st) noexcept
+CheckIfNoneMatch(const struct was_simple &was, const ETagConfig &config,
+		 const char *path, const struct statx *st) noexcept
 {
 	const char *p = was_simple_get_header(&was, "if-none-match");
 	if (p == nullptr)
@@ -43,7 +47,44 @@ CheckIfNoneMatch(const struct was_simple &was, const struct statx *st) noexcept
 	if (strcmp(p, "*") == 0)
 		return PreconditionResult::FAILURE;
 
-	return http_list_contains(p, MakeETag(*st).c_str())
+	return http_list_contains(p, GetETag(config, FileDescriptor::Undefined(),
+					      path, *st).c_str())
+		? PreconditionResult::FAILURE
+		: PreconditionResult::SUCCESS;
+}
+
+PreconditionResult
+CheckIfMatch(const struct was_simple &was, const char *etag) noexcept
+{
+	const char *p = was_simple_get_header(&was, "if-match");
+	if (p == nullptr)
+		return PreconditionResult::NONE;
+
+	if (etag == nullptr)
+		return PreconditionResult::FAILURE;
+
+	if (strcmp(p, "*") == 0)
+		return PreconditionResult::SUCCESS;
+
+	return http_list_contains(p, etag)
+		? PreconditionResult::SUCCESS
+		: PreconditionResult::FAILURE;
+}
+
+PreconditionResult
+CheckIfNoneMatch(const struct was_simple &was, const char *etag) noexcept
+{
+	const char *p = was_simple_get_header(&was, "if-none-match");
+	if (p == nullptr)
+		return PreconditionResult::NONE;
+
+	if (etag == nullptr)
+		return PreconditionResult::SUCCESS;
+
+	if (strcmp(p, "*") == 0)
+		return PreconditionResult::FAILURE;
+
+	return http_list_contains(p, etag)
 		? PreconditionResult::FAILURE
 		: PreconditionResult::SUCCESS;
 }
@@ -8,11 +8,29 @@
 
 struct statx;
 struct was_simple;
+struct ETagConfig;
 
-[[gnu::pure]]
+/**
+ * @param path the path of the file; only used to calculate a content
+ * hash ETag
+ * @param st the status of the file or nullptr if it does not exist
+ */
 PreconditionResult
-CheckIfMatch(const struct was_simple &was, const struct statx *st) noexcept;
+CheckIfMatch(const struct was_simple &was, const ETagConfig &config,
+	     const char *path, const struct statx *st) noexcept;
 
-[[gnu::pure]]
 PreconditionResult
-CheckIfNoneMatch(const struct was_simple &was, const struct statx *st) noexcept;
+CheckIfNoneMatch(const struct was_simple &was, const ETagConfig &config,
+		 const char *path, const struct statx *st) noexcept;
+
+/**
+ * Like above, but with an ETag which has already been determined,
+ * so a content hash is not looked up again.
+ *
+ * @param etag the ETag of the file or nullptr if it does not exist
+ */
+PreconditionResult
+CheckIfMatch(const struct was_simple &was, const char *etag) noexcept;
+
+PreconditionResult
+CheckIfNoneMatch(const struct was_simple &was, const char *etag) noexcept;
@@ -0,0 +1,388 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Journal.hxx"
+#include "Parameter.hxx"
+#include "system/Error.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/PrintException.hxx"
+#include "util/ScopeExit.hxx"
+
+#include <was/simple.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * The size of the header line: "davos-journal ID BASE\n", both
+ * numbers with 16 hex digits.
+ */
+static constexpr std::size_t HEADER_SIZE = 48;
+
+static constexpr std::string_view HEADER_MAGIC = "davos-journal ";
+
+/**
+ * The lower limit for #JournalConfig::max_size.
+ */
+static constexpr uint64_t MIN_MAX_SIZE = 64 * 1024;
+
+/**
+ * Records are read in chunks of this size; it is larger than the
+ * longest possible record.
+ */
+static constexpr std::size_t READ_BUFFER_SIZE = 64 * 1024;
+
+bool
+JournalConfig::Setup(was_simple *w) noexcept
+{
+	if (const char *p = was_simple_get_parameter(w, "DAVOS_JOURNAL");
+	    p != nullptr) {
+		if (*p != '/') {
+			fprintf(stderr, "Malformed DAVOS_JOURNAL\n");
+			return false;
+		}
+
+		/* copy the string, because this object is reused for
+		   later requests (see #SiteCache) */
+		path = p;
+	}
+
+	if (!GetUnsignedParameter(w, "DAVOS_JOURNAL_MAX_SIZE", max_size))
+		return false;
+
+	if (max_size < MIN_MAX_SIZE) {
+		fprintf(stderr, "Malformed DAVOS_JOURNAL_MAX_SIZE\n");
+		return false;
+	}
+
+	return true;
+}
+
+struct JournalHeader {
+	uint64_t id;
+
+	/**
+	 * The logical offset of the first record.
+	 */
+	uint64_t base;
+};
+
+static uint64_t
+GenerateId() noexcept
+{
+	uint64_t id;
+	if (getrandom(&id, sizeof(id), 0) != sizeof(id))
+		id = std::chrono::system_clock::now().time_since_epoch().count() ^
+			getpid();
+	return id;
+}
+
+static std::optional<JournalHeader>
+ReadHeader(FileDescriptor fd) noexcept
+{
+	char buffer[HEADER_SIZE];
+	if (fd.ReadAt(0, std::as_writable_bytes(std::span{buffer})) != HEADER_SIZE)
+		return std::nullopt;
+
+	const std::string_view s{buffer, HEADER_SIZE};
+	if (!s.starts_with(HEADER_MAGIC) || s[30] != ' ' || s[47] != '\n')
+		return std::nullopt;
+
+	JournalHeader header;
+	if (std::from_chars(buffer + 14, buffer + 30, header.id, 16).ptr != buffer + 30 ||
+	    std::from_chars(buffer + 31, buffer + 47, header.base, 16).ptr != buffer + 47)
+		return std::nullopt;
+
+	return header;
+}
+
+static void
+WriteAll(FileDescriptor fd, std::span<const std::byte> src)
+{
+	while (!src.empty()) {
+		const ssize_t nbytes = fd.Write(src);
+		if (nbytes < 0)
+			throw MakeErrno("Failed to write journal");
+
+		src = src.subspan(nbytes);
+	}
+}
+
+/**
+ * Write a new journal file under a temporary name and move it to
+ * the given path.
+ *
+ * @param replace replace an existing file; if false and the file
+ * exists already, the new one is discarded
+ */
+static void
+WriteJournalFile(const char *path, JournalHeader header,
+		 std::span<const std::byte> records, bool replace)
+{
+	const std::string tmp = std::string{path} + ".tmp" +
+		std::to_string(gettid());
+
+	UniqueFileDescriptor fd;
+	if (!fd.Open(tmp.c_str(), O_CREAT|O_TRUNC|O_WRONLY, 0666))
+		throw MakeErrno("Failed to create journal");
+
+	AtScopeExit(&tmp) { unlink(tmp.c_str()); };
+
+	char buffer[HEADER_SIZE + 1];
+	snprintf(buffer, sizeof(buffer), "davos-journal %016" PRIx64 " %016" PRIx64 "\n",
+		 header.id, header.base);
+
+	WriteAll(fd, std::as_bytes(std::span{buffer, HEADER_SIZE}));
+	WriteAll(fd, records);
+
+	if (replace
+	    ? rename(tmp.c_str(), path) < 0
+	    : link(tmp.c_str(), path) < 0 && errno != EEXIST)
+		throw MakeErrno("Failed to commit journal");
+}
+
+static void
+CreateJournal(const char *path)
+{
+	WriteJournalFile(path, {GenerateId(), 0}, {}, false);
+}
+
+/**
+ * Was the journal file replaced (by Compact()) after it was opened?
+ */
+[[gnu::pure]]
+static bool
+IsReplaced(FileDescriptor fd, const char *path) noexcept
+{
+	struct stat a, b;
+	return fstat(fd.Get(), &a) < 0 || stat(path, &b) < 0 ||
+		a.st_ino != b.st_ino || a.st_dev != b.st_dev;
+}
+
+/**
+ * Open the journal for appending with a shared lock, creating it if
+ * it does not exist.
+ */
+static UniqueFileDescriptor
+OpenLocked(const char *path)
+{
+	while (true) {
+		UniqueFileDescriptor fd;
+		if (!fd.Open(path, O_RDWR|O_APPEND)) {
+			if (errno != ENOENT)
+				throw MakeErrno("Failed to open journal");
+
+			CreateJournal(path);
+			continue;
+		}
+
+		if (flock(fd.Get(), LOCK_SH) < 0)
+			throw MakeErrno("Failed to lock journal");
+
+		if (!IsReplaced(fd, path))
+			return fd;
+	}
+}
+
+/**
+ * Determine the physical offset after the last complete record.
+ * Only a crashed writer could have left an incomplete one.
+ */
+static uint64_t
+FindRecordsEnd(FileDescriptor fd, uint64_t size)
+{
+	std::byte buffer[4096];
+
+	while (size > HEADER_SIZE) {
+		const std::size_t n = std::min<uint64_t>(size - HEADER_SIZE,
+							 sizeof(buffer));
+		if (fd.ReadAt(size - n, std::span{buffer, n}) != ssize_t(n))
+			throw MakeErrno("Failed to read journal");
+
+		for (std::size_t i = n; i > 0; --i)
+			if (buffer[i - 1] == std::byte{})
+				return size - n + i;
+
+		size -= n;
+	}
+
+	return HEADER_SIZE;
+}
+
+/**
+ * Discard the older half of the journal.
+ *
+ * @param fd the journal file with a shared lock
+ */
+static void
+Compact(FileDescriptor fd, const JournalConfig &config)
+{
+	const char *const path = config.path.c_str();
+
+	/* converting the lock is not atomic, so somebody else may
+	   have compacted the journal meanwhile */
+	if (flock(fd.Get(), LOCK_EX) < 0)
+		throw MakeErrno("Failed to lock journal");
+
+	if (IsReplaced(fd, path))
+		return;
+
+	const uint64_t size = fd.GetSize();
+	if (size <= config.max_size)
+		return;
+
+	const auto header = ReadHeader(fd);
+	if (!header) {
+		/* start over; all sync tokens become invalid */
+		WriteJournalFile(path, {GenerateId(), 0}, {}, true);
+		return;
+	}
+
+	const uint64_t end = FindRecordsEnd(fd, size);
+	const uint64_t keep = std::min(config.max_size / 2, end - HEADER_SIZE);
+
+	const auto tail = std::make_unique_for_overwrite<std::byte[]>(keep);
+	if (fd.ReadAt(end - keep, std::span{tail.get(), keep}) != ssize_t(keep))
+		throw MakeErrno("Failed to read journal");
+
+	/* skip the incomplete record at the beginning */
+	const std::span<const std::byte> records{tail.get(), keep};
+	const auto nul = std::find(records.begin(), records.end(), std::byte{});
+	const std::size_t start = nul == records.end()
+		? keep
+		: std::size_t(nul - records.begin()) + 1;
+
+	WriteJournalFile(path,
+			 {header->id, header->base + (end - keep - HEADER_SIZE) + start},
+			 records.subspan(start), true);
+}
+
+void
+AppendJournal(const JournalConfig &config,
+	      std::span<const JournalRecord> records) noexcept
+try {
+	std::string buffer;
+	for (const auto &i : records) {
+		buffer.push_back(static_cast<char>(i.op));
+		buffer.append(i.path);
+		buffer.push_back('\0');
+	}
+
+	auto fd = OpenLocked(config.path.c_str());
+
+	if (uint64_t(fd.GetSize()) > config.max_size) {
+		Compact(fd, config);
+
+		/* this closes the old file, which releases its
+		   lock */
+		fd = OpenLocked(config.path.c_str());
+	}
+
+	/* O_APPEND and a single write() keep records of concurrent
+	   writers from being interleaved */
+	WriteAll(fd, std::as_bytes(std::span{buffer}));
+} catch (...) {
+	PrintException(std::current_exception());
+}
+
+JournalPosition
+GetJournalEnd(const JournalConfig &config)
+{
+	const char *const path = config.path.c_str();
+
+	UniqueFileDescriptor fd;
+	while (!fd.Open(path, O_RDONLY)) {
+		if (errno != ENOENT)
+			throw MakeErrno("Failed to open journal");
+
+		CreateJournal(path);
+	}
+
+	const auto header = ReadHeader(fd);
+	if (!header)
+		throw std::runtime_error("Malformed journal");
+
+	return {
+		header->id,
+		header->base + FindRecordsEnd(fd, fd.GetSize()) - HEADER_SIZE,
+	};
+}
+
+std::optional<JournalPosition>
+ReadJournal(const JournalConfig &config, JournalPosition position,
+	    std::size_t max_records, std::vector<JournalRecord> &records)
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open(config.path.c_str(), O_RDONLY)) {
+		if (errno == ENOENT)
+			/* the journal was deleted */
+			return std::nullopt;
+
+		throw MakeErrno("Failed to open journal");
+	}
+
+	const auto header = ReadHeader(fd);
+	if (!header)
+		throw std::runtime_error("Malformed journal");
+
+	if (position.id != header->id || position.offset < header->base)
+		return std::nullopt;
+
+	uint64_t offset = HEADER_SIZE + (position.offset - header->base);
+	const uint64_t size = fd.GetSize();
+	if (offset > size)
+		return std::nullopt;
+
+	std::unique_ptr<std::byte[]> buffer;
+
+	while (offset < size && records.size() < max_records) {
+		if (!buffer)
+			buffer = std::make_unique_for_overwrite<std::byte[]>(READ_BUFFER_SIZE);
+
+		const ssize_t nbytes =
+			fd.ReadAt(offset, std::span{buffer.get(),
+					std::min<uint64_t>(size - offset, READ_BUFFER_SIZE)});
+		if (nbytes < 0)
+			throw MakeErrno("Failed to read journal");
+
+		const std::string_view chunk{reinterpret_cast<const char *>(buffer.get()),
+					     std::size_t(nbytes)};
+		std::size_t consumed = 0;
+
+		while (records.size() < max_records) {
+			const auto nul = chunk.find('\0', consumed);
+			if (nul == chunk.npos)
+				break;
+
+			const auto record = chunk.substr(consumed, nul - consumed);
+			consumed = nul + 1;
+
+			if (!record.empty())
+				records.push_back({
+					static_cast<JournalOp>(record.front()),
+					std::string{record.substr(1)},
+				});
+		}
+
+		if (consumed == 0)
+			/* the last record is incomplete */
+			break;
+
+		offset += consumed;
+	}
+
+	return JournalPosition{header->id, header->base + offset - HEADER_SIZE};
+}
@@ -0,0 +1,142 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * An append-only journal of the changes in a document root.  It
+ * allows answering "sync-collection" REPORTs (RFC 6578) with only
+ * the changes since the client's sync token instead of scanning the
+ * whole tree.
+ *
+ * The file begins with a header line containing a random id and the
+ * logical offset of the first record; each record is an operation
+ * character followed by the path (relative to the document root) and
+ * a null byte.  When the file grows too large, the older half is
+ * discarded, and the logical offsets of the remaining records stay
+ * the same.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct was_simple;
+
+struct JournalConfig {
+	/**
+	 * The path of the journal file; empty if the journal is
+	 * disabled.  It must not be inside the document root.
+	 */
+	std::string path;
+
+	/**
+	 * If the journal grows beyond this size, the older half is
+	 * discarded.
+	 */
+	uint64_t max_size = 16 * 1024 * 1024;
+
+	bool IsEnabled() const noexcept {
+		return !path.empty();
+	}
+
+	/**
+	 * Parse the WAS parameters.
+	 *
+	 * @return false on error (after printing an error message)
+	 */
+	bool Setup(was_simple *w) noexcept;
+};
+
+enum class JournalOp : char {
+	/**
+	 * The resource was created or modified.
+	 */
+	MODIFIED = 'M',
+
+	/**
+	 * The resource was deleted.
+	 */
+	DELETED = 'D',
+
+	/**
+	 * The resource is a collection which was created, replaced
+	 * or modified as a whole; all of its members may have
+	 * changed.
+	 */
+	TREE = 'T',
+};
+
+struct JournalRecord {
+	JournalOp op;
+
+	/**
+	 * The path relative to the document root (without a leading
+	 * slash); empty for the document root itself.
+	 */
+	std::string path;
+};
+
+/**
+ * A position in the journal; this is what a sync token refers to.
+ */
+struct JournalPosition {
+	/**
+	 * The random id of the journal file; it changes if the
+	 * journal gets deleted and created again.
+	 */
+	uint64_t id;
+
+	/**
+	 * The logical offset; it is not affected by discarding old
+	 * records.
+	 */
+	uint64_t offset;
+};
+
+/**
+ * Append records to the journal (with a single write), creating it
+ * if it does not exist.  Errors are printed to stderr and are
+ * otherwise ignored.
+ */
+void
+AppendJournal(const JournalConfig &config,
+	      std::span<const JournalRecord> records) noexcept;
+
+static inline void
+AppendJournal(const JournalConfig &config,
+	      JournalOp op, std::string_view path) noexcept
+{
+	const JournalRecord record{op, std::string{path}};
+	AppendJournal(config, {&record, 1});
+}
+
+/**
+ * Determine the position after the last record, creating the
+ * journal if it does not exist.
+ *
+ * Throws std::system_error on error.
+ */
+JournalPosition
+GetJournalEnd(const JournalConfig &config);
+
+/**
+ * Read the records after the given position.  This costs nothing
+ * (but reading the header) if there are none.
+ *
+ * Throws std::system_error on error.
+ *
+ * @param max_records stop after this number of records
+ * @return the position after the last record which was read or
+ * std::nullopt if the position is not valid (anymore), i.e. it
+ * belongs to a different journal or the records after it have been
+ * discarded
+ */
+std::optional<JournalPosition>
+ReadJournal(const JournalConfig &config, JournalPosition position,
+	    std::size_t max_records, std::vector<JournalRecord> &records);
@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Feed changes which were not made by davos (e.g. by FTP or SSH
+ * users) into the journal.  This watches the whole filesystem with
+ * fanotify and requires CAP_SYS_ADMIN.
+ */
+
+#include "Journal.hxx"
+#include "lib/fmt/SystemError.hxx"
+#include "system/Error.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/PrintException.hxx"
+#include "util/StringCompare.hxx"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <unistd.h>
+
+static constexpr uint64_t EVENT_MASK =
+	FAN_CREATE|FAN_DELETE|FAN_MOVED_FROM|FAN_MOVED_TO|
+	FAN_ATTRIB|FAN_CLOSE_WRITE|FAN_ONDIR;
+
+static UniqueFileDescriptor
+OpenFanotify(const char *document_root)
+{
+	/* with FAN_REPORT_DFID_NAME, each event identifies the
+	   parent directory and the name of the affected file */
+	int fd = fanotify_init(FAN_CLASS_NOTIF|FAN_CLOEXEC|FAN_REPORT_DFID_NAME,
+			       O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		throw MakeErrno("fanotify_init() failed");
+
+	UniqueFileDescriptor result{fd};
+
+	if (fanotify_mark(fd, FAN_MARK_ADD|FAN_MARK_FILESYSTEM, EVENT_MASK,
+			  AT_FDCWD, document_root) < 0)
+		throw MakeErrno("fanotify_mark() failed");
+
+	return result;
+}
+
+/**
+ * Determine the current path of the directory with the given
+ * handle.
+ *
+ * @return false if the directory does not exist anymore
+ */
+static bool
+ResolveHandle(FileDescriptor mount_fd, struct file_handle &handle,
+	      std::string &path)
+{
+	const int fd = open_by_handle_at(mount_fd.Get(), &handle, O_PATH);
+	if (fd < 0) {
+		if (errno == ESTALE || errno == ENOENT)
+			return false;
+
+		throw MakeErrno("open_by_handle_at() failed");
+	}
+
+	UniqueFileDescriptor dir{fd};
+
+	char link[64], buffer[PATH_MAX];
+	snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+	const ssize_t length = readlink(link, buffer, sizeof(buffer));
+	if (length < 0)
+		throw MakeErrno("readlink() failed");
+
+	path.assign(buffer, length);
+	return true;
+}
+
+[[gnu::pure]]
+static JournalOp
+ToJournalOp(uint64_t mask) noexcept
+{
+	if (mask & (FAN_DELETE|FAN_MOVED_FROM))
+		return JournalOp::DELETED;
+
+	/* a directory which was moved here brings its members */
+	if ((mask & (FAN_CREATE|FAN_MOVED_TO)) && (mask & FAN_ONDIR))
+		return JournalOp::TREE;
+
+	return JournalOp::MODIFIED;
+}
+
+/**
+ * Convert the events in the buffer to journal records.
+ */
+static void
+ParseEvents(std::string_view document_root, FileDescriptor mount_fd,
+	    const std::byte *buffer, std::size_t length,
+	    std::vector<JournalRecord> &records)
+{
+	std::string path;
+
+	for (auto *m = reinterpret_cast<const struct fanotify_event_metadata *>(buffer);
+	     FAN_EVENT_OK(m, length); m = FAN_EVENT_NEXT(m, length)) {
+		if (m->vers != FANOTIFY_METADATA_VERSION)
+			throw std::runtime_error("Wrong fanotify version");
+
+		if (m->mask & FAN_Q_OVERFLOW) {
+			/* events were lost; everything may have
+			   changed */
+			records.push_back({JournalOp::TREE, {}});
+			continue;
+		}
+
+		const auto &info = *reinterpret_cast<const struct fanotify_event_info_fid *>(m + 1);
+		if (m->event_len < sizeof(*m) + sizeof(info) ||
+		    info.hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+			continue;
+
+		auto &handle = *const_cast<struct file_handle *>(reinterpret_cast<const struct file_handle *>(info.handle));
+		const char *name = reinterpret_cast<const char *>(handle.f_handle + handle.handle_bytes);
+
+		if (!ResolveHandle(mount_fd, handle, path))
+			/* the parent directory was deleted meanwhile,
+			   which has its own event */
+			continue;
+
+		if (strcmp(name, ".") != 0) {
+			path.push_back('/');
+			path.append(name);
+		}
+
+		std::string_view relative = path;
+		if (!SkipPrefix(relative, document_root) ||
+		    (!relative.empty() && relative.front() != '/'))
+			/* somewhere else on this filesystem */
+			continue;
+
+		if (!relative.empty())
+			relative.remove_prefix(1);
+
+		records.push_back({ToJournalOp(m->mask), std::string{relative}});
+	}
+}
+
+int
+main(int argc, char **argv) noexcept
+try {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s DOCUMENT_ROOT JOURNAL\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::string_view document_root = argv[1];
+	while (!document_root.empty() && document_root.ends_with('/'))
+		document_root.remove_suffix(1);
+
+	JournalConfig config;
+	config.path = argv[2];
+
+	UniqueFileDescriptor mount_fd;
+	if (!mount_fd.Open(argv[1], O_DIRECTORY|O_RDONLY))
+		throw FmtErrno("Failed to open {:?}", argv[1]);
+
+	const auto fanotify_fd = OpenFanotify(argv[1]);
+
+	alignas(struct fanotify_event_metadata) std::byte buffer[64 * 1024];
+	std::vector<JournalRecord> records;
+
+	while (true) {
+		const ssize_t nbytes = fanotify_fd.Read(buffer);
+		if (nbytes < 0) {
+			if (errno == EINTR)
+				continue;
+
+			throw MakeErrno("Failed to read fanotify events");
+		}
+
+		records.clear();
+		ParseEvents(document_root, mount_fd, buffer, nbytes, records);
+
+		/* one write per batch of events */
+		if (!records.empty())
+			AppendJournal(config, records);
+	}
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
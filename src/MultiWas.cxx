@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Receive WAS connections from a Multi-WAS socket.
+ */
+
+#include "MultiWas.hxx"
+#include "system/Error.hxx"
+
+#include <cstdint>
+#include <stdexcept>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/**
+ * The header of a Multi-WAS packet (like struct was_header).
+ */
+struct MultiWasHeader {
+	uint16_t length;
+	uint16_t command;
+};
+
+enum MultiWasCommand : uint16_t {
+	MULTI_WAS_NOP = 0,
+
+	/**
+	 * A new WAS connection; the payload is empty, and the
+	 * control socket, input pipe and output pipe are passed as
+	 * SCM_RIGHTS (in this order).
+	 */
+	MULTI_WAS_NEW = 1,
+};
+
+bool
+MultiWasSocket::Check(FileDescriptor fd) noexcept
+{
+	int type;
+	socklen_t length = sizeof(type);
+	return getsockopt(fd.Get(), SOL_SOCKET, SO_TYPE, &type, &length) == 0 &&
+		type == SOCK_SEQPACKET;
+}
+
+bool
+MultiWasSocket::Receive(WasConnectionFds &fds)
+{
+	while (true) {
+		MultiWasHeader header;
+		struct iovec iov = {
+			.iov_base = &header,
+			.iov_len = sizeof(header),
+		};
+
+		alignas(struct cmsghdr) char cmsg_buffer[CMSG_SPACE(3 * sizeof(int))];
+		struct msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cmsg_buffer;
+		msg.msg_controllen = sizeof(cmsg_buffer);
+
+		const ssize_t nbytes = recvmsg(fd.Get(), &msg, MSG_CMSG_CLOEXEC);
+		if (nbytes < 0) {
+			if (errno == EINTR)
+				continue;
+
+			throw MakeErrno("Failed to receive from Multi-WAS socket");
+		}
+
+		if (nbytes == 0)
+			return false;
+
+		if ((std::size_t)nbytes < sizeof(header))
+			throw std::runtime_error("Short Multi-WAS packet");
+
+		const struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if (header.command != MULTI_WAS_NEW) {
+			if (cmsg != nullptr)
+				throw std::runtime_error("Unexpected file descriptors in Multi-WAS packet");
+
+			/* ignore NOP and unknown commands */
+			continue;
+		}
+
+		if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS ||
+		    cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+			throw std::runtime_error("Malformed Multi-WAS packet");
+
+		int received[3];
+		memcpy(received, CMSG_DATA(cmsg), sizeof(received));
+
+		fds.control = UniqueFileDescriptor{received[0]};
+		fds.input = UniqueFileDescriptor{received[1]};
+		fds.output = UniqueFileDescriptor{received[2]};
+		return true;
+	}
+}
+
+void
+MultiWasSocket::Send(const WasConnectionFds &fds)
+{
+	MultiWasHeader header{0, MULTI_WAS_NEW};
+	struct iovec iov = {
+		.iov_base = &header,
+		.iov_len = sizeof(header),
+	};
+
+	const int fd_array[3] = {
+		fds.control.Get(), fds.input.Get(), fds.output.Get(),
+	};
+
+	alignas(struct cmsghdr) char cmsg_buffer[CMSG_SPACE(sizeof(fd_array))];
+	struct msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsg_buffer;
+	msg.msg_controllen = sizeof(cmsg_buffer);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fd_array));
+	memcpy(CMSG_DATA(cmsg), fd_array, sizeof(fd_array));
+
+	if (sendmsg(fd.Get(), &msg, MSG_NOSIGNAL) < 0)
+		throw MakeErrno("Failed to send to Multi-WAS socket");
+}
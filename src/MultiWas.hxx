@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Receive WAS connections from a Multi-WAS socket.
+ */
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+/**
+ * The three file descriptors of one WAS connection.
+ */
+struct WasConnectionFds {
+	UniqueFileDescriptor control, input, output;
+};
+
+/**
+ * A Multi-WAS socket, over which beng-proxy passes new WAS
+ * connections to this process, each carrying the usual control
+ * socket and the two data pipes.  This allows one process to serve
+ * several requests at the same time.
+ */
+class MultiWasSocket {
+	const FileDescriptor fd;
+
+public:
+	explicit MultiWasSocket(FileDescriptor _fd) noexcept
+		:fd(_fd) {}
+
+	/**
+	 * Does the given file descriptor look like a Multi-WAS
+	 * socket (and not like a WAS input pipe)?
+	 */
+	[[gnu::pure]]
+	static bool Check(FileDescriptor fd) noexcept;
+
+	/**
+	 * Wait for the next connection.
+	 *
+	 * @return false if the socket was closed by the peer
+	 */
+	bool Receive(WasConnectionFds &fds);
+
+	/**
+	 * Pass a new connection to the peer (i.e. act like
+	 * beng-proxy).  Throws on error.
+	 */
+	void Send(const WasConnectionFds &fds);
+};
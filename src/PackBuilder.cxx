@@ -0,0 +1,303 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Builder for packed images.
+ */
+
+#include "PackImage.hxx"
+#include "ContentHash.hxx"
+#include "DirectoryScanner.hxx"
+#include "ETag.hxx"
+#include "mime_types.hxx"
+#include "lib/fmt/RuntimeError.hxx"
+#include "lib/fmt/SystemError.hxx"
+#include "system/Error.hxx"
+#include "io/FileWriter.hxx"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+namespace {
+
+struct PackSource {
+	/**
+	 * The path relative to the root.
+	 */
+	std::string path;
+
+	std::size_t name_start;
+
+	struct statx st;
+
+	std::string_view GetParent() const noexcept {
+		return name_start > 0
+			? std::string_view{path}.substr(0, name_start - 1)
+			: std::string_view{};
+	}
+
+	std::string_view GetName() const noexcept {
+		return std::string_view{path}.substr(name_start);
+	}
+
+	/**
+	 * The order of the index (see PackImage.hxx).
+	 */
+	bool operator<(const PackSource &other) const noexcept {
+		return std::pair{GetParent(), GetName()} <
+			std::pair{other.GetParent(), other.GetName()};
+	}
+};
+
+/**
+ * Collects the strings of an image.
+ */
+class PackStringPool {
+	std::string data;
+
+	/**
+	 * Content types are shared by many files; store each only
+	 * once.
+	 */
+	std::map<std::string, uint32_t, std::less<>> shared;
+
+public:
+	/**
+	 * The empty string.
+	 */
+	static constexpr uint32_t EMPTY = 0;
+
+	PackStringPool() noexcept
+		:data(1, '\0') {}
+
+	std::string_view GetData() const noexcept {
+		return data;
+	}
+
+	uint32_t Add(std::string_view s) {
+		if (s.empty())
+			return EMPTY;
+
+		if (data.size() + s.size() + 1 > UINT32_MAX)
+			throw std::runtime_error("Too many strings for a pack image");
+
+		const uint32_t offset = data.size();
+		data.append(s);
+		data.push_back('\0');
+		return offset;
+	}
+
+	uint32_t AddShared(std::string_view s) {
+		if (auto i = shared.find(s); i != shared.end())
+			return i->second;
+
+		const uint32_t offset = Add(s);
+		shared.emplace(s, offset);
+		return offset;
+	}
+};
+
+}
+
+static void
+StatSource(const char *path, struct statx &st)
+{
+	if (statx(-1, path, AT_SYMLINK_NOFOLLOW|AT_STATX_SYNC_AS_STAT,
+		  STATX_TYPE|STATX_MODE|STATX_MTIME|STATX_SIZE, &st) < 0)
+		throw FmtErrno("Failed to stat {:?}", path);
+}
+
+/**
+ * Collect all directories and regular files below the given
+ * directory.
+ */
+static void
+CollectSources(const std::string &root, std::string_view relative,
+	       std::vector<PackSource> &sources)
+{
+	std::string path = root;
+	if (!relative.empty()) {
+		path.push_back('/');
+		path.append(relative);
+	}
+
+	DirectoryScanner scanner;
+	if (!scanner.Scan(path.c_str()))
+		throw FmtErrno("Failed to read {:?}", path);
+
+	path.push_back('/');
+	const auto path_length = path.length();
+
+	for (const auto &i : scanner.GetEntries()) {
+		const char *name = scanner.GetName(i);
+
+		PackSource source;
+		source.path = relative;
+		if (!relative.empty())
+			source.path.push_back('/');
+		source.name_start = source.path.length();
+		source.path.append(name);
+
+		if (source.path.length() > UINT16_MAX)
+			throw FmtRuntimeError("Path too long: {:?}", source.path);
+
+		path.erase(path_length);
+		path.append(name);
+		StatSource(path.c_str(), source.st);
+
+		if (S_ISDIR(source.st.stx_mode)) {
+			const std::string child = source.path;
+			sources.emplace_back(std::move(source));
+			CollectSources(root, child, sources);
+		} else if (S_ISREG(source.st.stx_mode))
+			sources.emplace_back(std::move(source));
+	}
+}
+
+/**
+ * Copy a file into the image and calculate its #ContentHash.
+ */
+static ContentHash
+CopySource(const char *path, uint64_t size, FileWriter &writer)
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open(path, O_RDONLY|O_NOFOLLOW))
+		throw FmtErrno("Failed to open {:?}", path);
+
+	ContentHasher hasher;
+
+	std::byte buffer[65536];
+	while (size > 0) {
+		const auto nbytes = fd.Read(std::span{buffer}.first(std::min<uint64_t>(size, sizeof(buffer))));
+		if (nbytes < 0)
+			throw FmtErrno("Failed to read {:?}", path);
+
+		if (nbytes == 0)
+			throw FmtRuntimeError("File was truncated: {:?}", path);
+
+		const std::span<const std::byte> data{buffer, std::size_t(nbytes)};
+		hasher.Update(data);
+		writer.Write(data);
+		size -= nbytes;
+	}
+
+	return hasher.Final();
+}
+
+static void
+WritePadding(FileWriter &writer, uint64_t &position, uint64_t alignment)
+{
+	static constexpr std::byte zero[4096]{};
+
+	const uint64_t padding = (alignment - position % alignment) % alignment;
+	writer.Write(std::span{zero}.first(padding));
+	position += padding;
+}
+
+std::size_t
+BuildPackImage(const char *directory, const char *path)
+{
+	std::vector<PackSource> sources;
+
+	{
+		/* the root directory */
+		auto &root = sources.emplace_back();
+		root.name_start = 0;
+		StatSource(directory, root.st);
+		if (!S_ISDIR(root.st.stx_mode))
+			throw FmtRuntimeError("Not a directory: {:?}", directory);
+	}
+
+	CollectSources(directory, {}, sources);
+
+	if (sources.size() > UINT32_MAX)
+		throw std::runtime_error("Too many files for a pack image");
+
+	std::sort(sources.begin(), sources.end());
+
+	FileWriter writer{path};
+
+	/* the header is written last, when all offsets are known */
+	PackHeader header{};
+	writer.Write(std::as_bytes(std::span{&header, 1}));
+	uint64_t position = sizeof(header);
+
+	PackStringPool strings;
+	std::vector<PackEntry> entries(sources.size());
+
+	for (std::size_t i = 0; i < sources.size(); ++i) {
+		const auto &source = sources[i];
+		auto &entry = entries[i];
+
+		entry.size = 0;
+		entry.mtime_sec = source.st.stx_mtime.tv_sec;
+		entry.mtime_nsec = source.st.stx_mtime.tv_nsec;
+		entry.mode = source.st.stx_mode;
+		entry.path = strings.Add(source.path);
+		entry.path_length = source.path.length();
+		entry.name_start = source.name_start;
+
+		if (S_ISDIR(source.st.stx_mode)) {
+			/* the children follow their siblings, sorted
+			   by parent; the root is the only entry with
+			   an empty name, and is not its own child */
+			const auto first =
+				std::partition_point(sources.begin() + 1, sources.end(),
+						     [&source](const PackSource &i){
+							     return i.GetParent() < source.path;
+						     });
+			const auto last =
+				std::partition_point(first, sources.end(),
+						     [&source](const PackSource &i){
+							     return i.GetParent() == source.path;
+						     });
+
+			entry.first_child = first - sources.begin();
+			entry.n_children = last - first;
+			continue;
+		}
+
+		const std::string source_path = std::string{directory} + "/" + source.path;
+		entry.data_offset = position;
+		entry.size = source.st.stx_size;
+		const auto hash = CopySource(source_path.c_str(), entry.size,
+					     writer);
+		position += entry.size;
+
+		const auto etag = MakeETag(hash);
+		entry.etag = strings.Add(etag.c_str());
+		entry.etag_length = strlen(etag.c_str());
+
+		const char *content_type = LookupMimeTypeByFilePath(source.path);
+		if (content_type == nullptr)
+			content_type = "application/octet-stream";
+
+		entry.content_type = strings.AddShared(content_type);
+		entry.content_type_length = strlen(content_type);
+	}
+
+	WritePadding(writer, position, 4096);
+
+	memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+	header.n_entries = entries.size();
+	header.index_offset = position;
+	header.strings_size = strings.GetData().size();
+
+	writer.Write(std::as_bytes(std::span{entries}));
+	writer.Write(std::as_bytes(std::span{strings.GetData()}));
+
+	if (writer.GetFileDescriptor().WriteAt(0, std::as_bytes(std::span{&header, 1})) != sizeof(header))
+		throw MakeErrno("Failed to write pack image header");
+
+	writer.Commit();
+	return entries.size();
+}
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Reader for packed images.
+ */
+
+#include "PackImage.hxx"
+#include "lib/fmt/SystemError.hxx"
+#include "system/Error.hxx"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Split a path into its parent and its name.  This is the sort key
+ * of the index.
+ */
+[[gnu::pure]]
+static std::pair<std::string_view, std::string_view>
+SplitPath(std::string_view path) noexcept
+{
+	const auto slash = path.rfind('/');
+	if (slash == path.npos)
+		return {std::string_view{}, path};
+
+	return {path.substr(0, slash), path.substr(slash + 1)};
+}
+
+PackImage::PackImage(const char *path)
+{
+	if (!fd.Open(path, O_RDONLY))
+		throw FmtErrno("Failed to open {:?}", path);
+
+	struct stat st;
+	if (fstat(fd.Get(), &st) < 0)
+		throw FmtErrno("Failed to stat {:?}", path);
+
+	dev = st.st_dev;
+	ino = st.st_ino;
+
+	PackHeader header;
+	if (fd.ReadAt(0, std::as_writable_bytes(std::span{&header, 1})) != sizeof(header) ||
+	    memcmp(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0)
+		throw std::runtime_error("Not a davos pack image");
+
+	const uint64_t file_size = st.st_size;
+	const uint64_t entries_size = uint64_t{header.n_entries} * sizeof(PackEntry);
+
+	if (header.n_entries == 0 ||
+	    header.index_offset < sizeof(header) ||
+	    header.index_offset > file_size ||
+	    entries_size + header.strings_size > file_size - header.index_offset ||
+	    header.strings_size == 0 || header.strings_size > UINT32_MAX)
+		throw std::runtime_error("Corrupt pack image header");
+
+	/* the builder aligns the index to 4 kB, but the page size
+	   may be larger */
+	const uint64_t page_size = sysconf(_SC_PAGESIZE);
+	const uint64_t delta = header.index_offset % page_size;
+
+	mapping_size = delta + entries_size + header.strings_size;
+	mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED,
+		       fd.Get(), header.index_offset - delta);
+	if (mapping == MAP_FAILED)
+		throw MakeErrno("Failed to map pack image");
+
+	const char *index = static_cast<const char *>(mapping) + delta;
+	entries = {reinterpret_cast<const PackEntry *>(index), header.n_entries};
+	strings = {index + entries_size,
+		   static_cast<std::size_t>(header.strings_size)};
+
+	try {
+		Verify(header.index_offset);
+	} catch (...) {
+		munmap(mapping, mapping_size);
+		throw;
+	}
+}
+
+PackImage::~PackImage() noexcept
+{
+	munmap(mapping, mapping_size);
+}
+
+/**
+ * Is the given string completely inside the pool, and
+ * null-terminated?
+ */
+[[gnu::pure]]
+static bool
+IsValidString(std::string_view strings, uint32_t offset,
+	      std::size_t length) noexcept
+{
+	return offset < strings.size() &&
+		length < strings.size() - offset &&
+		strings[offset + length] == 0;
+}
+
+[[gnu::pure]]
+static bool
+IsSorted(std::string_view a, std::string_view b) noexcept
+{
+	return SplitPath(a) < SplitPath(b);
+}
+
+void
+PackImage::Verify(uint64_t data_end) const
+{
+	/* everything which is used later without checks is verified
+	   here once, so a corrupt image cannot make a lookup read
+	   outside of the mapping */
+
+	const auto &root = GetRoot();
+	if (!S_ISDIR(root.mode) || root.path_length != 0)
+		throw std::runtime_error("Corrupt pack image root");
+
+	for (std::size_t i = 0; i < entries.size(); ++i) {
+		const auto &entry = entries[i];
+
+		if (!IsValidString(strings, entry.path, entry.path_length) ||
+		    entry.name_start > entry.path_length ||
+		    (entry.name_start > 0 &&
+		     strings[entry.path + entry.name_start - 1] != '/') ||
+		    !IsValidString(strings, entry.etag, entry.etag_length) ||
+		    !IsValidString(strings, entry.content_type,
+				   entry.content_type_length))
+			throw std::runtime_error("Corrupt pack image string");
+
+		if (i > 0 && !IsSorted(GetPath(entries[i - 1]), GetPath(entry)))
+			throw std::runtime_error("Pack image is not sorted");
+
+		if (S_ISDIR(entry.mode)) {
+			if (entry.n_children > 0 &&
+			    (entry.first_child <= i ||
+			     entry.first_child > entries.size() ||
+			     entry.n_children > entries.size() - entry.first_child))
+				throw std::runtime_error("Corrupt pack image directory");
+		} else if (S_ISREG(entry.mode)) {
+			if (entry.data_offset < sizeof(PackHeader) ||
+			    entry.data_offset > data_end ||
+			    entry.size > data_end - entry.data_offset)
+				throw std::runtime_error("Corrupt pack image file");
+		} else
+			throw std::runtime_error("Corrupt pack image entry");
+	}
+}
+
+const PackEntry *
+PackImage::Find(std::string_view path) const noexcept
+{
+	const auto key = SplitPath(path);
+
+	const auto i = std::lower_bound(entries.begin(), entries.end(), key,
+					[this](const PackEntry &entry,
+					       const auto &k){
+						return SplitPath(GetPath(entry)) < k;
+					});
+	if (i == entries.end() || GetPath(*i) != path)
+		return nullptr;
+
+	return &*i;
+}
+
+/**
+ * The images opened by OpenPackImage(), shared by all connection
+ * threads.
+ */
+static std::mutex pack_image_mutex;
+static std::map<std::string, std::weak_ptr<const PackImage>, std::less<>> pack_image_cache;
+
+std::shared_ptr<const PackImage>
+OpenPackImage(const char *path)
+{
+	struct stat st;
+	if (stat(path, &st) < 0)
+		throw FmtErrno("Failed to stat {:?}", path);
+
+	const std::scoped_lock lock{pack_image_mutex};
+
+	auto &slot = pack_image_cache[path];
+	if (auto image = slot.lock();
+	    image && image->IsFile(st.st_dev, st.st_ino))
+		return image;
+
+	auto image = std::make_shared<const PackImage>(path);
+	slot = image;
+	return image;
+}
@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * A read-only image of a directory tree in one file, built by
+ * davos-pack and served by #PackedBackend.
+ *
+ * The file begins with a #PackHeader, followed by the contents of
+ * all files (contiguously), and then by the index: an array of
+ * #PackEntry and a pool of null-terminated strings.  The index is
+ * memory-mapped; the file contents are spliced from the file.
+ *
+ * The entries are sorted by their parent path, then by their name.
+ * This allows a binary search, and the children of each directory
+ * are a contiguous range of entries.  The first entry is the root
+ * directory, whose path is empty.  All integers are in native byte
+ * order.
+ */
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+
+#include <sys/types.h>
+
+static constexpr char PACK_MAGIC[8] = {'d', 'a', 'v', 'o', 's', 'p', 'k', '1'};
+
+struct PackHeader {
+	char magic[8];
+
+	uint32_t n_entries;
+	uint32_t reserved;
+
+	/**
+	 * The position of the #PackEntry array (which is also the
+	 * end of the file contents); it is aligned to 4 kB.  The
+	 * string pool follows it.
+	 */
+	uint64_t index_offset;
+
+	uint64_t strings_size;
+};
+
+static_assert(sizeof(PackHeader) == 32);
+
+struct PackEntry {
+	/**
+	 * The position of the file contents in the image.
+	 */
+	uint64_t data_offset;
+
+	uint64_t size;
+
+	int64_t mtime_sec;
+	uint32_t mtime_nsec;
+
+	/**
+	 * The file type and permissions (st_mode); only directories
+	 * and regular files are packed.
+	 */
+	uint32_t mode;
+
+	/**
+	 * The path relative to the root (a string pool offset).
+	 */
+	uint32_t path;
+
+	/**
+	 * The range of entries which are the children of this
+	 * directory.
+	 */
+	uint32_t first_child, n_children;
+
+	/**
+	 * The precalculated ETag and content type (string pool
+	 * offsets); empty for directories.
+	 */
+	uint32_t etag, content_type;
+
+	uint16_t path_length;
+
+	/**
+	 * The position of the name within the path.
+	 */
+	uint16_t name_start;
+
+	uint16_t etag_length, content_type_length;
+
+	uint32_t reserved;
+};
+
+static_assert(sizeof(PackEntry) == 64);
+
+class PackImage {
+	UniqueFileDescriptor fd;
+
+	/**
+	 * Identify the file, to detect when it was replaced.
+	 */
+	dev_t dev;
+	ino_t ino;
+
+	/**
+	 * The mapped index (the #PackEntry array and the string
+	 * pool).
+	 */
+	void *mapping = nullptr;
+	std::size_t mapping_size;
+
+	std::span<const PackEntry> entries;
+	std::string_view strings;
+
+public:
+	/**
+	 * Open and verify the image.  Throws on error.
+	 */
+	explicit PackImage(const char *path);
+	~PackImage() noexcept;
+
+	PackImage(const PackImage &) = delete;
+	PackImage &operator=(const PackImage &) = delete;
+
+	/**
+	 * The image file, for splicing file contents.
+	 */
+	FileDescriptor GetFileDescriptor() const noexcept {
+		return fd;
+	}
+
+	bool IsFile(dev_t _dev, ino_t _ino) const noexcept {
+		return dev == _dev && ino == _ino;
+	}
+
+	const PackEntry &GetRoot() const noexcept {
+		return entries.front();
+	}
+
+	/**
+	 * Look up an entry by its path (relative to the root,
+	 * without leading and trailing slashes).  This is a binary
+	 * search in the mapped index without system calls.
+	 *
+	 * @return nullptr if there is no such entry
+	 */
+	[[gnu::pure]]
+	const PackEntry *Find(std::string_view path) const noexcept;
+
+	[[gnu::pure]]
+	std::span<const PackEntry> GetChildren(const PackEntry &directory) const noexcept {
+		return entries.subspan(directory.first_child,
+				       directory.n_children);
+	}
+
+	/**
+	 * The position of an entry in the index.
+	 */
+	[[gnu::pure]]
+	std::size_t GetIndex(const PackEntry &entry) const noexcept {
+		return &entry - entries.data();
+	}
+
+	/**
+	 * The returned strings are null-terminated.
+	 */
+	[[gnu::pure]]
+	std::string_view GetPath(const PackEntry &entry) const noexcept {
+		return strings.substr(entry.path, entry.path_length);
+	}
+
+	[[gnu::pure]]
+	std::string_view GetName(const PackEntry &entry) const noexcept {
+		return GetPath(entry).substr(entry.name_start);
+	}
+
+	[[gnu::pure]]
+	std::string_view GetETag(const PackEntry &entry) const noexcept {
+		return strings.substr(entry.etag, entry.etag_length);
+	}
+
+	[[gnu::pure]]
+	std::string_view GetContentType(const PackEntry &entry) const noexcept {
+		return strings.substr(entry.content_type,
+				      entry.content_type_length);
+	}
+
+private:
+	void Verify(uint64_t file_size) const;
+};
+
+/**
+ * Open an image, sharing it with all other sites (and threads) of
+ * this process which use it.  An image must not be modified while
+ * it is in use; to deploy a new version, rename() it over the old
+ * one, which is detected here.  Throws on error.
+ */
+std::shared_ptr<const PackImage>
+OpenPackImage(const char *path);
+
+/**
+ * Pack the given directory tree into a new image file.  Symlinks
+ * and special files are omitted.  Throws on error.
+ *
+ * @return the number of entries
+ */
+std::size_t
+BuildPackImage(const char *directory, const char *path);
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Pack a directory tree into an image for davos-packed.
+ */
+
+#include "PackImage.hxx"
+#include "util/PrintException.hxx"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int
+main(int argc, char **argv) noexcept
+try {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s DIRECTORY IMAGE\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const std::size_t n = BuildPackImage(argv[1], argv[2]);
+
+	/* verify the new image */
+	const PackImage image{argv[2]};
+
+	printf("%zu\t%s\n", n, argv[2]);
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,500 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "PackedBackend.hxx"
+#include "DavParser.hxx"
+#include "Transfer.hxx"
+#include "VmspliceOutputStream.hxx"
+#include "uri_escape.hxx"
+#include "wxml.hxx"
+#include "was/ExceptionResponse.hxx"
+#include "was/WasOutputStream.hxx"
+#include "lib/fmt/ToBuffer.hxx"
+#include "http/Date.hxx"
+#include "http/List.hxx"
+#include "http/Range.hxx"
+#include "util/PrintException.hxx"
+#include "util/StringAPI.hxx"
+
+#include <was/simple.h>
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <optional>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The "Allow" response header value for rejected write methods.
+ */
+static constexpr char PACKED_ALLOW_FILE[] = "OPTIONS,GET,HEAD,PROPFIND";
+
+bool
+PackedBackend::Setup(was_simple *w) noexcept
+{
+	const char *path = was_simple_get_parameter(w, "DAVOS_PACK");
+	if (path == nullptr) {
+		fprintf(stderr, "No DAVOS_PACK\n");
+		return false;
+	}
+
+	try {
+		image = OpenPackImage(path);
+	} catch (...) {
+		PrintException(std::current_exception());
+		return false;
+	}
+
+	return propfind.Setup(w) && compress.Setup(w);
+}
+
+[[gnu::pure]]
+static std::chrono::system_clock::time_point
+GetModificationTime(const PackEntry &entry) noexcept
+{
+	return std::chrono::system_clock::from_time_t(entry.mtime_sec) +
+		std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds{entry.mtime_nsec});
+}
+
+static bool
+static_response_headers(was_simple *was, const PackImage &image,
+			const PackEntry &entry)
+{
+	return was_simple_set_header(was, "content-type",
+				     image.GetContentType(entry).data()) &&
+		was_simple_set_header(was, "accept-ranges", "bytes") &&
+		was_simple_set_header(was, "last-modified",
+				      http_date_format(GetModificationTime(entry))) &&
+		was_simple_set_header(was, "etag", image.GetETag(entry).data());
+}
+
+static void
+SendNotModified(was_simple *was, const char *etag)
+{
+	if (was_simple_status(was, HTTP_STATUS_NOT_MODIFIED))
+		was_simple_set_header(was, "etag", etag);
+	throw Was::EndResponse{};
+}
+
+/**
+ * Parse a date request header.
+ *
+ * @return the time point or std::nullopt if there is no such header
+ */
+static std::optional<std::chrono::system_clock::time_point>
+GetDateHeader(was_simple *was, const char *name)
+{
+	const char *p = was_simple_get_header(was, name);
+	if (p == nullptr)
+		return std::nullopt;
+
+	const auto t = http_date_parse(p);
+	if (t < std::chrono::system_clock::time_point()) {
+		was_simple_status(was, HTTP_STATUS_BAD_REQUEST);
+		throw Was::EndResponse{};
+	}
+
+	return t;
+}
+
+/**
+ * Evaluate the preconditions (RFC 9110 13.2.2) with the
+ * precalculated ETag; this needs no access to the image.
+ */
+static void
+HandlePreconditions(was_simple *was, const PackImage &image,
+		    const PackEntry &entry)
+{
+	const char *etag = image.GetETag(entry).data();
+	const auto mtime = std::chrono::system_clock::from_time_t(entry.mtime_sec);
+
+	if (const char *p = was_simple_get_header(was, "if-match")) {
+		if (strcmp(p, "*") != 0 && !http_list_contains(p, etag)) {
+			was_simple_status(was, HTTP_STATUS_PRECONDITION_FAILED);
+			throw Was::EndResponse{};
+		}
+	} else if (const auto t = GetDateHeader(was, "if-unmodified-since");
+		   t && mtime > *t) {
+		was_simple_status(was, HTTP_STATUS_PRECONDITION_FAILED);
+		throw Was::EndResponse{};
+	}
+
+	if (const char *p = was_simple_get_header(was, "if-none-match")) {
+		if (strcmp(p, "*") == 0 || http_list_contains(p, etag))
+			SendNotModified(was, etag);
+	} else if (const auto t = GetDateHeader(was, "if-modified-since");
+		   t && mtime <= *t)
+		SendNotModified(was, etag);
+}
+
+/**
+ * Verifies the If-Range request header (RFC 9110 13.1.5).
+ */
+[[gnu::pure]]
+static bool
+CheckIfRange(const char *if_range, const PackEntry &entry, const char *etag)
+{
+	if (if_range == nullptr)
+		return true;
+
+	const auto t = http_date_parse(if_range);
+	if (t != std::chrono::system_clock::from_time_t(-1))
+		return std::chrono::system_clock::from_time_t(entry.mtime_sec) == t;
+
+	return StringIsEqual(if_range, etag);
+}
+
+void
+PackedBackend::HandleHead(was_simple *w, const Resource &resource)
+{
+	if (!resource.Exists()) {
+		was_simple_status(w, HTTP_STATUS_NOT_FOUND);
+		return;
+	}
+
+	if (!resource.IsFile()) {
+		was_simple_status(w, HTTP_STATUS_METHOD_NOT_ALLOWED);
+		return;
+	}
+
+	const auto &entry = resource.GetEntry();
+	HandlePreconditions(w, *image, entry);
+
+	if (!was_simple_set_header(w, "content-length",
+				   fmt::format_int{entry.size}.c_str()))
+		return;
+
+	static_response_headers(w, *image, entry);
+}
+
+void
+PackedBackend::HandleGet(was_simple *w, const Resource &resource)
+{
+	if (!resource.Exists()) {
+		was_simple_status(w, HTTP_STATUS_NOT_FOUND);
+		return;
+	}
+
+	if (!resource.IsFile()) {
+		was_simple_status(w, HTTP_STATUS_METHOD_NOT_ALLOWED);
+		return;
+	}
+
+	const auto &entry = resource.GetEntry();
+	HandlePreconditions(w, *image, entry);
+
+	HttpRangeRequest range(entry.size);
+
+	const char *p = was_simple_get_header(w, "range");
+	if (p != nullptr &&
+	    CheckIfRange(was_simple_get_header(w, "if-range"), entry,
+			 image->GetETag(entry).data()))
+		range.ParseRangeHeader(p);
+
+	switch (range.type) {
+	case HttpRangeRequest::Type::NONE:
+		break;
+
+	case HttpRangeRequest::Type::VALID:
+		if (!was_simple_status(w, HTTP_STATUS_PARTIAL_CONTENT))
+			return;
+
+		if (!was_simple_set_header(w, "content-range",
+					   FmtBuffer<128>("bytes {}-{}/{}",
+							  range.skip,
+							  range.size - 1,
+							  entry.size)))
+		    return;
+
+		break;
+
+	case HttpRangeRequest::Type::INVALID:
+		if (!was_simple_status(w, HTTP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE))
+			return;
+
+		if (!was_simple_set_header(w, "content-range",
+					   FmtBuffer<128>("bytes */{}",
+							  entry.size)))
+		    return;
+
+		static_response_headers(w, *image, entry);
+		return;
+	}
+
+	/* the range is spliced directly out of the image */
+	if (static_response_headers(w, *image, entry))
+		TransferToWas(w, image->GetFileDescriptor(),
+			      entry.data_offset + range.skip,
+			      range.size - range.skip);
+}
+
+/**
+ * Reject a method which would modify the tree.
+ */
+static void
+SendReadOnly(was_simple *was) noexcept
+{
+	if (was_simple_status(was, HTTP_STATUS_METHOD_NOT_ALLOWED))
+		was_simple_set_header(was, "allow", PACKED_ALLOW_FILE);
+}
+
+void
+PackedBackend::HandlePut(was_simple *w, Resource &)
+{
+	SendReadOnly(w);
+}
+
+void
+PackedBackend::HandlePost(was_simple *w, const char *, Resource &)
+{
+	SendReadOnly(w);
+}
+
+void
+PackedBackend::HandleDelete(was_simple *w, const char *, Resource &)
+{
+	SendReadOnly(w);
+}
+
+void
+PackedBackend::HandleReport(was_simple *w, const char *, const Resource &)
+{
+	SendReadOnly(w);
+}
+
+void
+PackedBackend::HandleProppatch(was_simple *w, const char *, Resource &)
+{
+	SendReadOnly(w);
+}
+
+void
+PackedBackend::HandleMkcol(was_simple *w, Resource &)
+{
+	SendReadOnly(w);
+}
+
+void
+PackedBackend::HandleCopy(was_simple *w, const Resource &, const char *,
+			  Resource &)
+{
+	SendReadOnly(w);
+}
+
+void
+PackedBackend::HandleMove(was_simple *w, Resource &, Resource &)
+{
+	SendReadOnly(w);
+}
+
+void
+PackedBackend::HandleLock(was_simple *w, Resource &)
+{
+	SendReadOnly(w);
+}
+
+/**
+ * Generate a "Davos-Continuation" token.  It contains the index of
+ * the collection (to detect tokens which are used on a different
+ * collection) and the number of children which were already sent.
+ */
+static StringBuffer<64>
+MakeContinuation(std::size_t index, std::size_t offset) noexcept
+{
+	return FmtBuffer<64>("{:x}-{:x}", index, offset);
+}
+
+/**
+ * Parse a "Davos-Continuation" token.
+ *
+ * @return false if the token is malformed
+ */
+static bool
+ParseContinuation(const char *s, std::size_t &index, std::size_t &offset) noexcept
+{
+	char *endptr;
+	index = strtoull(s, &endptr, 16);
+	if (endptr == s || *endptr != '-')
+		return false;
+
+	s = endptr + 1;
+	offset = strtoull(s, &endptr, 16);
+	return endptr != s && *endptr == 0;
+}
+
+static void
+propfind_entry(BufferedOutputStream &o, std::string_view uri,
+	       const PackImage &image, const PackEntry &entry)
+{
+	wxml_write(o, WxmlOpen<"D:response">{},
+		   WxmlOpen<"D:href">{}, WxmlText{uri}, WxmlClose<"D:href">{},
+		   WxmlOpen<"D:propstat">{},
+		   WxmlConst<"<D:status>HTTP/1.1 200 OK</D:status>">{},
+		   WxmlOpen<"D:prop">{});
+
+	if (S_ISDIR(entry.mode))
+		resourcetype_collection(o);
+	else
+		wxml_write(o, WxmlOpen<"D:getcontentlength">{},
+			   WxmlUnsigned{entry.size},
+			   WxmlClose<"D:getcontentlength">{},
+			   WxmlOpen<"D:getcontenttype">{},
+			   WxmlText{image.GetContentType(entry)},
+			   WxmlClose<"D:getcontenttype">{},
+			   WxmlOpen<"D:getetag">{},
+			   WxmlText{image.GetETag(entry)},
+			   WxmlClose<"D:getetag">{});
+
+	wxml_write(o, WxmlOpen<"D:getlastmodified">{},
+		   WxmlRaw{http_date_format(GetModificationTime(entry))},
+		   WxmlClose<"D:getlastmodified">{},
+		   WxmlCloseResponseProp{});
+}
+
+/**
+ * Emit response elements for a range of children of a collection.
+ * This iterates over the index instead of reading a directory.
+ *
+ * @param uri the URI of the collection, ending with a slash
+ * @param truncated true if this is not the end of the collection
+ */
+static void
+propfind_children(BufferedOutputStream &o, std::string &uri,
+		  const PackImage &image,
+		  std::span<const PackEntry> children, bool truncated,
+		  unsigned depth, const PropfindConfig &config)
+{
+	const auto uri_length = uri.length();
+
+	for (const auto &child : children) {
+		AppendUriEscape(uri, image.GetName(child).data());
+		if (S_ISDIR(child.mode))
+			/* directory URIs should end with a slash */
+			uri.push_back('/');
+
+		propfind_entry(o, uri, image, child);
+
+		if (depth > 0 && S_ISDIR(child.mode)) {
+			auto grandchildren = image.GetChildren(child);
+			const bool t = grandchildren.size() > config.max_files;
+			if (t)
+				grandchildren = grandchildren.first(config.max_files);
+
+			propfind_children(o, uri, image, grandchildren, t,
+					  depth - 1, config);
+		}
+
+		uri.erase(uri_length);
+	}
+
+	if (truncated)
+		insufficient_storage(o, uri);
+}
+
+void
+PackedBackend::HandlePropfind(was_simple *w, const char *uri,
+			      const Resource &resource)
+{
+	/* the properties are all cheap, so "allprop" is sent for
+	   every request; the body is only parsed to reject malformed
+	   requests */
+	if (was_simple_has_body(w)) {
+		if (const auto status = GetThreadDavParser().Parse(w);
+		    status != HTTP_STATUS_OK) {
+			was_simple_status(w, status);
+			return;
+		}
+	}
+
+	if (!resource.Exists()) {
+		was_simple_status(w, HTTP_STATUS_NOT_FOUND);
+		return;
+	}
+
+	const auto &entry = resource.GetEntry();
+
+	const unsigned depth = ParseDepth(was_simple_get_header(w, "depth"),
+					  propfind.max_depth);
+	const bool list = depth > 0 && resource.IsDirectory();
+
+	std::size_t start = 0;
+	const char *const token = was_simple_get_header(w, "davos-continuation");
+	if (token != nullptr) {
+		std::size_t index;
+		if (!list || !ParseContinuation(token, index, start)) {
+			was_simple_status(w, HTTP_STATUS_BAD_REQUEST);
+			return;
+		}
+
+		if (index != image->GetIndex(entry) ||
+		    start > entry.n_children) {
+			/* the token was made for a different
+			   collection */
+			was_simple_status(w, HTTP_STATUS_PRECONDITION_FAILED);
+			return;
+		}
+	}
+
+	std::span<const PackEntry> children;
+	if (list)
+		children = image->GetChildren(entry).subspan(start);
+
+	const bool truncated = children.size() > propfind.max_files;
+	if (truncated)
+		children = children.first(propfind.max_files);
+
+	const auto encoding = compress.Negotiate(w);
+
+	if (!was_simple_status(w, HTTP_STATUS_MULTI_STATUS) ||
+	    !was_simple_set_header(w, "content-type",
+				   "text/xml; charset=\"utf-8\""))
+		return;
+
+	if (truncated &&
+	    !was_simple_set_header(w, "davos-continuation",
+				   MakeContinuation(image->GetIndex(entry),
+						    start + children.size())))
+		return;
+
+	if (compress.IsEnabled() &&
+	    !was_simple_set_header(w, "vary", "accept-encoding"))
+		return;
+
+	WasOutputStream wos{w};
+	std::optional<VmspliceOutputStream> vos;
+	if (propfind.vmsplice)
+		vos.emplace(w);
+
+	OutputStream &out = vos
+		? static_cast<OutputStream &>(*vos)
+		: static_cast<OutputStream &>(wos);
+
+	CompressOutputStream cos{w, out, encoding, compress};
+	BufferedOutputStream bos{cos};
+
+	begin_multistatus(bos);
+
+	std::string uri2(uri);
+	propfind_entry(bos, uri2, *image, entry);
+
+	if (list) {
+		if (uri2.back() != '/')
+			uri2.push_back('/');
+
+		propfind_children(bos, uri2, *image, children, truncated,
+				  depth - 1, propfind);
+	}
+
+	end_multistatus(bos);
+
+	bos.Flush();
+	cos.Finish();
+
+	if (vos)
+		vos->Flush();
+}
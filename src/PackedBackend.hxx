@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#pragma once
+
+#include "Compress.hxx"
+#include "PackImage.hxx"
+#include "propfind.hxx"
+
+#include <memory>
+#include <string_view>
+
+#include <sys/stat.h>
+
+struct was_simple;
+
+/**
+ * A resource in a #PackImage.
+ */
+class PackedResource {
+	const PackEntry *entry;
+
+public:
+	explicit PackedResource(const PackEntry *_entry) noexcept
+		:entry(_entry) {}
+
+	bool Exists() const noexcept {
+		return entry != nullptr;
+	}
+
+	bool IsDirectory() const noexcept {
+		return S_ISDIR(entry->mode);
+	}
+
+	bool IsFile() const noexcept {
+		return S_ISREG(entry->mode);
+	}
+
+	const PackEntry &GetEntry() const noexcept {
+		return *entry;
+	}
+};
+
+/**
+ * Serves a read-only tree from a #PackImage.  Mapping a URI is a
+ * lookup in the memory-mapped index, GET splices from the image
+ * file, and PROPFIND iterates over ranges of the index; none of
+ * this needs a system call on the original tree.  All methods which
+ * would modify the tree are rejected.
+ */
+class PackedBackend {
+	std::shared_ptr<const PackImage> image;
+
+	PropfindConfig propfind;
+
+	CompressConfig compress;
+
+public:
+	typedef PackedResource Resource;
+
+	bool Setup(was_simple *w) noexcept;
+	void TearDown() noexcept {}
+
+	bool IsReadOnly() const noexcept {
+		return true;
+	}
+
+	bool AllowsPost() const noexcept {
+		return false;
+	}
+
+	bool AllowsReport() const noexcept {
+		return false;
+	}
+
+	[[gnu::pure]]
+	Resource Map(std::string_view uri) const noexcept {
+		return Resource{image->Find(uri)};
+	}
+
+	void HandleHead(was_simple *w, const Resource &resource);
+	void HandleGet(was_simple *w, const Resource &resource);
+
+	void HandlePut(was_simple *w, Resource &resource);
+	void HandlePost(was_simple *w, const char *uri, Resource &resource);
+	void HandleDelete(was_simple *w, const char *uri, Resource &resource);
+
+	void HandlePropfind(was_simple *w, const char *uri,
+			    const Resource &resource);
+
+	void HandleReport(was_simple *w, const char *uri,
+			  const Resource &resource);
+
+	void HandleProppatch(was_simple *w, const char *uri,
+			     Resource &resource);
+
+	void HandleMkcol(was_simple *w, Resource &resource);
+	void HandleCopy(was_simple *w, const Resource &src,
+			const char *dest_uri, Resource &dest);
+	void HandleMove(was_simple *w, Resource &src, Resource &dest);
+
+	void HandleLock(was_simple *w, Resource &resource);
+};
@@ -0,0 +1,830 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Copy and delete directory trees with a pool of threads.
+ */
+
+#include "ParallelTree.hxx"
+#include "DirectoryScanner.hxx"
+#include "system/Error.hxx"
+#include "io/FileAt.hxx"
+#include "io/RecursiveCopy.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Collect at most this number of errors.
+ */
+static constexpr std::size_t MAX_ERRORS = 1000;
+
+/**
+ * If this many directories are open, subdirectories are processed by
+ * the current task instead of being queued, which limits the number
+ * of file descriptors.
+ */
+static constexpr unsigned MAX_OPEN_DIRECTORIES = 256;
+
+/**
+ * The number of directory entries deleted by one task.
+ */
+static constexpr std::size_t UNLINK_BATCH = 256;
+
+/**
+ * A pool of threads with one task queue per thread.  Each thread
+ * takes tasks from the end of its own queue (depth first); idle
+ * threads steal from the beginning of the other queues.
+ */
+class TreePool {
+public:
+	using Task = std::function<void()>;
+
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	const unsigned n_threads;
+	const std::unique_ptr<Queue[]> queues;
+
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	/**
+	 * The number of tasks which are queued or running.
+	 */
+	std::atomic_size_t pending{0};
+
+	/**
+	 * Incremented by each Push(), to let idle threads detect new
+	 * tasks which were queued while they were looking for one.
+	 */
+	std::atomic_size_t generation{0};
+
+	/**
+	 * The index of the queue of the current thread.
+	 */
+	static thread_local unsigned current;
+
+public:
+	explicit TreePool(unsigned _n_threads) noexcept
+		:n_threads(_n_threads), queues(new Queue[n_threads]) {}
+
+	/**
+	 * Queue a task.  Must be called by a task or by Run().
+	 */
+	void Push(Task &&task) noexcept;
+
+	/**
+	 * Run the given task and all tasks queued by it, and return
+	 * when all of them are finished.
+	 */
+	void Run(Task &&task) noexcept;
+
+private:
+	bool Pop(unsigned self, Task &task) noexcept;
+	void Work(unsigned self) noexcept;
+};
+
+thread_local unsigned TreePool::current;
+
+void
+TreePool::Push(Task &&task) noexcept
+{
+	++pending;
+
+	{
+		Queue &queue = queues[current];
+		const std::scoped_lock lock{queue.mutex};
+		queue.tasks.push_back(std::move(task));
+	}
+
+	++generation;
+
+	const std::scoped_lock lock{mutex};
+	cond.notify_one();
+}
+
+bool
+TreePool::Pop(unsigned self, Task &task) noexcept
+{
+	{
+		Queue &queue = queues[self];
+		const std::scoped_lock lock{queue.mutex};
+		if (!queue.tasks.empty()) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (unsigned i = 1; i < n_threads; ++i) {
+		Queue &queue = queues[(self + i) % n_threads];
+		const std::scoped_lock lock{queue.mutex};
+		if (!queue.tasks.empty()) {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void
+TreePool::Work(unsigned self) noexcept
+{
+	current = self;
+
+	Task task;
+	while (true) {
+		const std::size_t old_generation = generation;
+
+		if (Pop(self, task)) {
+			try {
+				task();
+			} catch (...) {
+				/* tasks report their own errors; this
+				   can only be std::bad_alloc */
+			}
+
+			task = nullptr;
+
+			if (--pending == 0) {
+				const std::scoped_lock lock{mutex};
+				cond.notify_all();
+			}
+
+			continue;
+		}
+
+		std::unique_lock lock{mutex};
+		if (pending == 0)
+			break;
+
+		if (generation == old_generation)
+			cond.wait(lock);
+	}
+}
+
+void
+TreePool::Run(Task &&task) noexcept
+{
+	current = 0;
+	Push(std::move(task));
+
+	std::vector<std::jthread> threads;
+	for (unsigned i = 1; i < n_threads; ++i) {
+		try {
+			threads.emplace_back([this, i]{ Work(i); });
+		} catch (...) {
+			/* continue with the threads we have */
+			break;
+		}
+	}
+
+	Work(0);
+}
+
+/**
+ * Thread-safe wrapper for the error list.
+ */
+class TreeErrors {
+	std::mutex mutex;
+	std::vector<TreeError> &errors;
+
+public:
+	explicit TreeErrors(std::vector<TreeError> &_errors) noexcept
+		:errors(_errors) {}
+
+	void Add(std::string_view parent, std::string_view name, int error) {
+		std::string path{parent};
+		if (!path.empty() && !name.empty())
+			path.push_back('/');
+		path.append(name);
+
+		const std::scoped_lock lock{mutex};
+		if (errors.size() < MAX_ERRORS)
+			errors.push_back({std::move(path), error});
+	}
+};
+
+static std::string
+JoinPath(std::string_view parent, std::string_view name) noexcept
+{
+	if (parent.empty())
+		return std::string{name};
+
+	std::string path;
+	path.reserve(parent.size() + 1 + name.size());
+	path.append(parent);
+	path.push_back('/');
+	path.append(name);
+	return path;
+}
+
+/**
+ * Copy the rest of the file with copy_file_range(), which allows the
+ * filesystem to share extents or to copy on the server (NFS), or
+ * with sendfile() if that is not supported.
+ *
+ * @return 0 or an errno value
+ */
+static int
+CopyData(FileDescriptor in, FileDescriptor out) noexcept
+{
+	static constexpr std::size_t MAX = 1024 * 1024 * 1024;
+
+	bool fallback = false;
+
+	while (true) {
+		const ssize_t nbytes = fallback
+			? sendfile(out.Get(), in.Get(), nullptr, MAX)
+			: copy_file_range(in.Get(), nullptr, out.Get(), nullptr,
+					  MAX, 0);
+		if (nbytes > 0)
+			continue;
+
+		if (nbytes == 0)
+			return 0;
+
+		if (!fallback &&
+		    (errno == EXDEV || errno == EINVAL ||
+		     errno == EOPNOTSUPP || errno == ENOSYS)) {
+			fallback = true;
+			continue;
+		}
+
+		return errno;
+	}
+}
+
+/**
+ * A pair of directories being copied.  It is shared by all tasks
+ * which copy its entries.
+ */
+struct CopyDirectory {
+	std::atomic_uint &n_open;
+
+	const UniqueFileDescriptor src, dst;
+
+	/**
+	 * The path relative to the root.
+	 */
+	const std::string path;
+
+	CopyDirectory(std::atomic_uint &_n_open,
+		      UniqueFileDescriptor &&_src, UniqueFileDescriptor &&_dst,
+		      std::string &&_path) noexcept
+		:n_open(_n_open),
+		 src(std::move(_src)), dst(std::move(_dst)),
+		 path(std::move(_path))
+	{
+		++n_open;
+	}
+
+	~CopyDirectory() noexcept {
+		--n_open;
+	}
+
+	CopyDirectory(const CopyDirectory &) = delete;
+	CopyDirectory &operator=(const CopyDirectory &) = delete;
+};
+
+class TreeCopy {
+	TreePool &pool;
+	TreeErrors &errors;
+
+	const unsigned options;
+
+	/**
+	 * The device of the source root.
+	 */
+	const dev_t dev;
+
+	/**
+	 * The destination root directory; it is never copied into
+	 * itself.
+	 */
+	dev_t dst_dev = 0;
+	ino_t dst_ino = 0;
+
+	std::atomic_uint n_open{0};
+
+public:
+	TreeCopy(TreePool &_pool, TreeErrors &_errors,
+		 unsigned _options, dev_t _dev) noexcept
+		:pool(_pool), errors(_errors), options(_options), dev(_dev) {}
+
+	/**
+	 * @return 0 or an errno value
+	 */
+	int CopyFile(FileAt src, FileAt dst) const noexcept;
+
+	/**
+	 * @return 0 or an errno value
+	 */
+	int LinkFile(FileAt src, FileAt dst) const noexcept;
+
+	/**
+	 * @return 0 or an errno value
+	 */
+	int CopySymlink(FileAt src, FileAt dst) const noexcept;
+
+	/**
+	 * Open the source directory and create the destination
+	 * directory.  If the source directory shall be skipped, this
+	 * returns 0 and leaves #result empty.
+	 *
+	 * @return 0 or an errno value
+	 */
+	int OpenDirectory(FileAt src, FileAt dst, std::string &&path,
+			  std::shared_ptr<CopyDirectory> &result) noexcept;
+
+	void SetDestinationRoot(const CopyDirectory &root) noexcept {
+		struct stat st;
+		if (fstat(root.dst.Get(), &st) == 0) {
+			dst_dev = st.st_dev;
+			dst_ino = st.st_ino;
+		}
+	}
+
+	void CopyContents(const std::shared_ptr<CopyDirectory> &dir) noexcept;
+
+private:
+	[[gnu::pure]]
+	bool IsOtherFilesystem(const struct stat &st) const noexcept {
+		return (options & RECURSIVE_COPY_ONE_FILESYSTEM) != 0 &&
+			st.st_dev != dev;
+	}
+
+	void Fail(std::string_view parent, std::string_view name,
+		  int error) noexcept {
+		/* ENOENT means the source was deleted meanwhile */
+		if (error != ENOENT)
+			errors.Add(parent, name, error);
+	}
+
+	void CopySubdirectory(const CopyDirectory &parent,
+			      const char *name) noexcept;
+};
+
+int
+TreeCopy::CopyFile(FileAt src, FileAt dst) const noexcept
+{
+	/* O_NONBLOCK because it may have been replaced by a FIFO */
+	UniqueFileDescriptor in;
+	if (!in.Open(src.directory, src.name,
+		     O_RDONLY|O_NOFOLLOW|O_NONBLOCK|O_NOCTTY))
+		return errno;
+
+	struct stat st;
+	if (fstat(in.Get(), &st) < 0)
+		return errno;
+
+	if (!S_ISREG(st.st_mode) || IsOtherFilesystem(st))
+		return 0;
+
+	if ((options & PARALLEL_COPY_LINK) && st.st_nlink > 1)
+		return LinkFile(src, dst);
+
+	int flags = O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW|O_NOCTTY;
+	if (options & RECURSIVE_COPY_NO_OVERWRITE)
+		flags |= O_EXCL;
+
+	UniqueFileDescriptor out;
+	if (!out.Open(dst.directory, dst.name, flags, st.st_mode & 07777))
+		return errno;
+
+	return CopyData(in, out);
+}
+
+int
+TreeCopy::LinkFile(FileAt src, FileAt dst) const noexcept
+{
+	if (linkat(src.directory.Get(), src.name,
+		   dst.directory.Get(), dst.name, 0) == 0)
+		return 0;
+
+	if (errno != EEXIST || (options & RECURSIVE_COPY_NO_OVERWRITE))
+		return errno;
+
+	/* replace the existing file */
+	if (unlinkat(dst.directory.Get(), dst.name, 0) < 0 ||
+	    linkat(src.directory.Get(), src.name,
+		   dst.directory.Get(), dst.name, 0) < 0)
+		return errno;
+
+	return 0;
+}
+
+int
+TreeCopy::CopySymlink(FileAt src, FileAt dst) const noexcept
+{
+	char target[PATH_MAX];
+	const ssize_t length = readlinkat(src.directory.Get(), src.name,
+					  target, sizeof(target) - 1);
+	if (length < 0)
+		return errno;
+
+	target[length] = 0;
+
+	if (symlinkat(target, dst.directory.Get(), dst.name) == 0)
+		return 0;
+
+	if (errno != EEXIST || (options & RECURSIVE_COPY_NO_OVERWRITE))
+		return errno;
+
+	/* replace the existing file */
+	if (unlinkat(dst.directory.Get(), dst.name, 0) < 0 ||
+	    symlinkat(target, dst.directory.Get(), dst.name) < 0)
+		return errno;
+
+	return 0;
+}
+
+int
+TreeCopy::OpenDirectory(FileAt src, FileAt dst, std::string &&path,
+			std::shared_ptr<CopyDirectory> &result) noexcept
+{
+	UniqueFileDescriptor src_fd;
+	if (!src_fd.Open(src.directory, src.name,
+			 O_DIRECTORY|O_RDONLY|O_NOFOLLOW))
+		return errno;
+
+	struct stat st;
+	if (fstat(src_fd.Get(), &st) < 0)
+		return errno;
+
+	if (IsOtherFilesystem(st) ||
+	    (st.st_dev == dst_dev && st.st_ino == dst_ino))
+		return 0;
+
+	if (mkdirat(dst.directory.Get(), dst.name, st.st_mode & 07777) < 0 &&
+	    (errno != EEXIST || (options & RECURSIVE_COPY_NO_OVERWRITE)))
+		return errno;
+
+	UniqueFileDescriptor dst_fd;
+	if (!dst_fd.Open(dst.directory, dst.name,
+			 O_DIRECTORY|O_RDONLY|O_NOFOLLOW))
+		return errno;
+
+	result = std::make_shared<CopyDirectory>(n_open, std::move(src_fd),
+						 std::move(dst_fd),
+						 std::move(path));
+	return 0;
+}
+
+inline void
+TreeCopy::CopySubdirectory(const CopyDirectory &parent,
+			   const char *name) noexcept
+{
+	std::shared_ptr<CopyDirectory> sub;
+	if (int e = OpenDirectory({parent.src, name}, {parent.dst, name},
+				  JoinPath(parent.path, name), sub);
+	    e != 0) {
+		Fail(parent.path, name, e);
+		return;
+	}
+
+	if (!sub)
+		/* skipped */
+		return;
+
+	if (n_open < MAX_OPEN_DIRECTORIES)
+		pool.Push([this, sub]{ CopyContents(sub); });
+	else
+		CopyContents(sub);
+}
+
+void
+TreeCopy::CopyContents(const std::shared_ptr<CopyDirectory> &dir) noexcept
+{
+	DirectoryScanner scanner;
+	if (!scanner.Scan(dir->src)) {
+		Fail(dir->path, {}, errno);
+		return;
+	}
+
+	for (const auto &i : scanner.GetEntries()) {
+		const char *name = scanner.GetName(i);
+
+		unsigned type = i.type;
+		if (type == DT_UNKNOWN) {
+			struct stat st;
+			if (fstatat(dir->src.Get(), name, &st,
+				    AT_SYMLINK_NOFOLLOW) < 0) {
+				Fail(dir->path, name, errno);
+				continue;
+			}
+
+			type = IFTODT(st.st_mode);
+		}
+
+		switch (type) {
+		case DT_REG:
+			/* one task per file; the name is copied,
+			   because the scanner is gone when the task
+			   runs */
+			pool.Push([this, dir, name=std::string{name}]{
+				if (int e = CopyFile({dir->src, name.c_str()},
+						     {dir->dst, name.c_str()});
+				    e != 0)
+					Fail(dir->path, name, e);
+			});
+			break;
+
+		case DT_DIR:
+			CopySubdirectory(*dir, name);
+			break;
+
+		case DT_LNK:
+			if (int e = CopySymlink({dir->src, name}, {dir->dst, name});
+			    e != 0)
+				Fail(dir->path, name, e);
+			break;
+
+		default:
+			/* special files are omitted */
+			break;
+		}
+	}
+}
+
+void
+ParallelCopy(FileAt src, FileAt dst, unsigned options, unsigned threads,
+	     std::vector<TreeError> &errors)
+{
+	struct stat st;
+	if (fstatat(src.directory.Get(), src.name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+		throw MakeErrno("Failed to stat source");
+
+	TreePool pool{threads};
+	TreeErrors tree_errors{errors};
+	TreeCopy copy{pool, tree_errors, options, st.st_dev};
+
+	if (S_ISDIR(st.st_mode)) {
+		std::shared_ptr<CopyDirectory> root;
+		if (int e = copy.OpenDirectory(src, dst, {}, root); e != 0)
+			throw MakeErrno(e, "Failed to copy directory");
+
+		copy.SetDestinationRoot(*root);
+		pool.Run([&copy, root]{ copy.CopyContents(root); });
+	} else if (S_ISREG(st.st_mode)) {
+		if (int e = copy.CopyFile(src, dst); e != 0)
+			throw MakeErrno(e, "Failed to copy file");
+	} else if (S_ISLNK(st.st_mode)) {
+		if (int e = copy.CopySymlink(src, dst); e != 0)
+			throw MakeErrno(e, "Failed to copy symlink");
+	}
+}
+
+/**
+ * A directory being deleted.  It is removed from its parent when
+ * all of its entries have been processed.
+ */
+struct DeleteDirectory {
+	/**
+	 * The parent directory, or nullptr for the root.
+	 */
+	const std::shared_ptr<DeleteDirectory> parent;
+
+	UniqueFileDescriptor fd;
+
+	/**
+	 * The name in the parent directory.
+	 */
+	const std::string name;
+
+	/**
+	 * The path relative to the root.
+	 */
+	const std::string path;
+
+	/**
+	 * The number of unfinished tasks for this directory: the
+	 * one which reads it, the unlink batches and the
+	 * subdirectories.
+	 */
+	std::atomic_uint pending{1};
+
+	DeleteDirectory(std::shared_ptr<DeleteDirectory> _parent,
+			UniqueFileDescriptor &&_fd,
+			std::string_view _name, std::string &&_path) noexcept
+		:parent(std::move(_parent)), fd(std::move(_fd)),
+		 name(_name), path(std::move(_path)) {}
+};
+
+class TreeDelete {
+	TreePool &pool;
+	TreeErrors &errors;
+
+	/**
+	 * The device of the root; other filesystems mounted below
+	 * are not entered.
+	 */
+	const dev_t dev;
+
+	std::atomic_uint n_open{0};
+
+public:
+	TreeDelete(TreePool &_pool, TreeErrors &_errors, dev_t _dev) noexcept
+		:pool(_pool), errors(_errors), dev(_dev) {}
+
+	std::shared_ptr<DeleteDirectory> MakeRoot(UniqueFileDescriptor &&fd) noexcept {
+		++n_open;
+		return std::make_shared<DeleteDirectory>(nullptr, std::move(fd),
+							 std::string_view{},
+							 std::string{});
+	}
+
+	void DeleteContents(const std::shared_ptr<DeleteDirectory> &dir) noexcept;
+
+private:
+	void Fail(std::string_view parent, std::string_view name,
+		  int error) noexcept {
+		/* ENOENT means it was deleted meanwhile */
+		if (error != ENOENT)
+			errors.Add(parent, name, error);
+	}
+
+	/**
+	 * Finish one task of the directory.  After the last one, the
+	 * directory is removed.
+	 */
+	void Release(DeleteDirectory &dir) noexcept;
+
+	void DeleteSubdirectory(const std::shared_ptr<DeleteDirectory> &parent,
+				const char *name) noexcept;
+
+	void Unlink(const std::shared_ptr<DeleteDirectory> &dir,
+		    const DirectoryScanner &scanner,
+		    std::size_t begin, std::size_t end) noexcept;
+};
+
+void
+TreeDelete::Release(DeleteDirectory &dir) noexcept
+{
+	if (--dir.pending > 0)
+		return;
+
+	dir.fd.Close();
+	--n_open;
+
+	if (dir.parent == nullptr)
+		/* the root is removed by ParallelDelete() */
+		return;
+
+	/* ENOTEMPTY means an entry could not be deleted, which has
+	   been reported already */
+	if (unlinkat(dir.parent->fd.Get(), dir.name.c_str(), AT_REMOVEDIR) < 0 &&
+	    errno != ENOTEMPTY)
+		Fail(dir.path, {}, errno);
+
+	Release(*dir.parent);
+}
+
+inline void
+TreeDelete::DeleteSubdirectory(const std::shared_ptr<DeleteDirectory> &parent,
+			       const char *name) noexcept
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open(parent->fd, name, O_DIRECTORY|O_RDONLY|O_NOFOLLOW)) {
+		Fail(parent->path, name, errno);
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd.Get(), &st) < 0) {
+		Fail(parent->path, name, errno);
+		return;
+	}
+
+	if (st.st_dev != dev) {
+		/* a mount point */
+		Fail(parent->path, name, EBUSY);
+		return;
+	}
+
+	++parent->pending;
+	++n_open;
+	auto sub = std::make_shared<DeleteDirectory>(parent, std::move(fd), name,
+						     JoinPath(parent->path, name));
+
+	if (n_open < MAX_OPEN_DIRECTORIES)
+		pool.Push([this, sub]{ DeleteContents(sub); });
+	else
+		DeleteContents(sub);
+}
+
+inline void
+TreeDelete::Unlink(const std::shared_ptr<DeleteDirectory> &dir,
+		   const DirectoryScanner &scanner,
+		   std::size_t begin, std::size_t end) noexcept
+{
+	for (const auto &i : scanner.GetEntries().subspan(begin, end - begin)) {
+		if (i.type == DT_DIR)
+			continue;
+
+		const char *name = scanner.GetName(i);
+		if (unlinkat(dir->fd.Get(), name, 0) == 0)
+			continue;
+
+		if (errno == EISDIR)
+			/* the filesystem did not report the type */
+			DeleteSubdirectory(dir, name);
+		else
+			Fail(dir->path, name, errno);
+	}
+}
+
+void
+TreeDelete::DeleteContents(const std::shared_ptr<DeleteDirectory> &dir) noexcept
+{
+	/* shared with the unlink tasks */
+	auto scanner = std::make_shared<DirectoryScanner>();
+	if (!scanner->Scan(dir->fd)) {
+		Fail(dir->path, {}, errno);
+		Release(*dir);
+		return;
+	}
+
+	const auto entries = scanner->GetEntries();
+
+	const auto push_unlink = [&](std::size_t begin, std::size_t end){
+		++dir->pending;
+		pool.Push([this, dir, scanner, begin, end]{
+			Unlink(dir, *scanner, begin, end);
+			Release(*dir);
+		});
+	};
+
+	std::size_t batch_begin = 0, batch_size = 0;
+	for (std::size_t i = 0; i < entries.size(); ++i) {
+		if (entries[i].type == DT_DIR) {
+			DeleteSubdirectory(dir, scanner->GetName(entries[i]));
+			continue;
+		}
+
+		if (++batch_size == UNLINK_BATCH) {
+			push_unlink(batch_begin, i + 1);
+			batch_begin = i + 1;
+			batch_size = 0;
+		}
+	}
+
+	if (batch_size > 0)
+		push_unlink(batch_begin, entries.size());
+
+	Release(*dir);
+}
+
+void
+ParallelDelete(FileAt file, unsigned threads,
+	       std::vector<TreeError> &errors)
+{
+	/* try a plain file first; this is the common case */
+	if (unlinkat(file.directory.Get(), file.name, 0) == 0)
+		return;
+
+	if (errno != EISDIR)
+		throw MakeErrno("Failed to delete file");
+
+	UniqueFileDescriptor fd;
+	if (!fd.Open(file.directory, file.name, O_DIRECTORY|O_RDONLY|O_NOFOLLOW))
+		throw MakeErrno("Failed to open directory");
+
+	struct stat st;
+	if (fstat(fd.Get(), &st) < 0)
+		throw MakeErrno("Failed to stat directory");
+
+	TreePool pool{threads};
+	TreeErrors tree_errors{errors};
+	TreeDelete tree_delete{pool, tree_errors, st.st_dev};
+
+	auto root = tree_delete.MakeRoot(std::move(fd));
+	pool.Run([&tree_delete, root]{ tree_delete.DeleteContents(root); });
+
+	/* if entries could not be deleted, they have been reported,
+	   and this fails with ENOTEMPTY */
+	if (unlinkat(file.directory.Get(), file.name, AT_REMOVEDIR) < 0 &&
+	    errors.empty())
+		throw MakeErrno("Failed to delete directory");
+}
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Copy and delete directory trees with a pool of threads.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct FileAt;
+
+/**
+ * An error on an entry below the root of a tree operation.
+ */
+struct TreeError {
+	/**
+	 * The path relative to the root.
+	 */
+	std::string path;
+
+	/**
+	 * An errno value.
+	 */
+	int error;
+};
+
+/**
+ * An option for ParallelCopy() (in addition to the
+ * RECURSIVE_COPY_* flags): regular files which have more than one
+ * link (i.e. objects of a content store, see ContentStore.hxx) are
+ * linked instead of copied.
+ */
+static constexpr unsigned PARALLEL_COPY_LINK = 0x10000;
+
+/**
+ * Copy a file or a directory tree.  Errors on the root throw
+ * std::system_error; errors on entries below the root are collected
+ * in #errors (up to a limit), and the rest of the tree is still
+ * copied.
+ *
+ * @param options a bit mask of RECURSIVE_COPY_NO_OVERWRITE,
+ * RECURSIVE_COPY_ONE_FILESYSTEM (see RecursiveCopy()) and
+ * #PARALLEL_COPY_LINK
+ * @param threads the number of threads to use, including the
+ * calling thread
+ */
+void
+ParallelCopy(FileAt src, FileAt dst, unsigned options, unsigned threads,
+	     std::vector<TreeError> &errors);
+
+/**
+ * Delete a file or a directory tree.  Errors on the root throw
+ * std::system_error (unless they are caused by errors below the
+ * root); errors on entries below the root are collected in #errors
+ * (up to a limit), and the rest of the tree is still deleted.
+ * Mount points are not entered; they are reported with EBUSY.
+ *
+ * @param threads the number of threads to use, including the
+ * calling thread
+ */
+void
+ParallelDelete(FileAt file, unsigned threads,
+	       std::vector<TreeError> &errors);
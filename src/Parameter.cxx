@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Parsers for WAS parameters.
+ */
+
+#include "Parameter.hxx"
+
+#include <was/simple.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool
+GetUnsignedParameter(was_simple *w, const char *name,
+		     uint64_t &value) noexcept
+{
+	const char *p = was_simple_get_parameter(w, name);
+	if (p == nullptr)
+		return true;
+
+	char *endptr;
+	unsigned long long result = strtoull(p, &endptr, 10);
+	if (endptr == p || *endptr != 0 || *p == '-') {
+		fprintf(stderr, "Malformed %s\n", name);
+		return false;
+	}
+
+	value = result;
+	return true;
+}
+
+bool
+GetBooleanParameter(was_simple *w, const char *name, bool &value) noexcept
+{
+	const char *p = was_simple_get_parameter(w, name);
+	if (p == nullptr)
+		return true;
+
+	if (strcmp(p, "yes") == 0)
+		value = true;
+	else if (strcmp(p, "no") == 0)
+		value = false;
+	else {
+		fprintf(stderr, "Malformed %s\n", name);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Parsers for WAS parameters.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+struct was_simple;
+
+/**
+ * Parse an unsigned integer WAS parameter.  If the parameter is not
+ * present, the value is left unmodified.
+ *
+ * @return false if the parameter is malformed (after printing an
+ * error message)
+ */
+bool
+GetUnsignedParameter(was_simple *w, const char *name,
+		     uint64_t &value) noexcept;
+
+/**
+ * Parse a boolean WAS parameter ("yes" or "no").  If the parameter
+ * is not present, the value is left unmodified.
+ *
+ * @return false if the parameter is malformed (after printing an
+ * error message)
+ */
+bool
+GetBooleanParameter(was_simple *w, const char *name, bool &value) noexcept;
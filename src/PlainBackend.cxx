@@ -3,27 +3,50 @@
 // author: Max Kellermann <max.kellermann@ionos.com>
 
 #include "PlainBackend.hxx"
+#include "archive.hxx"
 #include "Chrono.hxx"
+#include "CollectionTag.hxx"
 #include "error.hxx"
 #include "http/Date.hxx"
+#include "util/StringCompare.hxx"
 
 #include <was/simple.h>
 
 bool
 PlainBackend::Setup(was_simple *w) noexcept
 {
-	document_root = was_simple_get_parameter(w, "DAVOS_DOCUMENT_ROOT");
-	if (document_root == nullptr) {
+	const char *_document_root =
+		was_simple_get_parameter(w, "DAVOS_DOCUMENT_ROOT");
+	if (_document_root == nullptr) {
 		fprintf(stderr, "No DAVOS_DOCUMENT_ROOT\n");
 		return false;
 	}
 
-	return true;
+	/* copy the string, because this object is reused for later
+	   requests (see #SiteCache) */
+	document_root = _document_root;
+	quota.document_root = document_root.c_str();
+
+	return propfind.Setup(w) && compress.Setup(w) && etag.Setup(w) &&
+		put.Setup(w) && quota.Setup(w) && bulk_upload.Setup(w) &&
+		tree.Setup(w) && upload.Setup(w) && journal.Setup(w);
 }
 
 PlainBackend::Resource
 PlainBackend::Map(std::string_view uri) const noexcept
 {
+	if (upload.IsEnabled()) {
+		std::string_view rest = uri;
+		if (SkipPrefix(rest, UPLOAD_URI) &&
+		    (rest.empty() || rest.front() == '/')) {
+			/* the upload sessions are not inside the
+			   document root */
+			std::string path(upload.directory);
+			path.append(rest);
+			return Resource(std::move(path));
+		}
+	}
+
 	std::string path(document_root);
 
 	if (!uri.empty()) {
@@ -34,6 +57,347 @@ PlainBackend::Map(std::string_view uri) const noexcept
 	return Resource(std::move(path));
 }
 
+/**
+ * Return the parent directory of the given path.
+ */
+[[gnu::pure]]
+static std::string_view
+ParentPath(std::string_view path) noexcept
+{
+	while (path.size() > 1 && path.back() == '/')
+		path.remove_suffix(1);
+
+	const auto slash = path.rfind('/');
+	return slash == path.npos || slash == 0
+		? path.substr(0, 1)
+		: path.substr(0, slash);
+}
+
+std::optional<uint64_t>
+PlainBackend::GetUsageBefore(const Resource &resource) const noexcept
+{
+	if (!quota.accounting)
+		return std::nullopt;
+
+	if (!resource.Exists())
+		return 0;
+
+	return GetUsage(resource.GetPath(), resource.GetStat());
+}
+
+void
+PlainBackend::UpdateUsage(const Resource &resource,
+			  std::optional<uint64_t> before,
+			  const Resource *source) const noexcept
+{
+	if (!before)
+		/* accounting is disabled or the old usage is
+		   unknown */
+		return;
+
+	/* stat the resource again to see what the request did */
+	const Resource after{std::string{resource.GetPathView()}};
+
+	std::optional<uint64_t> usage = 0;
+	if (after.Exists()) {
+		if (source != nullptr && after.IsDirectory()) {
+			/* a copied collection has the usage of its
+			   source; the directories below it are not
+			   accounted */
+			usage = GetUsage(source->GetPath(), source->GetStat());
+
+			/* if it was merged into an existing
+			   collection, overwritten files were counted
+			   twice; this overestimates the usage, which
+			   is the safe direction for the quota */
+			if (usage && resource.Exists() && resource.IsDirectory())
+				*usage += *before;
+
+			if (usage)
+				InitUsage(after.GetPath(), *usage);
+		} else
+			/* if a DELETE left a tree behind, its stale
+			   attribute cancels the delta; the tree remains
+			   accounted until davos-usage rebuilds it */
+			usage = GetUsage(after.GetPath(), after.GetStat());
+	}
+
+	if (usage)
+		AddUsage(document_root, ParentPath(resource.GetPathView()),
+			 int64_t(*usage) - int64_t(*before));
+}
+
+std::optional<std::string_view>
+PlainBackend::GetRelativePath(std::string_view path) const noexcept
+{
+	if (!SkipPrefix(path, document_root) ||
+	    (!path.empty() && path.front() != '/' &&
+	     !document_root.ends_with('/')))
+		/* for example an upload session */
+		return std::nullopt;
+
+	while (!path.empty() && path.front() == '/')
+		path.remove_prefix(1);
+
+	while (!path.empty() && path.back() == '/')
+		path.remove_suffix(1);
+
+	return path;
+}
+
+void
+PlainBackend::RecordChange(const Resource &resource,
+			   bool tree) const noexcept
+{
+	if (!journal.IsEnabled() && !etag.collection_tag)
+		return;
+
+	const auto relative = GetRelativePath(resource.GetPathView());
+	if (!relative)
+		return;
+
+	/* stat the resource again to see what the request did; the
+	   request may have failed, but a superfluous record only
+	   costs a superfluous response element */
+	const Resource after{std::string{resource.GetPathView()}};
+
+	JournalOp op;
+	if (!after.Exists()) {
+		if (!resource.Exists())
+			return;
+
+		op = JournalOp::DELETED;
+	} else if (tree && after.IsDirectory())
+		op = JournalOp::TREE;
+	else
+		op = JournalOp::MODIFIED;
+
+	if (journal.IsEnabled())
+		AppendJournal(journal, op, *relative);
+
+	/* a directory's own tag changes, too, because its members
+	   or its properties may have changed */
+	if (etag.collection_tag)
+		BumpCollectionTags(document_root,
+				   after.Exists() && after.IsDirectory()
+				   ? resource.GetPathView()
+				   : ParentPath(resource.GetPathView()));
+}
+
+void
+PlainBackend::HandleHead(was_simple *w, const Resource &resource)
+{
+	if (resource.Exists() && resource.IsDirectory() && WantsArchive(*w))
+		handle_get_archive(w, resource, propfind, true);
+	else
+		handle_head(w, resource, etag);
+}
+
+void
+PlainBackend::HandleGet(was_simple *w, const Resource &resource)
+{
+	if (resource.Exists() && resource.IsDirectory() && WantsArchive(*w))
+		handle_get_archive(w, resource, propfind, false);
+	else
+		handle_get(w, resource, etag);
+}
+
+void
+PlainBackend::HandlePut(was_simple *w, Resource &resource)
+{
+	HandlePut(w, resource, nullptr);
+}
+
+void
+PlainBackend::HandlePut(was_simple *w, Resource &resource,
+			const ContentStore *store)
+{
+	std::optional<uint64_t> available;
+	if (quota.limit > 0)
+		available = GetQuotaAvailable(quota);
+
+	switch (GetUploadPath(resource)) {
+	case UploadPath::NONE:
+		break;
+
+	case UploadPath::CHUNK:
+		/* chunks are accounted only when the session gets
+		   assembled */
+		handle_upload_put(w, resource, put, etag, available);
+		return;
+
+	default:
+		was_simple_status(w, HTTP_STATUS_FORBIDDEN);
+		return;
+	}
+
+	const auto before = GetUsageBefore(resource);
+	handle_put(w, resource, put, etag, available, store);
+	UpdateUsage(resource, before);
+	RecordChange(resource, false);
+}
+
+void
+PlainBackend::HandlePost(was_simple *w, const char *uri, Resource &resource)
+{
+	if (GetUploadPath(resource) != UploadPath::NONE) {
+		was_simple_status(w, HTTP_STATUS_FORBIDDEN);
+		return;
+	}
+
+	std::optional<uint64_t> available;
+	if (quota.limit > 0)
+		available = GetQuotaAvailable(quota);
+
+	/* the delta is calculated per extracted file; the tree is
+	   never scanned */
+	const int64_t delta = handle_post(w, uri, resource, bulk_upload,
+					  available);
+	if (quota.accounting)
+		AddUsage(document_root, resource.GetPathView(), delta);
+
+	RecordChange(resource, true);
+}
+
+void
+PlainBackend::HandleDelete(was_simple *w, const char *uri, Resource &resource)
+{
+	switch (GetUploadPath(resource)) {
+	case UploadPath::NONE:
+		break;
+
+	case UploadPath::SESSION:
+	case UploadPath::CHUNK:
+		/* cancel the session or discard a chunk */
+		handle_delete(w, uri, resource, tree);
+		return;
+
+	default:
+		was_simple_status(w, HTTP_STATUS_FORBIDDEN);
+		return;
+	}
+
+	const auto before = GetUsageBefore(resource);
+	handle_delete(w, uri, resource, tree);
+	UpdateUsage(resource, before);
+	RecordChange(resource, true);
+}
+
+void
+PlainBackend::HandleMkcol(was_simple *w, Resource &resource)
+{
+	switch (GetUploadPath(resource)) {
+	case UploadPath::NONE:
+		break;
+
+	case UploadPath::SESSION:
+		handle_upload_mkcol(w, resource, upload, tree);
+		return;
+
+	default:
+		was_simple_status(w, HTTP_STATUS_FORBIDDEN);
+		return;
+	}
+
+	/* if the collection exists already, MKCOL fails and nothing
+	   changes */
+	const auto before = resource.Exists()
+		? std::nullopt
+		: GetUsageBefore(resource);
+	handle_mkcol(w, resource);
+
+	/* initialize the usage attribute of the new directory */
+	if (before)
+		InitUsage(resource.GetPath(), 0);
+
+	UpdateUsage(resource, before);
+	RecordChange(resource, false);
+}
+
+void
+PlainBackend::HandleCopy(was_simple *w, const Resource &src,
+			 const char *dest_uri, Resource &dest)
+{
+	if (GetUploadPath(src) != UploadPath::NONE ||
+	    GetUploadPath(dest) != UploadPath::NONE) {
+		was_simple_status(w, HTTP_STATUS_FORBIDDEN);
+		return;
+	}
+
+	const auto before = GetUsageBefore(dest);
+	handle_copy(w, src, dest_uri, dest, tree);
+	UpdateUsage(dest, before, &src);
+	RecordChange(dest, true);
+}
+
+void
+PlainBackend::HandleMove(was_simple *w, Resource &src, Resource &dest)
+{
+	if (GetUploadPath(dest) != UploadPath::NONE) {
+		was_simple_status(w, HTTP_STATUS_FORBIDDEN);
+		return;
+	}
+
+	switch (GetUploadPath(src)) {
+	case UploadPath::NONE:
+		break;
+
+	case UploadPath::SESSION:
+	case UploadPath::ASSEMBLE:
+		HandleAssemble(w, src, dest);
+		return;
+
+	default:
+		was_simple_status(w, HTTP_STATUS_FORBIDDEN);
+		return;
+	}
+
+	const auto src_before = GetUsageBefore(src);
+	const auto dest_before = GetUsageBefore(dest);
+	handle_move(w, src, dest);
+
+	/* the usage attributes are moved along with the
+	   directories */
+	UpdateUsage(src, src_before);
+	UpdateUsage(dest, dest_before);
+	RecordChange(src, true);
+	RecordChange(dest, true);
+}
+
+void
+PlainBackend::HandleAssemble(was_simple *w, const Resource &src,
+			     Resource &dest)
+{
+	/* Nextcloud clients move the virtual ".file" inside the
+	   session */
+	const std::string session{GetUploadPath(src) == UploadPath::ASSEMBLE
+		? ParentPath(src.GetPathView())
+		: src.GetPathView()};
+
+	std::optional<uint64_t> available;
+	if (quota.limit > 0)
+		available = GetQuotaAvailable(quota);
+
+	const auto before = GetUsageBefore(dest);
+	handle_upload_move(w, session.c_str(), dest, tree, available);
+	UpdateUsage(dest, before);
+	RecordChange(dest, false);
+}
+
+void
+PlainBackend::HandleReport(was_simple *w, const char *uri,
+			   const Resource &resource)
+{
+	const auto relative = GetRelativePath(resource.GetPathView());
+	if (!journal.IsEnabled() || !relative) {
+		was_simple_status(w, HTTP_STATUS_METHOD_NOT_ALLOWED);
+		return;
+	}
+
+	handle_report(w, uri, resource, *relative, journal, propfind,
+		      compress, etag, quota);
+}
+
 void
 PlainBackend::HandleProppatch(was_simple *w, const char *uri,
 			       Resource &resource)
@@ -71,7 +435,7 @@ PlainBackend::HandleProppatch(was_simple *w, const char *uri,
 
 			times_enabled = true;
 		} else if (prop.IsGetLastModified()) {
-			const auto t = http_date_parse(prop.value.c_str());
+			const auto t = http_date_parse(prop.value.data());
 			if (t < std::chrono::system_clock::time_point()) {
 				prop.status = HTTP_STATUS_BAD_REQUEST;
 				continue;
@@ -83,10 +447,12 @@ PlainBackend::HandleProppatch(was_simple *w, const char *uri,
 		}
 	}
 
-	if (times_enabled)
+	if (times_enabled) {
 		times_status = utimes(resource.GetPath(), times) == 0
 			? HTTP_STATUS_OK
 			: errno_status(errno);
+		RecordChange(resource, false);
+	}
 
 	for (auto &prop : method.GetProps()) {
 		if ((prop.IsGetLastModified() ||
@@ -128,6 +494,7 @@ PlainBackend::HandleLock(was_simple *w, Resource &resource)
 				}
 			} else {
 				created = true;
+				RecordChange(resource, false);
 			}
 		} else if (e == ENOTDIR) {
 			was_simple_status(w, HTTP_STATUS_CONFLICT);
@@ -4,19 +4,50 @@
 
 #pragma once
 
+#include "Compress.hxx"
+#include "ETag.hxx"
+#include "Journal.hxx"
+#include "Usage.hxx"
 #include "file.hxx"
 #include "directory.hxx"
 #include "get.hxx"
 #include "put.hxx"
+#include "upload.hxx"
+#include "UploadSession.hxx"
+#include "post.hxx"
 #include "propfind.hxx"
 #include "proppatch.hxx"
 #include "lock.hxx"
 #include "other.hxx"
 
+#include <optional>
+#include <string>
+
 struct was_simple;
 
+class ContentStore;
+
 class PlainBackend {
-	const char *document_root;
+protected:
+	std::string document_root;
+
+	PropfindConfig propfind;
+
+	CompressConfig compress;
+
+	ETagConfig etag;
+
+	PutConfig put;
+
+	QuotaConfig quota;
+
+	BulkUploadConfig bulk_upload;
+
+	TreeConfig tree;
+
+	UploadConfig upload;
+
+	JournalConfig journal;
 
 public:
 	typedef FileResource Resource;
@@ -24,44 +55,118 @@ public:
 	bool Setup(was_simple *w) noexcept;
 	void TearDown() noexcept {}
 
-	[[gnu::pure]]
-	Resource Map(std::string_view uri) const noexcept;
-
-	void HandleHead(was_simple *w, const Resource &resource) {
-		handle_head(w, resource);
+	/**
+	 * Does this backend reject all methods which modify the
+	 * tree?
+	 */
+	bool IsReadOnly() const noexcept {
+		return false;
 	}
 
-	void HandleGet(was_simple *w, const Resource &resource) {
-		handle_get(w, resource);
+	/**
+	 * Does this site accept POST on collections?
+	 */
+	bool AllowsPost() const noexcept {
+		return bulk_upload.enabled;
 	}
 
-	void HandlePut(was_simple *w, Resource &resource) {
-		handle_put(w, resource);
+	/**
+	 * Does this site support the "sync-collection" REPORT?
+	 */
+	bool AllowsReport() const noexcept {
+		return journal.IsEnabled();
 	}
 
-	void HandleDelete(was_simple *w, Resource &resource) {
-		handle_delete(w, resource);
-	}
+	[[gnu::pure]]
+	Resource Map(std::string_view uri) const noexcept;
+
+	void HandleHead(was_simple *w, const Resource &resource);
+	void HandleGet(was_simple *w, const Resource &resource);
+
+	void HandlePut(was_simple *w, Resource &resource);
+	void HandlePost(was_simple *w, const char *uri, Resource &resource);
+	void HandleDelete(was_simple *w, const char *uri, Resource &resource);
 
 	void HandlePropfind(was_simple *w, const char *uri,
 			    const Resource &resource) {
-		handle_propfind(w, uri, resource);
+		handle_propfind(w, uri, resource, propfind, compress, etag,
+				quota);
 	}
 
+	void HandleReport(was_simple *w, const char *uri,
+			  const Resource &resource);
+
 	void HandleProppatch(was_simple *w, const char *uri,
 			     Resource &resource);
 
-	void HandleMkcol(was_simple *w, Resource &resource) {
-		handle_mkcol(w, resource);
-	}
+	void HandleMkcol(was_simple *w, Resource &resource);
+	void HandleCopy(was_simple *w, const Resource &src,
+			const char *dest_uri, Resource &dest);
+	void HandleMove(was_simple *w, Resource &src, Resource &dest);
 
-	void HandleCopy(was_simple *w, const Resource &src, Resource &dest) {
-		handle_copy(w, src, dest);
-	}
+	void HandleLock(was_simple *w, Resource &resource);
 
-	void HandleMove(was_simple *w, Resource &src, Resource &dest) {
-		handle_move(w, src, dest);
+protected:
+	/**
+	 * @param store if set, then the new file is added to this
+	 * content store
+	 */
+	void HandlePut(was_simple *w, Resource &resource,
+		       const ContentStore *store);
+
+	/**
+	 * Does the resource belong to the upload directory?
+	 */
+	[[gnu::pure]]
+	UploadPath GetUploadPath(const Resource &resource) const noexcept {
+		return upload.IsEnabled()
+			? ClassifyUploadPath(upload.directory,
+					     resource.GetPathView())
+			: UploadPath::NONE;
 	}
 
-	void HandleLock(was_simple *w, Resource &resource);
+	/**
+	 * Convert an absolute path to a path relative to the document
+	 * root (without leading and trailing slashes).
+	 *
+	 * @return std::nullopt if the path is outside of the document
+	 * root
+	 */
+	[[gnu::pure]]
+	std::optional<std::string_view> GetRelativePath(std::string_view path) const noexcept;
+
+	/**
+	 * Append a record about a resource which may have been
+	 * modified by a request to the journal, and update the
+	 * collection tags of its ancestors.
+	 *
+	 * @param tree if the resource is now a directory, then all of
+	 * its members may have changed, too
+	 */
+	void RecordChange(const Resource &resource, bool tree) const noexcept;
+
+	/**
+	 * Move an upload session to its destination.
+	 */
+	void HandleAssemble(was_simple *w, const Resource &src,
+			    Resource &dest);
+
+	/**
+	 * Determine the usage of a resource before it gets modified.
+	 */
+	std::optional<uint64_t> GetUsageBefore(const Resource &resource) const noexcept;
+
+	/**
+	 * Update the usage accounting of the resource's ancestors
+	 * after it has been modified.  This only applies the delta;
+	 * trees are never scanned, and resources whose usage is
+	 * unknown are skipped.
+	 *
+	 * @param before the return value of GetUsageBefore()
+	 * @param source if the resource is a copy, then this is the
+	 * original, whose usage a copied collection inherits
+	 */
+	void UpdateUsage(const Resource &resource,
+			 std::optional<uint64_t> before,
+			 const Resource *source=nullptr) const noexcept;
 };
@@ -0,0 +1,344 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * A cache for rendered PROPFIND responses.
+ */
+
+#include "PropfindCache.hxx"
+#include "system/Error.hxx"
+
+#include <was/simple.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+static constexpr uint32_t WATCH_MASK =
+	IN_ATTRIB|IN_CREATE|IN_DELETE|IN_DELETE_SELF|
+	IN_MODIFY|IN_CLOSE_WRITE|IN_MOVED_FROM|IN_MOVED_TO|IN_MOVE_SELF|
+	IN_ONLYDIR;
+
+static UniqueFileDescriptor
+OpenInotify()
+{
+	int fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (fd < 0)
+		throw MakeErrno("inotify_init1() failed");
+
+	return UniqueFileDescriptor{fd};
+}
+
+PropfindCache::PropfindCache(std::size_t _max_size)
+	:max_size(_max_size), inotify_fd(OpenInotify())
+{
+}
+
+PropfindCache::~PropfindCache() noexcept = default;
+
+void
+PropfindCache::Erase(std::list<Entry>::iterator i) noexcept
+{
+	for (const int wd : i->watches) {
+		auto w = watches.find(wd);
+		assert(w != watches.end());
+
+		auto &e = w->second.entries;
+		e.erase(std::find(e.begin(), e.end(), &*i));
+		Unref(wd, w->second);
+	}
+
+	size -= i->GetSize();
+	map.erase(i->key);
+	entries.erase(i);
+}
+
+void
+PropfindCache::Clear() noexcept
+{
+	while (!entries.empty())
+		Erase(std::prev(entries.end()));
+}
+
+void
+PropfindCache::Invalidate(Watch &watch) noexcept
+{
+	watch.last_event = event_sequence;
+
+	/* copy the list, because Erase() modifies it (and may even
+	   destroy the #Watch if there are no recorders) */
+	const auto e = watch.entries;
+	for (Entry *entry : e)
+		Erase(map.find(entry->key)->second);
+}
+
+void
+PropfindCache::Drain() noexcept
+{
+	alignas(struct inotify_event) std::byte buffer[4096];
+
+	while (true) {
+		ssize_t nbytes = inotify_fd.Read(std::span{buffer});
+		if (nbytes <= 0)
+			break;
+
+		for (std::size_t position = 0; position < std::size_t(nbytes);) {
+			const auto &event = *reinterpret_cast<const struct inotify_event *>(buffer + position);
+			position += sizeof(event) + event.len;
+
+			++event_sequence;
+
+			if (event.mask & IN_Q_OVERFLOW) {
+				/* events were lost; we can't know
+				   which entries are stale */
+				overflow_sequence = event_sequence;
+				Clear();
+				continue;
+			}
+
+			auto i = watches.find(event.wd);
+			if (i == watches.end())
+				continue;
+
+			Invalidate(i->second);
+		}
+	}
+}
+
+int
+PropfindCache::AddWatch(const char *path) noexcept
+{
+	const int wd = inotify_add_watch(inotify_fd.Get(), path, WATCH_MASK);
+	if (wd < 0)
+		return -1;
+
+	++watches[wd].recorders;
+	return wd;
+}
+
+void
+PropfindCache::Unref(int wd, Watch &watch) noexcept
+{
+	if (watch.recorders > 0 || !watch.entries.empty())
+		return;
+
+	inotify_rm_watch(inotify_fd.Get(), wd);
+	watches.erase(wd);
+}
+
+void
+PropfindCache::Unref(int wd) noexcept
+{
+	auto i = watches.find(wd);
+	assert(i != watches.end());
+	assert(i->second.recorders > 0);
+
+	--i->second.recorders;
+	Unref(wd, i->second);
+}
+
+inline void
+PropfindCache::SubmitMetrics(was_simple *w, bool hit) noexcept
+{
+	was_simple_metric(w, "davos_propfind_cache_hit", hit);
+	was_simple_metric(w, "davos_propfind_cache_hits", hits);
+	was_simple_metric(w, "davos_propfind_cache_misses", misses);
+	was_simple_metric(w, "davos_propfind_cache_bytes", size);
+}
+
+bool
+PropfindCache::Send(was_simple *w, std::string_view key)
+{
+	std::shared_ptr<const Response> response;
+
+	{
+		const std::scoped_lock lock{mutex};
+		Drain();
+
+		auto i = map.find(key);
+		if (i == map.end()) {
+			++misses;
+			SubmitMetrics(w, false);
+			return false;
+		}
+
+		/* move to the front of the LRU list */
+		entries.splice(entries.begin(), entries, i->second);
+
+		response = i->second->response;
+		++hits;
+		SubmitMetrics(w, true);
+	}
+
+	if (!was_simple_status(w, HTTP_STATUS_MULTI_STATUS) ||
+	    !was_simple_set_header(w, "content-type",
+				   "text/xml; charset=\"utf-8\""))
+		return true;
+
+	if (!response->continuation.empty() &&
+	    !was_simple_set_header(w, "davos-continuation",
+				   response->continuation.c_str()))
+		return true;
+
+	if (response->vary &&
+	    !was_simple_set_header(w, "vary", "accept-encoding"))
+		return true;
+
+	if (response->encoding != ContentEncoding::IDENTITY &&
+	    !was_simple_set_header(w, "content-encoding",
+				   std::string{ToString(response->encoding)}.c_str()))
+		return true;
+
+	/* the whole body goes to the pipe in one write() */
+	if (was_simple_set_length(w, response->body.size()))
+		was_simple_write(w, response->body.data(),
+				 response->body.size());
+	return true;
+}
+
+void
+PropfindCache::Store(Recorder &recorder, ContentEncoding encoding, bool vary,
+		     std::string_view continuation) noexcept
+{
+	const std::scoped_lock lock{mutex};
+
+	/* pick up events which occurred while the response was being
+	   generated */
+	Drain();
+
+	if (overflow_sequence > recorder.start_sequence)
+		return;
+
+	for (const auto &i : recorder.watches)
+		if (watches[i.wd].last_event > i.sequence)
+			return;
+
+	if (map.contains(recorder.key))
+		/* another thread was faster */
+		return;
+
+	auto response = std::make_shared<Response>();
+	response->body = std::move(recorder.body);
+	response->encoding = encoding;
+	response->vary = vary;
+	response->continuation = continuation;
+
+	auto &entry = entries.emplace_front();
+	entry.key = std::move(recorder.key);
+	entry.response = std::move(response);
+
+	for (const auto &i : recorder.watches) {
+		if (std::find(entry.watches.begin(), entry.watches.end(),
+			      i.wd) != entry.watches.end())
+			continue;
+
+		entry.watches.push_back(i.wd);
+		watches[i.wd].entries.push_back(&entry);
+	}
+
+	map.emplace(entry.key, entries.begin());
+	size += entry.GetSize();
+
+	/* evict the least recently used entries, but never the new
+	   one */
+	while (size > max_size && std::next(entries.begin()) != entries.end())
+		Erase(std::prev(entries.end()));
+}
+
+PropfindCache::Recorder::Recorder(PropfindCache &_cache, OutputStream &_next,
+				  std::string &&_key) noexcept
+	:cache(_cache), next(_next), key(std::move(_key)),
+	 start_sequence(cache.GetEventSequence())
+{
+}
+
+PropfindCache::Recorder::~Recorder() noexcept
+{
+	if (watches.empty())
+		return;
+
+	const std::scoped_lock lock{cache.mutex};
+	for (const auto &i : watches)
+		cache.Unref(i.wd);
+}
+
+void
+PropfindCache::Recorder::WatchDirectory(const char *path,
+					const struct statx &st) noexcept
+{
+	if (!valid)
+		return;
+
+	{
+		const std::scoped_lock lock{cache.mutex};
+		cache.Drain();
+
+		const int wd = cache.AddWatch(path);
+		if (wd < 0) {
+			valid = false;
+			return;
+		}
+
+		watches.push_back({wd, cache.event_sequence});
+	}
+
+	/* the watch was established after the collection was
+	   stat()ed; if it was modified in between, the response may
+	   contain stale data which no event will ever invalidate */
+	struct statx st2;
+	if (statx(-1, path, AT_STATX_SYNC_AS_STAT,
+		  STATX_INO|STATX_MTIME|STATX_CTIME, &st2) < 0 ||
+	    st2.stx_ino != st.stx_ino ||
+	    st2.stx_mtime.tv_sec != st.stx_mtime.tv_sec ||
+	    st2.stx_mtime.tv_nsec != st.stx_mtime.tv_nsec ||
+	    st2.stx_ctime.tv_sec != st.stx_ctime.tv_sec ||
+	    st2.stx_ctime.tv_nsec != st.stx_ctime.tv_nsec)
+		valid = false;
+}
+
+void
+PropfindCache::Recorder::Commit(ContentEncoding encoding, bool vary,
+				std::string_view continuation) noexcept
+{
+	if (valid)
+		cache.Store(*this, encoding, vary, continuation);
+}
+
+void
+PropfindCache::Recorder::Write(std::span<const std::byte> src)
+{
+	if (valid) {
+		if (body.size() + src.size() <= cache.max_size / 8)
+			body.append(reinterpret_cast<const char *>(src.data()),
+				    src.size());
+		else {
+			/* too large for the cache */
+			valid = false;
+			body = {};
+		}
+	}
+
+	next.Write(src);
+}
+
+static PropfindCache *propfind_cache;
+
+void
+SetupPropfindCache(std::size_t max_size)
+{
+	assert(propfind_cache == nullptr);
+
+	if (max_size > 0)
+		propfind_cache = new PropfindCache(max_size);
+}
+
+PropfindCache *
+GetPropfindCache() noexcept
+{
+	return propfind_cache;
+}
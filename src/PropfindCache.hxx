@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * A cache for rendered PROPFIND responses.
+ */
+
+#pragma once
+
+#include "AcceptEncoding.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "io/OutputStream.hxx"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct was_simple;
+
+/**
+ * A cache for rendered (and possibly compressed) multistatus bodies.
+ * Clients like the Windows mini-redirector repeat the same PROPFIND
+ * every few seconds; this cache allows answering it without reading
+ * the directory again.
+ *
+ * Each cached response depends on a set of inotify watches, one for
+ * each collection listed or reported in it.  Any event on one of
+ * those watches (e.g. a file created, deleted, modified or touched)
+ * invalidates the response.  Since inotify events are generated
+ * synchronously, draining the inotify queue at the start of each
+ * request is enough to never serve stale data.
+ *
+ * One instance is shared by all threads.
+ */
+class PropfindCache {
+	struct Response {
+		std::string body;
+
+		/**
+		 * The Content-Encoding of the body.
+		 */
+		ContentEncoding encoding;
+
+		/**
+		 * Was "Vary: accept-encoding" sent?
+		 */
+		bool vary;
+
+		/**
+		 * The "Davos-Continuation" response header (or empty).
+		 */
+		std::string continuation;
+	};
+
+	struct Entry {
+		std::string key;
+
+		std::shared_ptr<const Response> response;
+
+		/**
+		 * The inotify watch descriptors this response depends
+		 * on.
+		 */
+		std::vector<int> watches;
+
+		std::size_t GetSize() const noexcept {
+			return key.size() + response->body.size() +
+				response->continuation.size() +
+				watches.size() * sizeof(int) + sizeof(*this);
+		}
+	};
+
+	struct Watch {
+		/**
+		 * The event sequence number of the last event on this
+		 * watch.
+		 */
+		uint64_t last_event = 0;
+
+		/**
+		 * The number of #Recorder instances using this watch.
+		 */
+		unsigned recorders = 0;
+
+		std::vector<Entry *> entries;
+	};
+
+	const std::size_t max_size;
+
+	std::mutex mutex;
+
+	const UniqueFileDescriptor inotify_fd;
+
+	/**
+	 * Incremented for each inotify event.
+	 */
+	uint64_t event_sequence = 0;
+
+	/**
+	 * The #event_sequence of the last queue overflow, which
+	 * invalidates everything.
+	 */
+	uint64_t overflow_sequence = 0;
+
+	/**
+	 * All entries; the most recently used one is at the front.
+	 */
+	std::list<Entry> entries;
+
+	std::unordered_map<std::string_view, std::list<Entry>::iterator> map;
+
+	std::unordered_map<int, Watch> watches;
+
+	std::size_t size = 0;
+
+	uint64_t hits = 0, misses = 0;
+
+public:
+	class Recorder;
+
+	/**
+	 * Throws on error.
+	 *
+	 * @param _max_size the memory budget in bytes
+	 */
+	explicit PropfindCache(std::size_t _max_size);
+	~PropfindCache() noexcept;
+
+	PropfindCache(const PropfindCache &) = delete;
+	PropfindCache &operator=(const PropfindCache &) = delete;
+
+	/**
+	 * Look up a response and send it if it was found.
+	 *
+	 * @return true if the response was sent (or sending failed),
+	 * false on cache miss
+	 */
+	bool Send(was_simple *w, std::string_view key);
+
+private:
+	/**
+	 * Process all pending inotify events.  Caller must hold the
+	 * mutex.
+	 */
+	void Drain() noexcept;
+
+	void Invalidate(Watch &watch) noexcept;
+	void Erase(std::list<Entry>::iterator i) noexcept;
+	void Clear() noexcept;
+
+	int AddWatch(const char *path) noexcept;
+	void Unref(int wd, Watch &watch) noexcept;
+	void Unref(int wd) noexcept;
+
+	void Store(Recorder &recorder, ContentEncoding encoding, bool vary,
+		   std::string_view continuation) noexcept;
+
+	void SubmitMetrics(was_simple *w, bool hit) noexcept;
+
+	uint64_t GetEventSequence() noexcept {
+		const std::scoped_lock lock{mutex};
+		return event_sequence;
+	}
+};
+
+/**
+ * Records a response while it is being generated and sent to the
+ * client, and the collections it depends on.  It is inserted into the
+ * #OutputStream chain after the compressor, so the cache receives the
+ * encoded body.
+ */
+class PropfindCache::Recorder final : public OutputStream {
+	PropfindCache &cache;
+	OutputStream &next;
+
+	std::string key;
+
+	std::string body;
+
+	struct WatchRef {
+		int wd;
+		uint64_t sequence;
+	};
+
+	std::vector<WatchRef> watches;
+
+	/**
+	 * The #event_sequence when recording started.
+	 */
+	const uint64_t start_sequence;
+
+	/**
+	 * Set to false if the response cannot be cached.
+	 */
+	bool valid = true;
+
+public:
+	Recorder(PropfindCache &_cache, OutputStream &_next,
+		 std::string &&_key) noexcept;
+	~Recorder() noexcept;
+
+	/**
+	 * Watch a collection whose properties or members are part of
+	 * this response.  Call this before reading the directory.
+	 *
+	 * @param st the status of the collection as it is reported
+	 * in the response; if it was modified meanwhile, the response
+	 * is not cached
+	 */
+	void WatchDirectory(const char *path, const struct statx &st) noexcept;
+
+	/**
+	 * The response is complete; store it in the cache.
+	 */
+	void Commit(ContentEncoding encoding, bool vary,
+		    std::string_view continuation) noexcept;
+
+	/* virtual methods from class OutputStream */
+	void Write(std::span<const std::byte> src) override;
+
+private:
+	friend class PropfindCache;
+};
+
+/**
+ * Create the process-wide #PropfindCache instance.  Throws on error.
+ */
+void
+SetupPropfindCache(std::size_t max_size);
+
+/**
+ * @return the process-wide #PropfindCache instance or nullptr if the
+ * cache is disabled
+ */
+[[gnu::pure]]
+PropfindCache *
+GetPropfindCache() noexcept;
@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Quality of service.
+ */
+
+#include "Qos.hxx"
+#include "Parameter.hxx"
+
+#include <was/simple.h>
+
+#include <thread>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/ioprio.h>
+
+static bool
+GetBulkPriorityParameter(was_simple *w, const char *name,
+			 BulkPriority &value) noexcept
+{
+	const char *p = was_simple_get_parameter(w, name);
+	if (p == nullptr)
+		return true;
+
+	if (strcmp(p, "normal") == 0)
+		value = BulkPriority::NORMAL;
+	else if (strcmp(p, "low") == 0)
+		value = BulkPriority::LOW;
+	else if (strcmp(p, "idle") == 0)
+		value = BulkPriority::IDLE;
+	else {
+		fprintf(stderr, "Malformed %s\n", name);
+		return false;
+	}
+
+	return true;
+}
+
+bool
+QosConfig::Setup(was_simple *w) noexcept
+{
+	uint64_t rate = 0;
+	if (!GetUnsignedParameter(w, "DAVOS_QOS_RATE", rate))
+		return false;
+
+	/* the per-method limits override the general one */
+	get_rate = put_rate = post_rate = rate;
+
+	return GetUnsignedParameter(w, "DAVOS_QOS_RATE_GET", get_rate) &&
+		GetUnsignedParameter(w, "DAVOS_QOS_RATE_PUT", put_rate) &&
+		GetUnsignedParameter(w, "DAVOS_QOS_RATE_POST", post_rate) &&
+		GetUnsignedParameter(w, "DAVOS_QOS_BULK_SIZE", bulk_size) &&
+		GetBulkPriorityParameter(w, "DAVOS_QOS_BULK_IOPRIO", bulk_priority);
+}
+
+std::size_t
+TokenBucket::GetChunkSize(uint64_t rate) noexcept
+{
+	/* about 16 delays per second */
+	return std::clamp<uint64_t>(rate / 16, 16 * 1024, 1024 * 1024);
+}
+
+TokenBucket::TokenBucket(uint64_t _rate, Clock::time_point now) noexcept
+	:rate(_rate), burst(GetChunkSize(_rate)),
+	 tokens(burst), last(now) {}
+
+TokenBucket::Clock::duration
+TokenBucket::Consume(std::size_t nbytes, Clock::time_point now) noexcept
+{
+	const std::chrono::duration<double> elapsed = now - last;
+	last = now;
+
+	tokens = std::min(tokens + elapsed.count() * rate, burst) - nbytes;
+	if (tokens >= 0)
+		return {};
+
+	return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(-tokens / rate));
+}
+
+static thread_local QosScope *current_qos_scope;
+
+QosScope *
+GetQosScope() noexcept
+{
+	return current_qos_scope;
+}
+
+[[gnu::pure]]
+static uint64_t
+GetRate(const QosConfig &config, http_method_t method) noexcept
+{
+	switch (method) {
+	case HTTP_METHOD_GET:
+		return config.get_rate;
+
+	case HTTP_METHOD_PUT:
+		return config.put_rate;
+
+	case HTTP_METHOD_POST:
+		return config.post_rate;
+
+	default:
+		return 0;
+	}
+}
+
+QosScope::QosScope(was_simple &_w, const QosConfig &_config) noexcept
+	:w(_w), config(_config)
+{
+	if (const auto rate = GetRate(config, was_simple_get_method(&w));
+	    rate > 0) {
+		bucket.emplace(rate, TokenBucket::Clock::now());
+		chunk_size = TokenBucket::GetChunkSize(rate);
+	}
+
+	current_qos_scope = this;
+}
+
+static int
+ioprio_get() noexcept
+{
+	return syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+}
+
+static int
+ioprio_set(int value) noexcept
+{
+	return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, value);
+}
+
+QosScope::~QosScope() noexcept
+{
+	current_qos_scope = nullptr;
+
+	if (old_priority >= 0)
+		ioprio_set(old_priority);
+
+	if (throttled > TokenBucket::Clock::duration{})
+		was_simple_metric(&w, "davos_throttled_seconds",
+				  std::chrono::duration<float>(throttled).count());
+}
+
+void
+QosScope::Bulk(uint64_t size) noexcept
+{
+	if (size < config.bulk_size ||
+	    config.bulk_priority == BulkPriority::NORMAL ||
+	    old_priority >= 0)
+		return;
+
+	const int old = ioprio_get();
+	if (old < 0)
+		return;
+
+	/* with IOPRIO_WHO_PROCESS, 0 is the calling thread */
+	if (ioprio_set(config.bulk_priority == BulkPriority::IDLE
+		       ? IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)
+		       : IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 7)) < 0)
+		return;
+
+	old_priority = old;
+	was_simple_metric(&w, "davos_bulk", 1);
+}
+
+void
+QosScope::Sleep(TokenBucket::Clock::duration d) noexcept
+{
+	if (d <= TokenBucket::Clock::duration{})
+		return;
+
+	std::this_thread::sleep_for(d);
+	throttled += d;
+}
@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Quality of service: rate limits for request and response bodies,
+ * and a lower I/O priority for bulk operations.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+struct was_simple;
+
+enum class BulkPriority : uint8_t {
+	/**
+	 * Don't change the I/O priority.
+	 */
+	NORMAL,
+
+	/**
+	 * The lowest level of the "best effort" class.
+	 */
+	LOW,
+
+	/**
+	 * The "idle" class: only use the disk when nobody else
+	 * does.
+	 */
+	IDLE,
+};
+
+struct QosConfig {
+	/**
+	 * The maximum number of bytes per second of GET response
+	 * bodies and of PUT and POST request bodies; 0 means
+	 * unlimited.
+	 */
+	uint64_t get_rate = 0, put_rate = 0, post_rate = 0;
+
+	/**
+	 * Transfers of at least this many bytes are bulk operations,
+	 * and so are COPY and DELETE of collections.
+	 */
+	uint64_t bulk_size = 64 * 1024 * 1024;
+
+	BulkPriority bulk_priority = BulkPriority::LOW;
+
+	/**
+	 * Parse the WAS parameters.
+	 *
+	 * @return false on error (after printing an error message)
+	 */
+	bool Setup(was_simple *w) noexcept;
+};
+
+/**
+ * A token bucket which accumulates debt: a transfer may always
+ * proceed, and the caller then waits until the bucket has refilled.
+ */
+class TokenBucket {
+public:
+	using Clock = std::chrono::steady_clock;
+
+private:
+	/**
+	 * Bytes per second.
+	 */
+	const double rate;
+
+	/**
+	 * The capacity in bytes.
+	 */
+	const double burst;
+
+	double tokens;
+
+	Clock::time_point last;
+
+public:
+	TokenBucket(uint64_t _rate, Clock::time_point now) noexcept;
+
+	/**
+	 * The size of one transfer chunk: small enough that the
+	 * delays are short, but large enough to keep the number of
+	 * system calls low.  This is also the capacity of the
+	 * bucket.
+	 */
+	[[gnu::pure]]
+	static std::size_t GetChunkSize(uint64_t rate) noexcept;
+
+	/**
+	 * Take tokens for a completed transfer.
+	 *
+	 * @return how long to wait before the next transfer
+	 */
+	Clock::duration Consume(std::size_t nbytes, Clock::time_point now) noexcept;
+};
+
+/**
+ * Applies the #QosConfig to the current request while it is in
+ * scope.  The transfer functions find it with GetQosScope().
+ */
+class QosScope {
+	was_simple &w;
+
+	const QosConfig &config;
+
+	std::optional<TokenBucket> bucket;
+
+	std::size_t chunk_size;
+
+	/**
+	 * The total time this request was delayed by the rate limit.
+	 */
+	TokenBucket::Clock::duration throttled{};
+
+	/**
+	 * The I/O priority before this request was switched to
+	 * #QosConfig::bulk_priority, or -1 if it was not switched.
+	 */
+	int old_priority = -1;
+
+public:
+	QosScope(was_simple &_w, const QosConfig &_config) noexcept;
+	~QosScope() noexcept;
+
+	QosScope(const QosScope &) = delete;
+	QosScope &operator=(const QosScope &) = delete;
+
+	/**
+	 * Is the body of this request rate-limited?
+	 */
+	bool IsThrottled() const noexcept {
+		return bucket.has_value();
+	}
+
+	/**
+	 * The maximum size of one transfer chunk.
+	 */
+	std::size_t GetChunkSize(std::size_t max) const noexcept {
+		return bucket ? std::min(chunk_size, max) : max;
+	}
+
+	/**
+	 * Account for transferred body data, and sleep if the rate
+	 * limit has been exceeded.
+	 */
+	void Throttle(std::size_t nbytes) noexcept {
+		if (bucket)
+			Sleep(bucket->Consume(nbytes, TokenBucket::Clock::now()));
+	}
+
+	/**
+	 * Announce an operation on the given number of bytes (or on
+	 * a directory tree, which is always considered bulk).  If it
+	 * is large, switch to #QosConfig::bulk_priority for the rest
+	 * of this request.  Threads created after this call inherit
+	 * the priority.
+	 */
+	void Bulk(uint64_t size=UINT64_MAX) noexcept;
+
+private:
+	void Sleep(TokenBucket::Clock::duration d) noexcept;
+};
+
+/**
+ * @return the #QosScope of the request being handled by this
+ * thread, or nullptr
+ */
+[[gnu::pure]]
+QosScope *
+GetQosScope() noexcept;
@@ -0,0 +1,535 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Replay a trace recorded with DAVOS_TRACE: launch davos-plain with
+ * a Multi-WAS socket, synthesize a tree which contains all resources
+ * referred to by the trace, send the requests at the original (or
+ * an accelerated) pace and report the latencies per method.
+ */
+
+#include "Trace.hxx"
+#include "WasClient.hxx"
+#include "util.hxx"
+#include "system/Error.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/LightString.hxx"
+#include "util/PrintException.hxx"
+#include "util/StringCompare.hxx"
+#include "util/UriEscape.hxx"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using std::string_view_literals::operator""sv;
+
+struct ReplayOptions {
+	std::vector<WasClientRequest::Pair> parameters;
+
+	/**
+	 * The pace of the replay relative to the original; 0 means
+	 * as fast as possible.
+	 */
+	double speed = 1;
+
+	/**
+	 * The size of synthesized files whose size is not known from
+	 * a PUT in the trace.
+	 */
+	uint64_t file_size = 65536;
+};
+
+[[gnu::const]]
+static const char *
+MethodName(http_method_t method) noexcept
+{
+	switch (method) {
+	case HTTP_METHOD_HEAD: return "HEAD";
+	case HTTP_METHOD_GET: return "GET";
+	case HTTP_METHOD_POST: return "POST";
+	case HTTP_METHOD_PUT: return "PUT";
+	case HTTP_METHOD_DELETE: return "DELETE";
+	case HTTP_METHOD_OPTIONS: return "OPTIONS";
+	case HTTP_METHOD_PROPFIND: return "PROPFIND";
+	case HTTP_METHOD_PROPPATCH: return "PROPPATCH";
+	case HTTP_METHOD_MKCOL: return "MKCOL";
+	case HTTP_METHOD_COPY: return "COPY";
+	case HTTP_METHOD_MOVE: return "MOVE";
+	case HTTP_METHOD_LOCK: return "LOCK";
+	case HTTP_METHOD_UNLOCK: return "UNLOCK";
+	case HTTP_METHOD_REPORT: return "REPORT";
+	default: return "other";
+	}
+}
+
+/**
+ * Convert a request URI (or a "Destination" header) to a path
+ * relative to the document root, assuming DAVOS_MOUNT is "/".
+ *
+ * @return an empty string if the URI is unusable
+ */
+static std::string
+UriToRelativePath(std::string_view uri)
+{
+	if (SkipPrefix(uri, "http://"sv) || SkipPrefix(uri, "https://"sv)) {
+		const auto slash = uri.find('/');
+		uri = slash == uri.npos ? "/"sv : uri.substr(slash);
+	}
+
+	uri = uri.substr(0, uri.find('?'));
+
+	const LightString unescaped = UriUnescape(std::string{uri}.c_str());
+	if (unescaped.IsNull())
+		return {};
+
+	std::string_view path = unescaped.c_str();
+	if (HasDotDotSegment(path) || path.starts_with("../"sv))
+		return {};
+
+	while (path.starts_with('/'))
+		path.remove_prefix(1);
+
+	return std::string{path};
+}
+
+/**
+ * File contents and request bodies.
+ */
+static constexpr auto fill_data = []{
+	std::array<char, 65536> a;
+	a.fill('x');
+	return a;
+}();
+
+static constexpr std::array<char, 65536> fill_zeroes{};
+
+/**
+ * Add all ancestors of the given path to the set.
+ */
+static void
+AddAncestors(std::set<std::string> &directories, std::string_view path)
+{
+	for (auto slash = path.find('/'); slash != path.npos;
+	     slash = path.find('/', slash + 1))
+		if (slash > 0)
+			directories.emplace(path.substr(0, slash));
+}
+
+static void
+CreateFile(const std::string &path, uint64_t size)
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open(path.c_str(), O_CREAT|O_EXCL|O_WRONLY, 0644)) {
+		if (errno == EEXIST)
+			return;
+
+		throw MakeErrno("Failed to create file");
+	}
+
+	/* real data (not a sparse file), so reading it costs what
+	   it costs in production */
+	while (size > 0) {
+		const std::size_t n = std::min<uint64_t>(size, fill_data.size());
+		if (fd.Write(std::as_bytes(std::span{fill_data}.first(n))) != ssize_t(n))
+			throw MakeErrno("Failed to write file");
+
+		size -= n;
+	}
+}
+
+/**
+ * Create the directories and files the trace refers to; existing
+ * ones are kept.
+ */
+static void
+SynthesizeTree(const char *root, std::span<const TraceRecord> records,
+	       const ReplayOptions &options)
+{
+	std::set<std::string> directories;
+	std::map<std::string, uint64_t> files;
+
+	for (const auto &i : records) {
+		auto path = UriToRelativePath(i.uri);
+		if (path.empty())
+			continue;
+
+		AddAncestors(directories, path);
+
+		for (const auto &h : i.headers)
+			if (h.name == "destination"sv)
+				AddAncestors(directories,
+					     UriToRelativePath(h.value));
+
+		if (path.ends_with('/')) {
+			path.pop_back();
+
+			/* MKCOL needs a new name */
+			if (i.method != HTTP_METHOD_MKCOL)
+				directories.emplace(path);
+		} else if (i.method == HTTP_METHOD_PUT && i.body_length >= 0) {
+			auto &size = files[path];
+			size = std::max<uint64_t>(size, i.body_length);
+		} else if (i.method != HTTP_METHOD_MKCOL)
+			files.try_emplace(path, options.file_size);
+	}
+
+	/* the set is sorted, so parents are created first */
+	for (const auto &i : directories) {
+		const auto path = std::string{root} + "/" + i;
+		if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST)
+			throw MakeErrno("Failed to create directory");
+	}
+
+	for (const auto &[name, size] : files)
+		if (!directories.contains(name))
+			CreateFile(std::string{root} + "/" + name, size);
+}
+
+/**
+ * Request bodies are not recorded; these are sent instead.
+ */
+static constexpr std::string_view propfind_body =
+	R"(<?xml version="1.0" encoding="utf-8"?>)"
+	R"(<D:propfind xmlns:D="DAV:"><D:allprop/></D:propfind>)";
+
+static constexpr std::string_view proppatch_body =
+	R"(<?xml version="1.0" encoding="utf-8"?>)"
+	R"(<D:propertyupdate xmlns:D="DAV:"><D:set><D:prop>)"
+	R"(<D:getlastmodified>Thu, 01 Jan 2015 00:00:00 GMT</D:getlastmodified>)"
+	R"(</D:prop></D:set></D:propertyupdate>)";
+
+static constexpr std::string_view lock_body =
+	R"(<?xml version="1.0" encoding="utf-8"?>)"
+	R"(<D:lockinfo xmlns:D="DAV:"><D:lockscope><D:exclusive/></D:lockscope>)"
+	R"(<D:locktype><D:write/></D:locktype>)"
+	R"(<D:owner><D:href>davos-replay</D:href></D:owner></D:lockinfo>)";
+
+static constexpr std::string_view report_body =
+	R"(<?xml version="1.0" encoding="utf-8"?>)"
+	R"(<D:sync-collection xmlns:D="DAV:"><D:sync-token/>)"
+	R"(<D:sync-level>1</D:sync-level><D:prop><D:getetag/></D:prop></D:sync-collection>)";
+
+static void
+SetBody(WasClientRequest &request, const TraceRecord &record,
+	const ReplayOptions &options) noexcept
+{
+	if (!record.has_body)
+		return;
+
+	switch (record.method) {
+	case HTTP_METHOD_PROPFIND:
+		request.body_pattern = propfind_body;
+		break;
+
+	case HTTP_METHOD_PROPPATCH:
+		request.body_pattern = proppatch_body;
+		break;
+
+	case HTTP_METHOD_LOCK:
+		request.body_pattern = lock_body;
+		break;
+
+	case HTTP_METHOD_REPORT:
+		request.body_pattern = report_body;
+		break;
+
+	case HTTP_METHOD_POST:
+		/* null blocks mark the end of a tar archive, so this
+		   is an empty bulk upload */
+		request.body_pattern = {fill_zeroes.data(), fill_zeroes.size()};
+		request.body_length = std::max<uint64_t>((record.body_length + 511) / 512 * 512,
+							 1024);
+		return;
+
+	default:
+		request.body_pattern = {fill_data.data(), fill_data.size()};
+		request.body_length = record.body_length >= 0
+			? uint64_t(record.body_length)
+			: options.file_size;
+		return;
+	}
+
+	request.body_length = request.body_pattern.size();
+}
+
+struct Sample {
+	http_method_t method;
+
+	/**
+	 * 0 if the request failed.
+	 */
+	http_status_t status;
+
+	/**
+	 * The latency of the replayed request and of the original
+	 * one in microseconds.
+	 */
+	uint64_t latency, original;
+};
+
+/**
+ * Replay the requests of one connection in the trace over one WAS
+ * connection.
+ */
+static void
+ReplayConnection(MultiWasSocket &socket, std::mutex &socket_mutex,
+		 std::span<const TraceRecord *const> records,
+		 uint64_t trace_start,
+		 std::chrono::steady_clock::time_point replay_start,
+		 const ReplayOptions &options,
+		 std::vector<Sample> &samples)
+try {
+	WasConnectionFds peer;
+	WasClient client{peer};
+
+	{
+		const std::scoped_lock lock{socket_mutex};
+		socket.Send(peer);
+	}
+
+	/* close our copies, or davos wouldn't notice when we're
+	   done */
+	peer = {};
+
+	for (const auto *record : records) {
+		if (options.speed > 0)
+			std::this_thread::sleep_until(replay_start +
+						      std::chrono::microseconds(uint64_t((record->start - trace_start) / options.speed)));
+
+		std::vector<WasClientRequest::Pair> headers;
+		for (const auto &h : record->headers)
+			headers.emplace_back(h.name, h.value);
+
+		WasClientRequest request{
+			.method = record->method,
+			.uri = record->uri,
+			.headers = headers,
+			.parameters = options.parameters,
+			.body_pattern = {},
+			.body_length = std::nullopt,
+		};
+		SetBody(request, *record, options);
+
+		Sample sample{record->method, HTTP_STATUS_OK, 0, record->duration};
+
+		const auto start = std::chrono::steady_clock::now();
+
+		try {
+			sample.status = client.Request(request).status;
+		} catch (...) {
+			PrintException(std::current_exception());
+			sample.status = {};
+		}
+
+		sample.latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		samples.push_back(sample);
+
+		if (sample.status == http_status_t{})
+			/* the connection is broken */
+			break;
+	}
+} catch (...) {
+	PrintException(std::current_exception());
+}
+
+static UniqueFileDescriptor
+LaunchDavos(const char *program)
+{
+	int fds[2];
+	if (socketpair(AF_LOCAL, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, fds) < 0)
+		throw MakeErrno("socketpair() failed");
+
+	UniqueFileDescriptor socket{fds[0]}, child_socket{fds[1]};
+
+	const pid_t pid = fork();
+	if (pid < 0)
+		throw MakeErrno("fork() failed");
+
+	if (pid == 0) {
+		/* davos detects the Multi-WAS socket on stdin */
+		dup2(child_socket.Get(), STDIN_FILENO);
+		execl(program, program, nullptr);
+		perror("Failed to execute davos");
+		_exit(EXIT_FAILURE);
+	}
+
+	return socket;
+}
+
+[[gnu::pure]]
+static double
+Percentile(std::span<const uint64_t> sorted, double q) noexcept
+{
+	const std::size_t i = std::min<std::size_t>(sorted.size() * q,
+						    sorted.size() - 1);
+	return sorted[i] / 1000.;
+}
+
+static void
+PrintReport(std::span<const Sample> samples)
+{
+	std::map<std::string_view, std::vector<const Sample *>> by_method;
+	for (const auto &i : samples)
+		by_method[MethodName(i.method)].push_back(&i);
+
+	printf("%-10s %7s %6s %6s %6s %6s %6s %9s %9s %9s %9s %9s %9s\n",
+	       "method", "count", "2xx", "3xx", "4xx", "5xx", "failed",
+	       "p50 ms", "p90 ms", "p99 ms", "max ms",
+	       "orig p50", "orig p99");
+
+	for (const auto &[method, list] : by_method) {
+		unsigned classes[6]{};
+		std::vector<uint64_t> latency, original;
+
+		for (const auto *i : list) {
+			++classes[std::min<unsigned>(i->status / 100, 5)];
+			latency.push_back(i->latency);
+			original.push_back(i->original);
+		}
+
+		std::sort(latency.begin(), latency.end());
+		std::sort(original.begin(), original.end());
+
+		printf("%-10.*s %7zu %6u %6u %6u %6u %6u %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+		       int(method.size()), method.data(), list.size(),
+		       classes[2], classes[3], classes[4], classes[5],
+		       classes[0],
+		       Percentile(latency, .5), Percentile(latency, .9),
+		       Percentile(latency, .99), latency.back() / 1000.,
+		       Percentile(original, .5), Percentile(original, .99));
+	}
+}
+
+static void
+Usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [--speed=FACTOR] [--file-size=BYTES] [--param=NAME=VALUE...] TRACE DOCUMENT_ROOT DAVOS_PLAIN\n",
+		argv0);
+}
+
+int
+main(int argc, char **argv) noexcept
+try {
+	ReplayOptions options;
+	std::vector<std::string> parameter_strings;
+
+	int i = 1;
+	for (; i < argc && StringStartsWith(argv[i], "--"); ++i) {
+		if (const char *p = StringAfterPrefix(argv[i], "--speed=")) {
+			options.speed = strtod(p, nullptr);
+		} else if (const char *p = StringAfterPrefix(argv[i], "--file-size=")) {
+			options.file_size = strtoull(p, nullptr, 10);
+		} else if (const char *p = StringAfterPrefix(argv[i], "--param=")) {
+			if (strchr(p, '=') == nullptr) {
+				Usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+
+			parameter_strings.emplace_back(p);
+		} else {
+			Usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - i != 3) {
+		Usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char *const trace_path = argv[i];
+	const char *const document_root = argv[i + 1];
+	const char *const program = argv[i + 2];
+
+	for (const std::string_view p : parameter_strings) {
+		const auto eq = p.find('=');
+		options.parameters.emplace_back(p.substr(0, eq), p.substr(eq + 1));
+	}
+
+	/* the URIs in the trace are mapped below the document root
+	   as they are */
+	options.parameters.emplace_back("DAVOS_MOUNT", "/");
+	options.parameters.emplace_back("DAVOS_DOCUMENT_ROOT", document_root);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	auto records = LoadTrace(trace_path);
+	if (records.empty())
+		throw std::runtime_error("Trace is empty");
+
+	std::sort(records.begin(), records.end(), [](const auto &a, const auto &b){
+		return a.start < b.start;
+	});
+
+	if (mkdir(document_root, 0755) < 0 && errno != EEXIST)
+		throw MakeErrno("Failed to create document root");
+
+	SynthesizeTree(document_root, records, options);
+
+	/* requests of one connection were sent one after another;
+	   different connections were concurrent */
+	std::map<std::pair<uint32_t, uint32_t>, std::vector<const TraceRecord *>> connections;
+	for (const auto &r : records)
+		connections[{r.process, r.connection}].push_back(&r);
+
+	auto socket_fd = LaunchDavos(program);
+	MultiWasSocket socket{socket_fd};
+	std::mutex socket_mutex;
+
+	const uint64_t trace_start = records.front().start;
+	const auto replay_start = std::chrono::steady_clock::now();
+
+	std::vector<std::vector<Sample>> samples(connections.size());
+	std::vector<std::thread> threads;
+
+	std::size_t n = 0;
+	for (const auto &[key, list] : connections)
+		threads.emplace_back(ReplayConnection, std::ref(socket),
+				     std::ref(socket_mutex),
+				     std::span{list}, trace_start,
+				     replay_start, std::cref(options),
+				     std::ref(samples[n++]));
+
+	for (auto &t : threads)
+		t.join();
+
+	const auto duration = std::chrono::steady_clock::now() - replay_start;
+
+	/* davos exits when the Multi-WAS socket gets closed */
+	socket_fd.Close();
+	wait(nullptr);
+
+	std::vector<Sample> all;
+	for (const auto &s : samples)
+		all.insert(all.end(), s.begin(), s.end());
+
+	printf("%zu requests on %zu connections in %.3f s\n\n",
+	       all.size(), connections.size(),
+	       std::chrono::duration<double>(duration).count());
+
+	PrintReport(all);
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
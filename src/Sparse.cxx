@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Writing sparse files.
+ */
+
+#include "Sparse.hxx"
+#include "io/FileDescriptor.hxx"
+
+#include <algorithm>
+#include <cstring>
+
+bool
+IsAllZero(std::span<const std::byte> src) noexcept
+{
+	/* the GCC vector extension is compiled to SIMD instructions
+	   where available (e.g. two SSE2 registers per vector on
+	   x86_64), and to plain integer operations elsewhere */
+	typedef uint64_t Vector __attribute__((vector_size(32)));
+
+	static constexpr std::size_t STEP = 4 * sizeof(Vector);
+
+	const std::byte *p = src.data();
+	std::size_t n = src.size();
+
+	while (n >= STEP) {
+		/* memcpy() allows unaligned buffers; the compiler
+		   turns it into plain loads */
+		Vector v[4];
+		std::memcpy(v, p, STEP);
+
+		const Vector x = v[0] | v[1] | v[2] | v[3];
+		if ((x[0] | x[1] | x[2] | x[3]) != 0)
+			return false;
+
+		p += STEP;
+		n -= STEP;
+	}
+
+	return std::all_of(p, p + n, [](std::byte b){
+		return b == std::byte{};
+	});
+}
+
+static bool
+WriteAllAt(FileDescriptor fd, std::span<const std::byte> src,
+	  off_t offset) noexcept
+{
+	while (!src.empty()) {
+		ssize_t nbytes = fd.WriteAt(offset, src);
+		if (nbytes <= 0)
+			return false;
+
+		src = src.subspan(nbytes);
+		offset += nbytes;
+	}
+
+	return true;
+}
+
+bool
+WriteSparse(FileDescriptor fd, std::span<const std::byte> src, off_t offset,
+	    uint64_t &skipped) noexcept
+{
+	/* consecutive non-zero blocks are collected and written with
+	   one pwrite() */
+	std::size_t run_start = 0, i = 0;
+
+	while (i < src.size()) {
+		const std::size_t block_end =
+			std::min<std::size_t>(src.size(),
+					      i + SPARSE_BLOCK_SIZE -
+					      (offset + i) % SPARSE_BLOCK_SIZE);
+		const auto block = src.subspan(i, block_end - i);
+
+		if (IsAllZero(block)) {
+			if (run_start < i &&
+			    !WriteAllAt(fd, src.subspan(run_start, i - run_start),
+				       offset + run_start))
+				return false;
+
+			skipped += block.size();
+			run_start = block_end;
+		}
+
+		i = block_end;
+	}
+
+	return run_start == src.size() ||
+		WriteAllAt(fd, src.subspan(run_start), offset + run_start);
+}
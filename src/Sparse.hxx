@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Writing sparse files.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include <sys/types.h>
+
+class FileDescriptor;
+
+/**
+ * The granularity of hole detection; this is the block size of most
+ * filesystems.
+ */
+static constexpr std::size_t SPARSE_BLOCK_SIZE = 4096;
+
+/**
+ * Does the buffer contain only null bytes?
+ */
+[[gnu::pure]]
+bool
+IsAllZero(std::span<const std::byte> src) noexcept;
+
+/**
+ * Write data to a new (or truncated) file, but skip all blocks which
+ * contain only null bytes, leaving holes.  Blocks are aligned to the
+ * file offset, not to the buffer.  The file size is not extended
+ * over a trailing hole; the caller must call ftruncate() at the end.
+ *
+ * @param offset the file offset of the first byte
+ * @param skipped incremented by the number of bytes not written
+ * @return false on error (with errno set)
+ */
+bool
+WriteSparse(FileDescriptor fd, std::span<const std::byte> src, off_t offset,
+	    uint64_t &skipped) noexcept;
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Delete the objects of a content store which are not linked from
+ * any document root anymore.
+ */
+
+#include "ContentStore.hxx"
+#include "util/PrintException.hxx"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int
+main(int argc, char **argv) noexcept
+try {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s STORE...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 1; i < argc; ++i) {
+		const auto stats = CollectGarbage(argv[i]);
+		printf("%llu\t%llu\t%s\n",
+		       (unsigned long long)stats.objects,
+		       (unsigned long long)stats.bytes, argv[i]);
+	}
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,354 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Parser and generator for tar archives (POSIX ustar, pax and the
+ * GNU long name extension).
+ */
+
+#include "Tar.hxx"
+#include "util/SpanCast.hxx"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+#include <assert.h>
+
+using std::string_view_literals::operator""sv;
+
+/* the field offsets of a ustar header */
+static constexpr std::size_t TAR_NAME = 0, TAR_NAME_SIZE = TAR_MAX_NAME;
+static constexpr std::size_t TAR_MODE = 100, TAR_MODE_SIZE = 8;
+static constexpr std::size_t TAR_UID = 108, TAR_UID_SIZE = 8;
+static constexpr std::size_t TAR_GID = 116, TAR_GID_SIZE = 8;
+static constexpr std::size_t TAR_SIZE = 124, TAR_SIZE_SIZE = 12;
+static constexpr std::size_t TAR_MTIME = 136, TAR_MTIME_SIZE = 12;
+static constexpr std::size_t TAR_CHKSUM = 148, TAR_CHKSUM_SIZE = 8;
+static constexpr std::size_t TAR_TYPEFLAG = 156;
+static constexpr std::size_t TAR_MAGIC = 257, TAR_MAGIC_SIZE = 6;
+static constexpr std::size_t TAR_VERSION = 263;
+static constexpr std::size_t TAR_PREFIX = 345, TAR_PREFIX_SIZE = 155;
+
+/**
+ * Return a string field, which is terminated by a null byte unless
+ * it fills the whole field.
+ */
+static std::string_view
+GetString(TarBlock block, std::size_t offset, std::size_t size) noexcept
+{
+	const std::string_view s = ToStringView(block.subspan(offset, size));
+	return s.substr(0, s.find('\0'));
+}
+
+/**
+ * Parse a numeric field, which is either octal (padded with spaces
+ * or null bytes) or, as a GNU extension for large values, big-endian
+ * binary with the most significant bit of the first byte set.
+ */
+static std::optional<uint64_t>
+ParseNumber(TarBlock block, std::size_t offset, std::size_t size) noexcept
+{
+	const auto field = block.subspan(offset, size);
+
+	if ((std::to_integer<unsigned>(field.front()) & 0x80) != 0) {
+		uint64_t value = std::to_integer<unsigned>(field.front()) & 0x7f;
+		for (const std::byte b : field.subspan(1)) {
+			if (value >> 56 != 0)
+				return std::nullopt;
+
+			value = (value << 8) | std::to_integer<unsigned>(b);
+		}
+
+		return value;
+	}
+
+	std::string_view s = ToStringView(field);
+	while (!s.empty() && (s.front() == ' ' || s.front() == '\0'))
+		s.remove_prefix(1);
+
+	while (!s.empty() && (s.back() == ' ' || s.back() == '\0'))
+		s.remove_suffix(1);
+
+	if (s.empty())
+		return 0;
+
+	uint64_t value;
+	auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(),
+					 value, 8);
+	if (ec != std::errc{} || ptr != s.data() + s.size())
+		return std::nullopt;
+
+	return value;
+}
+
+[[gnu::pure]]
+static bool
+IsZero(TarBlock block) noexcept
+{
+	return std::all_of(block.begin(), block.end(), [](std::byte b){
+		return b == std::byte{};
+	});
+}
+
+/**
+ * Verify the header checksum, which is the sum of all bytes with
+ * the checksum field itself treated as spaces.  Some historic
+ * implementations used signed bytes, which is accepted, too.
+ */
+[[gnu::pure]]
+static bool
+VerifyChecksum(TarBlock block) noexcept
+{
+	const auto expected = ParseNumber(block, TAR_CHKSUM, TAR_CHKSUM_SIZE);
+	if (!expected)
+		return false;
+
+	uint64_t unsigned_sum = 0;
+	int64_t signed_sum = 0;
+
+	for (std::size_t i = 0; i < block.size(); ++i) {
+		const unsigned char ch =
+			i >= TAR_CHKSUM && i < TAR_CHKSUM + TAR_CHKSUM_SIZE
+			? ' '
+			: std::to_integer<unsigned char>(block[i]);
+
+		unsigned_sum += ch;
+		signed_sum += static_cast<signed char>(ch);
+	}
+
+	return *expected == unsigned_sum ||
+		int64_t(*expected) == signed_sum;
+}
+
+static constexpr TarEntry::Type
+ParseType(char typeflag) noexcept
+{
+	switch (typeflag) {
+	case '\0':
+	case '0':
+	case '7': // contiguous file
+		return TarEntry::Type::REGULAR;
+
+	case '5':
+		return TarEntry::Type::DIRECTORY;
+
+	case 'L':
+		return TarEntry::Type::LONG_NAME;
+
+	case 'x':
+		return TarEntry::Type::PAX;
+
+	case 'g':
+		return TarEntry::Type::GLOBAL_PAX;
+
+	default:
+		return TarEntry::Type::OTHER;
+	}
+}
+
+TarHeaderResult
+ParseTarHeader(TarBlock block, TarEntry &entry)
+{
+	if (IsZero(block))
+		return TarHeaderResult::END;
+
+	if (!VerifyChecksum(block))
+		return TarHeaderResult::MALFORMED;
+
+	const auto size = ParseNumber(block, TAR_SIZE, TAR_SIZE_SIZE);
+	const auto mtime = ParseNumber(block, TAR_MTIME, TAR_MTIME_SIZE);
+	if (!size || !mtime)
+		return TarHeaderResult::MALFORMED;
+
+	entry.size = *size;
+	entry.mtime = *mtime;
+	entry.type = ParseType(static_cast<char>(block[TAR_TYPEFLAG]));
+
+	entry.name.clear();
+
+	/* only POSIX archives have a prefix field; old GNU archives
+	   ("ustar  ") store other data there */
+	if (GetString(block, TAR_MAGIC, TAR_MAGIC_SIZE) == "ustar"sv) {
+		const auto prefix = GetString(block, TAR_PREFIX, TAR_PREFIX_SIZE);
+		if (!prefix.empty()) {
+			entry.name = prefix;
+			entry.name.push_back('/');
+		}
+	}
+
+	entry.name.append(GetString(block, TAR_NAME, TAR_NAME_SIZE));
+
+	/* pre-POSIX archives mark directories only with a trailing
+	   slash */
+	if (entry.type == TarEntry::Type::REGULAR && entry.name.ends_with('/'))
+		entry.type = TarEntry::Type::DIRECTORY;
+
+	return TarHeaderResult::ENTRY;
+}
+
+void
+TarOverride::Apply(TarEntry &entry) const noexcept
+{
+	if (!name.empty())
+		entry.name = name;
+
+	if (size)
+		entry.size = *size;
+
+	if (mtime)
+		entry.mtime = *mtime;
+}
+
+template<typename T>
+static std::optional<T>
+ParseDecimal(std::string_view s) noexcept
+{
+	T value;
+	auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+	if (ec != std::errc{} || ptr == s.data())
+		return std::nullopt;
+
+	return value;
+}
+
+bool
+ParsePaxHeader(std::string_view data, TarOverride &o)
+{
+	/* each record is "LENGTH KEY=VALUE\n", where LENGTH includes
+	   the whole record */
+
+	while (!data.empty()) {
+		std::size_t length;
+		auto [ptr, ec] = std::from_chars(data.data(),
+						 data.data() + data.size(),
+						 length);
+		if (ec != std::errc{} || ptr == data.data() + data.size() ||
+		    *ptr != ' ' || length > data.size())
+			return false;
+
+		const std::size_t header = ptr + 1 - data.data();
+		if (length <= header || data[length - 1] != '\n')
+			return false;
+
+		const auto record = data.substr(header, length - header - 1);
+		data.remove_prefix(length);
+
+		const auto eq = record.find('=');
+		if (eq == record.npos)
+			return false;
+
+		const auto key = record.substr(0, eq);
+		const auto value = record.substr(eq + 1);
+
+		if (key == "path"sv) {
+			/* a null byte would truncate the name later,
+			   possibly to ".." */
+			if (value.find('\0') != value.npos)
+				return false;
+
+			o.name = value;
+		} else if (key == "linkpath"sv) {
+			/* links are not extracted, but a name with a
+			   null byte makes the whole archive suspect */
+			if (value.find('\0') != value.npos)
+				return false;
+		} else if (key == "size"sv) {
+			o.size = ParseDecimal<uint64_t>(value);
+			if (!o.size)
+				return false;
+		} else if (key == "mtime"sv) {
+			/* the fraction is ignored */
+			o.mtime = ParseDecimal<int64_t>(value);
+			if (!o.mtime)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static void
+FormatString(std::span<std::byte> block, std::size_t offset,
+	     std::string_view value) noexcept
+{
+	std::memcpy(block.data() + offset, value.data(), value.size());
+}
+
+/**
+ * Format a numeric field as zero-padded octal, or (if it does not
+ * fit) as big-endian binary (GNU extension).
+ */
+static void
+FormatNumber(std::span<std::byte> block, std::size_t offset, std::size_t size,
+	     uint64_t value) noexcept
+{
+	const auto field = block.subspan(offset, size);
+
+	/* one byte is reserved for the null terminator */
+	if (size - 1 >= 22 || value >> (3 * (size - 1)) == 0) {
+		for (std::size_t i = size - 1; i-- > 0;) {
+			field[i] = std::byte('0' + (value & 7));
+			value >>= 3;
+		}
+
+		field[size - 1] = std::byte{};
+		return;
+	}
+
+	for (std::size_t i = size; i-- > 1;) {
+		field[i] = std::byte(value & 0xff);
+		value >>= 8;
+	}
+
+	field[0] = std::byte{0x80};
+}
+
+static void
+FormatBlock(std::span<std::byte> block, std::string_view name, char type,
+	    uint64_t size, int64_t mtime) noexcept
+{
+	std::fill(block.begin(), block.end(), std::byte{});
+
+	FormatString(block, TAR_NAME, name.substr(0, TAR_NAME_SIZE));
+	FormatNumber(block, TAR_MODE, TAR_MODE_SIZE, type == '5' ? 0755 : 0644);
+	FormatNumber(block, TAR_UID, TAR_UID_SIZE, 0);
+	FormatNumber(block, TAR_GID, TAR_GID_SIZE, 0);
+	FormatNumber(block, TAR_SIZE, TAR_SIZE_SIZE, size);
+	FormatNumber(block, TAR_MTIME, TAR_MTIME_SIZE, std::max<int64_t>(mtime, 0));
+	block[TAR_TYPEFLAG] = std::byte(type);
+	FormatString(block, TAR_MAGIC, "ustar"sv);
+	FormatString(block, TAR_VERSION, "00"sv);
+
+	std::fill_n(block.begin() + TAR_CHKSUM, TAR_CHKSUM_SIZE, std::byte{' '});
+
+	unsigned sum = 0;
+	for (const std::byte b : block)
+		sum += std::to_integer<unsigned>(b);
+
+	/* six digits, a null byte and a space */
+	FormatNumber(block, TAR_CHKSUM, TAR_CHKSUM_SIZE - 1, sum);
+}
+
+void
+FormatTarHeader(std::span<std::byte> dest, const TarEntry &entry) noexcept
+{
+	assert(dest.size() == GetTarHeaderSize(entry.name.size()));
+
+	const char type = entry.type == TarEntry::Type::DIRECTORY ? '5' : '0';
+
+	if (entry.name.size() > TAR_NAME_SIZE) {
+		const std::size_t length = entry.name.size() + 1;
+		FormatBlock(dest.first(TAR_BLOCK_SIZE), "././@LongLink"sv, 'L',
+			    length, 0);
+		dest = dest.subspan(TAR_BLOCK_SIZE);
+
+		const auto data = dest.first(TarRoundUp(length));
+		std::fill(data.begin(), data.end(), std::byte{});
+		FormatString(data, 0, entry.name);
+		dest = dest.subspan(data.size());
+	}
+
+	FormatBlock(dest, entry.name, type, entry.size, entry.mtime);
+}
@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Parser and generator for tar archives (POSIX ustar, pax and the
+ * GNU long name extension).
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+static constexpr std::size_t TAR_BLOCK_SIZE = 512;
+
+/**
+ * The maximum length of a name which fits into the header; longer
+ * names need an extension.
+ */
+static constexpr std::size_t TAR_MAX_NAME = 100;
+
+using TarBlock = std::span<const std::byte, TAR_BLOCK_SIZE>;
+
+constexpr uint64_t
+TarRoundUp(uint64_t size) noexcept
+{
+	return (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+}
+
+struct TarEntry {
+	enum class Type : uint8_t {
+		REGULAR,
+		DIRECTORY,
+
+		/**
+		 * GNU extension: the data is the name of the next
+		 * entry.
+		 */
+		LONG_NAME,
+
+		/**
+		 * POSIX pax: the data contains attributes of the next
+		 * entry.
+		 */
+		PAX,
+
+		/**
+		 * POSIX pax: the data contains attributes of all
+		 * following entries.
+		 */
+		GLOBAL_PAX,
+
+		/**
+		 * Anything else, e.g. symlinks, hard links and device
+		 * nodes.
+		 */
+		OTHER,
+	};
+
+	Type type;
+
+	/**
+	 * The path as it appears in the archive (not normalized).
+	 */
+	std::string name;
+
+	uint64_t size;
+
+	int64_t mtime;
+
+	/**
+	 * The number of bytes following the data to fill up the last
+	 * block.
+	 */
+	constexpr std::size_t GetPadding() const noexcept {
+		return TarRoundUp(size) - size;
+	}
+};
+
+/**
+ * Attributes from #TarEntry::Type::LONG_NAME and
+ * #TarEntry::Type::PAX entries which override the following header.
+ */
+struct TarOverride {
+	std::string name;
+	std::optional<uint64_t> size;
+	std::optional<int64_t> mtime;
+
+	bool IsEmpty() const noexcept {
+		return name.empty() && !size && !mtime;
+	}
+
+	void Apply(TarEntry &entry) const noexcept;
+
+	void Clear() noexcept {
+		name.clear();
+		size.reset();
+		mtime.reset();
+	}
+};
+
+enum class TarHeaderResult {
+	ENTRY,
+
+	/**
+	 * An empty block which marks the end of the archive.
+	 */
+	END,
+
+	MALFORMED,
+};
+
+/**
+ * Parse one header block.
+ */
+TarHeaderResult
+ParseTarHeader(TarBlock block, TarEntry &entry);
+
+/**
+ * Parse the data of a #TarEntry::Type::PAX entry.  Unknown keys are
+ * ignored.
+ *
+ * @return false if the data is malformed
+ */
+bool
+ParsePaxHeader(std::string_view data, TarOverride &o);
+
+/**
+ * The number of bytes generated by FormatTarHeader() for a name of
+ * the given length.
+ */
+constexpr std::size_t
+GetTarHeaderSize(std::size_t name_length) noexcept
+{
+	if (name_length <= TAR_MAX_NAME)
+		return TAR_BLOCK_SIZE;
+
+	/* a GNU long name entry precedes the header */
+	return 2 * TAR_BLOCK_SIZE + TarRoundUp(name_length + 1);
+}
+
+/**
+ * Generate the header of a #TarEntry::Type::REGULAR or
+ * #TarEntry::Type::DIRECTORY entry.  Names of directories should
+ * end with a slash.
+ *
+ * @param dest a buffer of GetTarHeaderSize() bytes
+ */
+void
+FormatTarHeader(std::span<std::byte> dest, const TarEntry &entry) noexcept;
@@ -0,0 +1,323 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Trace.hxx"
+#include "system/Error.hxx"
+
+#include <was/simple.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+const std::string_view trace_headers[] = {
+	"depth",
+	"destination",
+	"overwrite",
+	"if",
+	"if-match",
+	"if-none-match",
+	"if-modified-since",
+	"if-unmodified-since",
+	"if-range",
+	"range",
+	"content-type",
+	"accept-encoding",
+	"user-agent",
+	"lock-token",
+	"timeout",
+	"oc-total-length",
+	"oc-checksum",
+	"davos-continuation",
+};
+
+static constexpr std::size_t N_TRACE_HEADERS = std::size(trace_headers);
+
+struct TraceRecordHeader {
+	/**
+	 * The size of the whole record including this header.
+	 */
+	uint32_t size;
+
+	uint32_t duration;
+	uint64_t start;
+	int64_t body_length;
+	uint32_t process, connection;
+	uint8_t method;
+
+	/**
+	 * See #TRACE_FLAG_HAS_BODY.
+	 */
+	uint8_t flags;
+
+	uint8_t n_headers;
+	uint8_t reserved;
+	uint16_t uri_length;
+	uint16_t reserved2;
+};
+
+static_assert(sizeof(TraceRecordHeader) == 40);
+
+static constexpr uint8_t TRACE_FLAG_HAS_BODY = 0x1;
+
+struct TraceHeaderHeader {
+	/**
+	 * The index in #trace_headers.
+	 */
+	uint8_t index;
+
+	uint8_t reserved;
+	uint16_t length;
+};
+
+static constexpr std::size_t MAX_STRING = UINT16_MAX;
+
+void
+SerializeTraceRecord(std::string &dest, const TraceRecord &record) noexcept
+{
+	const std::size_t start = dest.size();
+
+	const std::string_view uri{record.uri.data(),
+		std::min(record.uri.size(), MAX_STRING)};
+
+	TraceRecordHeader header{};
+	header.duration = record.duration;
+	header.start = record.start;
+	header.body_length = record.body_length;
+	header.process = record.process;
+	header.connection = record.connection;
+	header.method = static_cast<uint8_t>(record.method);
+	header.flags = record.has_body ? TRACE_FLAG_HAS_BODY : 0;
+	header.n_headers = std::min<std::size_t>(record.headers.size(), UINT8_MAX);
+	header.uri_length = uri.size();
+
+	dest.append(reinterpret_cast<const char *>(&header), sizeof(header));
+	dest.append(uri);
+
+	for (std::size_t i = 0; i < header.n_headers; ++i) {
+		const auto &h = record.headers[i];
+		const auto index = std::find(trace_headers,
+					     trace_headers + N_TRACE_HEADERS,
+					     h.name) - trace_headers;
+		assert(std::size_t(index) < N_TRACE_HEADERS);
+
+		const std::string_view value{h.value.data(),
+			std::min(h.value.size(), MAX_STRING)};
+
+		const TraceHeaderHeader hh{
+			.index = static_cast<uint8_t>(index),
+			.reserved = 0,
+			.length = static_cast<uint16_t>(value.size()),
+		};
+
+		dest.append(reinterpret_cast<const char *>(&hh), sizeof(hh));
+		dest.append(value);
+	}
+
+	const uint32_t size = dest.size() - start;
+	memcpy(dest.data() + start, &size, sizeof(size));
+}
+
+/**
+ * Remove a fixed-size struct from the source.
+ */
+template<typename T>
+static bool
+ReadStruct(std::span<const std::byte> &src, T &value) noexcept
+{
+	if (src.size() < sizeof(value))
+		return false;
+
+	memcpy(&value, src.data(), sizeof(value));
+	src = src.subspan(sizeof(value));
+	return true;
+}
+
+static bool
+ReadString(std::span<const std::byte> &src, std::size_t length,
+	   std::string &value) noexcept
+{
+	if (src.size() < length)
+		return false;
+
+	value.assign(reinterpret_cast<const char *>(src.data()), length);
+	src = src.subspan(length);
+	return true;
+}
+
+bool
+ParseTraceRecord(std::span<const std::byte> &src, TraceRecord &record) noexcept
+{
+	TraceRecordHeader header;
+	if (src.size() < sizeof(header))
+		return false;
+
+	memcpy(&header, src.data(), sizeof(header));
+	if (header.size < sizeof(header) || header.size > src.size())
+		return false;
+
+	auto r = src.first(header.size).subspan(sizeof(header));
+
+	record.start = header.start;
+	record.duration = header.duration;
+	record.process = header.process;
+	record.connection = header.connection;
+	record.method = static_cast<http_method_t>(header.method);
+	record.has_body = header.flags & TRACE_FLAG_HAS_BODY;
+	record.body_length = header.body_length;
+
+	if (!ReadString(r, header.uri_length, record.uri))
+		return false;
+
+	record.headers.clear();
+	for (unsigned i = 0; i < header.n_headers; ++i) {
+		TraceHeaderHeader hh;
+		std::string value;
+		if (!ReadStruct(r, hh) || !ReadString(r, hh.length, value))
+			return false;
+
+		/* ignore headers which were added by a newer
+		   version */
+		if (hh.index < N_TRACE_HEADERS)
+			record.headers.push_back({trace_headers[hh.index],
+						  std::move(value)});
+	}
+
+	src = src.subspan(header.size);
+	return true;
+}
+
+std::vector<TraceRecord>
+LoadTrace(const char *path)
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open(path, O_RDONLY))
+		throw MakeErrno("Failed to open trace");
+
+	const std::size_t size = fd.GetSize();
+	const auto buffer = std::make_unique_for_overwrite<std::byte[]>(size);
+	std::span<const std::byte> src{buffer.get(), size};
+
+	for (std::size_t position = 0; position < size;) {
+		const ssize_t nbytes = fd.ReadAt(position,
+						 {buffer.get() + position,
+						  size - position});
+		if (nbytes < 0)
+			throw MakeErrno("Failed to read trace");
+
+		if (nbytes == 0)
+			throw std::runtime_error("Trace was truncated");
+
+		position += nbytes;
+	}
+
+	if (size < TRACE_MAGIC.size() ||
+	    memcmp(src.data(), TRACE_MAGIC.data(), TRACE_MAGIC.size()) != 0)
+		throw std::runtime_error("Not a davos trace");
+
+	src = src.subspan(TRACE_MAGIC.size());
+
+	std::vector<TraceRecord> records;
+	while (!src.empty()) {
+		/* an incomplete record at the end was still being
+		   written */
+		if (!ParseTraceRecord(src, records.emplace_back())) {
+			records.pop_back();
+			break;
+		}
+	}
+
+	return records;
+}
+
+TraceWriter::TraceWriter(const char *path)
+{
+	if (!fd.Open(path, O_CREAT|O_WRONLY|O_APPEND, 0600))
+		throw MakeErrno("Failed to open trace");
+
+	/* if several processes share the file, only one wins the
+	   race to write the magic; the others see a non-empty file */
+	if (fd.GetSize() == 0 &&
+	    pwrite(fd.Get(), TRACE_MAGIC.data(), TRACE_MAGIC.size(), 0) < 0)
+		throw MakeErrno("Failed to write trace");
+}
+
+void
+TraceWriter::Write(const TraceRecord &record) noexcept
+{
+	std::string buffer;
+	SerializeTraceRecord(buffer, record);
+
+	(void)fd.Write(std::as_bytes(std::span{buffer}));
+}
+
+static TraceWriter *trace_writer;
+
+void
+SetupTrace(const char *path)
+{
+	assert(trace_writer == nullptr);
+
+	trace_writer = new TraceWriter(path);
+}
+
+TraceWriter *
+GetTrace() noexcept
+{
+	return trace_writer;
+}
+
+/**
+ * Returns the number of the WAS connection handled by the current
+ * thread.
+ */
+static uint32_t
+GetConnectionNumber() noexcept
+{
+	static std::atomic_uint32_t next_connection;
+	thread_local const uint32_t connection = next_connection++;
+	return connection;
+}
+
+TraceScope::TraceScope(const was_simple &w, const char *uri) noexcept
+	:writer(GetTrace())
+{
+	if (writer == nullptr)
+		return;
+
+	start = std::chrono::steady_clock::now();
+
+	record.start = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	record.process = getpid();
+	record.connection = GetConnectionNumber();
+	record.method = was_simple_get_method(&w);
+	record.has_body = was_simple_has_body(&w);
+	record.body_length = record.has_body
+		? was_simple_input_remaining(&w)
+		: 0;
+	record.uri = uri;
+
+	for (const std::string_view name : trace_headers)
+		if (const char *value = was_simple_get_header(&w, name.data()))
+			record.headers.push_back({name, value});
+}
+
+TraceScope::~TraceScope() noexcept
+{
+	if (writer == nullptr)
+		return;
+
+	const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - start);
+	record.duration = std::min<uint64_t>(duration.count(), UINT32_MAX);
+
+	writer->Write(record);
+}
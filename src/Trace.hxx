@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * A compact binary trace of all requests, which can be replayed with
+ * davos-replay.  Request bodies are never recorded, only their
+ * length.
+ *
+ * The file begins with #TRACE_MAGIC; each record is a little
+ * header (see Trace.cxx) followed by the URI and the values of the
+ * headers listed in #trace_headers.  All integers are in native byte
+ * order.
+ */
+
+#pragma once
+
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <http/method.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct was_simple;
+
+static constexpr std::string_view TRACE_MAGIC{"davos-trace-1\n\0\0", 16};
+
+/**
+ * The request headers which are recorded.  A record refers to them
+ * by their index, so new ones may only be appended.
+ */
+extern const std::string_view trace_headers[];
+
+struct TraceHeader {
+	/**
+	 * A name from #trace_headers.
+	 */
+	std::string_view name;
+
+	std::string value;
+};
+
+struct TraceRecord {
+	/**
+	 * The wall clock time the request was accepted in
+	 * microseconds since the epoch.
+	 */
+	uint64_t start;
+
+	/**
+	 * The time it took to handle the request in microseconds.
+	 */
+	uint32_t duration;
+
+	/**
+	 * The process and the WAS connection (a number counted
+	 * within the process) which handled the request.  Requests
+	 * with the same pair were sent one after another.
+	 */
+	uint32_t process, connection;
+
+	http_method_t method;
+
+	/**
+	 * Did the request have a body?
+	 */
+	bool has_body;
+
+	/**
+	 * The announced length of the request body; -1 if it was
+	 * unknown.
+	 */
+	int64_t body_length;
+
+	std::string uri;
+
+	std::vector<TraceHeader> headers;
+};
+
+/**
+ * Append the binary representation of the record.
+ */
+void
+SerializeTraceRecord(std::string &dest, const TraceRecord &record) noexcept;
+
+/**
+ * Parse one record and remove it from the source.
+ *
+ * @return false if the source is truncated or malformed
+ */
+bool
+ParseTraceRecord(std::span<const std::byte> &src, TraceRecord &record) noexcept;
+
+/**
+ * Load all records of a trace file.  Throws on error.
+ */
+std::vector<TraceRecord>
+LoadTrace(const char *path);
+
+class TraceWriter {
+	UniqueFileDescriptor fd;
+
+public:
+	/**
+	 * Open the trace file for appending.  Throws on error.
+	 */
+	explicit TraceWriter(const char *path);
+
+	/**
+	 * Append one record (with a single write(), so concurrent
+	 * writers don't interleave).  Errors are ignored.
+	 */
+	void Write(const TraceRecord &record) noexcept;
+};
+
+/**
+ * Create the process-wide #TraceWriter.  Throws on error.
+ */
+void
+SetupTrace(const char *path);
+
+/**
+ * @return the process-wide #TraceWriter or nullptr if tracing is
+ * disabled
+ */
+[[gnu::pure]]
+TraceWriter *
+GetTrace() noexcept;
+
+/**
+ * Records one request to the process-wide #TraceWriter (if any)
+ * when it goes out of scope.
+ */
+class TraceScope {
+	TraceWriter *const writer;
+
+	std::chrono::steady_clock::time_point start;
+
+	TraceRecord record;
+
+public:
+	TraceScope(const was_simple &w, const char *uri) noexcept;
+	~TraceScope() noexcept;
+
+	TraceScope(const TraceScope &) = delete;
+	TraceScope &operator=(const TraceScope &) = delete;
+};
@@ -0,0 +1,380 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Splice file contents from/to the WAS pipes.
+ */
+
+#include "Transfer.hxx"
+#include "CachePolicy.hxx"
+#include "ContentHash.hxx"
+#include "Qos.hxx"
+#include "Sparse.hxx"
+#include "io/FileDescriptor.hxx"
+#include "config.h"
+
+#ifdef HAVE_URING
+#include "UringTransfer.hxx"
+#endif
+
+#include <was/simple.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * The maximum number of bytes per splice() call; this limits how
+ * long the cache policies have to wait for the next update.
+ */
+static constexpr off_t MAX_CHUNK = 1024 * 1024;
+
+/**
+ * If TransferSparseFromWas() has not found a single hole in this
+ * many bytes, it switches back to splice().
+ */
+static constexpr off_t SPARSE_PROBE_SIZE = 8 * 1024 * 1024;
+
+#ifdef HAVE_URING
+/**
+ * Transfers smaller than this don't use io_uring, because the setup
+ * overhead is not worth it.
+ */
+static constexpr off_t URING_THRESHOLD = 1024 * 1024;
+#endif
+
+/**
+ * The maximum number of bytes per system call for the current
+ * request; rate-limited requests use smaller chunks, so each delay
+ * is short.
+ */
+static off_t
+GetMaxChunk(const QosScope *qos) noexcept
+{
+	return qos != nullptr ? qos->GetChunkSize(MAX_CHUNK) : MAX_CHUNK;
+}
+
+/**
+ * Obtain the request's #QosScope and announce a transfer of the
+ * given size to it.
+ *
+ * @param size the size or a negative value if it is unknown
+ */
+static QosScope *
+BeginQosTransfer(int64_t size) noexcept
+{
+	QosScope *qos = GetQosScope();
+	if (qos != nullptr && size >= 0)
+		qos->Bulk(size);
+	return qos;
+}
+
+bool
+TransferToWas(was_simple *w, FileDescriptor in_fd,
+	      off_t offset, off_t size) noexcept
+{
+	if (!was_simple_set_length(w, size))
+		return false;
+
+	const FileDescriptor out_fd(was_simple_output_fd(w));
+	const off_t end = offset + size;
+	ReadCachePolicy cache{in_fd, offset, end};
+	QosScope *const qos = BeginQosTransfer(size);
+	const off_t max_chunk = GetMaxChunk(qos);
+
+#ifdef HAVE_URING
+	/* io_uring submits the whole range at once, which cannot be
+	   throttled */
+	if (size >= URING_THRESHOLD && (qos == nullptr || !qos->IsThrottled()))
+		if (auto *ring = GetThreadUring())
+			return UringSpliceToWas(*ring, w, in_fd,
+						offset, end, cache);
+	/* else: fall back to splice() */
+#endif
+
+	while (offset < end) {
+		cache.Update(offset);
+
+		ssize_t nbytes = splice(in_fd.Get(), &offset,
+					out_fd.Get(), nullptr,
+					std::min(end - offset, max_chunk),
+					SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (nbytes > 0) {
+			if (!was_simple_sent(w, nbytes))
+				return false;
+
+			if (qos != nullptr)
+				qos->Throttle(nbytes);
+			continue;
+		}
+
+		if (nbytes == 0 || errno != EAGAIN)
+			/* premature end of file or I/O error */
+			return false;
+
+		if (was_simple_output_poll(w, -1) != WAS_SIMPLE_POLL_SUCCESS)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Move exactly the given number of bytes from the pipe to the file.
+ * The data must already be in the pipe.
+ */
+static bool
+SpliceAll(FileDescriptor in_fd, FileDescriptor out_fd, std::size_t size) noexcept
+{
+	while (size > 0) {
+		ssize_t nbytes = splice(in_fd.Get(), nullptr,
+					out_fd.Get(), nullptr, size,
+					SPLICE_F_MOVE);
+		if (nbytes <= 0)
+			return false;
+
+		size -= nbytes;
+	}
+
+	return true;
+}
+
+/**
+ * Move the rest of the request body to the file, starting at the
+ * given position (which must be the current file offset).
+ */
+static bool
+SpliceRestFromWas(was_simple *w, FileDescriptor in_fd, FileDescriptor out_fd,
+		  TeeHasher *hasher, WriteCachePolicy &cache,
+		  QosScope *qos, off_t position) noexcept
+{
+	const off_t max_chunk = GetMaxChunk(qos);
+
+	while (true) {
+		const int64_t remaining = was_simple_input_remaining(w);
+		if (remaining == 0)
+			break;
+
+		switch (was_simple_input_poll(w, -1)) {
+		case WAS_SIMPLE_POLL_SUCCESS:
+			break;
+
+		case WAS_SIMPLE_POLL_END:
+			cache.Finish(position);
+			return true;
+
+		case WAS_SIMPLE_POLL_ERROR:
+		case WAS_SIMPLE_POLL_TIMEOUT:
+		case WAS_SIMPLE_POLL_CLOSED:
+			return false;
+		}
+
+		const off_t max = remaining > 0
+			? std::min<off_t>(remaining, max_chunk)
+			: max_chunk;
+
+		/* with a hasher, the data is first duplicated into
+		   the hasher's pipe (this blocks if the hasher thread
+		   is behind), and then the same amount is moved to
+		   the file */
+		ssize_t nbytes = hasher != nullptr
+			? tee(in_fd.Get(), hasher->GetPipe().Get(), max, 0)
+			: splice(in_fd.Get(), nullptr,
+				 out_fd.Get(), nullptr, max,
+				 SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (nbytes <= 0) {
+			if (nbytes < 0 && errno == EAGAIN)
+				continue;
+
+			return false;
+		}
+
+		if (hasher != nullptr && !SpliceAll(in_fd, out_fd, nbytes))
+			return false;
+
+		if (!was_simple_received(w, nbytes))
+			return false;
+
+		if (qos != nullptr)
+			qos->Throttle(nbytes);
+
+		position += nbytes;
+		cache.Update(position);
+	}
+
+	cache.Finish(position);
+	return true;
+}
+
+bool
+TransferFromWas(was_simple *w, FileDescriptor out_fd,
+		TeeHasher *hasher) noexcept
+{
+	const FileDescriptor in_fd(was_simple_input_fd(w));
+	const int64_t remaining = was_simple_input_remaining(w);
+	WriteCachePolicy cache{out_fd, remaining};
+	QosScope *const qos = BeginQosTransfer(remaining);
+	return SpliceRestFromWas(w, in_fd, out_fd, hasher, cache, qos, 0);
+}
+
+/**
+ * Read exactly the given number of bytes from the pipe.  The data
+ * must already be in the pipe.
+ */
+static bool
+ReadAll(FileDescriptor in_fd, std::span<std::byte> dest) noexcept
+{
+	while (!dest.empty()) {
+		ssize_t nbytes = in_fd.Read(dest);
+		if (nbytes <= 0)
+			return false;
+
+		dest = dest.subspan(nbytes);
+	}
+
+	return true;
+}
+
+static bool
+FinishSparse(FileDescriptor out_fd, WriteCachePolicy &cache,
+	     off_t position) noexcept
+{
+	/* extend the file over a trailing hole */
+	if (ftruncate(out_fd.Get(), position) < 0)
+		return false;
+
+	cache.Finish(position);
+	return true;
+}
+
+bool
+TransferSparseFromWas(was_simple *w, FileDescriptor out_fd,
+		      TeeHasher *hasher, uint64_t &skipped) noexcept
+{
+	const FileDescriptor in_fd(was_simple_input_fd(w));
+	const int64_t total = was_simple_input_remaining(w);
+	WriteCachePolicy cache{out_fd, total};
+	QosScope *const qos = BeginQosTransfer(total);
+	const off_t max_chunk = GetMaxChunk(qos);
+	off_t position = 0;
+	skipped = 0;
+
+	const auto buffer = std::make_unique_for_overwrite<std::byte[]>(MAX_CHUNK);
+
+	while (true) {
+		const int64_t remaining = was_simple_input_remaining(w);
+		if (remaining == 0)
+			break;
+
+		if (position >= SPARSE_PROBE_SIZE && skipped == 0) {
+			/* no holes so far: this is probably
+			   incompressible data, so switch back to
+			   splice() which doesn't copy */
+			if (out_fd.Seek(position) < 0)
+				return false;
+
+			return SpliceRestFromWas(w, in_fd, out_fd, hasher,
+						 cache, qos, position);
+		}
+
+		switch (was_simple_input_poll(w, -1)) {
+		case WAS_SIMPLE_POLL_SUCCESS:
+			break;
+
+		case WAS_SIMPLE_POLL_END:
+			return FinishSparse(out_fd, cache, position);
+
+		case WAS_SIMPLE_POLL_ERROR:
+		case WAS_SIMPLE_POLL_TIMEOUT:
+		case WAS_SIMPLE_POLL_CLOSED:
+			return false;
+		}
+
+		const off_t max = remaining > 0
+			? std::min<off_t>(remaining, max_chunk)
+			: max_chunk;
+
+		ssize_t nbytes = hasher != nullptr
+			? tee(in_fd.Get(), hasher->GetPipe().Get(), max, 0)
+			: in_fd.Read({buffer.get(), std::size_t(max)});
+		if (nbytes <= 0) {
+			if (nbytes < 0 && errno == EAGAIN)
+				continue;
+
+			return false;
+		}
+
+		const std::span<const std::byte> data{buffer.get(), std::size_t(nbytes)};
+		if (hasher != nullptr &&
+		    !ReadAll(in_fd, {buffer.get(), std::size_t(nbytes)}))
+			return false;
+
+		if (!was_simple_received(w, nbytes))
+			return false;
+
+		if (!WriteSparse(out_fd, data, position, skipped))
+			return false;
+
+		if (qos != nullptr)
+			qos->Throttle(nbytes);
+
+		position += nbytes;
+		cache.Update(position);
+	}
+
+	return FinishSparse(out_fd, cache, position);
+}
+
+bool
+TransferPartFromWas(was_simple *w, FileDescriptor out_fd,
+		    uint64_t size) noexcept
+{
+	const FileDescriptor in_fd(was_simple_input_fd(w));
+	WriteCachePolicy cache{out_fd, off_t(size)};
+	QosScope *const qos = BeginQosTransfer(size);
+	const off_t max_chunk = GetMaxChunk(qos);
+	off_t position = 0;
+
+	while (uint64_t(position) < size) {
+		switch (was_simple_input_poll(w, -1)) {
+		case WAS_SIMPLE_POLL_SUCCESS:
+			break;
+
+		case WAS_SIMPLE_POLL_END:
+			/* premature end of the request body */
+		case WAS_SIMPLE_POLL_ERROR:
+		case WAS_SIMPLE_POLL_TIMEOUT:
+		case WAS_SIMPLE_POLL_CLOSED:
+			return false;
+		}
+
+		const off_t max = std::min<uint64_t>(size - position,
+						     max_chunk);
+
+		ssize_t nbytes = splice(in_fd.Get(), nullptr,
+					out_fd.Get(), nullptr, max,
+					SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (nbytes <= 0) {
+			if (nbytes < 0 && errno == EAGAIN)
+				continue;
+
+			return false;
+		}
+
+		if (!was_simple_received(w, nbytes))
+			return false;
+
+		if (qos != nullptr)
+			qos->Throttle(nbytes);
+
+		position += nbytes;
+		cache.Update(position);
+	}
+
+	cache.Finish(position);
+	return true;
+}
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Splice file contents from/to the WAS pipes.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <sys/types.h>
+
+struct was_simple;
+class FileDescriptor;
+class TeeHasher;
+
+/**
+ * Send a file range as response body.  This is similar to
+ * SpliceToWas(), but it applies the #ReadCachePolicy to large
+ * transfers.
+ *
+ * @return true on success, false if the transfer has failed (the
+ * response cannot be continued)
+ */
+bool
+TransferToWas(was_simple *w, FileDescriptor in_fd,
+	      off_t offset, off_t size) noexcept;
+
+/**
+ * Copy the request body to the given file.  This is similar to
+ * SpliceFromWas(), but it applies the #WriteCachePolicy to large
+ * transfers.
+ *
+ * @param hasher if not nullptr, then all data is duplicated into
+ * this #TeeHasher
+ * @return true on success, false on error
+ */
+bool
+TransferFromWas(was_simple *w, FileDescriptor out_fd,
+		TeeHasher *hasher=nullptr) noexcept;
+
+/**
+ * Like TransferFromWas(), but skip blocks which contain only null
+ * bytes, leaving holes in the file, which must be new and empty.
+ * The data is copied through userspace for this, unless the
+ * beginning of the body turns out to have no holes; then the rest
+ * is spliced.
+ *
+ * @param skipped set to the number of bytes which were not written
+ * @return true on success, false on error
+ */
+bool
+TransferSparseFromWas(was_simple *w, FileDescriptor out_fd,
+		      TeeHasher *hasher, uint64_t &skipped) noexcept;
+
+/**
+ * Copy exactly the given number of bytes of the request body to the
+ * given file, leaving the rest of the body in the pipe.  This is used
+ * to extract files from an archive.
+ *
+ * @return true on success, false on error (including premature end
+ * of the request body)
+ */
+bool
+TransferPartFromWas(was_simple *w, FileDescriptor out_fd,
+		    uint64_t size) noexcept;
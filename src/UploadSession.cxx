@@ -0,0 +1,277 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "UploadSession.hxx"
+#include "DirectoryScanner.hxx"
+#include "ParallelTree.hxx"
+#include "system/Error.hxx"
+#include "io/FileAt.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "time/StatxCast.hxx"
+#include "util/CharUtil.hxx"
+#include "util/StringCompare.hxx"
+#include "util/StringSplit.hxx"
+
+#include <algorithm>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string_view_literals::operator""sv;
+
+/**
+ * Chunk numbers have at most this number of digits, which keeps
+ * them far away from integer overflows.
+ */
+static constexpr std::size_t MAX_CHUNK_DIGITS = 9;
+
+UploadPath
+ClassifyUploadPath(std::string_view directory, std::string_view path) noexcept
+{
+	if (!SkipPrefix(path, directory))
+		return UploadPath::NONE;
+
+	if (path.empty())
+		return UploadPath::ROOT;
+
+	if (!SkipPrefix(path, "/"sv))
+		/* a sibling of the upload directory whose name
+		   begins with the same characters */
+		return UploadPath::NONE;
+
+	const auto [session, rest] = Split(path, '/');
+	if (session.empty())
+		return UploadPath::INVALID;
+
+	if (rest.data() == nullptr)
+		return UploadPath::SESSION;
+
+	if (rest == ".file"sv)
+		return UploadPath::ASSEMBLE;
+
+	if (IsChunkName(rest))
+		return UploadPath::CHUNK;
+
+	return UploadPath::INVALID;
+}
+
+bool
+IsChunkName(std::string_view name) noexcept
+{
+	return !name.empty() && name.size() <= MAX_CHUNK_DIGITS &&
+		(name.front() != '0' || name.size() == 1) &&
+		std::all_of(name.begin(), name.end(), IsDigitASCII);
+}
+
+std::vector<UploadChunk>
+ListChunks(FileDescriptor session)
+{
+	DirectoryScanner scanner;
+	if (!scanner.Scan(session))
+		throw MakeErrno("Failed to read upload session");
+
+	std::vector<UploadChunk> chunks;
+
+	for (const auto &i : scanner.GetEntries()) {
+		const char *name = scanner.GetName(i);
+		if (!IsChunkName(name))
+			continue;
+
+		struct statx st;
+		if (statx(session.Get(), name, AT_SYMLINK_NOFOLLOW,
+			  STATX_TYPE|STATX_SIZE, &st) < 0) {
+			if (errno == ENOENT)
+				/* deleted meanwhile */
+				continue;
+
+			throw MakeErrno("Failed to stat chunk");
+		}
+
+		if (!S_ISREG(st.stx_mode))
+			continue;
+
+		chunks.push_back({
+			name,
+			strtoull(name, nullptr, 10),
+			st.stx_size,
+		});
+	}
+
+	std::sort(chunks.begin(), chunks.end(), [](const auto &a, const auto &b){
+		return a.number < b.number;
+	});
+
+	return chunks;
+}
+
+uint64_t
+GetSessionSize(FileDescriptor session)
+{
+	uint64_t size = 0;
+	for (const auto &i : ListChunks(session))
+		size += i.size;
+	return size;
+}
+
+/**
+ * Share the extents of the whole input file with the given range of
+ * the output file.
+ *
+ * @return false if the filesystem cannot do this (for this range)
+ */
+static bool
+CloneRange(FileDescriptor in, FileDescriptor out,
+	   uint64_t offset, uint64_t size)
+{
+	const struct file_clone_range range{
+		.src_fd = in.Get(),
+		.src_offset = 0,
+		.src_length = size,
+		.dest_offset = offset,
+	};
+
+	if (ioctl(out.Get(), FICLONERANGE, &range) == 0)
+		return true;
+
+	switch (errno) {
+	case EOPNOTSUPP:
+	case ENOTTY:
+	case EXDEV:
+		/* not supported by this filesystem */
+	case EINVAL:
+		/* not aligned to the filesystem block size */
+		return false;
+
+	default:
+		throw MakeErrno("FICLONERANGE failed");
+	}
+}
+
+/**
+ * Copy the whole input file to the given offset of the output file
+ * with copy_file_range() or (if that is not supported) sendfile().
+ */
+static void
+CopyRange(FileDescriptor in, FileDescriptor out,
+	  uint64_t offset, uint64_t size)
+{
+	static constexpr std::size_t MAX = 1024 * 1024 * 1024;
+
+	off_t in_offset = 0, out_offset = offset;
+	bool fallback = false;
+
+	while (size > 0) {
+		const std::size_t n = std::min<uint64_t>(size, MAX);
+
+		/* sendfile() writes at the file position of the
+		   output file, which was set when switching to the
+		   fallback */
+		const ssize_t nbytes = fallback
+			? sendfile(out.Get(), in.Get(), &in_offset, n)
+			: copy_file_range(in.Get(), &in_offset,
+					  out.Get(), &out_offset, n, 0);
+		if (nbytes > 0) {
+			size -= nbytes;
+			continue;
+		}
+
+		if (nbytes == 0)
+			throw MakeErrno(ESTALE, "Chunk was truncated");
+
+		if (!fallback &&
+		    (errno == EXDEV || errno == EINVAL ||
+		     errno == EOPNOTSUPP || errno == ENOSYS)) {
+			if (out.Seek(out_offset) < 0)
+				throw MakeErrno("Failed to seek");
+
+			fallback = true;
+			continue;
+		}
+
+		throw MakeErrno("Failed to copy chunk");
+	}
+}
+
+uint64_t
+AssembleChunks(FileDescriptor session, std::span<const UploadChunk> chunks,
+	       FileDescriptor out)
+{
+	uint64_t position = 0, cloned = 0;
+
+	/* once cloning fails, all following offsets are unaligned
+	   (or the filesystem can't do it at all) */
+	bool try_clone = true;
+
+	for (const auto &chunk : chunks) {
+		if (chunk.size == 0)
+			continue;
+
+		UniqueFileDescriptor in;
+		if (!in.Open(session, chunk.name.c_str(), O_RDONLY|O_NOFOLLOW))
+			throw MakeErrno("Failed to open chunk");
+
+		/* the chunk may have been replaced since it was
+		   listed, and the caller has already checked the
+		   size */
+		if (in.GetSize() != off_t(chunk.size))
+			throw MakeErrno(ESTALE, "Chunk was modified");
+
+		if (try_clone && CloneRange(in, out, position, chunk.size))
+			cloned += chunk.size;
+		else {
+			try_clone = false;
+			CopyRange(in, out, position, chunk.size);
+		}
+
+		position += chunk.size;
+	}
+
+	return cloned;
+}
+
+unsigned
+ExpireSessions(const char *directory, std::chrono::seconds max_age,
+	       unsigned threads) noexcept
+{
+	UniqueFileDescriptor fd;
+	DirectoryScanner scanner;
+	if (!fd.Open(directory, O_DIRECTORY|O_RDONLY) || !scanner.Scan(fd))
+		return 0;
+
+	const auto now = std::chrono::system_clock::now();
+	unsigned n = 0;
+
+	for (const auto &i : scanner.GetEntries()) {
+		if (i.type != DT_DIR && i.type != DT_UNKNOWN)
+			continue;
+
+		const char *name = scanner.GetName(i);
+
+		/* each chunk upload modifies the session directory,
+		   so its modification time is the time of the last
+		   activity */
+		struct statx st;
+		if (statx(fd.Get(), name, AT_SYMLINK_NOFOLLOW,
+			  STATX_TYPE|STATX_MTIME, &st) < 0 ||
+		    !S_ISDIR(st.stx_mode) ||
+		    now - ToSystemTimePoint(st.stx_mtime) < max_age)
+			continue;
+
+		std::vector<TreeError> errors;
+		try {
+			ParallelDelete({fd, name}, threads, errors);
+			++n;
+		} catch (...) {
+		}
+	}
+
+	return n;
+}
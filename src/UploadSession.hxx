@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Chunked upload sessions: the client creates a session collection,
+ * uploads chunks (in parallel and in any order) as numbered files
+ * into it and finally moves the session to the destination, which
+ * assembles the chunks.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class FileDescriptor;
+
+/**
+ * What does a path inside the upload directory refer to?
+ */
+enum class UploadPath {
+	/**
+	 * The path is not inside the upload directory.
+	 */
+	NONE,
+
+	/**
+	 * The upload directory itself.
+	 */
+	ROOT,
+
+	/**
+	 * A session collection.
+	 */
+	SESSION,
+
+	/**
+	 * A chunk inside a session.
+	 */
+	CHUNK,
+
+	/**
+	 * The virtual ".file" inside a session; moving it assembles
+	 * the session (this is what Nextcloud clients do).
+	 */
+	ASSEMBLE,
+
+	/**
+	 * Something else which cannot be created.
+	 */
+	INVALID,
+};
+
+/**
+ * @param directory the upload directory (without a trailing slash)
+ * @param path an absolute path
+ */
+[[gnu::pure]]
+UploadPath
+ClassifyUploadPath(std::string_view directory, std::string_view path) noexcept;
+
+/**
+ * Is this a valid chunk name, i.e. a decimal number without leading
+ * zeroes?
+ */
+[[gnu::pure]]
+bool
+IsChunkName(std::string_view name) noexcept;
+
+struct UploadChunk {
+	std::string name;
+
+	uint64_t number;
+
+	uint64_t size;
+};
+
+/**
+ * Obtain a list of all chunks in the session directory, ordered by
+ * their number.  Files which are not chunks are ignored.
+ *
+ * Throws std::system_error on error.
+ */
+std::vector<UploadChunk>
+ListChunks(FileDescriptor session);
+
+/**
+ * Determine the total size of all chunks in the session directory.
+ *
+ * Throws std::system_error on error.
+ */
+uint64_t
+GetSessionSize(FileDescriptor session);
+
+/**
+ * Append the chunks to the (empty) output file.  Wherever possible,
+ * the extents are shared with FICLONERANGE, which requires that
+ * both files are on the same filesystem and that all chunks except
+ * for the last one are a multiple of the filesystem block size;
+ * after that, copy_file_range() and sendfile() are tried, so the
+ * data never passes through userspace.
+ *
+ * Throws std::system_error on error.
+ *
+ * @return the number of bytes which were cloned
+ */
+uint64_t
+AssembleChunks(FileDescriptor session, std::span<const UploadChunk> chunks,
+	       FileDescriptor out);
+
+/**
+ * Delete all sessions which have not been modified for the
+ * specified duration.  Errors are ignored.
+ *
+ * @param threads the number of threads for deleting a session
+ * (see ParallelDelete())
+ * @return the number of sessions which were deleted
+ */
+unsigned
+ExpireSessions(const char *directory, std::chrono::seconds max_age,
+	       unsigned threads) noexcept;
@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * io_uring based transfer of file contents to the WAS pipe.
+ */
+
+#include "UringTransfer.hxx"
+#include "CachePolicy.hxx"
+#include "io/FileDescriptor.hxx"
+
+#include <was/simple.h>
+
+#include <liburing.h>
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+
+/**
+ * The maximum number of linked splice operations in flight.
+ */
+static constexpr unsigned DEPTH = 8;
+
+/**
+ * The size of each splice operation.
+ */
+static constexpr off_t CHUNK = 256 * 1024;
+
+namespace {
+
+class ThreadUring {
+	struct io_uring ring;
+
+	enum class State {
+		NONE,
+		READY,
+		FAILED,
+	} state = State::NONE;
+
+public:
+	~ThreadUring() noexcept {
+		if (state == State::READY)
+			io_uring_queue_exit(&ring);
+	}
+
+	struct io_uring *Get() noexcept {
+		if (state == State::NONE)
+			state = io_uring_queue_init(DEPTH, &ring, 0) == 0
+				? State::READY
+				: State::FAILED;
+
+		return state == State::READY ? &ring : nullptr;
+	}
+};
+
+/**
+ * Counters for one transfer, submitted as WAS metrics.
+ */
+struct UringTransferStats {
+	unsigned submitted = 0;
+
+	/**
+	 * How often was the chain interrupted by a short transfer?
+	 */
+	unsigned short_transfers = 0;
+
+	/**
+	 * How often was the output pipe full?
+	 */
+	unsigned full = 0;
+
+	void Submit(was_simple *w) const noexcept {
+		was_simple_metric(w, "davos_uring_sqes", submitted);
+		was_simple_metric(w, "davos_uring_short", short_transfers);
+		was_simple_metric(w, "davos_uring_full", full);
+	}
+};
+
+} // anonymous namespace
+
+static thread_local ThreadUring thread_uring;
+
+struct io_uring *
+GetThreadUring() noexcept
+{
+	return thread_uring.Get();
+}
+
+bool
+UringSpliceToWas(struct io_uring &ring, was_simple *w,
+		 FileDescriptor in_fd, off_t offset, const off_t end,
+		 ReadCachePolicy &cache) noexcept
+{
+	const int out_fd = was_simple_output_fd(w);
+	UringTransferStats stats;
+
+	while (offset < end) {
+		cache.Update(offset);
+
+		/* submit a chain of linked splice operations; the link
+		   guarantees that they are executed in order, so the
+		   data arrives in the pipe in the right order */
+
+		unsigned lengths[DEPTH];
+		unsigned n = 0;
+		struct io_uring_sqe *sqe = nullptr;
+
+		for (off_t o = offset; n < DEPTH && o < end; ++n) {
+			if (sqe != nullptr)
+				sqe->flags |= IOSQE_IO_LINK;
+
+			sqe = io_uring_get_sqe(&ring);
+			lengths[n] = std::min(end - o, CHUNK);
+			io_uring_prep_splice(sqe, in_fd.Get(), o, out_fd, -1,
+					     lengths[n], SPLICE_F_MOVE);
+			sqe->user_data = n;
+			o += lengths[n];
+		}
+
+		if (io_uring_submit_and_wait(&ring, n) < 0)
+			return false;
+
+		stats.submitted += n;
+
+		int results[DEPTH];
+		for (unsigned i = 0; i < n; ++i) {
+			struct io_uring_cqe *cqe;
+			if (io_uring_wait_cqe(&ring, &cqe) < 0)
+				return false;
+
+			results[cqe->user_data] = cqe->res;
+			io_uring_cqe_seen(&ring, cqe);
+		}
+
+		/* evaluate the results in submission order; a short
+		   or failed operation breaks the chain, and all
+		   following ones get ECANCELED */
+
+		bool interrupted = false;
+		for (unsigned i = 0; i < n; ++i) {
+			const int res = results[i];
+
+			if (res > 0) {
+				if (interrupted)
+					/* the kernel did not break the chain
+					   after a short transfer; the data in
+					   the pipe is out of order */
+					return false;
+
+				if (!was_simple_sent(w, res))
+					return false;
+
+				offset += res;
+
+				if ((unsigned)res < lengths[i]) {
+					++stats.short_transfers;
+					interrupted = true;
+				}
+			} else if (res == -ECANCELED) {
+				interrupted = true;
+			} else if (res == -EAGAIN) {
+				/* the output pipe is full */
+				++stats.full;
+				interrupted = true;
+
+				if (was_simple_output_poll(w, -1) != WAS_SIMPLE_POLL_SUCCESS)
+					return false;
+			} else {
+				/* premature end of file or I/O error */
+				return false;
+			}
+		}
+	}
+
+	stats.Submit(w);
+	return true;
+}
@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * io_uring based transfer of file contents to the WAS pipe.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+struct was_simple;
+struct io_uring;
+class FileDescriptor;
+class ReadCachePolicy;
+
+/**
+ * Obtain the io_uring instance of the current thread, creating it on
+ * demand.
+ *
+ * @return nullptr if io_uring is not available (e.g. old kernel or
+ * forbidden by seccomp)
+ */
+struct io_uring *
+GetThreadUring() noexcept;
+
+/**
+ * Send a file range to the WAS output pipe with several linked
+ * IORING_OP_SPLICE operations in flight.  The response length must
+ * have been announced already.
+ *
+ * @return true on success, false if the transfer has failed (the
+ * response cannot be continued)
+ */
+bool
+UringSpliceToWas(struct io_uring &ring, was_simple *w,
+		 FileDescriptor in_fd, off_t offset, off_t end,
+		 ReadCachePolicy &cache) noexcept;
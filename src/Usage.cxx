@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Incremental accounting of disk usage per collection (RFC 4331).
+ */
+
+#include "Usage.hxx"
+#include "Parameter.hxx"
+#include "DirectoryScanner.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "system/Error.hxx"
+
+#include <string>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/xattr.h>
+
+bool
+QuotaConfig::Setup(was_simple *w) noexcept
+{
+	if (!GetBooleanParameter(w, "DAVOS_USAGE_ACCOUNTING", accounting) ||
+	    !GetUnsignedParameter(w, "DAVOS_QUOTA", limit))
+		return false;
+
+	/* enforcing a quota requires accounting */
+	if (limit > 0)
+		accounting = true;
+
+	return true;
+}
+
+static std::optional<uint64_t>
+LoadUsage(FileDescriptor fd) noexcept
+{
+	uint64_t value;
+	if (fgetxattr(fd.Get(), USAGE_XATTR, &value, sizeof(value)) != sizeof(value))
+		return std::nullopt;
+
+	return value;
+}
+
+std::optional<uint64_t>
+LoadUsage(const char *path) noexcept
+{
+	uint64_t value;
+	if (getxattr(path, USAGE_XATTR, &value, sizeof(value)) != sizeof(value))
+		return std::nullopt;
+
+	return value;
+}
+
+static void
+StoreUsage(FileDescriptor fd, uint64_t value)
+{
+	if (fsetxattr(fd.Get(), USAGE_XATTR, &value, sizeof(value), 0) < 0)
+		throw MakeErrno("Failed to store usage");
+}
+
+/**
+ * Calculate the total size of all regular files in the given
+ * directory, and store the usage of all directories in their
+ * #USAGE_XATTR attribute.
+ */
+static uint64_t
+ScanDirectory(FileDescriptor fd)
+{
+	DirectoryScanner children;
+	if (!children.Scan(fd))
+		throw MakeErrno("Failed to read directory");
+
+	/* the order doesn't matter for the sum, and the inode order
+	   saves disk seeks */
+	children.SortByInode();
+
+	uint64_t total = 0;
+
+	for (const auto &i : children.GetEntries()) {
+		const char *name = children.GetName(i);
+
+		/* only regular files need a statx(), unless the
+		   filesystem doesn't report the type */
+		if (i.type == DT_REG || i.type == DT_UNKNOWN) {
+			struct statx st;
+			if (statx(fd.Get(), name, AT_SYMLINK_NOFOLLOW,
+				  STATX_TYPE|STATX_SIZE, &st) < 0)
+				/* probably deleted meanwhile */
+				continue;
+
+			if (S_ISREG(st.stx_mode)) {
+				total += st.stx_size;
+				continue;
+			}
+
+			if (!S_ISDIR(st.stx_mode))
+				continue;
+		} else if (i.type != DT_DIR)
+			continue;
+
+		UniqueFileDescriptor sub;
+		if (!sub.Open(fd, name, O_DIRECTORY|O_RDONLY|O_NOFOLLOW))
+			continue;
+
+		total += ScanDirectory(sub);
+	}
+
+	StoreUsage(fd, total);
+	return total;
+}
+
+std::optional<uint64_t>
+GetUsage(const char *path, const struct statx &st) noexcept
+{
+	if (S_ISREG(st.stx_mode))
+		return st.stx_size;
+
+	if (!S_ISDIR(st.stx_mode))
+		return 0;
+
+	return LoadUsage(path);
+}
+
+void
+InitUsage(const char *path, uint64_t value) noexcept
+{
+	setxattr(path, USAGE_XATTR, &value, sizeof(value), 0);
+}
+
+/**
+ * Add a delta to the #USAGE_XATTR attribute of one directory.  A
+ * lock prevents lost updates from concurrent requests.
+ */
+static void
+AddUsage(const char *path, int64_t delta) noexcept
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open(path, O_DIRECTORY|O_RDONLY))
+		return;
+
+	if (flock(fd.Get(), LOCK_EX) < 0)
+		return;
+
+	if (auto value = LoadUsage(fd)) {
+		/* clamp at zero; a negative value means that the
+		   accounting was already off */
+		*value = delta < 0 && uint64_t(-delta) > *value
+			? 0
+			: *value + delta;
+
+		try {
+			StoreUsage(fd, *value);
+		} catch (...) {
+		}
+	}
+
+	/* the lock is released by close() */
+}
+
+void
+AddUsage(std::string_view root, std::string_view directory,
+	 int64_t delta) noexcept
+{
+	if (delta == 0)
+		return;
+
+	while (root.size() > 1 && root.back() == '/')
+		root.remove_suffix(1);
+
+	std::string path{directory};
+
+	while (true) {
+		while (path.size() > 1 && path.back() == '/')
+			path.pop_back();
+
+		AddUsage(path.c_str(), delta);
+
+		if (path.size() <= root.size())
+			break;
+
+		const auto slash = path.rfind('/');
+		if (slash == path.npos || slash < root.size())
+			break;
+
+		path.erase(slash);
+	}
+}
+
+uint64_t
+RebuildUsage(const char *path)
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open(path, O_DIRECTORY|O_RDONLY))
+		throw MakeErrno("Failed to open directory");
+
+	return ScanDirectory(fd);
+}
+
+std::optional<uint64_t>
+GetQuotaAvailable(const QuotaConfig &config) noexcept
+{
+	const char *const root = config.document_root;
+
+	if (config.limit == 0) {
+		struct statvfs s;
+		if (statvfs(root, &s) < 0)
+			return std::nullopt;
+
+		return uint64_t(s.f_bavail) * s.f_frsize;
+	}
+
+	const auto used = LoadUsage(root);
+	if (!used)
+		return std::nullopt;
+
+	return *used < config.limit ? config.limit - *used : 0;
+}
@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Incremental accounting of disk usage per collection (RFC 4331).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+struct statx;
+struct was_simple;
+
+/**
+ * The name of the extended attribute of a directory which contains
+ * the total size of all regular files below it (a native 64 bit
+ * integer).
+ */
+static constexpr char USAGE_XATTR[] = "user.davos.usage";
+
+struct QuotaConfig {
+	/**
+	 * The directory the quota applies to, i.e. the document
+	 * root.
+	 */
+	const char *document_root = nullptr;
+
+	/**
+	 * Maintain the #USAGE_XATTR attributes?
+	 */
+	bool accounting = false;
+
+	/**
+	 * The maximum usage of the document root in bytes; 0 means
+	 * unlimited.
+	 */
+	uint64_t limit = 0;
+
+	/**
+	 * Parse the WAS parameters.
+	 *
+	 * @return false on error (after printing an error message)
+	 */
+	bool Setup(was_simple *w) noexcept;
+};
+
+/**
+ * Load the usage of a directory from its #USAGE_XATTR attribute.
+ *
+ * @return the usage or std::nullopt if it is unknown
+ */
+std::optional<uint64_t>
+LoadUsage(const char *path) noexcept;
+
+/**
+ * Determine the usage of a file or directory.  This never scans a
+ * tree: a directory without a #USAGE_XATTR attribute is not
+ * accounted (until davos-usage rebuilds it).
+ *
+ * @param st the status of the file
+ * @return the usage or std::nullopt if it is unknown
+ */
+std::optional<uint64_t>
+GetUsage(const char *path, const struct statx &st) noexcept;
+
+/**
+ * Store the #USAGE_XATTR attribute of a new directory whose usage is
+ * known (e.g. 0 after MKCOL).  Errors are ignored; the directory is
+ * then not accounted.
+ */
+void
+InitUsage(const char *path, uint64_t value) noexcept;
+
+/**
+ * Add a (possibly negative) delta to the usage of the given
+ * directory and all of its ancestors up to the document root.
+ * Directories without a #USAGE_XATTR attribute are skipped.
+ *
+ * @param root the document root
+ * @param directory the directory below (or equal to) #root whose
+ * contents have been modified
+ */
+void
+AddUsage(std::string_view root, std::string_view directory,
+	 int64_t delta) noexcept;
+
+/**
+ * Scan the tree and store the #USAGE_XATTR attribute of all
+ * directories.  This is expensive and is only used by davos-usage.
+ * Throws on error.
+ *
+ * @return the usage of the directory
+ */
+uint64_t
+RebuildUsage(const char *path);
+
+/**
+ * Calculate the number of bytes which may still be written below
+ * QuotaConfig::document_root.  If there is no quota, the free space
+ * of the filesystem is returned.
+ *
+ * @return the number of bytes or std::nullopt if the usage of the
+ * document root is unknown
+ */
+std::optional<uint64_t>
+GetQuotaAvailable(const QuotaConfig &config) noexcept;
@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Rebuild the usage attributes of an existing tree.
+ */
+
+#include "Usage.hxx"
+#include "util/PrintException.hxx"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int
+main(int argc, char **argv) noexcept
+try {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s DIRECTORY...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 1; i < argc; ++i) {
+		const uint64_t usage = RebuildUsage(argv[i]);
+		printf("%llu\t%s\n", (unsigned long long)usage, argv[i]);
+	}
+
+	return EXIT_SUCCESS;
+} catch (...) {
+	PrintException(std::current_exception());
+	return EXIT_FAILURE;
+}
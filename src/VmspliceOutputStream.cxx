@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Hand generated response bodies to the WAS pipe with vmsplice().
+ */
+
+#include "VmspliceOutputStream.hxx"
+#include "was/WasOutputStream.hxx"
+
+#include <was/simple.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+static constexpr std::size_t MAPPING_SIZE = 3 * VmspliceOutputStream::BUFFER_SIZE;
+
+VmspliceOutputStream::~VmspliceOutputStream() noexcept
+{
+	/* unmapping is safe even if the pipe still references the
+	   pages */
+	if (mapping != nullptr)
+		munmap(mapping, MAPPING_SIZE);
+}
+
+inline bool
+VmspliceOutputStream::Allocate() noexcept
+{
+	/* allocate one more buffer than needed, to be able to align
+	   to the huge page size */
+	void *p = mmap(nullptr, MAPPING_SIZE, PROT_READ|PROT_WRITE,
+		       MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return false;
+
+	mapping = p;
+
+	const auto address = reinterpret_cast<uintptr_t>(p);
+	buffers = reinterpret_cast<std::byte *>((address + BUFFER_SIZE - 1)
+						/ BUFFER_SIZE * BUFFER_SIZE);
+
+	/* this is only a hint; without huge pages, refilling a
+	   buffer page-faults once per 4 kB page, which makes this
+	   slower than write() */
+	madvise(buffers, 2 * BUFFER_SIZE, MADV_HUGEPAGE);
+	return true;
+}
+
+inline void
+VmspliceOutputStream::WriteDirect(std::span<const std::byte> src)
+{
+	if (!was_simple_write(w, src.data(), src.size()))
+		throw WasOutputStream::WriteFailed{};
+
+	direct += src.size();
+}
+
+void
+VmspliceOutputStream::Splice(std::span<const std::byte> src)
+{
+	const int fd = was_simple_output_fd(w);
+
+	struct iovec iov{const_cast<std::byte *>(src.data()), src.size()};
+
+	while (iov.iov_len > 0) {
+		ssize_t nbytes = vmsplice(fd, &iov, 1,
+					  SPLICE_F_GIFT|SPLICE_F_NONBLOCK);
+		if (nbytes > 0) {
+			if (!was_simple_sent(w, nbytes))
+				throw WasOutputStream::WriteFailed{};
+
+			iov.iov_base = static_cast<std::byte *>(iov.iov_base) + nbytes;
+			iov.iov_len -= nbytes;
+			continue;
+		}
+
+		if (nbytes == 0 || errno != EAGAIN)
+			throw WasOutputStream::WriteFailed{};
+
+		if (was_simple_output_poll(w, -1) != WAS_SIMPLE_POLL_SUCCESS)
+			throw WasOutputStream::WriteFailed{};
+	}
+}
+
+inline void
+VmspliceOutputStream::Submit()
+{
+	Splice({buffers + current * BUFFER_SIZE, fill});
+
+	/* the other buffer gets recycled only when it is needed, so
+	   the last one of each response never is */
+	gifted[current] = true;
+	current ^= 1;
+	fill = 0;
+}
+
+void
+VmspliceOutputStream::Flush()
+{
+	if (fill > 0)
+		Submit();
+}
+
+void
+VmspliceOutputStream::Write(std::span<const std::byte> src)
+{
+	if (mapping == nullptr) {
+		if (fallback) {
+			WriteDirect(src);
+			return;
+		}
+
+		if (direct < BUFFER_SIZE) {
+			const auto n = std::min<std::size_t>(src.size(),
+							      BUFFER_SIZE - direct);
+			WriteDirect(src.first(n));
+			src = src.subspan(n);
+			if (src.empty())
+				return;
+		}
+
+		if (!Allocate()) {
+			fallback = true;
+			WriteDirect(src);
+			return;
+		}
+	}
+
+	while (!src.empty()) {
+		std::byte *const buffer = buffers + current * BUFFER_SIZE;
+
+		if (gifted[current]) {
+			/* the pipe owns the old pages now; replace
+			   them with fresh ones */
+			madvise(buffer, BUFFER_SIZE, MADV_DONTNEED);
+			gifted[current] = false;
+		}
+
+		const std::size_t n = std::min(src.size(), BUFFER_SIZE - fill);
+		std::memcpy(buffer + fill, src.data(), n);
+		fill += n;
+		src = src.subspan(n);
+
+		if (fill == BUFFER_SIZE)
+			Submit();
+	}
+}
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Hand generated response bodies to the WAS pipe with vmsplice().
+ */
+
+#pragma once
+
+#include "io/OutputStream.hxx"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+struct was_simple;
+
+/**
+ * An #OutputStream which writes to the WAS output pipe like
+ * #WasOutputStream, but large responses are collected in two
+ * page-aligned buffers (backed by transparent huge pages if
+ * possible), which are moved into the pipe with vmsplice() instead of
+ * being copied by write().
+ *
+ * Pages handed to the pipe may still be referenced long after the
+ * peer has read them (e.g. if it splices them to a socket), so they
+ * are never modified again: before a buffer is refilled,
+ * MADV_DONTNEED replaces them with fresh pages.
+ *
+ * The first #BUFFER_SIZE bytes are written with was_simple_write();
+ * this switches libwas to the body state and keeps small responses
+ * from touching the buffers at all.
+ *
+ * Errors are reported by throwing WasOutputStream::WriteFailed.
+ */
+class VmspliceOutputStream final : public OutputStream {
+	was_simple *const w;
+
+public:
+	/**
+	 * The size of each buffer; this is the size of a huge page on
+	 * x86_64.
+	 */
+	static constexpr std::size_t BUFFER_SIZE = 2 * 1024 * 1024;
+
+private:
+	/**
+	 * The anonymous mapping containing both buffers (plus
+	 * alignment slack); nullptr if not yet allocated.
+	 */
+	void *mapping = nullptr;
+
+	/**
+	 * The first buffer, aligned to #BUFFER_SIZE; the second one
+	 * follows immediately.
+	 */
+	std::byte *buffers;
+
+	/**
+	 * Which buffers were handed to the pipe and need to be
+	 * recycled before they are written again?
+	 */
+	std::array<bool, 2> gifted{};
+
+	/**
+	 * The index of the buffer being filled.
+	 */
+	unsigned current = 0;
+
+	/**
+	 * The number of bytes in the current buffer.
+	 */
+	std::size_t fill = 0;
+
+	/**
+	 * The number of bytes written with was_simple_write().
+	 */
+	uint64_t direct = 0;
+
+	/**
+	 * Set if the buffers could not be allocated; all data is
+	 * then written with was_simple_write().
+	 */
+	bool fallback = false;
+
+public:
+	explicit VmspliceOutputStream(was_simple *_w) noexcept
+		:w(_w) {}
+
+	~VmspliceOutputStream() noexcept;
+
+	VmspliceOutputStream(const VmspliceOutputStream &) = delete;
+	VmspliceOutputStream &operator=(const VmspliceOutputStream &) = delete;
+
+	/**
+	 * Submit the partially filled buffer to the pipe.
+	 */
+	void Flush();
+
+	/* virtual methods from class OutputStream */
+	void Write(std::span<const std::byte> src) override;
+
+private:
+	bool Allocate() noexcept;
+	void WriteDirect(std::span<const std::byte> src);
+	void Splice(std::span<const std::byte> src);
+	void Submit();
+};
@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * The web server side of the WAS protocol: a minimal stand-in for
+ * beng-proxy, used by davos-replay.
+ */
+
+#include "WasClient.hxx"
+#include "system/Error.hxx"
+
+#include <was/protocol.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static void
+CreatePipe(UniqueFileDescriptor &r, UniqueFileDescriptor &w)
+{
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) < 0)
+		throw MakeErrno("pipe2() failed");
+
+	r = UniqueFileDescriptor{fds[0]};
+	w = UniqueFileDescriptor{fds[1]};
+}
+
+WasClient::WasClient(WasConnectionFds &peer)
+{
+	int fds[2];
+	if (socketpair(AF_LOCAL, SOCK_STREAM|SOCK_CLOEXEC, 0, fds) < 0)
+		throw MakeErrno("socketpair() failed");
+
+	control = UniqueFileDescriptor{fds[0]};
+	peer.control = UniqueFileDescriptor{fds[1]};
+
+	CreatePipe(peer.input, input);
+	CreatePipe(output, peer.output);
+
+	/* the request body is written only when the pipe has room,
+	   so a response which arrives meanwhile is not blocked */
+	fcntl(input.Get(), F_SETFL, O_NONBLOCK);
+}
+
+void
+WasClient::SendPacket(uint16_t command, std::span<const std::byte> payload)
+{
+	if (payload.size() > UINT16_MAX)
+		throw std::invalid_argument("WAS packet too large");
+
+	const struct was_header header{
+		.length = static_cast<uint16_t>(payload.size()),
+		.command = command,
+	};
+
+	std::string buffer{reinterpret_cast<const char *>(&header), sizeof(header)};
+	buffer.append(reinterpret_cast<const char *>(payload.data()),
+		      payload.size());
+
+	if (send(control.Get(), buffer.data(), buffer.size(), MSG_NOSIGNAL) != ssize_t(buffer.size()))
+		throw MakeErrno("Failed to send on WAS control socket");
+}
+
+void
+WasClient::SendPair(uint16_t command, std::string_view name,
+		    std::string_view value)
+{
+	std::string payload{name};
+	payload.push_back('=');
+	payload.append(value);
+	SendPacket(command, payload);
+}
+
+template<typename T>
+static T
+ParseScalar(std::span<const std::byte> payload)
+{
+	T value;
+	if (payload.size() != sizeof(value))
+		throw std::runtime_error("Malformed WAS packet");
+
+	memcpy(&value, payload.data(), sizeof(value));
+	return value;
+}
+
+template<typename T>
+static std::span<const std::byte>
+ToBytes(const T &value) noexcept
+{
+	return std::as_bytes(std::span{&value, 1});
+}
+
+WasClientResponse
+WasClient::Request(const WasClientRequest &request)
+{
+	SendPacket(WAS_COMMAND_REQUEST);
+	SendPacket(WAS_COMMAND_METHOD, ToBytes(uint32_t(request.method)));
+	SendPacket(WAS_COMMAND_URI, request.uri);
+
+	for (const auto &[name, value] : request.headers)
+		SendPair(WAS_COMMAND_HEADER, name, value);
+
+	for (const auto &[name, value] : request.parameters)
+		SendPair(WAS_COMMAND_PARAMETER, name, value);
+
+	uint64_t body_sent = 0;
+	bool body_done = true;
+	if (request.body_length) {
+		SendPacket(WAS_COMMAND_DATA);
+		SendPacket(WAS_COMMAND_LENGTH, ToBytes(*request.body_length));
+		body_done = *request.body_length == 0;
+	} else
+		SendPacket(WAS_COMMAND_NO_DATA);
+
+	WasClientResponse response{HTTP_STATUS_OK, 0};
+	bool response_done = false, response_data = false;
+	std::optional<uint64_t> response_length;
+
+	std::byte buffer[65536];
+
+	while (!response_done || !body_done) {
+		struct pollfd pfds[] = {
+			{control.Get(), POLLIN, 0},
+			{response_data ? output.Get() : -1, POLLIN, 0},
+			{body_done ? -1 : input.Get(), POLLOUT, 0},
+		};
+
+		if (poll(pfds, std::size(pfds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			throw MakeErrno("poll() failed");
+		}
+
+		if (pfds[0].revents) {
+			const ssize_t nbytes = recv(control.Get(), buffer,
+						    sizeof(buffer), 0);
+			if (nbytes < 0)
+				throw MakeErrno("Failed to receive on WAS control socket");
+
+			if (nbytes == 0)
+				throw std::runtime_error("WAS control socket closed");
+
+			control_buffer.append(reinterpret_cast<const char *>(buffer),
+					      nbytes);
+		}
+
+		while (control_buffer.size() >= sizeof(struct was_header)) {
+			struct was_header header;
+			memcpy(&header, control_buffer.data(), sizeof(header));
+			if (control_buffer.size() < sizeof(header) + header.length)
+				break;
+
+			const std::span<const std::byte> payload{
+				reinterpret_cast<const std::byte *>(control_buffer.data()) + sizeof(header),
+				header.length,
+			};
+
+			switch (header.command) {
+			case WAS_COMMAND_STATUS:
+				response.status = static_cast<http_status_t>(ParseScalar<uint32_t>(payload));
+				break;
+
+			case WAS_COMMAND_NO_DATA:
+				response_done = true;
+				break;
+
+			case WAS_COMMAND_DATA:
+				response_data = true;
+				break;
+
+			case WAS_COMMAND_LENGTH:
+			case WAS_COMMAND_PREMATURE:
+				/* after PREMATURE, the data which was
+				   sent so far is still in the pipe */
+				response_length = ParseScalar<uint64_t>(payload);
+				break;
+
+			case WAS_COMMAND_STOP:
+				/* the application doesn't want the rest
+				   of the request body */
+				if (!body_done) {
+					SendPacket(WAS_COMMAND_PREMATURE,
+						   ToBytes(body_sent));
+					body_done = true;
+				}
+
+				break;
+
+			default:
+				/* HEADER, METRIC etc. are not
+				   interesting */
+				break;
+			}
+
+			control_buffer.erase(0, sizeof(header) + header.length);
+		}
+
+		if (pfds[1].revents) {
+			const ssize_t nbytes = read(output.Get(), buffer,
+						    sizeof(buffer));
+			if (nbytes < 0)
+				throw MakeErrno("Failed to read response body");
+
+			if (nbytes == 0)
+				throw std::runtime_error("Response body pipe closed");
+
+			response.length += nbytes;
+		}
+
+		if (response_data && response_length &&
+		    response.length >= *response_length)
+			response_done = true;
+
+		if (pfds[2].revents && !body_done) {
+			const std::string_view pattern = request.body_pattern;
+			const std::size_t offset = body_sent % pattern.size();
+			const std::size_t length =
+				std::min<uint64_t>(pattern.size() - offset,
+						   *request.body_length - body_sent);
+
+			const ssize_t nbytes = write(input.Get(),
+						     pattern.data() + offset,
+						     length);
+			if (nbytes < 0) {
+				if (errno != EAGAIN)
+					throw MakeErrno("Failed to write request body");
+			} else {
+				body_sent += nbytes;
+				body_done = body_sent == *request.body_length;
+			}
+		}
+	}
+
+	return response;
+}
@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * The web server side of the WAS protocol: a minimal stand-in for
+ * beng-proxy, used by davos-replay.
+ */
+
+#pragma once
+
+#include "MultiWas.hxx"
+
+#include <http/method.h>
+#include <http/status.h>
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+
+struct WasClientRequest {
+	using Pair = std::pair<std::string_view, std::string_view>;
+
+	http_method_t method;
+
+	std::string_view uri;
+
+	std::span<const Pair> headers, parameters;
+
+	/**
+	 * The request body consists of this pattern, repeated until
+	 * #body_length bytes have been sent.
+	 */
+	std::string_view body_pattern;
+
+	/**
+	 * The length of the request body; std::nullopt if there is
+	 * no body.
+	 */
+	std::optional<uint64_t> body_length;
+};
+
+struct WasClientResponse {
+	http_status_t status;
+
+	/**
+	 * The number of response body bytes which were received (and
+	 * discarded).
+	 */
+	uint64_t length;
+};
+
+class WasClient {
+	UniqueFileDescriptor control;
+
+	/**
+	 * The pipe which carries the request body to the
+	 * application.
+	 */
+	UniqueFileDescriptor input;
+
+	/**
+	 * The pipe which carries the response body from the
+	 * application.
+	 */
+	UniqueFileDescriptor output;
+
+	/**
+	 * Data received on the control socket which has not been
+	 * parsed yet.
+	 */
+	std::string control_buffer;
+
+public:
+	/**
+	 * Create the control socket and the pipes.  Throws on error.
+	 *
+	 * @param peer receives the application's side, which may
+	 * then be passed with MultiWasSocket::Send()
+	 */
+	explicit WasClient(WasConnectionFds &peer);
+
+	/**
+	 * Send a request and wait for the whole response.  Throws on
+	 * error.
+	 */
+	WasClientResponse Request(const WasClientRequest &request);
+
+private:
+	void SendPacket(uint16_t command, std::span<const std::byte> payload);
+
+	void SendPacket(uint16_t command) {
+		SendPacket(command, std::span<const std::byte>{});
+	}
+
+	void SendPacket(uint16_t command, std::string_view payload) {
+		SendPacket(command, std::as_bytes(std::span{payload}));
+	}
+
+	void SendPair(uint16_t command, std::string_view name,
+		      std::string_view value);
+};
@@ -0,0 +1,481 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Request handler for GET on collections (download as tar archive).
+ */
+
+#include "archive.hxx"
+#include "propfind.hxx"
+#include "Tar.hxx"
+#include "DirectoryScanner.hxx"
+#include "error.hxx"
+#include "file.hxx"
+#include "was/Splice.hxx"
+#include "lib/fmt/ToBuffer.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "http/Range.hxx"
+#include "util/IterableSplitString.hxx"
+#include "util/ScopeExit.hxx"
+#include "util/StringAPI.hxx"
+#include "util/StringStrip.hxx"
+
+#include <was/simple.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+using std::string_view_literals::operator""sv;
+
+bool
+WantsArchive(const was_simple &w) noexcept
+{
+	if (const char *q = was_simple_get_query_string(&w);
+	    q != nullptr && StringIsEqual(q, "format=tar"))
+		return true;
+
+	const char *accept = was_simple_get_header(&w, "accept");
+	if (accept == nullptr)
+		return false;
+
+	for (std::string_view i : IterableSplitString(accept, ',')) {
+		i = Strip(i.substr(0, i.find(';')));
+		if (i == "application/x-tar"sv || i == "application/tar"sv)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * An exception type which gets thrown when the tree exceeds the
+ * #PropfindConfig limits.
+ */
+struct LimitExceeded {};
+
+/**
+ * Read all entries of a directory.  They are sorted by name, so the
+ * order is the same in both passes over the tree.  Throws
+ * #LimitExceeded.
+ */
+static DirectoryScanner
+ListDirectory(FileDescriptor fd, std::size_t max_files)
+{
+	DirectoryScanner children;
+
+	/* reading moves the file offset, so it gets its own file
+	   descriptor */
+	UniqueFileDescriptor dir_fd;
+	if (!dir_fd.Open(fd, ".", O_DIRECTORY|O_RDONLY) ||
+	    !children.Scan(dir_fd, 0, max_files))
+		return children;
+
+	if (children.IsTruncated())
+		throw LimitExceeded{};
+
+	children.SortByName();
+	return children;
+}
+
+/**
+ * Generates the tar archive of a tree.  The tree is walked twice:
+ * first without output to calculate the length and the ETag, and
+ * then to send the (requested range of the) archive.  Only the names
+ * of the directories currently being walked are kept in memory.
+ */
+class TarWriter {
+	was_simple *const w;
+
+	const PropfindConfig &limits;
+
+	/**
+	 * Send the archive?  If false, then only the length and the
+	 * ETag are calculated.
+	 */
+	const bool send;
+
+	/**
+	 * The range of the archive to be sent.
+	 */
+	const uint64_t start, end;
+
+	/**
+	 * The current offset within the archive.
+	 */
+	uint64_t position = 0;
+
+	/**
+	 * A FNV-1a hash of the metadata of all entries; it is the
+	 * ETag of the archive.
+	 */
+	uint64_t hash = 0xcbf29ce484222325;
+
+	std::vector<std::byte> header;
+
+public:
+	/**
+	 * Construct an instance which only calculates the length and
+	 * the ETag.
+	 */
+	TarWriter(was_simple *_w, const PropfindConfig &_limits) noexcept
+		:w(_w), limits(_limits), send(false), start(0), end(0) {}
+
+	TarWriter(was_simple *_w, const PropfindConfig &_limits,
+		  uint64_t _start, uint64_t _end) noexcept
+		:w(_w), limits(_limits), send(true),
+		 start(_start), end(_end) {}
+
+	uint64_t GetLength() const noexcept {
+		return position;
+	}
+
+	auto MakeETag() const noexcept {
+		return FmtBuffer<32>("\"tar-{:016x}\"", hash);
+	}
+
+	/**
+	 * Generate the archive of the given directory and the end
+	 * marker.  Throws #LimitExceeded.
+	 *
+	 * @param name the name of the top-level directory in the
+	 * archive (including a trailing slash)
+	 * @return false if the output has failed
+	 */
+	bool Write(FileDescriptor fd, std::string &name,
+		   const struct statx &st);
+
+private:
+	void Hash(std::span<const std::byte> src) noexcept {
+		for (const std::byte b : src) {
+			hash ^= std::to_integer<uint64_t>(b);
+			hash *= 0x100000001b3;
+		}
+	}
+
+	void Hash(std::string_view name, const struct statx &st) noexcept;
+
+	bool WriteBuffer(std::span<const std::byte> src) noexcept;
+	bool WriteZeroes(uint64_t size) noexcept;
+	bool WriteHeader(const TarEntry &entry) noexcept;
+	bool WriteFile(FileDescriptor directory, const char *name,
+		       uint64_t size) noexcept;
+	bool WriteDirectory(FileDescriptor fd, std::string &name,
+			    unsigned depth);
+};
+
+inline void
+TarWriter::Hash(std::string_view name, const struct statx &st) noexcept
+{
+	Hash(std::as_bytes(std::span{name}));
+
+	const uint64_t values[] = {
+		st.stx_ino,
+		st.stx_size,
+		uint64_t(st.stx_mtime.tv_sec),
+		st.stx_mtime.tv_nsec,
+	};
+
+	Hash(std::as_bytes(std::span{values}));
+}
+
+bool
+TarWriter::WriteBuffer(std::span<const std::byte> src) noexcept
+{
+	const uint64_t begin = position;
+	position += src.size();
+
+	if (!send || position <= start || begin >= end)
+		return true;
+
+	const uint64_t skip = start > begin ? start - begin : 0;
+	const uint64_t stop = std::min(position, end) - begin;
+	return was_simple_write(w, src.data() + skip, stop - skip);
+}
+
+bool
+TarWriter::WriteZeroes(uint64_t size) noexcept
+{
+	static constexpr std::byte zeroes[TAR_BLOCK_SIZE]{};
+
+	while (size > 0) {
+		const std::size_t n = std::min<uint64_t>(size, sizeof(zeroes));
+		if (!WriteBuffer(std::span{zeroes}.first(n)))
+			return false;
+
+		size -= n;
+	}
+
+	return true;
+}
+
+bool
+TarWriter::WriteHeader(const TarEntry &entry) noexcept
+{
+	const std::size_t size = GetTarHeaderSize(entry.name.size());
+
+	if (!send || position + size <= start || position >= end) {
+		/* no need to format it */
+		position += size;
+		return true;
+	}
+
+	header.resize(size);
+	FormatTarHeader(header, entry);
+	return WriteBuffer(header);
+}
+
+bool
+TarWriter::WriteFile(FileDescriptor directory, const char *name,
+		     uint64_t size) noexcept
+{
+	const uint64_t begin = position;
+	position += size;
+
+	if (!send || position <= start || begin >= end)
+		return true;
+
+	/* see OpenReadOnlyNoAtime() in get.cxx */
+	UniqueFileDescriptor fd;
+	if (!fd.Open(directory, name, O_RDONLY|O_NOFOLLOW|O_NOATIME) &&
+	    (errno != EPERM || !fd.Open(directory, name, O_RDONLY|O_NOFOLLOW)))
+		return false;
+
+	const uint64_t skip = start > begin ? start - begin : 0;
+	const uint64_t stop = std::min(position, end) - begin;
+
+	if (skip > 0 && fd.Seek(skip) < 0)
+		return false;
+
+	return SpliceToWas(w, fd, stop - skip);
+}
+
+bool
+TarWriter::WriteDirectory(FileDescriptor fd, std::string &name,
+			  unsigned depth)
+{
+	const auto children = ListDirectory(fd, limits.max_files);
+	if (!children.empty() && depth >= limits.max_depth)
+		throw LimitExceeded{};
+
+	const std::size_t name_length = name.size();
+	AtScopeExit(&name, name_length) { name.resize(name_length); };
+
+	for (const auto &i : children.GetEntries()) {
+		/* symlinks and special files are omitted, and if the
+		   filesystem reports the type, they don't need a
+		   statx() */
+		if (i.type != DT_UNKNOWN && i.type != DT_REG && i.type != DT_DIR)
+			continue;
+
+		const char *const child = children.GetName(i);
+		struct statx st;
+		if (statx(fd.Get(), child, AT_SYMLINK_NOFOLLOW,
+			  STATX_TYPE|STATX_MTIME|STATX_INO|STATX_SIZE,
+			  &st) < 0)
+			/* probably deleted meanwhile */
+			continue;
+
+		name.resize(name_length);
+		name.append(child);
+
+		if (S_ISREG(st.stx_mode)) {
+			Hash(name, st);
+
+			const TarEntry entry{
+				.type = TarEntry::Type::REGULAR,
+				.name = name,
+				.size = st.stx_size,
+				.mtime = st.stx_mtime.tv_sec,
+			};
+
+			if (!WriteHeader(entry) ||
+			    !WriteFile(fd, child, entry.size) ||
+			    !WriteZeroes(entry.GetPadding()))
+				return false;
+		} else if (S_ISDIR(st.stx_mode)) {
+			name.push_back('/');
+			Hash(name, st);
+
+			const TarEntry entry{
+				.type = TarEntry::Type::DIRECTORY,
+				.name = name,
+				.size = 0,
+				.mtime = st.stx_mtime.tv_sec,
+			};
+
+			if (!WriteHeader(entry))
+				return false;
+
+			UniqueFileDescriptor sub;
+			if (!sub.Open(fd, child,
+				      O_PATH|O_DIRECTORY|O_NOFOLLOW))
+				continue;
+
+			if (!WriteDirectory(sub, name, depth + 1))
+				return false;
+		}
+
+		/* symlinks and special files are omitted */
+	}
+
+	return true;
+}
+
+bool
+TarWriter::Write(FileDescriptor fd, std::string &name,
+		 const struct statx &st)
+{
+	Hash(name, st);
+
+	const TarEntry entry{
+		.type = TarEntry::Type::DIRECTORY,
+		.name = name,
+		.size = 0,
+		.mtime = st.stx_mtime.tv_sec,
+	};
+
+	return WriteHeader(entry) &&
+		WriteDirectory(fd, name, 0) &&
+		/* the end of the archive is marked by two empty
+		   blocks */
+		WriteZeroes(2 * TAR_BLOCK_SIZE);
+}
+
+/**
+ * Determine the name of the top-level directory in the archive.
+ */
+static std::string
+GetArchiveRootName(std::string_view path) noexcept
+{
+	while (path.size() > 1 && path.back() == '/')
+		path.remove_suffix(1);
+
+	std::string name{path.substr(path.rfind('/') + 1)};
+	if (name.empty() || name == "/"sv)
+		name = "root";
+
+	name.push_back('/');
+	return name;
+}
+
+/**
+ * Can the name be used in a "Content-Disposition" header without
+ * quoting or encoding?
+ */
+[[gnu::pure]]
+static bool
+IsSafeFilename(std::string_view name) noexcept
+{
+	return std::all_of(name.begin(), name.end(), [](char ch){
+		return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+			(ch >= '0' && ch <= '9') ||
+			ch == '-' || ch == '_' || ch == '.' || ch == ' ';
+	});
+}
+
+static bool
+SendArchiveHeaders(was_simple *w, std::string_view root_name,
+		   const char *etag) noexcept
+{
+	const auto base = root_name.substr(0, root_name.size() - 1);
+
+	if (IsSafeFilename(base) &&
+	    !was_simple_set_header(w, "content-disposition",
+				   FmtBuffer<512>("attachment; filename=\"{}.tar\"",
+						  base)))
+		return false;
+
+	return was_simple_set_header(w, "content-type", "application/x-tar") &&
+		was_simple_set_header(w, "accept-ranges", "bytes") &&
+		was_simple_set_header(w, "etag", etag);
+}
+
+void
+handle_get_archive(was_simple *w, const FileResource &resource,
+		   const PropfindConfig &limits, bool head)
+{
+	UniqueFileDescriptor fd;
+	if (!fd.Open(resource.GetPath(), O_PATH|O_DIRECTORY)) {
+		errno_response(w);
+		return;
+	}
+
+	std::string name = GetArchiveRootName(resource.GetPathView());
+
+	/* the first pass calculates the length, which allows
+	   "Content-Length" and thus "Range" */
+	TarWriter counter{w, limits};
+
+	try {
+		counter.Write(fd, name, resource.GetStat());
+	} catch (LimitExceeded) {
+		was_simple_status(w, HTTP_STATUS_INSUFFICIENT_STORAGE);
+		return;
+	}
+
+	const uint64_t length = counter.GetLength();
+	const auto etag = counter.MakeETag();
+
+	HttpRangeRequest range(length);
+
+	if (const char *p = was_simple_get_header(w, "range"); p != nullptr) {
+		const char *if_range = was_simple_get_header(w, "if-range");
+		if (if_range == nullptr || StringIsEqual(if_range, etag))
+			range.ParseRangeHeader(p);
+	}
+
+	switch (range.type) {
+	case HttpRangeRequest::Type::NONE:
+		break;
+
+	case HttpRangeRequest::Type::VALID:
+		if (!was_simple_status(w, HTTP_STATUS_PARTIAL_CONTENT) ||
+		    !was_simple_set_header(w, "content-range",
+					   FmtBuffer<128>("bytes {}-{}/{}",
+							  range.skip,
+							  range.size - 1,
+							  length)))
+			return;
+
+		break;
+
+	case HttpRangeRequest::Type::INVALID:
+		if (was_simple_status(w, HTTP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE) &&
+		    was_simple_set_header(w, "content-range",
+					  FmtBuffer<128>("bytes */{}", length)))
+			SendArchiveHeaders(w, name, etag);
+		return;
+	}
+
+	if (!SendArchiveHeaders(w, name, etag))
+		return;
+
+	if (head) {
+		was_simple_set_header(w, "content-length",
+				      FmtBuffer<32>("{}", range.size - range.skip));
+		return;
+	}
+
+	if (!was_simple_set_length(w, range.size - range.skip))
+		return;
+
+	/* if the tree is modified between the two passes, the output
+	   is clipped at the announced length, and libwas aborts the
+	   response if it is shorter */
+	TarWriter writer{w, limits, range.skip, range.size};
+
+	try {
+		writer.Write(fd, name, resource.GetStat());
+	} catch (LimitExceeded) {
+		/* the tree has grown meanwhile; the response is
+		   incomplete */
+	}
+}
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Request handler for GET on collections (download as tar archive).
+ */
+
+#pragma once
+
+struct was_simple;
+struct PropfindConfig;
+class FileResource;
+
+/**
+ * Does the client want to download a collection as an archive?
+ * This is requested with "Accept: application/x-tar" or with the
+ * query string "format=tar" (for browsers).
+ */
+[[gnu::pure]]
+bool
+WantsArchive(const was_simple &w) noexcept;
+
+/**
+ * Send the subtree of a collection as a tar archive.  The PROPFIND
+ * limits apply; larger trees are refused with "507 Insufficient
+ * Storage".
+ *
+ * @param head only send the headers (for HEAD)
+ */
+void
+handle_get_archive(was_simple *w, const FileResource &resource,
+		   const PropfindConfig &limits, bool head);
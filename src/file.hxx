@@ -66,6 +66,10 @@ public:
 		return st.stx_size;
 	}
 
+	unsigned GetLinkCount() const noexcept {
+		return st.stx_nlink;
+	}
+
 	std::chrono::system_clock::time_point GetAccessTime() const noexcept {
 		return ToSystemTimePoint(st.stx_atime);
 	}
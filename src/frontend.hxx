@@ -2,19 +2,30 @@
 // Copyright CM4all GmbH
 // author: Max Kellermann <max.kellermann@ionos.com>
 
+#include "ConnectionThreads.hxx"
+#include "MultiWas.hxx"
+#include "Qos.hxx"
+#include "Trace.hxx"
+#include "util.hxx"
+#include "system/Error.hxx"
 #include "was/Loop.hxx"
+#include "was/ExceptionResponse.hxx"
 #include "was/WasOutputStream.hxx"
 #include "util/UriEscape.hxx"
 #include "util/LightString.hxx"
+#include "util/PrintException.hxx"
 #include "util/ScopeExit.hxx"
 #include "util/StringCompare.hxx"
 
+#include <list>
 #include <string>
 #include <string_view>
 
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 #ifdef __linux
@@ -27,32 +38,70 @@
 
 using std::string_view_literals::operator""sv;
 
-static const char *dav_header;
+/**
+ * The configuration of one site (i.e. one set of WAS parameters) and
+ * the #Backend which was set up for it.
+ */
+template<typename Backend>
+struct Site {
+	/**
+	 * All WAS parameters; see MakeSiteKey().
+	 */
+	std::string key;
+
+	mode_t umask;
+
+	/**
+	 * The URI prefix mapped to the document root; it begins and
+	 * ends with a slash.
+	 */
+	std::string mountpoint;
+
+	/**
+	 * The value of the "DAV" response header.
+	 */
+	std::string dav_header;
 
-static std::string_view mountpoint;
+	/**
+	 * The value of the "Allow" response header for collections.
+	 */
+	std::string allow_directory;
+
+	QosConfig qos;
+
+	Backend backend;
+
+	/**
+	 * @return false on error (after printing an error message)
+	 */
+	bool Setup(was_simple *w) noexcept;
+};
 
 template<typename Backend>
 static void
-handle_options(was_simple *was, const typename Backend::Resource &resource)
+handle_options(was_simple *was, const Site<Backend> &site,
+	       const typename Backend::Resource &resource)
 {
-	const char *allow_new = "OPTIONS,MKCOL,PUT,LOCK";
-	const char *allow_file =
-		"OPTIONS,GET,HEAD,DELETE,PROPFIND,PROPPATCH,COPY,MOVE,PUT,LOCK,UNLOCK";
-	const char *allow_directory =
-		"OPTIONS,DELETE,PROPFIND,PROPPATCH,COPY,MOVE,LOCK,UNLOCK";
+	const bool read_only = site.backend.IsReadOnly();
+	const char *allow_new = read_only
+		? "OPTIONS"
+		: "OPTIONS,MKCOL,PUT,LOCK";
+	const char *allow_file = read_only
+		? "OPTIONS,GET,HEAD,PROPFIND"
+		: "OPTIONS,GET,HEAD,DELETE,PROPFIND,PROPPATCH,COPY,MOVE,PUT,LOCK,UNLOCK";
 
 	const char *allow;
 	if (!resource.Exists())
 		allow = allow_new;
 	else if (resource.IsDirectory())
-		allow = allow_directory;
+		allow = site.allow_directory.c_str();
 	else
 		allow = allow_file;
 
 	was_simple_set_header(was, "allow", allow);
 
 	/* RFC 4918 10.1 */
-	was_simple_set_header(was, "dav", dav_header);
+	was_simple_set_header(was, "dav", site.dav_header.c_str());
 }
 
 /**
@@ -94,7 +143,7 @@ struct OutsideUri {};
  */
 template<class Backend>
 static typename Backend::Resource
-map_uri(const Backend &backend, const char *_uri)
+map_uri(const Site<Backend> &site, const char *_uri)
 {
 	assert(_uri != nullptr);
 
@@ -104,9 +153,10 @@ map_uri(const Backend &backend, const char *_uri)
 
 	std::string_view uri = unescaped.c_str();
 
-	if (uri.contains("/../"sv) || uri.ends_with("/.."sv))
+	if (HasDotDotSegment(uri))
 		throw MalformedUri();
 
+	const std::string_view mountpoint = site.mountpoint;
 	if (SkipPrefix(uri, mountpoint)) {
 	} else if (uri == mountpoint.substr(0, mountpoint.size() - 1))
 		/* special case for clients that remove the trailing slash
@@ -119,11 +169,11 @@ map_uri(const Backend &backend, const char *_uri)
 	if (uri.ends_with('/'))
 		uri = uri.substr(0, uri.size() - 1);
 
-	return backend.Map(uri);
+	return site.backend.Map(uri);
 }
 
 static bool
-configure_umask(was_simple *w)
+parse_umask(was_simple *w, mode_t &value_r)
 {
 	const char *p = was_simple_get_parameter(w, "DAVOS_UMASK");
 	if (p == nullptr)
@@ -136,13 +186,18 @@ configure_umask(was_simple *w)
 		return false;
 	}
 
-	static unsigned long old = -1;
+	value_r = value;
+	return true;
+}
+
+static void
+apply_umask(mode_t value) noexcept
+{
+	static thread_local mode_t old = -1;
 	if (value != old) {
 		old = value;
 		umask(value);
 	}
-
-	return true;
 }
 
 static constexpr bool
@@ -151,9 +206,13 @@ check_mountpoint(std::string_view s) noexcept
 	return !s.empty() && s.front() == '/' && s.back() == '/';
 }
 
-static bool
-configure_mapper(was_simple *w)
+template<typename Backend>
+bool
+Site<Backend>::Setup(was_simple *w) noexcept
 {
+	if (!parse_umask(w, umask))
+		return false;
+
 	const char *m = was_simple_get_parameter(w, "DAVOS_MOUNT");
 	if (m == nullptr) {
 		fprintf(stderr, "No DAVOS_MOUNT\n");
@@ -166,26 +225,105 @@ configure_mapper(was_simple *w)
 		return false;
 	}
 
+	const char *dav = was_simple_get_parameter(w, "DAVOS_DAV_HEADER");
+	dav_header = dav != nullptr ? dav : "1";
+
+	if (!qos.Setup(w) || !backend.Setup(w))
+		return false;
+
+	if (backend.IsReadOnly()) {
+		allow_directory = "OPTIONS,PROPFIND";
+		return true;
+	}
+
+	allow_directory = "OPTIONS,DELETE,PROPFIND,PROPPATCH,COPY,MOVE,LOCK,UNLOCK";
+	if (backend.AllowsPost())
+		allow_directory += ",POST";
+	if (backend.AllowsReport())
+		allow_directory += ",REPORT";
+
 	return true;
 }
 
-static bool
-configure_dav_header(was_simple *w)
+/**
+ * Build a string which identifies the site: all WAS parameters,
+ * names and values separated by null bytes.
+ */
+static void
+MakeSiteKey(was_simple *w, std::string &key)
 {
-	dav_header = was_simple_get_parameter(w, "DAVOS_DAV_HEADER");
-	if (dav_header == nullptr)
-		dav_header = "1";
+	key.clear();
 
-	return true;
+	auto *i = was_simple_get_parameter_iterator(w);
+	if (i == nullptr)
+		return;
+
+	AtScopeExit(i) { was_simple_iterator_free(i); };
+
+	while (const auto *p = was_simple_iterator_next(i)) {
+		key.append(p->name);
+		key.push_back('\0');
+		key.append(p->value);
+		key.push_back('\0');
+	}
 }
 
+/**
+ * Each thread keeps the most recently used sites, so a worker
+ * switching between a handful of them parses the parameters and
+ * sets up the #Backend only once per site instead of once per
+ * request.
+ */
 template<typename Backend>
-static bool
-configure(Backend &backend, was_simple *w)
+class SiteCache {
+	static constexpr std::size_t MAX_SITES = 8;
+
+	/**
+	 * Most recently used first.
+	 */
+	std::list<Site<Backend>> sites;
+
+	/**
+	 * The key of the current request; this is a member only to
+	 * reuse its buffer.
+	 */
+	std::string key;
+
+public:
+	/**
+	 * Find or set up the #Site for the current request.
+	 *
+	 * @return nullptr on error (after printing an error message)
+	 */
+	Site<Backend> *Get(was_simple *w);
+};
+
+template<typename Backend>
+Site<Backend> *
+SiteCache<Backend>::Get(was_simple *w)
 {
-	return configure_umask(w) && configure_mapper(w) &&
-		configure_dav_header(w) &&
-		backend.Setup(w);
+	MakeSiteKey(w, key);
+
+	for (auto i = sites.begin(); i != sites.end(); ++i) {
+		if (i->key == key) {
+			sites.splice(sites.begin(), sites, i);
+			return &sites.front();
+		}
+	}
+
+	if (sites.size() >= MAX_SITES)
+		sites.pop_back();
+
+	/* set up a fresh instance, so parameters of other sites
+	   can't leak into this one */
+	auto &site = sites.emplace_front();
+	if (!site.Setup(w)) {
+		sites.pop_front();
+		return nullptr;
+	}
+
+	site.key = key;
+	return &site;
 }
 
 [[gnu::pure]]
@@ -199,9 +337,10 @@ HasTrailingSlash(const char *uri)
 
 template<typename Backend>
 static void
-run2(Backend &backend, was_simple *was, const char *uri)
+run2(Site<Backend> &site, was_simple *was, const char *uri)
 try {
-	auto resource = map_uri(backend, uri);
+	auto &backend = site.backend;
+	auto resource = map_uri(site, uri);
 
 	const http_method_t method = was_simple_get_method(was);
 
@@ -224,7 +363,7 @@ try {
 		if (!was_simple_input_close(was))
 			return;
 
-		handle_options<Backend>(was, resource);
+		handle_options<Backend>(was, site, resource);
 		break;
 
 	case HTTP_METHOD_HEAD:
@@ -250,21 +389,25 @@ try {
 		backend.HandlePut(was, resource);
 		break;
 
+	case HTTP_METHOD_POST:
+		backend.HandlePost(was, uri, resource);
+		break;
+
 	case HTTP_METHOD_DELETE:
 		if (!was_simple_input_close(was))
 			return;
 
-		backend.HandleDelete(was, resource);
+		backend.HandleDelete(was, uri, resource);
 		break;
 
 	case HTTP_METHOD_PROPFIND:
-		/* TODO: parse request body */
-		if (!was_simple_input_close(was))
-			return;
-
 		backend.HandlePropfind(was, uri, resource);
 		break;
 
+	case HTTP_METHOD_REPORT:
+		backend.HandleReport(was, uri, resource);
+		break;
+
 	case HTTP_METHOD_PROPPATCH:
 		backend.HandleProppatch(was, uri, resource);
 		break;
@@ -288,8 +431,8 @@ try {
 
 		p = get_uri_path(p);
 
-		auto destination = map_uri(backend, p);
-		backend.HandleCopy(was, resource, destination);
+		auto destination = map_uri(site, p);
+		backend.HandleCopy(was, resource, p, destination);
 	}
 		break;
 
@@ -305,7 +448,7 @@ try {
 
 		p = get_uri_path(p);
 
-		auto destination = map_uri(backend, p);
+		auto destination = map_uri(site, p);
 		backend.HandleMove(was, resource, destination);
 	}
 		break;
@@ -331,29 +474,124 @@ try {
 
 template<typename Backend>
 static void
-run(Backend &backend, was_simple *was, const char *uri)
+run(SiteCache<Backend> &sites, was_simple *was, const char *uri)
 {
-	if (!configure(backend, was)) {
+	const TraceScope trace{*was, uri};
+
+	auto *site = sites.Get(was);
+	if (site == nullptr) {
 		was_simple_status(was, HTTP_STATUS_INTERNAL_SERVER_ERROR);
 		return;
 	}
 
+	apply_umask(site->umask);
+
+	const QosScope qos{*was, site->qos};
+
+	auto &backend = site->backend;
 	AtScopeExit(&backend) {
 		backend.TearDown();
 	};
 
-	run2(backend, was, uri);
+	run2(*site, was, uri);
 }
 
+/**
+ * Serve requests on one WAS connection until it gets closed.  This
+ * runs in a separate thread, with its own #Backend instance.
+ */
 template<typename Backend>
 static void
-run(Backend &backend)
+run_connection(WasConnectionFds fds) noexcept
+{
+	/* the umask is a process attribute, but each connection may
+	   configure a different one; unsharing the filesystem
+	   attributes gives this thread its own umask */
+	if (unshare(CLONE_FS) < 0) {
+		/* closing the file descriptors drops the
+		   connection */
+		PrintException(MakeErrno("unshare(CLONE_FS) failed"));
+		return;
+	}
+
+	/* the was_simple object takes ownership of the file
+	   descriptors */
+	was_simple *was = was_simple_new_fds(fds.control.Release().Get(),
+					     fds.input.Release().Get(),
+					     fds.output.Release().Get());
+	if (was == nullptr)
+		return;
+
+	AtScopeExit(was) { was_simple_free(was); };
+
+	SiteCache<Backend> sites;
+
+	while (const char *uri = was_simple_accept(was)) {
+		try {
+			run(sites, was, uri);
+		} catch (Was::EndResponse) {
+		} catch (...) {
+			PrintException(std::current_exception());
+			was_simple_abort(was);
+			continue;
+		}
+
+		was_simple_end(was);
+	}
+}
+
+/**
+ * Receive WAS connections from the Multi-WAS socket and serve each
+ * of them in a new thread.  A slow request (e.g. on a stalled NFS
+ * mount) blocks only its own connection, and beng-proxy can run many
+ * requests concurrently in one process.
+ *
+ * At most #max_connections are served at a time; more connections
+ * wait in the socket.  This returns only after all connections have
+ * been finished.
+ */
+template<typename Backend>
+static void
+run_multi(FileDescriptor fd, unsigned max_connections)
+{
+	MultiWasSocket socket{fd};
+	ConnectionThreads threads{max_connections};
+
+	while (true) {
+		threads.WaitSlot();
+
+		WasConnectionFds fds;
+		if (!socket.Receive(fds))
+			break;
+
+		threads.Start([fds = std::move(fds)]() mutable {
+			run_connection<Backend>(std::move(fds));
+		});
+	}
+}
+
+/**
+ * @param max_connections the maximum number of concurrent
+ * connections of a Multi-WAS process
+ */
+template<typename Backend>
+static void
+run(unsigned max_connections)
 {
 #ifdef __linux
 	prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
 #endif
 
-	WasLoop([&backend](struct was_simple *was, const char *uri){
-		run(backend, was, uri);
+	if (const FileDescriptor fd{STDIN_FILENO};
+	    MultiWasSocket::Check(fd)) {
+		/* each connection gets its own #SiteCache */
+		run_multi<Backend>(fd, max_connections);
+		return;
+	}
+
+	SiteCache<Backend> sites;
+
+	WasLoop([&sites](struct was_simple *was, const char *uri){
+		run(sites, was, uri);
 	});
 }
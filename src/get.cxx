@@ -12,8 +12,8 @@
 #include "error.hxx"
 #include "file.hxx"
 #include "mime_types.hxx"
+#include "Transfer.hxx"
 #include "was/ExceptionResponse.hxx"
-#include "was/Splice.hxx"
 #include "lib/fmt/ToBuffer.hxx"
 #include "io/UniqueFileDescriptor.hxx"
 #include "http/Date.hxx"
@@ -25,17 +25,13 @@
 
 #include <fmt/format.h>
 
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
 
 static bool
-SendETagHeader(was_simple *was, const struct statx &st) noexcept
-{
-	return was_simple_set_header(was, "etag", MakeETag(st));
-}
-
-static bool
-static_response_headers(was_simple *was, const FileResource &resource)
+static_response_headers(was_simple *was, const FileResource &resource,
+			const char *etag)
 {
 	const char *content_type = LookupMimeTypeByFilePath(resource.GetPathView());
 	if (content_type == nullptr)
@@ -47,18 +43,19 @@ static_response_headers(was_simple *was, const FileResource &resource)
 				   http_date_format(resource.GetModificationTime())))
 		return false;
 
-	return SendETagHeader(was, resource.GetStat());
+	return was_simple_set_header(was, "etag", etag);
 }
 
 static bool
-SendNotModified(was_simple *was, const struct statx &st) noexcept
+SendNotModified(was_simple *was, const char *etag) noexcept
 {
 	return was_simple_status(was, HTTP_STATUS_NOT_MODIFIED) &&
-		SendETagHeader(was, st);
+		was_simple_set_header(was, "etag", etag);
 }
 
 static void
-HandleIfModifiedSince(was_simple *was, const struct statx &st)
+HandleIfModifiedSince(was_simple *was, const struct statx &st,
+		      const char *etag)
 {
 	const char *p = was_simple_get_header(was, "if-modified-since");
 	if (p == nullptr)
@@ -71,7 +68,7 @@ HandleIfModifiedSince(was_simple *was, const struct statx &st)
 	}
 
 	if (ToSystemTimePoint(st.stx_mtime) < t) {
-		SendNotModified(was, st);
+		SendNotModified(was, etag);
 		throw Was::EndResponse{};
 	}
 }
@@ -99,9 +96,9 @@ HandleIfUnmodifiedSince(was_simple *was, const struct statx &st)
  * @return false if there was no If-Match header
  */
 static bool
-HandleIfMatch(was_simple *was, const struct statx &st)
+HandleIfMatch(was_simple *was, const char *etag)
 {
-	switch (CheckIfMatch(*was, &st)) {
+	switch (CheckIfMatch(*was, etag)) {
 	case PreconditionResult::NONE:
 		return false;
 
@@ -120,9 +117,9 @@ HandleIfMatch(was_simple *was, const struct statx &st)
  * @return false if there was no If-None-Match header
  */
 static bool
-HandleIfNoneMatch(was_simple *was, const struct statx &st)
+HandleIfNoneMatch(was_simple *was, const char *etag)
 {
-	switch (CheckIfNoneMatch(*was, &st)) {
+	switch (CheckIfNoneMatch(*was, etag)) {
 	case PreconditionResult::NONE:
 		return false;
 
@@ -130,7 +127,7 @@ HandleIfNoneMatch(was_simple *was, const struct statx &st)
 		return true;
 
 	case PreconditionResult::FAILURE:
-		SendNotModified(was, st);
+		SendNotModified(was, etag);
 		throw Was::EndResponse{};
 	}
 
@@ -141,7 +138,7 @@ HandleIfNoneMatch(was_simple *was, const struct statx &st)
  * Verifies the If-Range request header (RFC 2616 14.27).
  */
 static bool
-CheckIfRange(const char *if_range, const struct statx &st)
+CheckIfRange(const char *if_range, const struct statx &st, const char *etag)
 {
 	if (if_range == nullptr)
 		return true;
@@ -150,14 +147,27 @@ CheckIfRange(const char *if_range, const struct statx &st)
 	if (t != std::chrono::system_clock::from_time_t(-1))
 		return std::chrono::system_clock::from_time_t(st.stx_mtime.tv_sec) == t;
 
-	return StringIsEqual(if_range, MakeETag(st));
+	return StringIsEqual(if_range, etag);
+}
+
+/**
+ * Open the file with O_NOATIME, to avoid an inode update for each
+ * GET.  This is only allowed for the owner of the file, so fall back
+ * to a plain open() if we're not.
+ */
+static bool
+OpenReadOnlyNoAtime(UniqueFileDescriptor &fd, const char *path) noexcept
+{
+	return fd.Open(path, O_RDONLY|O_NOATIME) ||
+		(errno == EPERM && fd.Open(path, O_RDONLY));
 }
 
 void
-handle_get(was_simple *was, const FileResource &resource)
+handle_get(was_simple *was, const FileResource &resource,
+	   const ETagConfig &etag_config)
 {
 	UniqueFileDescriptor fd;
-	if (!fd.Open(resource.GetPath(), O_RDONLY)) {
+	if (!OpenReadOnlyNoAtime(fd, resource.GetPath())) {
 		errno_response(was);
 		return;
 	}
@@ -175,10 +185,14 @@ handle_get(was_simple *was, const FileResource &resource)
 		return;
 	}
 
-	const bool has_if_match = HandleIfMatch(was, st);
-	const bool has_if_none_match = HandleIfNoneMatch(was, st);
+	const auto etag = GetETag(etag_config, fd, resource.GetPath(), st);
+
+	/* the ETag is determined only once, because it may be a
+	   content hash */
+	const bool has_if_match = HandleIfMatch(was, etag);
+	const bool has_if_none_match = HandleIfNoneMatch(was, etag);
 	if (!has_if_none_match)
-		HandleIfModifiedSince(was, st);
+		HandleIfModifiedSince(was, st, etag);
 	if (!has_if_match)
 		HandleIfUnmodifiedSince(was, st);
 
@@ -186,7 +200,7 @@ handle_get(was_simple *was, const FileResource &resource)
 
 	const char *p = was_simple_get_header(was, "range");
 	if (p != nullptr &&
-	    CheckIfRange(was_simple_get_header(was, "if-range"), st))
+	    CheckIfRange(was_simple_get_header(was, "if-range"), st, etag))
 		range.ParseRangeHeader(p);
 
 	switch (range.type) {
@@ -215,21 +229,17 @@ handle_get(was_simple *was, const FileResource &resource)
 							  st.stx_size)))
 		    return;
 
-		static_response_headers(was, resource);
-		return;
-	}
-
-	if (range.skip > 0 && fd.Seek(range.skip) < 0) {
-		errno_response(was);
+		static_response_headers(was, resource, etag);
 		return;
 	}
 
-	if (static_response_headers(was, resource))
-		SpliceToWas(was, fd, range.size - range.skip);
+	if (static_response_headers(was, resource, etag))
+		TransferToWas(was, fd, range.skip, range.size - range.skip);
 }
 
 void
-handle_head(was_simple *was, const FileResource &resource)
+handle_head(was_simple *was, const FileResource &resource,
+	    const ETagConfig &etag_config)
 {
 	if (!resource.Exists()) {
 		errno_response(was, resource.GetError());
@@ -245,5 +255,9 @@ handle_head(was_simple *was, const FileResource &resource)
 				   fmt::format_int{resource.GetSize()}.c_str()))
 		return;
 
-	static_response_headers(was, resource);
+	static_response_headers(was, resource,
+				GetETag(etag_config,
+					FileDescriptor::Undefined(),
+					resource.GetPath(),
+					resource.GetStat()));
 }
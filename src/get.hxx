@@ -9,10 +9,13 @@
 #pragma once
 
 struct was_simple;
+struct ETagConfig;
 class FileResource;
 
 void
-handle_get(was_simple *was, const FileResource &resource);
+handle_get(was_simple *was, const FileResource &resource,
+	   const ETagConfig &etag_config);
 
 void
-handle_head(was_simple *was, const FileResource &resource);
+handle_head(was_simple *was, const FileResource &resource,
+	    const ETagConfig &etag_config);
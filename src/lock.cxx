@@ -9,7 +9,7 @@
 #include "lock.hxx"
 #include "wxml.hxx"
 #include "error.hxx"
-#include "expat.hxx"
+#include "DavParser.hxx"
 #include "was/WasOutputStream.hxx"
 
 #include <was/simple.h>
@@ -19,96 +19,6 @@
 
 #include <string.h>
 
-static void
-begin_prop(BufferedOutputStream &o)
-{
-	wxml_declaration(o);
-	wxml_begin_tag(o, "D:prop");
-	wxml_attribute(o, "xmlns:D", "DAV:");
-	wxml_end_tag(o);
-}
-
-static void
-end_prop(BufferedOutputStream &o)
-{
-	wxml_close_element(o, "D:prop");
-}
-
-static void
-locktoken_href(BufferedOutputStream &o, std::string_view token)
-{
-	wxml_open_element(o, "D:locktoken");
-	href(o, token);
-	wxml_close_element(o, "D:locktoken");
-}
-
-static void
-owner_href(BufferedOutputStream &o, std::string_view token)
-{
-	wxml_open_element(o, "D:owner");
-	href(o, token);
-	wxml_close_element(o, "D:owner");
-}
-
-static void XMLCALL
-start_element(void *userData, const XML_Char *name,
-	      [[maybe_unused]] const XML_Char **atts)
-{
-	LockParserData &data = *(LockParserData *)userData;
-
-	switch (data.state) {
-	case LockParserData::ROOT:
-		if (strcmp(name, "DAV:|owner") == 0)
-			data.state = LockParserData::OWNER;
-		break;
-
-	case LockParserData::OWNER:
-		if (strcmp(name, "DAV:|href") == 0)
-			data.state = LockParserData::OWNER_HREF;
-		break;
-
-	case LockParserData::OWNER_HREF:
-		break;
-	}
-}
-
-static void XMLCALL
-end_element(void *userData, const XML_Char *name)
-{
-	LockParserData &data = *(LockParserData *)userData;
-
-	switch (data.state) {
-	case LockParserData::ROOT:
-		break;
-
-	case LockParserData::OWNER:
-		if (strcmp(name, "DAV:|owner") == 0)
-			data.state = LockParserData::ROOT;
-		break;
-
-	case LockParserData::OWNER_HREF:
-		if (strcmp(name, "DAV:|href") == 0)
-			data.state = LockParserData::OWNER;
-		break;
-	}
-}
-
-static void XMLCALL
-char_data(void *userData, const XML_Char *s, int len)
-{
-	LockParserData &data = *(LockParserData *)userData;
-
-	switch (data.state) {
-	case LockParserData::ROOT:
-	case LockParserData::OWNER:
-		break;
-
-	case LockParserData::OWNER_HREF:
-		data.owner_href.assign(s, len);
-		break;
-	}
-}
-
 bool
 LockMethod::ParseRequest(was_simple *w)
 {
@@ -116,14 +26,13 @@ LockMethod::ParseRequest(was_simple *w)
 		/* lock refresh, no XML request body */
 		return false;
 
-	ExpatParser expat(&data);
-	expat.SetElementHandler(start_element, end_element);
-	expat.SetCharacterDataHandler(char_data);
-	if (!expat.Parse(w)) {
-		was_simple_status(w, HTTP_STATUS_BAD_REQUEST);
+	auto &parser = GetThreadDavParser();
+	if (const auto status = parser.Parse(w); status != HTTP_STATUS_OK) {
+		was_simple_status(w, status);
 		return false;
 	}
 
+	owner_href = parser.GetOwnerHref();
 	return true;
 }
 
@@ -144,26 +53,30 @@ LockMethod::Run(was_simple *w, bool created)
 	WasOutputStream wos{w};
 	BufferedOutputStream bos{wos};
 
-	begin_prop(bos);
-	wxml_open_element(bos, "D:lockdiscovery");
-	wxml_open_element(bos, "D:activelock");
-
-	wxml_open_element(bos, "D:locktype");
-	wxml_short_element(bos, "D:write");
-	wxml_close_element(bos, "D:locktype");
-
-	wxml_open_element(bos, "D:lockscope");
-	wxml_short_element(bos, "D:exclusive");
-	wxml_close_element(bos, "D:lockscope");
-
-	wxml_string_element(bos, "D:depth", "infinity");
-
-	locktoken_href(bos, token);
-	if (!data.owner_href.empty())
-		owner_href(bos, data.owner_href);
-	wxml_close_element(bos, "D:activelock");
-	wxml_close_element(bos, "D:lockdiscovery");
-	end_prop(bos);
+	wxml_write(bos, WxmlDeclaration{},
+		   WxmlConst<"<D:prop xmlns:D=\"DAV:\">">{},
+		   WxmlOpen<"D:lockdiscovery">{},
+		   WxmlOpen<"D:activelock">{},
+		   WxmlOpen<"D:locktype">{},
+		   WxmlShort<"D:write">{},
+		   WxmlClose<"D:locktype">{},
+		   WxmlOpen<"D:lockscope">{},
+		   WxmlShort<"D:exclusive">{},
+		   WxmlClose<"D:lockscope">{},
+		   WxmlConst<"<D:depth>infinity</D:depth>">{},
+		   WxmlOpen<"D:locktoken">{},
+		   WxmlOpen<"D:href">{}, WxmlText{token}, WxmlClose<"D:href">{},
+		   WxmlClose<"D:locktoken">{});
+
+	if (!owner_href.empty())
+		wxml_write(bos, WxmlOpen<"D:owner">{},
+			   WxmlOpen<"D:href">{}, WxmlText{owner_href},
+			   WxmlClose<"D:href">{},
+			   WxmlClose<"D:owner">{});
+
+	wxml_write(bos, WxmlClose<"D:activelock">{},
+		   WxmlClose<"D:lockdiscovery">{},
+		   WxmlClose<"D:prop">{});
 
 	bos.Flush();
 }
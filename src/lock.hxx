@@ -8,24 +8,15 @@
 
 #pragma once
 
-#include <string>
+#include <string_view>
 
 struct was_simple;
 
-struct LockParserData {
-	enum State {
-		ROOT,
-		OWNER,
-		OWNER_HREF,
-	} state;
-
-	std::string owner_href;
-
-	LockParserData():state(ROOT) {}
-};
-
 class LockMethod {
-	LockParserData data;
+	/**
+	 * Points into the thread's #DavParser.
+	 */
+	std::string_view owner_href;
 
 public:
 	bool ParseRequest(was_simple *w);
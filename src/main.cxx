@@ -3,9 +3,17 @@
 // author: Max Kellermann <max.kellermann@ionos.com>
 
 #include "frontend.hxx"
+#if defined(DAVOS_CONTENT_STORE)
+#include "ContentStoreBackend.hxx"
+#elif defined(DAVOS_PACKED)
+#include "PackedBackend.hxx"
+#else
 #include "PlainBackend.hxx"
+#endif
 #include "PivotRoot.hxx"
 #include "IsolatePath.hxx"
+#include "PropfindCache.hxx"
+#include "Trace.hxx"
 #include "util/PrintException.hxx"
 
 #include <cerrno>
@@ -17,6 +25,14 @@
 #include <unistd.h>
 #include <sys/time.h>
 
+#if defined(DAVOS_CONTENT_STORE)
+using Backend = ContentStoreBackend;
+#elif defined(DAVOS_PACKED)
+using Backend = PackedBackend;
+#else
+using Backend = PlainBackend;
+#endif
+
 static void
 MaybePivotRoot()
 {
@@ -47,14 +63,60 @@ MaybeIsolatePath()
 	IsolatePath(path);
 }
 
+static void
+MaybeSetupPropfindCache()
+{
+	const char *s = getenv("DAVOS_PROPFIND_CACHE");
+	if (s == nullptr)
+		return;
+
+	char *endptr;
+	const unsigned long long max_size = strtoull(s, &endptr, 10);
+	if (endptr == s || *endptr != 0)
+		throw std::runtime_error("Malformed DAVOS_PROPFIND_CACHE");
+
+	SetupPropfindCache(max_size);
+}
+
+/**
+ * @return the value of DAVOS_MAX_CONNECTIONS
+ */
+static unsigned
+GetMaxConnections()
+{
+	const char *s = getenv("DAVOS_MAX_CONNECTIONS");
+	if (s == nullptr)
+		return 64;
+
+	char *endptr;
+	const unsigned long value = strtoul(s, &endptr, 10);
+	if (endptr == s || *endptr != 0 || value == 0 || value > 65536)
+		throw std::runtime_error("Malformed DAVOS_MAX_CONNECTIONS");
+
+	return value;
+}
+
+static void
+MaybeSetupTrace()
+{
+	const char *path = getenv("DAVOS_TRACE");
+	if (path == nullptr)
+		return;
+
+	SetupTrace(path);
+}
+
 int
 main(int, const char *const*) noexcept
 try {
+	/* the trace file is opened first, because it is usually not
+	   inside the new root */
+	MaybeSetupTrace();
 	MaybePivotRoot();
 	MaybeIsolatePath();
+	MaybeSetupPropfindCache();
 
-	PlainBackend backend;
-	run(backend);
+	run<Backend>(GetMaxConnections());
 	return EXIT_SUCCESS;
 } catch (...) {
 	PrintException(std::current_exception());
@@ -15,11 +15,12 @@
 #include <map>
 #include <string>
 #include <algorithm>
+#include <mutex>
 
 #include <string.h>
 
 static std::map<std::string, std::string, std::less<>> mime_types;
-static bool mime_types_loaded = false;
+static std::once_flag mime_types_loaded;
 
 static char *
 end_of_word(char *p)
@@ -32,11 +33,6 @@ end_of_word(char *p)
 static void
 LoadMimeTypesFile()
 {
-	if (mime_types_loaded)
-		return;
-
-	mime_types_loaded = true;
-
 	FILE *file = fopen("/etc/mime.types", "r");
 	if (file == nullptr)
 		return;
@@ -76,7 +72,7 @@ LoadMimeTypesFile()
 static const char *
 LookupMimeTypeByExtension(std::string_view ext)
 {
-	LoadMimeTypesFile();
+	std::call_once(mime_types_loaded, LoadMimeTypesFile);
 
 	char buffer[32];
 	if (ext.size() >= sizeof(buffer))
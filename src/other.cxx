@@ -7,32 +7,128 @@
  */
 
 #include "other.hxx"
+#include "ParallelTree.hxx"
+#include "Parameter.hxx"
+#include "Qos.hxx"
 #include "error.hxx"
 #include "file.hxx"
+#include "uri_escape.hxx"
 #include "util.hxx"
+#include "wxml.hxx"
+#include "was/WasOutputStream.hxx"
 #include "system/Error.hxx"
 #include "io/FileAt.hxx"
 #include "io/FileDescriptor.hxx"
 #include "io/RecursiveCopy.hxx"
-#include "io/RecursiveDelete.hxx"
+
+#include <was/simple.h>
+
+#include <algorithm>
+#include <vector>
 
 #include <fcntl.h> // for AT_FDCWD
+#include <stdio.h>
+
+/**
+ * The upper limit for #TreeConfig::threads.
+ */
+static constexpr unsigned MAX_TREE_THREADS = 64;
+
+bool
+TreeConfig::Setup(was_simple *w) noexcept
+{
+	uint64_t value = 1;
+	if (!GetUnsignedParameter(w, "DAVOS_TREE_THREADS", value))
+		return false;
+
+	if (value == 0) {
+		fprintf(stderr, "Malformed DAVOS_TREE_THREADS\n");
+		return false;
+	}
+
+	threads = std::min<uint64_t>(value, MAX_TREE_THREADS);
+	return true;
+}
+
+/**
+ * Report the members of a collection which could not be copied or
+ * deleted (RFC 4918 9.6.1 and 9.8.5).
+ */
+static void
+SendTreeErrors(was_simple *w, std::string_view uri,
+	       std::span<const TreeError> errors)
+{
+	if (!was_simple_status(w, HTTP_STATUS_MULTI_STATUS) ||
+	    !was_simple_set_header(w, "content-type",
+				   "text/xml; charset=\"utf-8\""))
+		return;
+
+	WasOutputStream wos{w};
+	BufferedOutputStream bos{wos};
+
+	begin_multistatus(bos);
+
+	std::string base{uri};
+	if (!base.ends_with('/'))
+		base.push_back('/');
+
+	std::string entry_uri;
+	for (const auto &i : errors) {
+		entry_uri = base;
+		AppendUriEscape(entry_uri, i.path.c_str());
+
+		response_status(bos, entry_uri,
+				http_status_to_string(errno_status(i.error)));
+	}
+
+	end_multistatus(bos);
+
+	bos.Flush();
+}
+
+/**
+ * Operations on directory trees and on large files run with the
+ * bulk I/O priority (see #QosConfig).
+ */
+static void
+BeginBulk(const FileResource &resource) noexcept
+{
+	if (!resource.Exists())
+		return;
+
+	if (QosScope *qos = GetQosScope())
+		qos->Bulk(resource.IsDirectory()
+			  ? UINT64_MAX
+			  : resource.GetSize());
+}
 
 void
-handle_delete(was_simple *w, const FileResource &resource)
+handle_delete(was_simple *w, const char *uri, const FileResource &resource,
+	      const TreeConfig &config)
 {
+	std::vector<TreeError> errors;
+
+	BeginBulk(resource);
+
 	try {
-		RecursiveDelete({FileDescriptor{AT_FDCWD}, resource.GetPath()});
+		ParallelDelete({FileDescriptor{AT_FDCWD}, resource.GetPath()},
+			       config.threads, errors);
 	} catch (const std::system_error &e) {
 		if (e.code().category() == ErrnoCategory())
 			errno_response(w, e.code().value());
 		else
 			throw;
+		return;
 	}
+
+	if (!errors.empty())
+		SendTreeErrors(w, uri, errors);
 }
 
 void
-handle_copy(was_simple *w, const FileResource &src, const FileResource &dest)
+handle_copy(was_simple *w, const FileResource &src,
+	    const char *dest_uri, const FileResource &dest,
+	    const TreeConfig &config)
 {
 	// TODO: support "Depth: 0"
 	// TODO: overwriting an existing directory?
@@ -42,16 +138,27 @@ handle_copy(was_simple *w, const FileResource &src, const FileResource &dest)
 	if (!get_overwrite_header(w))
 		options |= RECURSIVE_COPY_NO_OVERWRITE;
 
+	if (config.link)
+		options |= PARALLEL_COPY_LINK;
+
+	std::vector<TreeError> errors;
+
+	BeginBulk(src);
+
 	try {
-		RecursiveCopy({FileDescriptor{AT_FDCWD}, src.GetPath()},
-			      {FileDescriptor{AT_FDCWD}, dest.GetPath()},
-			      options);
+		ParallelCopy({FileDescriptor{AT_FDCWD}, src.GetPath()},
+			     {FileDescriptor{AT_FDCWD}, dest.GetPath()},
+			     options, config.threads, errors);
 	} catch (const std::system_error &e) {
 		if (e.code().category() == ErrnoCategory())
 			errno_response(w, e.code().value());
 		else
 			throw;
+		return;
 	}
+
+	if (!errors.empty())
+		SendTreeErrors(w, dest_uri, errors);
 }
 
 void
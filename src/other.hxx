@@ -11,11 +11,44 @@
 struct was_simple;
 class FileResource;
 
+struct TreeConfig {
+	/**
+	 * The number of threads which copy or delete a collection
+	 * (including the thread which handles the request).
+	 */
+	unsigned threads = 1;
+
+	/**
+	 * Link files of the content store instead of copying them?
+	 * This is not a WAS parameter; it is set by
+	 * #ContentStoreBackend.
+	 */
+	bool link = false;
+
+	/**
+	 * Parse the WAS parameters.
+	 *
+	 * @return false on error (after printing an error message)
+	 */
+	bool Setup(was_simple *w) noexcept;
+};
+
+/**
+ * @param uri the request URI; used in a "207 Multi-Status" response
+ * if some members of a collection could not be deleted
+ */
 void
-handle_delete(was_simple *was, const FileResource &resource);
+handle_delete(was_simple *was, const char *uri, const FileResource &resource,
+	      const TreeConfig &config);
 
+/**
+ * @param dest_uri the destination URI; used in a "207 Multi-Status"
+ * response if some members of a collection could not be copied
+ */
 void
-handle_copy(was_simple *w, const FileResource &src, const FileResource &dest);
+handle_copy(was_simple *w, const FileResource &src,
+	    const char *dest_uri, const FileResource &dest,
+	    const TreeConfig &config);
 
 void
 handle_move(was_simple *w, const FileResource &src, const FileResource &dest);
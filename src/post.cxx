@@ -0,0 +1,556 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Request handler for POST (bulk upload of a tar archive into a
+ * collection).
+ */
+
+#include "post.hxx"
+#include "Parameter.hxx"
+#include "Tar.hxx"
+#include "Transfer.hxx"
+#include "error.hxx"
+#include "file.hxx"
+#include "uri_escape.hxx"
+#include "wxml.hxx"
+#include "was/WasOutputStream.hxx"
+#include "system/Error.hxx"
+#include "io/FileAt.hxx"
+#include "io/FileWriter.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+#include "util/IterableSplitString.hxx"
+#include "util/StringStrip.hxx"
+
+#include <was/simple.h>
+
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+using std::string_view_literals::operator""sv;
+
+/**
+ * The maximum size of a GNU long name or a pax header.
+ */
+static constexpr uint64_t MAX_METADATA_SIZE = 64 * 1024;
+
+bool
+BulkUploadConfig::Setup(was_simple *w) noexcept
+{
+	return GetBooleanParameter(w, "DAVOS_BULK_UPLOAD", enabled) &&
+		GetUnsignedParameter(w, "DAVOS_BULK_MAX_ENTRIES", max_entries) &&
+		GetUnsignedParameter(w, "DAVOS_BULK_MAX_SIZE", max_size);
+}
+
+[[gnu::pure]]
+static bool
+IsTarContentType(const char *content_type) noexcept
+{
+	if (content_type == nullptr)
+		return false;
+
+	std::string_view s = content_type;
+	s = Strip(s.substr(0, s.find(';')));
+	return s == "application/x-tar"sv || s == "application/tar"sv;
+}
+
+static bool
+ReadFull(was_simple *w, std::span<std::byte> dest) noexcept
+{
+	while (!dest.empty()) {
+		const ssize_t nbytes = was_simple_read(w, dest.data(), dest.size());
+		if (nbytes <= 0)
+			return false;
+
+		dest = dest.subspan(nbytes);
+	}
+
+	return true;
+}
+
+static bool
+ReadString(was_simple *w, std::size_t size, std::string &dest)
+{
+	dest.resize(size);
+	return ReadFull(w, std::as_writable_bytes(std::span{dest}));
+}
+
+static bool
+Skip(was_simple *w, uint64_t size) noexcept
+{
+	std::byte buffer[16384];
+
+	while (size > 0) {
+		const std::size_t n = std::min<uint64_t>(size, sizeof(buffer));
+		if (!ReadFull(w, std::span{buffer}.first(n)))
+			return false;
+
+		size -= n;
+	}
+
+	return true;
+}
+
+/**
+ * Convert a path from the archive to a path relative to the
+ * collection.  ".." segments and null bytes are rejected; leading
+ * slashes, "." segments and duplicate slashes are removed.
+ *
+ * @return false if the path is not allowed
+ */
+static bool
+NormalizeEntryPath(std::string_view src, std::string &dest)
+{
+	dest.clear();
+
+	/* the segments end up as C strings, and a null byte would
+	   truncate "..\0x" to ".." */
+	if (src.find('\0') != src.npos)
+		return false;
+
+	for (const std::string_view segment : IterableSplitString(src, '/')) {
+		if (segment.empty() || segment == "."sv)
+			continue;
+
+		if (segment == ".."sv)
+			return false;
+
+		if (!dest.empty())
+			dest.push_back('/');
+		dest.append(segment);
+	}
+
+	return !dest.empty();
+}
+
+[[gnu::pure]]
+static http_status_t
+ExceptionStatus(const std::exception &e) noexcept
+{
+	if (const auto *se = dynamic_cast<const std::system_error *>(&e);
+	    se != nullptr && se->code().category() == ErrnoCategory())
+		return errno_status(se->code().value());
+
+	return HTTP_STATUS_INTERNAL_SERVER_ERROR;
+}
+
+/**
+ * Open a directory with O_PATH, creating it if it does not exist.
+ * Symlinks are not followed.  Throws on error.
+ */
+static UniqueFileDescriptor
+OpenOrMakeDirectory(FileDescriptor parent, const char *name)
+{
+	constexpr int flags = O_PATH|O_DIRECTORY|O_NOFOLLOW;
+
+	UniqueFileDescriptor fd;
+	if (fd.Open(parent, name, flags))
+		return fd;
+
+	if (errno != ENOENT)
+		throw MakeErrno("Failed to open directory");
+
+	if (mkdirat(parent.Get(), name, 0777) < 0 && errno != EEXIST)
+		throw MakeErrno("Failed to create directory");
+
+	if (!fd.Open(parent, name, flags))
+		throw MakeErrno("Failed to open directory");
+
+	return fd;
+}
+
+struct BulkUploadResult {
+	/**
+	 * The (unescaped) path relative to the collection.
+	 */
+	std::string path;
+
+	http_status_t status;
+};
+
+class BulkUpload {
+	was_simple *const w;
+
+	const BulkUploadConfig &config;
+
+	/**
+	 * The number of bytes which may still be written;
+	 * std::nullopt means unlimited.
+	 */
+	std::optional<uint64_t> available;
+
+	/**
+	 * An O_PATH descriptor of the collection.
+	 */
+	const UniqueFileDescriptor root;
+
+	/**
+	 * The path (relative to #root) of #current_fd.  Archives
+	 * usually list all entries of a directory consecutively, so
+	 * keeping the most recent directory open saves most lookups.
+	 */
+	std::string current_path;
+
+	UniqueFileDescriptor current_fd;
+
+	uint64_t n_entries = 0, total_size = 0;
+
+public:
+	/**
+	 * The change of the collection's usage: the sizes of the
+	 * extracted files minus the sizes of the files they
+	 * replaced.
+	 */
+	int64_t usage_delta = 0;
+
+	std::vector<BulkUploadResult> results;
+
+	BulkUpload(was_simple *_w, const BulkUploadConfig &_config,
+		   std::optional<uint64_t> _available,
+		   UniqueFileDescriptor &&_root) noexcept
+		:w(_w), config(_config), available(_available),
+		 root(std::move(_root)) {}
+
+	/**
+	 * Extract the whole archive.
+	 *
+	 * @return #HTTP_STATUS_OK if the end of the archive was
+	 * reached (individual entries may have failed), or the
+	 * reason why extraction was aborted
+	 */
+	http_status_t Run();
+
+private:
+	/**
+	 * Open (and create) a directory below #root.  Throws on
+	 * error.
+	 *
+	 * @param path a normalized relative path; empty for #root
+	 */
+	FileDescriptor MakeDirectory(std::string_view path);
+
+	/**
+	 * @return false if the request body could not be read
+	 */
+	bool ExtractFile(const TarEntry &entry, std::string_view path,
+			 http_status_t &status);
+
+	/**
+	 * @return false if the request body could not be read
+	 */
+	bool HandleEntry(const TarEntry &entry, std::string_view path,
+			 http_status_t &status);
+};
+
+FileDescriptor
+BulkUpload::MakeDirectory(std::string_view path)
+{
+	if (path.empty())
+		return root;
+
+	if (current_fd.IsDefined() && path == current_path)
+		return current_fd;
+
+	std::string_view rest = path;
+	UniqueFileDescriptor fd;
+	FileDescriptor parent = root;
+
+	if (current_fd.IsDefined() && path.size() > current_path.size() &&
+	    path.starts_with(current_path) && path[current_path.size()] == '/') {
+		/* the new directory is below the current one */
+		rest.remove_prefix(current_path.size() + 1);
+		fd = std::move(current_fd);
+		parent = fd;
+	}
+
+	/* invalidate the cache until the new directory is open */
+	current_path.clear();
+	current_fd = UniqueFileDescriptor{};
+
+	for (const std::string_view segment : IterableSplitString(rest, '/')) {
+		fd = OpenOrMakeDirectory(parent, std::string{segment}.c_str());
+		parent = fd;
+	}
+
+	current_fd = std::move(fd);
+	current_path = path;
+	return current_fd;
+}
+
+bool
+BulkUpload::ExtractFile(const TarEntry &entry, std::string_view path,
+			http_status_t &status)
+{
+	if (config.max_size > 0 && entry.size > config.max_size - total_size) {
+		status = HTTP_STATUS_REQUEST_ENTITY_TOO_LARGE;
+		return Skip(w, entry.size + entry.GetPadding());
+	}
+
+	if (available && entry.size > *available) {
+		status = HTTP_STATUS_INSUFFICIENT_STORAGE;
+		return Skip(w, entry.size + entry.GetPadding());
+	}
+
+	const auto slash = path.rfind('/');
+	const std::string_view parent = slash == path.npos
+		? std::string_view{}
+		: path.substr(0, slash);
+	const std::string name{path.substr(slash + 1)};
+
+	std::optional<FileWriter> fw;
+	uint64_t old_size = 0;
+
+	try {
+		const FileDescriptor directory = MakeDirectory(parent);
+		fw.emplace(FileAt{directory, name.c_str()});
+
+		if (struct statx st;
+		    statx(directory.Get(), name.c_str(), AT_SYMLINK_NOFOLLOW,
+			  STATX_TYPE|STATX_SIZE, &st) == 0 &&
+		    S_ISREG(st.stx_mode))
+			old_size = st.stx_size;
+	} catch (const std::exception &e) {
+		status = ExceptionStatus(e);
+		return Skip(w, entry.size + entry.GetPadding());
+	}
+
+	if (entry.size >= 64 * 1024)
+		fw->Allocate(entry.size);
+
+	if (!TransferPartFromWas(w, fw->GetFileDescriptor(), entry.size) ||
+	    !Skip(w, entry.GetPadding()))
+		return false;
+
+	const struct timespec times[2] = {
+		{ .tv_sec = 0, .tv_nsec = UTIME_OMIT },
+		{ .tv_sec = entry.mtime, .tv_nsec = 0 },
+	};
+	futimens(fw->GetFileDescriptor().Get(), times);
+
+	try {
+		fw->Commit();
+	} catch (const std::exception &e) {
+		status = ExceptionStatus(e);
+		return true;
+	}
+
+	total_size += entry.size;
+	usage_delta += int64_t(entry.size) - int64_t(old_size);
+	if (available)
+		*available -= entry.size;
+
+	status = HTTP_STATUS_CREATED;
+	return true;
+}
+
+bool
+BulkUpload::HandleEntry(const TarEntry &entry, std::string_view path,
+			http_status_t &status)
+{
+	switch (entry.type) {
+	case TarEntry::Type::REGULAR:
+		return ExtractFile(entry, path, status);
+
+	case TarEntry::Type::DIRECTORY:
+		try {
+			MakeDirectory(path);
+			status = HTTP_STATUS_CREATED;
+		} catch (const std::exception &e) {
+			status = ExceptionStatus(e);
+		}
+
+		break;
+
+	case TarEntry::Type::LONG_NAME:
+	case TarEntry::Type::PAX:
+	case TarEntry::Type::GLOBAL_PAX:
+		/* handled by Run() */
+		std::unreachable();
+
+	case TarEntry::Type::OTHER:
+		/* symlinks, hard links and special files are not
+		   allowed, because they could point outside of the
+		   collection */
+		status = HTTP_STATUS_FORBIDDEN;
+		break;
+	}
+
+	return Skip(w, entry.size + entry.GetPadding());
+}
+
+http_status_t
+BulkUpload::Run()
+{
+	TarEntry entry;
+	TarOverride override;
+	std::string data, path;
+
+	while (true) {
+		std::array<std::byte, TAR_BLOCK_SIZE> block;
+		if (!ReadFull(w, block))
+			return HTTP_STATUS_BAD_REQUEST;
+
+		switch (ParseTarHeader(block, entry)) {
+		case TarHeaderResult::ENTRY:
+			break;
+
+		case TarHeaderResult::END:
+			/* ignore the second end block and the padding
+			   of the last record */
+			was_simple_input_close(w);
+			return HTTP_STATUS_OK;
+
+		case TarHeaderResult::MALFORMED:
+			return HTTP_STATUS_BAD_REQUEST;
+		}
+
+		switch (entry.type) {
+		case TarEntry::Type::LONG_NAME:
+			if (entry.size > MAX_METADATA_SIZE ||
+			    !ReadString(w, entry.size, override.name) ||
+			    !Skip(w, entry.GetPadding()))
+				return HTTP_STATUS_BAD_REQUEST;
+
+			/* strip the null terminator */
+			if (const auto i = override.name.find('\0');
+			    i != override.name.npos)
+				override.name.erase(i);
+
+			continue;
+
+		case TarEntry::Type::PAX:
+			if (entry.size > MAX_METADATA_SIZE ||
+			    !ReadString(w, entry.size, data) ||
+			    !Skip(w, entry.GetPadding()) ||
+			    !ParsePaxHeader(data, override))
+				return HTTP_STATUS_BAD_REQUEST;
+
+			continue;
+
+		case TarEntry::Type::GLOBAL_PAX:
+			/* global attributes are not relevant for
+			   extraction */
+			if (!Skip(w, entry.size + entry.GetPadding()))
+				return HTTP_STATUS_BAD_REQUEST;
+
+			continue;
+
+		case TarEntry::Type::REGULAR:
+		case TarEntry::Type::DIRECTORY:
+		case TarEntry::Type::OTHER:
+			break;
+		}
+
+		override.Apply(entry);
+		override.Clear();
+
+		if (++n_entries > config.max_entries) {
+			was_simple_input_close(w);
+			return HTTP_STATUS_REQUEST_ENTITY_TOO_LARGE;
+		}
+
+		http_status_t status;
+		if (!NormalizeEntryPath(entry.name, path)) {
+			status = HTTP_STATUS_FORBIDDEN;
+			path = entry.name;
+
+			if (!Skip(w, entry.size + entry.GetPadding()))
+				return HTTP_STATUS_BAD_REQUEST;
+		} else if (!HandleEntry(entry, path, status))
+			return HTTP_STATUS_BAD_REQUEST;
+
+		if (entry.type == TarEntry::Type::DIRECTORY)
+			path.push_back('/');
+
+		results.push_back({std::move(path), status});
+	}
+}
+
+static void
+SendResults(was_simple *w, std::string_view uri,
+	    std::span<const BulkUploadResult> results,
+	    http_status_t status)
+{
+	if (!was_simple_status(w, HTTP_STATUS_MULTI_STATUS) ||
+	    !was_simple_set_header(w, "content-type",
+				   "text/xml; charset=\"utf-8\""))
+		return;
+
+	WasOutputStream wos{w};
+	BufferedOutputStream bos{wos};
+
+	begin_multistatus(bos);
+
+	std::string base{uri};
+	if (!base.ends_with('/'))
+		base.push_back('/');
+
+	std::string entry_uri;
+	for (const auto &i : results) {
+		entry_uri = base;
+		AppendUriEscape(entry_uri, i.path.c_str());
+
+		response_status(bos, entry_uri,
+				http_status_to_string(i.status));
+	}
+
+	if (status != HTTP_STATUS_OK) {
+		/* the archive was not extracted completely; report
+		   the reason on the collection itself */
+		response_status(bos, base, http_status_to_string(status));
+	}
+
+	end_multistatus(bos);
+
+	bos.Flush();
+}
+
+int64_t
+handle_post(was_simple *w, const char *uri, const FileResource &resource,
+	    const BulkUploadConfig &config,
+	    std::optional<uint64_t> available)
+{
+	if (!resource.Exists()) {
+		errno_response(w, resource.GetError());
+		return 0;
+	}
+
+	if (!config.enabled || !resource.IsDirectory()) {
+		was_simple_status(w, HTTP_STATUS_METHOD_NOT_ALLOWED);
+		return 0;
+	}
+
+	if (!IsTarContentType(was_simple_get_header(w, "content-type"))) {
+		was_simple_status(w, HTTP_STATUS_UNSUPPORTED_MEDIA_TYPE);
+		return 0;
+	}
+
+	if (!was_simple_has_body(w)) {
+		was_simple_status(w, HTTP_STATUS_BAD_REQUEST);
+		return 0;
+	}
+
+	UniqueFileDescriptor root;
+	if (!root.Open(resource.GetPath(), O_PATH|O_DIRECTORY)) {
+		errno_response(w);
+		return 0;
+	}
+
+	BulkUpload upload{w, config, available, std::move(root)};
+	const http_status_t status = upload.Run();
+
+	if (upload.results.empty() && status != HTTP_STATUS_OK)
+		/* nothing was extracted */
+		was_simple_status(w, status);
+	else
+		SendResults(w, uri, upload.results, status);
+
+	return upload.usage_delta;
+}
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Request handler for POST (bulk upload of a tar archive into a
+ * collection).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+struct was_simple;
+class FileResource;
+
+struct BulkUploadConfig {
+	/**
+	 * Accept tar archives with POST on collections?
+	 */
+	bool enabled = false;
+
+	/**
+	 * The maximum number of archive entries in one request.
+	 */
+	uint64_t max_entries = 10000;
+
+	/**
+	 * The maximum total size of all files in one request; 0
+	 * means unlimited.
+	 */
+	uint64_t max_size = 0;
+
+	/**
+	 * Parse the WAS parameters.
+	 *
+	 * @return false on error (after printing an error message)
+	 */
+	bool Setup(was_simple *w) noexcept;
+};
+
+/**
+ * Extract the tar archive in the request body into the given
+ * collection and respond with a multistatus containing one response
+ * element per archive entry.
+ *
+ * @param available the number of bytes which may still be written
+ * (see GetQuotaAvailable()); std::nullopt means unlimited
+ * @return the change of the collection's usage in bytes (see
+ * AddUsage())
+ */
+int64_t
+handle_post(was_simple *w, const char *uri, const FileResource &resource,
+	    const BulkUploadConfig &config,
+	    std::optional<uint64_t> available);
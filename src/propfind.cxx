@@ -3,139 +3,956 @@
 // author: Max Kellermann <max.kellermann@ionos.com>
 
 /*
- * PROPFIND implementation.
+ * PROPFIND and REPORT implementation.
  */
 
 #include "propfind.hxx"
+#include "CollectionTag.hxx"
+#include "Compress.hxx"
+#include "ETag.hxx"
+#include "Journal.hxx"
+#include "Usage.hxx"
+#include "DavParser.hxx"
+#include "DirectoryScanner.hxx"
+#include "PropfindCache.hxx"
+#include "VmspliceOutputStream.hxx"
 #include "uri_escape.hxx"
 #include "wxml.hxx"
 #include "error.hxx"
 #include "file.hxx"
+#include "Parameter.hxx"
 #include "was/WasOutputStream.hxx"
+#include "lib/fmt/ToBuffer.hxx"
 #include "http/Date.hxx"
-#include "io/DirectoryReader.hxx"
+#include "http/List.hxx"
 #include "time/StatxCast.hxx"
 #include "util/Compiler.h"
+#include "util/StringCompare.hxx"
+#include "util/StringStrip.hxx"
 
 #include <was/simple.h>
 
+#include <algorithm>
+#include <charconv>
+#include <map>
+#include <optional>
 #include <string>
-#include <forward_list>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
-#include <dirent.h>
-
-static std::size_t MAX_FILES = 2000;
-static unsigned MAX_DEPTH = 3;
-
-static std::forward_list<std::string>
-ListDirectory(const char *path)
-try {
-	std::forward_list<std::string> result;
-	std::size_t n = 0;
-	DirectoryReader r{path};
-	while (const char *name = r.Read()) {
-		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
-			continue;
 
-		result.emplace_front(name);
-		if (++n >= MAX_FILES)
-			break;
+bool
+PropfindConfig::Setup(was_simple *w) noexcept
+{
+	uint64_t _max_files = 2000, _max_depth = 3;
+	if (!GetUnsignedParameter(w, "DAVOS_PROPFIND_MAX_FILES", _max_files) ||
+	    !GetUnsignedParameter(w, "DAVOS_PROPFIND_MAX_DEPTH", _max_depth) ||
+	    !GetBooleanParameter(w, "DAVOS_PROPFIND_VMSPLICE", vmsplice) ||
+	    !GetBooleanParameter(w, "DAVOS_PROPFIND_INODE_ORDER", inode_order))
+		return false;
+
+	if (_max_files == 0) {
+		fprintf(stderr, "Malformed DAVOS_PROPFIND_MAX_FILES\n");
+		return false;
+	}
+
+	max_files = _max_files;
+	max_depth = std::min<uint64_t>(_max_depth, 16);
+	return true;
+}
+
+/**
+ * The parsed PROPFIND request body.  Only properties which are not
+ * part of "allprop" are of interest here; all others are always
+ * sent.
+ */
+struct PropfindRequest {
+	/**
+	 * RFC 4331 properties; these are only sent if they are
+	 * requested explicitly.
+	 */
+	bool quota_available_bytes = false, quota_used_bytes = false;
+
+	bool WantsQuota() const noexcept {
+		return quota_available_bytes || quota_used_bytes;
+	}
+
+	/**
+	 * Parse the request body (if any).
+	 *
+	 * @return #HTTP_STATUS_OK on success, otherwise the status
+	 * which shall be sent to the client
+	 */
+	http_status_t Parse(was_simple *w) noexcept;
+
+	/**
+	 * Load the requested properties from a parsed request body.
+	 */
+	void Load(const DavParser &parser) noexcept;
+};
+
+http_status_t
+PropfindRequest::Parse(was_simple *w) noexcept
+{
+	if (!was_simple_has_body(w))
+		/* no body means "allprop" */
+		return HTTP_STATUS_OK;
+
+	auto &parser = GetThreadDavParser();
+	if (const auto status = parser.Parse(w); status != HTTP_STATUS_OK)
+		return status;
+
+	Load(parser);
+	return HTTP_STATUS_OK;
+}
+
+void
+PropfindRequest::Load(const DavParser &parser) noexcept
+{
+	for (const auto &i : parser.GetProperties()) {
+		if (i.id == DavName::QUOTA_AVAILABLE_BYTES)
+			quota_available_bytes = true;
+		else if (i.id == DavName::QUOTA_USED_BYTES)
+			quota_used_bytes = true;
 	}
+}
+
+/**
+ * Read a slice of a directory listing.  The slice is taken in
+ * directory order; optionally, it is then sorted by inode number.
+ *
+ * @param start a directory offset to resume a previous listing or 0
+ * to start at the beginning
+ */
+static DirectoryScanner
+ListDirectory(const char *path, off_t start, const PropfindConfig &config)
+{
+	DirectoryScanner children;
+	if (children.Scan(path, start, config.max_files) &&
+	    config.inode_order)
+		children.SortByInode();
+	return children;
+}
+
+/**
+ * Generate a "Davos-Continuation" token.  It contains the inode
+ * number of the collection (to detect tokens which are used on a
+ * different collection) and the directory cookie.
+ */
+static StringBuffer<64>
+MakeContinuation(const struct statx &st, off_t cookie) noexcept
+{
+	return FmtBuffer<64>("{:x}-{:x}", st.stx_ino, cookie);
+}
+
+/**
+ * Parse a "Davos-Continuation" token.
+ *
+ * @return the directory cookie or -1 if the token is malformed
+ */
+[[gnu::pure]]
+static long
+ParseContinuation(const char *s, uint64_t &ino) noexcept
+{
+	char *endptr;
+	ino = strtoull(s, &endptr, 16);
+	if (endptr == s || *endptr != '-')
+		return -1;
 
-	return result;
-} catch (...) {
-	return {};
+	s = endptr + 1;
+	long cookie = strtol(s, &endptr, 16);
+	if (endptr == s || *endptr != 0 || cookie < 0)
+		return -1;
+
+	return cookie;
+}
+
+unsigned
+ParseDepth(const char *s, unsigned max_depth) noexcept
+{
+	if (s == nullptr)
+		return 0;
+
+	if (strcmp(s, "infinity") == 0)
+		return max_depth;
+
+	return std::min<unsigned long>(strtoul(s, nullptr, 10), max_depth);
 }
 
+/**
+ * State shared by all levels of a PROPFIND response.
+ */
+struct PropfindContext {
+	const PropfindConfig &config;
+	const ETagConfig &etag;
+	const PropfindRequest &request;
+
+	/**
+	 * The value of "quota-available-bytes"; only set if it was
+	 * requested and is known.
+	 */
+	std::optional<uint64_t> quota_available;
+
+	/**
+	 * If not nullptr, then the response is being recorded for
+	 * the #PropfindCache.
+	 */
+	PropfindCache::Recorder *recorder;
+
+	/**
+	 * Set if the listing of a collection below the requested one
+	 * was truncated.  Such members cannot be resumed with a
+	 * continuation.
+	 */
+	mutable bool nested_truncated = false;
+};
+
 static void
-propfind_file(BufferedOutputStream &o, std::string &uri, std::string &path,
-	      const struct statx &st,
-	      unsigned depth)
+checksum_property(BufferedOutputStream &o, const ContentHash &hash)
+{
+	wxml_write(o, WxmlConst<"<C:checksum xmlns:C=\"http://cm4all.com/davos/\">">{},
+		   WxmlText{FormatChecksum(hash).c_str()},
+		   WxmlClose<"C:checksum">{});
+}
+
+static void
+propfind_entry(BufferedOutputStream &o, std::string_view uri,
+	       const char *path, const struct statx &st,
+	       const PropfindContext &ctx)
 {
-	open_response_prop(o, uri, "HTTP/1.1 200 OK");
+	/* the status is constant, so it gets fused with the
+	   surrounding tags at compile time */
+	wxml_write(o, WxmlOpen<"D:response">{},
+		   WxmlOpen<"D:href">{}, WxmlText{uri}, WxmlClose<"D:href">{},
+		   WxmlOpen<"D:propstat">{},
+		   WxmlConst<"<D:status>HTTP/1.1 200 OK</D:status>">{},
+		   WxmlOpen<"D:prop">{});
 
 	if (S_ISDIR(st.stx_mode)) {
 		resourcetype_collection(o);
+
+		/* "getctag" is what CalDAV/CardDAV clients look
+		   for */
+		if (ctx.etag.collection_tag)
+			if (const auto etag = GetCollectionETag(path, st))
+				wxml_write(o, WxmlOpen<"D:getetag">{},
+					   WxmlText{etag->c_str()},
+					   WxmlClose<"D:getetag">{},
+					   WxmlConst<"<CS:getctag xmlns:CS=\"http://calendarserver.org/ns/\">">{},
+					   WxmlText{etag->c_str()},
+					   WxmlClose<"CS:getctag">{});
+
+		/* both values are precalculated, so this never needs
+		   to scan the tree */
+		if (ctx.request.quota_used_bytes)
+			if (const auto used = LoadUsage(path))
+				wxml_write(o, WxmlOpen<"D:quota-used-bytes">{},
+					   WxmlUnsigned{*used},
+					   WxmlClose<"D:quota-used-bytes">{});
+
+		if (ctx.quota_available)
+			wxml_write(o, WxmlOpen<"D:quota-available-bytes">{},
+				   WxmlUnsigned{*ctx.quota_available},
+				   WxmlClose<"D:quota-available-bytes">{});
 	} else if (S_ISREG(st.stx_mode)) {
-		wxml_fmt_element(o, "D:getcontentlength", "{}", st.stx_size);
+		wxml_write(o, WxmlOpen<"D:getcontentlength">{},
+			   WxmlUnsigned{st.stx_size},
+			   WxmlClose<"D:getcontentlength">{});
+
+		/* only hashes which are already known are reported;
+		   calculating them here would read all files */
+		if (ctx.etag.content_hash)
+			if (const auto hash = LoadContentHash(path, st))
+				checksum_property(o, *hash);
 	}
 
 	const auto mtime = ToSystemTimePoint(st.stx_mtime);
 
-	wxml_string_element(o, "D:getlastmodified", http_date_format(mtime));
+	wxml_write(o, WxmlOpen<"D:getlastmodified">{},
+		   WxmlRaw{http_date_format(mtime)},
+		   WxmlClose<"D:getlastmodified">{},
+		   WxmlCloseResponseProp{});
+}
+
+static void
+propfind_file(BufferedOutputStream &o, std::string &uri, std::string &path,
+	      const struct statx &st,
+	      unsigned depth, const PropfindContext &ctx);
+
+/**
+ * Emit response elements for the given children of a collection.
+ *
+ * @param uri the URI of the collection, ending with a slash
+ */
+static void
+propfind_children(BufferedOutputStream &o, std::string &uri, std::string &path,
+		  const DirectoryScanner &children,
+		  unsigned depth, const PropfindContext &ctx)
+{
+	const auto uri_length = uri.length();
+
+	path.push_back('/');
+	const auto path_length = path.length();
+
+	for (const auto &child : children.GetEntries()) {
+		const char *name = children.GetName(child);
+		AppendUriEscape(uri, name);
+		path.append(name);
 
-	close_response_prop(o);
+		struct statx st;
+		if (statx(-1, path.c_str(), AT_STATX_SYNC_AS_STAT,
+			  STATX_TYPE|STATX_MTIME|STATX_CTIME|STATX_INO|STATX_SIZE,
+			  &st) == 0) {
+			if (S_ISDIR(st.stx_mode))
+				/* directory URIs should end with a slash */
+				uri.push_back('/');
+
+			propfind_file(o, uri, path, st, depth, ctx);
+		}
+
+		uri.erase(uri_length);
+		path.erase(path_length);
+	}
+
+	path.pop_back();
+
+	if (children.IsTruncated())
+		insufficient_storage(o, uri);
+}
+
+/**
+ * Directory URIs should end with a slash - but we don't enforce that
+ * everywhere; fix up the URI if the user-supplied URI doesn't.
+ */
+static void
+FixCollectionUri(std::string &uri) noexcept
+{
+	if (uri.back() != '/')
+		uri.push_back('/');
+}
+
+static void
+propfind_file(BufferedOutputStream &o, std::string &uri, std::string &path,
+	      const struct statx &st,
+	      unsigned depth, const PropfindContext &ctx)
+{
+	/* even if this collection is not listed, its modification
+	   time is, and that changes without an event on the parent's
+	   watch */
+	if (ctx.recorder != nullptr && S_ISDIR(st.stx_mode))
+		ctx.recorder->WatchDirectory(path.c_str(), st);
+
+	propfind_entry(o, uri, path.c_str(), st, ctx);
 
 	if (depth > 0 && S_ISDIR(st.stx_mode)) {
-		--depth;
+		FixCollectionUri(uri);
 
-		if (uri.back() != '/')
-			/* directory URIs should end with a slash - but we don't
-			   enforce that everywhere; fix up the URI if the
-			   user-supplied URI doesn't */
-			uri.push_back('/');
+		const auto children = ListDirectory(path.c_str(), 0,
+						    ctx.config);
+		if (children.IsTruncated())
+			ctx.nested_truncated = true;
+
+		propfind_children(o, uri, path, children, depth - 1, ctx);
+	}
+}
 
-		const auto uri_length = uri.length();
+/**
+ * Build the #PropfindCache key for this request.  It contains
+ * everything the response body depends on.
+ */
+static std::string
+MakeCacheKey(const char *uri, const FileResource &resource, unsigned depth,
+	     const char *continuation, ContentEncoding encoding,
+	     const PropfindConfig &config, const CompressConfig &compress,
+	     const ETagConfig &etag)
+{
+	std::string key{uri};
+	for (const std::string_view i : {
+			std::string_view{resource.GetPath()},
+			ToString(encoding),
+			std::string_view{continuation != nullptr ? continuation : ""},
+		}) {
+		key.push_back('\0');
+		key.append(i);
+	}
 
-		const auto &children = ListDirectory(path.c_str());
+	for (const std::size_t i : {
+			std::size_t{depth}, config.max_files,
+			std::size_t{config.inode_order},
+			std::size_t{compress.level}, compress.threshold,
+			std::size_t{etag.content_hash},
+			std::size_t{etag.collection_tag},
+		}) {
+		key.push_back('\0');
+		key.append(std::to_string(i));
+	}
 
-		path.push_back('/');
-		const auto path_length = path.length();
+	return key;
+}
 
-		for (const std::string &name : children) {
-			AppendUriEscape(uri, name.c_str());
-			path.append(name);
+/**
+ * Check "If-None-Match" against the collection ETag and send "304
+ * Not Modified" if it matches.  This does not read the directory,
+ * so an unchanged tree costs just one statx() and one getxattr().
+ *
+ * @return true if a response has been sent
+ */
+static bool
+IsCollectionNotModified(was_simple *was, const FileResource &resource)
+{
+	const char *p = was_simple_get_header(was, "if-none-match");
+	if (p == nullptr)
+		return false;
 
-			struct statx st2;
-			if (statx(-1, path.c_str(), AT_STATX_SYNC_AS_STAT,
-				  STATX_TYPE|STATX_MTIME|STATX_SIZE,
-				  &st2) == 0) {
-				if (S_ISDIR(st2.stx_mode))
-					/* directory URIs should end with a slash */
-					uri.push_back('/');
+	const auto etag = GetCollectionETag(resource.GetPath(),
+					    resource.GetStat());
+	if (!etag || !http_list_contains(p, etag->c_str()))
+		return false;
 
-				propfind_file(o, uri, path, st2, depth);
-			}
+	if (was_simple_status(was, HTTP_STATUS_NOT_MODIFIED))
+		was_simple_set_header(was, "etag", etag->c_str());
+	return true;
+}
 
-			uri.erase(uri_length);
-			path.erase(path_length);
+void
+handle_propfind(was_simple *was, const char *uri, const FileResource &resource,
+		const PropfindConfig &config,
+		const CompressConfig &compress,
+		const ETagConfig &etag,
+		const QuotaConfig &quota)
+{
+	PropfindRequest request;
+	if (const auto status = request.Parse(was); status != HTTP_STATUS_OK) {
+		was_simple_status(was, status);
+		return;
+	}
+
+	if (!resource.Exists()) {
+		errno_response(was, resource.GetError());
+		return;
+	}
+
+	if (etag.collection_tag && resource.IsDirectory() &&
+	    IsCollectionNotModified(was, resource))
+		return;
+
+	const unsigned depth = ParseDepth(was_simple_get_header(was, "depth"),
+					  config.max_depth);
+	const bool list = depth > 0 && resource.IsDirectory();
+
+	long start = 0;
+	const char *const token = was_simple_get_header(was, "davos-continuation");
+	if (token != nullptr) {
+		uint64_t ino;
+		start = list ? ParseContinuation(token, ino) : -1;
+		if (start < 0) {
+			was_simple_status(was, HTTP_STATUS_BAD_REQUEST);
+			return;
+		}
+
+		if (ino != resource.GetStat().stx_ino) {
+			/* the token was made for a different
+			   collection */
+			was_simple_status(was, HTTP_STATUS_PRECONDITION_FAILED);
+			return;
 		}
 	}
+
+	const auto encoding = compress.Negotiate(was);
+
+	WasOutputStream wos{was};
+	std::optional<VmspliceOutputStream> vos;
+	if (config.vmsplice)
+		vos.emplace(was);
+
+	OutputStream &out = vos
+		? static_cast<OutputStream &>(*vos)
+		: static_cast<OutputStream &>(wos);
+
+	/* only listings are cached; a single resource is cheap to
+	   render; and quota properties change when anything in the
+	   document root is modified, which is not watched */
+	std::optional<PropfindCache::Recorder> recorder;
+	if (PropfindCache *cache = list && !request.WantsQuota()
+	    ? GetPropfindCache()
+	    : nullptr) {
+		auto key = MakeCacheKey(uri, resource, depth, token, encoding,
+					config, compress, etag);
+		if (cache->Send(was, key))
+			return;
+
+		recorder.emplace(*cache, out, std::move(key));
+		recorder->WatchDirectory(resource.GetPath(),
+					 resource.GetStat());
+	}
+
+	/* read the (first page of the) collection before sending the
+	   response headers, because the continuation token must be
+	   sent as a header */
+	DirectoryScanner children;
+	if (list)
+		children = ListDirectory(resource.GetPath(), start, config);
+
+	StringBuffer<64> continuation{};
+	if (children.IsTruncated())
+		continuation = MakeContinuation(resource.GetStat(),
+						children.GetNext());
+
+	if (!was_simple_status(was, HTTP_STATUS_MULTI_STATUS) ||
+	    !was_simple_set_header(was, "content-type",
+				   "text/xml; charset=\"utf-8\""))
+		return;
+
+	if (children.IsTruncated() &&
+	    !was_simple_set_header(was, "davos-continuation", continuation))
+		return;
+
+	if (compress.IsEnabled() &&
+	    !was_simple_set_header(was, "vary", "accept-encoding"))
+		return;
+
+	OutputStream &os = recorder
+		? static_cast<OutputStream &>(*recorder)
+		: out;
+	CompressOutputStream cos{was, os, encoding, compress};
+	BufferedOutputStream bos{cos};
+
+	begin_multistatus(bos);
+
+	const PropfindContext ctx{
+		config, etag, request,
+		request.quota_available_bytes
+		? GetQuotaAvailable(quota)
+		: std::nullopt,
+		recorder ? &*recorder : nullptr,
+	};
+
+	std::string uri2(uri);
+	propfind_entry(bos, uri2, resource.GetPath(), resource.GetStat(), ctx);
+
+	if (list) {
+		FixCollectionUri(uri2);
+
+		std::string path2(resource.GetPath());
+		propfind_children(bos, uri2, path2, children, depth - 1, ctx);
+	}
+
+	end_multistatus(bos);
+
+	bos.Flush();
+	cos.Finish();
+
+	if (vos)
+		vos->Flush();
+
+	if (recorder)
+		recorder->Commit(cos.GetContentEncoding(),
+				 compress.IsEnabled(),
+				 children.IsTruncated() ? continuation.c_str() : "");
+}
+
+/**
+ * The prefix of all sync tokens; RFC 6578 3.2 requires them to be
+ * URIs.
+ */
+static constexpr std::string_view SYNC_TOKEN_PREFIX =
+	"http://cm4all.com/davos/sync/";
+
+/**
+ * The contents of a sync token.
+ */
+struct SyncToken {
+	JournalPosition position;
+
+	/**
+	 * If the initial listing was truncated, then this is the
+	 * inode number of the collection and the directory cookie
+	 * where it continues (like "Davos-Continuation"); the journal
+	 * is only read after the listing is complete.
+	 */
+	uint64_t ino = 0;
+	off_t cookie = 0;
+
+	bool IsContinuation() const noexcept {
+		return cookie > 0;
+	}
+};
+
+static StringBuffer<128>
+MakeSyncToken(JournalPosition position) noexcept
+{
+	return FmtBuffer<128>("http://cm4all.com/davos/sync/{:x}-{:x}",
+			      position.id, position.offset);
+}
+
+static StringBuffer<128>
+MakeSyncToken(JournalPosition position,
+	      const struct statx &st, off_t cookie) noexcept
+{
+	return FmtBuffer<128>("http://cm4all.com/davos/sync/{:x}-{:x}-{:x}-{:x}",
+			      position.id, position.offset,
+			      st.stx_ino, cookie);
+}
+
+[[gnu::pure]]
+static std::optional<SyncToken>
+ParseSyncToken(std::string_view s) noexcept
+{
+	if (!SkipPrefix(s, SYNC_TOKEN_PREFIX))
+		return std::nullopt;
+
+	const char *const end = s.data() + s.size();
+
+	SyncToken token;
+	auto r = std::from_chars(s.data(), end, token.position.id, 16);
+	if (r.ec != std::errc{} || r.ptr == end || *r.ptr != '-')
+		return std::nullopt;
+
+	r = std::from_chars(r.ptr + 1, end, token.position.offset, 16);
+	if (r.ec != std::errc{})
+		return std::nullopt;
+
+	if (r.ptr == end)
+		return token;
+
+	if (*r.ptr != '-')
+		return std::nullopt;
+
+	r = std::from_chars(r.ptr + 1, end, token.ino, 16);
+	if (r.ec != std::errc{} || r.ptr == end || *r.ptr != '-')
+		return std::nullopt;
+
+	r = std::from_chars(r.ptr + 1, end, token.cookie, 16);
+	if (r.ec != std::errc{} || r.ptr != end || !token.IsContinuation())
+		return std::nullopt;
+
+	return token;
+}
+
+/**
+ * Send a "403 Forbidden" response with a precondition element (RFC
+ * 4918 16).
+ */
+static void
+SendPreconditionFailed(was_simple *was, const char *body)
+{
+	if (was_simple_status(was, HTTP_STATUS_FORBIDDEN) &&
+	    was_simple_set_header(was, "content-type",
+				  "text/xml; charset=\"utf-8\""))
+		was_simple_puts(was, body);
+}
+
+static void
+SendInvalidSyncToken(was_simple *was)
+{
+	SendPreconditionFailed(was,
+			       "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+			       "<D:error xmlns:D=\"DAV:\"><D:valid-sync-token/></D:error>");
+}
+
+static void
+SendUnsupportedReport(was_simple *was)
+{
+	SendPreconditionFailed(was,
+			       "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+			       "<D:error xmlns:D=\"DAV:\"><D:supported-report/></D:error>");
+}
+
+/**
+ * Is #ancestor the same as #path or one of its ancestors?  Both are
+ * relative to the document root.
+ */
+[[gnu::pure]]
+static bool
+IsAncestorOrSelf(std::string_view ancestor, std::string_view path) noexcept
+{
+	if (ancestor.empty())
+		return true;
+
+	return SkipPrefix(path, ancestor) &&
+		(path.empty() || path.front() == '/');
+}
+
+/**
+ * A member of the collection which was changed according to the
+ * journal.
+ */
+struct SyncChange {
+	/**
+	 * Were all members of this collection changed (see
+	 * #JournalOp::TREE)?
+	 */
+	bool tree;
+
+	/**
+	 * The number of levels below the collection; 1 for internal
+	 * members.
+	 */
+	unsigned level;
+};
+
+/**
+ * Collect the members of the collection which were changed
+ * according to the given journal records.
+ *
+ * @param base the path of the collection relative to the document
+ * root
+ * @return false if the collection itself was deleted or replaced,
+ * i.e. the sync token is not valid for it anymore
+ */
+static bool
+CollectChanges(std::map<std::string, SyncChange> &changes,
+	       std::string_view base, unsigned max_level,
+	       std::span<const JournalRecord> records)
+{
+	for (const auto &record : records) {
+		std::string_view member = record.path;
+		if (IsAncestorOrSelf(member, base)) {
+			if (record.op != JournalOp::MODIFIED)
+				return false;
+
+			/* the collection's own properties are not
+			   reported */
+			continue;
+		}
+
+		if (!base.empty() &&
+		    (!SkipPrefix(member, base) || !SkipPrefix(member, "/")))
+			continue;
+
+		const unsigned level =
+			1 + std::count(member.begin(), member.end(), '/');
+		if (level > max_level)
+			continue;
+
+		auto [i, _] = changes.try_emplace(std::string{member},
+						  false, level);
+		if (record.op == JournalOp::TREE)
+			i->second.tree = true;
+	}
+
+	return true;
+}
+
+/**
+ * Is one of the ancestors of this member listed as a changed tree?
+ * Then it is reported already.
+ */
+[[gnu::pure]]
+static bool
+IsInsideChangedTree(const std::map<std::string, SyncChange> &changes,
+		    std::string_view member) noexcept
+{
+	while (true) {
+		const auto slash = member.rfind('/');
+		if (slash == member.npos)
+			return false;
+
+		member = member.substr(0, slash);
+		if (const auto i = changes.find(std::string{member});
+		    i != changes.end() && i->second.tree)
+			return true;
+	}
+}
+
+/**
+ * Emit response elements for all changed members of the collection.
+ *
+ * @param uri the URI of the collection, ending with a slash
+ */
+static void
+sync_changes(BufferedOutputStream &o, std::string &uri, std::string &path,
+	     const std::map<std::string, SyncChange> &changes,
+	     unsigned max_level, const PropfindContext &ctx)
+{
+	const auto uri_length = uri.length();
+
+	path.push_back('/');
+	const auto path_length = path.length();
+
+	for (const auto &[member, change] : changes) {
+		if (IsInsideChangedTree(changes, member))
+			continue;
+
+		AppendUriEscape(uri, member.c_str());
+		path.append(member);
+
+		struct statx st;
+		if (statx(-1, path.c_str(), AT_STATX_SYNC_AS_STAT,
+			  STATX_TYPE|STATX_MTIME|STATX_CTIME|STATX_INO|STATX_SIZE,
+			  &st) == 0) {
+			if (S_ISDIR(st.stx_mode))
+				uri.push_back('/');
+
+			propfind_file(o, uri, path, st,
+				      change.tree ? max_level - change.level : 0,
+				      ctx);
+		} else
+			/* RFC 6578 3.5.2: removed members have only a
+			   status */
+			response_status(o, uri, "HTTP/1.1 404 Not Found");
+
+		uri.erase(uri_length);
+		path.erase(path_length);
+	}
+
+	path.pop_back();
 }
 
 void
-handle_propfind(was_simple *was, const char *uri, const FileResource &resource)
+handle_report(was_simple *was, const char *uri, const FileResource &resource,
+	      std::string_view relative, const JournalConfig &journal,
+	      const PropfindConfig &config,
+	      const CompressConfig &compress,
+	      const ETagConfig &etag,
+	      const QuotaConfig &quota)
 {
+	auto &parser = GetThreadDavParser();
+	if (const auto status = parser.Parse(was); status != HTTP_STATUS_OK) {
+		was_simple_status(was, status);
+		return;
+	}
+
+	if (parser.GetRoot() != DavName::SYNC_COLLECTION) {
+		SendUnsupportedReport(was);
+		return;
+	}
+
 	if (!resource.Exists()) {
 		errno_response(was, resource.GetError());
 		return;
 	}
 
-	unsigned depth = 0;
-	const char *depth_string = was_simple_get_header(was, "depth");
-	if (depth_string != nullptr)
-		depth = strtoul(depth_string, nullptr, 10);
-	if (depth > MAX_DEPTH)
-		depth = MAX_DEPTH;
+	if (!resource.IsDirectory()) {
+		/* RFC 6578 3.1: only collections support this
+		   report */
+		SendUnsupportedReport(was);
+		return;
+	}
+
+	/* "infinite" is clipped like "Depth: infinity" */
+	unsigned max_level;
+	if (const auto level = Strip(parser.GetSyncLevel()); level == "1")
+		max_level = 1;
+	else if (level == "infinite")
+		max_level = std::max(config.max_depth, 1U);
+	else {
+		was_simple_status(was, HTTP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	PropfindRequest request;
+	request.Load(parser);
+
+	const auto token = Strip(parser.GetSyncToken());
+
+	/* the initial synchronization lists the whole collection;
+	   the position is obtained first, so changes made during the
+	   listing are reported again next time */
+	std::optional<JournalPosition> position;
+	std::map<std::string, SyncChange> changes;
+	bool truncated = false;
+
+	/* the directory cookie where the initial listing starts (or
+	   continues), or -1 to report changes from the journal */
+	off_t start = -1;
+
+	if (token.empty()) {
+		position = GetJournalEnd(journal);
+		start = 0;
+	} else if (const auto t = ParseSyncToken(token); !t) {
+		SendInvalidSyncToken(was);
+		return;
+	} else if (t->IsContinuation()) {
+		if (t->ino != resource.GetStat().stx_ino) {
+			SendInvalidSyncToken(was);
+			return;
+		}
+
+		position = t->position;
+		start = t->cookie;
+	} else {
+		/* a poll without changes costs just the journal
+		   header */
+		std::vector<JournalRecord> records;
+		position = ReadJournal(journal, t->position, config.max_files,
+				       records);
+		if (!position ||
+		    !CollectChanges(changes, relative, max_level, records)) {
+			SendInvalidSyncToken(was);
+			return;
+		}
+
+		/* RFC 6578 3.6: the client continues with the new
+		   token; one more record is read to find out whether
+		   there are more */
+		if (records.size() >= config.max_files) {
+			std::vector<JournalRecord> more;
+			truncated = ReadJournal(journal, *position, 1, more) &&
+				!more.empty();
+		}
+	}
+
+	DirectoryScanner children;
+	if (start >= 0)
+		children = ListDirectory(resource.GetPath(), start, config);
+
+	const auto encoding = compress.Negotiate(was);
 
 	if (!was_simple_status(was, HTTP_STATUS_MULTI_STATUS) ||
 	    !was_simple_set_header(was, "content-type",
 				   "text/xml; charset=\"utf-8\""))
 		return;
 
+	if (compress.IsEnabled() &&
+	    !was_simple_set_header(was, "vary", "accept-encoding"))
+		return;
+
 	WasOutputStream wos{was};
-	BufferedOutputStream bos{wos};
+	CompressOutputStream cos{was, wos, encoding, compress};
+	BufferedOutputStream bos{cos};
 
 	begin_multistatus(bos);
 
+	const PropfindContext ctx{
+		config, etag, request,
+		request.quota_available_bytes
+		? GetQuotaAvailable(quota)
+		: std::nullopt,
+		nullptr,
+	};
+
 	std::string uri2(uri);
+	FixCollectionUri(uri2);
+
 	std::string path2(resource.GetPath());
-	propfind_file(bos, uri2, path2, resource.GetStat(), depth);
+
+	if (start >= 0)
+		propfind_children(bos, uri2, path2, children, max_level - 1,
+				  ctx);
+	else
+		sync_changes(bos, uri2, path2, changes, max_level, ctx);
+
+	if (truncated)
+		insufficient_storage(bos, uri2);
+
+	/* a truncated listing of the collection itself continues
+	   with the next token (RFC 6578 3.6), but members of a
+	   truncated sub-collection would never be reported; without
+	   a token, the client cannot miss them */
+	if (!ctx.nested_truncated)
+		wxml_write(bos, WxmlOpen<"D:sync-token">{},
+			   WxmlText{(children.IsTruncated()
+				     ? MakeSyncToken(*position,
+						     resource.GetStat(),
+						     children.GetNext())
+				     : MakeSyncToken(*position)).c_str()},
+			   WxmlClose<"D:sync-token">{});
+
 	end_multistatus(bos);
 
 	bos.Flush();
+	cos.Finish();
 }
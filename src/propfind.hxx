@@ -3,14 +3,89 @@
 // author: Max Kellermann <max.kellermann@ionos.com>
 
 /*
- * PROPFIND implementation.
+ * PROPFIND and REPORT implementation.
  */
 
 #pragma once
 
+#include <cstddef>
+#include <string_view>
+
 struct was_simple;
+struct CompressConfig;
+struct ETagConfig;
+struct JournalConfig;
+struct QuotaConfig;
 class FileResource;
 
+struct PropfindConfig {
+	/**
+	 * The maximum number of directory entries per collection in
+	 * one response.  Larger collections are truncated, which is
+	 * signalled with a "507 Insufficient Storage" response
+	 * element, and the client may fetch the next page with the
+	 * "Davos-Continuation" request header.
+	 */
+	std::size_t max_files = 2000;
+
+	/**
+	 * The maximum "Depth"; larger values (including "infinity")
+	 * are clipped.
+	 */
+	unsigned max_depth = 3;
+
+	/**
+	 * Move large responses into the WAS pipe with vmsplice()
+	 * (see #VmspliceOutputStream)?
+	 */
+	bool vmsplice = false;
+
+	/**
+	 * Sort the entries of each collection by their inode number
+	 * before calling statx() on them?  This saves disk seeks if
+	 * the inodes are not cached, but the response is not in
+	 * directory order anymore.
+	 */
+	bool inode_order = false;
+
+	/**
+	 * Parse the WAS parameters.
+	 *
+	 * @return false on error (after printing an error message)
+	 */
+	bool Setup(was_simple *w) noexcept;
+};
+
+/**
+ * Parse the "Depth" request header.
+ *
+ * @param s the header value or nullptr
+ * @param max_depth clip the value to this maximum
+ */
+[[gnu::pure]]
+unsigned
+ParseDepth(const char *s, unsigned max_depth) noexcept;
+
 void
 handle_propfind(was_simple *was, const char *uri,
-		const FileResource &resource);
+		const FileResource &resource,
+		const PropfindConfig &config,
+		const CompressConfig &compress,
+		const ETagConfig &etag,
+		const QuotaConfig &quota);
+
+/**
+ * Handle a "sync-collection" REPORT (RFC 6578).  The changes since
+ * the client's sync token are read from the journal.
+ *
+ * @param relative the path of the resource relative to the document
+ * root (without leading and trailing slashes)
+ */
+void
+handle_report(was_simple *was, const char *uri,
+	      const FileResource &resource, std::string_view relative,
+	      const JournalConfig &journal,
+	      const PropfindConfig &config,
+	      const CompressConfig &compress,
+	      const ETagConfig &etag,
+	      const QuotaConfig &quota);
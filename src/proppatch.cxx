@@ -8,7 +8,6 @@
 
 #include "proppatch.hxx"
 #include "wxml.hxx"
-#include "expat.hxx"
 #include "error.hxx"
 #include "was/WasOutputStream.hxx"
 #include "util/StringSplit.hxx"
@@ -20,65 +19,6 @@ extern "C" {
 #include <string.h>
 #include <time.h>
 
-static void XMLCALL
-start_element(void *userData, const XML_Char *name,
-	      [[maybe_unused]] const XML_Char **atts)
-{
-	ProppatchParserData &data = *(ProppatchParserData *)userData;
-
-	switch (data.state) {
-	case ProppatchParserData::ROOT:
-		if (strcmp(name, "DAV:|prop") == 0)
-			data.state = ProppatchParserData::PROP;
-		break;
-
-	case ProppatchParserData::PROP:
-		data.state = ProppatchParserData::PROP_NAME;
-		data.props.emplace_back(name);
-		break;
-
-	case ProppatchParserData::PROP_NAME:
-		break;
-	}
-}
-
-static void XMLCALL
-end_element(void *userData, const XML_Char *name)
-{
-	ProppatchParserData &data = *(ProppatchParserData *)userData;
-
-	switch (data.state) {
-	case ProppatchParserData::ROOT:
-		break;
-
-	case ProppatchParserData::PROP:
-		if (strcmp(name, "DAV:|prop") == 0)
-			data.state = ProppatchParserData::ROOT;
-		break;
-
-	case ProppatchParserData::PROP_NAME:
-		if (name == data.props.back().name)
-			data.state = ProppatchParserData::PROP;
-		break;
-	}
-}
-
-static void XMLCALL
-char_data(void *userData, const XML_Char *s, int len)
-{
-	ProppatchParserData &data = *(ProppatchParserData *)userData;
-
-	switch (data.state) {
-	case ProppatchParserData::ROOT:
-	case ProppatchParserData::PROP:
-		break;
-
-	case ProppatchParserData::PROP_NAME:
-		data.props.back().value.assign(s, len);
-		break;
-	}
-}
-
 static void
 ns_short_element(BufferedOutputStream &o, std::string_view name)
 {
@@ -87,24 +27,20 @@ ns_short_element(BufferedOutputStream &o, std::string_view name)
 		// TODO what now? is this a bug or bad user input?
 		return;
 
-	o.Write('<');
-	o.Write("X:");
-	o.Write(rest);
-	wxml_attribute(o, "xmlns:X", ns);
-	wxml_end_short_tag(o);
+	wxml_write(o, WxmlConst<"<X:">{}, WxmlRaw{rest},
+		   WxmlConst<" xmlns:X=\"">{}, WxmlText{ns},
+		   WxmlConst<"\"/>">{});
 }
 
 static void
 propstat(BufferedOutputStream &o, std::string_view name, std::string_view status)
 {
-	wxml_open_element(o, "D:propstat");
-	wxml_open_element(o, "D:prop");
+	wxml_write(o, WxmlOpen<"D:propstat">{}, WxmlOpen<"D:prop">{});
 	ns_short_element(o, name);
-	wxml_close_element(o, "D:prop");
-	wxml_open_element(o, "D:status");
-	o.Write(status);
-	wxml_close_element(o, "D:status");
-	wxml_close_element(o, "D:propstat");
+	wxml_write(o, WxmlClose<"D:prop">{},
+		   WxmlOpen<"D:status">{}, WxmlRaw{status},
+		   WxmlClose<"D:status">{},
+		   WxmlClose<"D:propstat">{});
 }
 
 [[gnu::pure]]
@@ -123,20 +59,23 @@ parse_win32_timestamp(const char *s, struct timeval &tv)
 bool
 PropNameValue::ParseWin32Timestamp(timeval &tv) const
 {
-	return parse_win32_timestamp(value.c_str(), tv);
+	return parse_win32_timestamp(value.data(), tv);
 }
 
 bool
 ProppatchMethod::ParseRequest(was_simple *w)
 {
-	ExpatParser expat(&data);
-	expat.SetElementHandler(start_element, end_element);
-	expat.SetCharacterDataHandler(char_data);
-	if (!expat.Parse(w)) {
-		was_simple_status(w, HTTP_STATUS_BAD_REQUEST);
+	auto &parser = GetThreadDavParser();
+	if (const auto status = parser.Parse(w); status != HTTP_STATUS_OK) {
+		was_simple_status(w, status);
 		return false;
 	}
 
+	const auto properties = parser.GetProperties();
+	props.reserve(properties.size());
+	for (const auto &i : properties)
+		props.emplace_back(i);
+
 	return true;
 }
 
@@ -151,16 +90,17 @@ ProppatchMethod::SendResponse(was_simple *w, std::string_view uri)
 	WasOutputStream wos{w};
 	BufferedOutputStream bos{wos};
 
-	begin_multistatus(bos);
-	wxml_open_element(bos, "D:response");
-	href(bos, uri);
+	wxml_write(bos, WxmlDeclaration{},
+		   WxmlConst<"<D:multistatus xmlns:D=\"DAV:\">">{},
+		   WxmlOpen<"D:response">{},
+		   WxmlOpen<"D:href">{}, WxmlText{uri}, WxmlClose<"D:href">{});
 
-	for (auto prop : data.props)
+	for (const auto &prop : props)
 		propstat(bos, prop.name,
 			 http_status_to_string(prop.status));
 
-	wxml_close_element(bos, "D:response");
-	end_multistatus(bos);
+	wxml_write(bos, WxmlClose<"D:response">{},
+		   WxmlClose<"D:multistatus">{});
 
 	bos.Flush();
 	return true;
@@ -8,63 +8,66 @@
 
 #pragma once
 
+#include "DavParser.hxx"
+
 extern "C" {
 #include <http/status.h>
 }
 
-#include <string>
-#include <list>
+#include <string_view>
+#include <vector>
 
 struct was_simple;
 struct timeval;
 
 struct PropNameValue {
-	std::string name;
-	std::string value;
-	http_status_t status;
+	DavName id;
+
+	/**
+	 * The name in the "NAMESPACE|LOCAL" form (null-terminated).
+	 */
+	std::string_view name;
+
+	/**
+	 * The new value (null-terminated).
+	 */
+	std::string_view value;
+
+	http_status_t status = HTTP_STATUS_NOT_FOUND;
 
-	PropNameValue(const char *_name)
-		:name(_name),
-		 status(HTTP_STATUS_NOT_FOUND) {}
+	explicit PropNameValue(const DavProperty &src) noexcept
+		:id(src.id), name(src.name), value(src.value) {}
 
 	[[gnu::pure]]
 	bool IsGetLastModified() const {
-		return name == "DAV:|getlastmodified";
+		return id == DavName::GETLASTMODIFIED;
 	}
 
 	[[gnu::pure]]
 	bool IsWin32LastAccessTime() const {
-		return name == "urn:schemas-microsoft-com:|Win32LastAccessTime";
+		return id == DavName::WIN32_LAST_ACCESS_TIME;
 	}
 
 	[[gnu::pure]]
 	bool IsWin32LastModifiedTime() const {
-		return name == "urn:schemas-microsoft-com:|Win32LastModifiedTime";
+		return id == DavName::WIN32_LAST_MODIFIED_TIME;
 	}
 
 	bool ParseWin32Timestamp(timeval &tv) const;
 };
 
-struct ProppatchParserData {
-	enum State {
-		ROOT,
-		PROP,
-		PROP_NAME,
-	} state;
-
-	std::list<PropNameValue> props;
-
-	ProppatchParserData():state(ROOT) {}
-};
-
 class ProppatchMethod {
-	ProppatchParserData data;
+	/**
+	 * The properties point into the thread's #DavParser, and
+	 * remain valid until it parses the next request.
+	 */
+	std::vector<PropNameValue> props;
 
 public:
 	bool ParseRequest(was_simple *w);
 
-	std::list<PropNameValue> &GetProps() {
-		return data.props;
+	std::vector<PropNameValue> &GetProps() {
+		return props;
 	}
 
 	bool SendResponse(was_simple *w, std::string_view uri);
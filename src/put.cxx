@@ -7,11 +7,16 @@
  */
 
 #include "put.hxx"
+#include "Checksum.hxx"
+#include "ContentHash.hxx"
+#include "ContentStore.hxx"
+#include "ETag.hxx"
 #include "IfMatch.hxx"
+#include "Parameter.hxx"
 #include "error.hxx"
 #include "file.hxx"
+#include "Transfer.hxx"
 #include "was/ExceptionResponse.hxx"
-#include "was/Splice.hxx"
 #include "io/FileWriter.hxx"
 #include "util/PrintException.hxx"
 
@@ -19,47 +24,265 @@ extern "C" {
 #include <was/simple.h>
 }
 
+#include <openssl/evp.h>
+
+#include <algorithm>
 #include <exception>
+#include <optional>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/**
+ * Request bodies smaller than this are never written sparsely; the
+ * copy through userspace would cost more than the holes save.
+ */
+static constexpr int64_t SPARSE_THRESHOLD = 1024 * 1024;
+
+bool
+PutConfig::Setup(was_simple *w) noexcept
+{
+	return GetBooleanParameter(w, "DAVOS_SPARSE_UPLOAD", sparse);
+}
 
 static void
-HandleIfMatch(struct was_simple &was, const struct statx *st)
+HandleIfMatch(struct was_simple &was, const ETagConfig &config,
+	      const FileResource &resource)
 {
-	if (CheckIfMatch(was, st) == PreconditionResult::FAILURE) {
+	if (CheckIfMatch(was, config, resource.GetPath(),
+			 resource.GetStatIfExists()) == PreconditionResult::FAILURE) {
 		was_simple_status(&was, HTTP_STATUS_PRECONDITION_FAILED);
 		throw Was::EndResponse{};
 	}
 }
 
 static void
-HandleIfNoneMatch(struct was_simple &was, const struct statx *st)
+HandleIfNoneMatch(struct was_simple &was, const ETagConfig &config,
+		  const FileResource &resource)
 {
-	if (CheckIfNoneMatch(was, st) == PreconditionResult::FAILURE) {
+	if (CheckIfNoneMatch(was, config, resource.GetPath(),
+			     resource.GetStatIfExists()) == PreconditionResult::FAILURE) {
 		was_simple_status(&was, HTTP_STATUS_PRECONDITION_FAILED);
 		throw Was::EndResponse{};
 	}
 }
 
+/**
+ * Parse the request headers which announce a checksum of the
+ * request body.
+ *
+ * @return false if a header is malformed
+ */
+static bool
+GetExpectedChecksum(was_simple *w, ExpectedChecksum &result) noexcept
+{
+	if (const char *p = was_simple_get_header(w, "digest");
+	    p != nullptr && !ParseDigestHeader(p, result))
+		return false;
+
+	if (const char *p = was_simple_get_header(w, "content-md5");
+	    p != nullptr && !result.IsDefined() &&
+	    !ParseContentMD5Header(p, result))
+		return false;
+
+	if (const char *p = was_simple_get_header(w, "oc-checksum");
+	    p != nullptr && !result.IsDefined() &&
+	    !ParseOcChecksumHeader(p, result))
+		return false;
+
+	return true;
+}
+
+[[gnu::const]]
+static const EVP_MD *
+ToEVP(ChecksumAlgorithm algorithm) noexcept
+{
+	switch (algorithm) {
+	case ChecksumAlgorithm::NONE:
+		break;
+
+	case ChecksumAlgorithm::MD5:
+		return EVP_md5();
+
+	case ChecksumAlgorithm::SHA1:
+		return EVP_sha1();
+
+	case ChecksumAlgorithm::SHA256:
+		return EVP_sha256();
+
+	case ChecksumAlgorithm::SHA512:
+		return EVP_sha512();
+	}
+
+	std::unreachable();
+}
+
+static bool
+VerifyChecksum(Digest &digest, const ExpectedChecksum &expected)
+{
+	std::array<std::byte, Digest::MAX_SIZE> buffer;
+	const auto actual = digest.Final(buffer);
+	return std::ranges::equal(actual, expected.GetValue());
+}
+
+/**
+ * Store the hash calculated while receiving the request body in the
+ * new file.
+ */
+static void
+StoreNewContentHash(FileDescriptor fd, const ContentHash &hash) noexcept
+{
+	struct statx st;
+	if (statx(fd.Get(), "", AT_EMPTY_PATH|AT_STATX_SYNC_AS_STAT,
+		  STATX_MTIME|STATX_INO|STATX_SIZE, &st) == 0)
+		StoreContentHash(fd, st, hash);
+}
+
+/**
+ * Would a file of the given size exceed the quota?
+ */
+[[gnu::pure]]
+static bool
+ExceedsQuota(const FileResource &resource, std::optional<uint64_t> available,
+	     uint64_t new_size) noexcept
+{
+	if (!available)
+		return false;
+
+	/* the old file (if any) is replaced, so its space becomes
+	   available */
+	const uint64_t old_size = resource.Exists() && resource.IsFile()
+		? resource.GetSize()
+		: 0;
+
+	return new_size > *available + old_size;
+}
+
 void
-handle_put(was_simple *w, const FileResource &resource)
+handle_put(was_simple *w, const FileResource &resource,
+	   const PutConfig &config, const ETagConfig &etag_config,
+	   std::optional<uint64_t> available,
+	   const ContentStore *store)
 {
 	assert(was_simple_has_body(w));
 
-	HandleIfMatch(*w, resource.GetStatIfExists());
-	HandleIfNoneMatch(*w, resource.GetStatIfExists());
+	HandleIfMatch(*w, etag_config, resource);
+	HandleIfNoneMatch(*w, etag_config, resource);
+
+	ExpectedChecksum expected_checksum;
+	if (!GetExpectedChecksum(w, expected_checksum)) {
+		was_simple_status(w, HTTP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	/* check the quota before any data is written, if the
+	   request body length is known */
+	if (const int64_t remaining = was_simple_input_remaining(w);
+	    remaining >= 0 && ExceedsQuota(resource, available, remaining)) {
+		was_simple_status(w, HTTP_STATUS_INSUFFICIENT_STORAGE);
+		return;
+	}
 
 	try {
 		FileWriter fw(resource.GetPath());
 
-		if (int64_t remaining = was_simple_input_remaining(w);
-		    remaining >= 64 * 1024)
+		/* if the length is not known, it may be a large
+		   upload */
+		const int64_t remaining = was_simple_input_remaining(w);
+		const bool sparse = config.sparse &&
+			(remaining < 0 || remaining >= SPARSE_THRESHOLD);
+
+		/* preallocating would fill all holes */
+		if (!sparse && remaining >= 64 * 1024)
 			fw.Allocate(remaining);
 
-		if (!SpliceFromWas(w, fw.GetFileDescriptor())) {
+		/* all digests are calculated by one thread which
+		   receives a copy of the body via tee() */
+		std::optional<ContentHasher> content_hasher;
+		if (etag_config.content_hash || store != nullptr)
+			content_hasher.emplace();
+
+		std::optional<Digest> checksum;
+		if (expected_checksum.IsDefined())
+			checksum.emplace(ToEVP(expected_checksum.algorithm));
+
+		Digest *digests[2];
+		std::size_t n_digests = 0;
+		if (content_hasher)
+			digests[n_digests++] = &*content_hasher;
+		if (checksum)
+			digests[n_digests++] = &*checksum;
+
+		std::optional<TeeHasher> hasher;
+		if (n_digests > 0)
+			hasher.emplace(std::span{digests, n_digests});
+
+		uint64_t skipped = 0;
+		if (!(sparse
+		      ? TransferSparseFromWas(w, fw.GetFileDescriptor(),
+					      hasher ? &*hasher : nullptr,
+					      skipped)
+		      : TransferFromWas(w, fw.GetFileDescriptor(),
+					hasher ? &*hasher : nullptr))) {
 			was_simple_status(w, HTTP_STATUS_INTERNAL_SERVER_ERROR);
 			return;
 		}
 
+		if (sparse)
+			was_simple_metric(w, "davos_sparse_skipped_bytes", skipped);
+
+		if (hasher && !hasher->Finish()) {
+			if (checksum) {
+				/* can't verify */
+				was_simple_status(w, HTTP_STATUS_INTERNAL_SERVER_ERROR);
+				return;
+			}
+
+			/* not fatal; the content hash will be
+			   calculated by the next GET */
+			content_hasher.reset();
+		}
+
+		if (checksum && !VerifyChecksum(*checksum, expected_checksum)) {
+			/* the upload was corrupted; discard it */
+			was_simple_status(w, HTTP_STATUS_BAD_REQUEST);
+			return;
+		}
+
+		if (available) {
+			/* the length was not known in advance; check
+			   the quota now, before the file gets
+			   visible */
+			struct statx st;
+			if (statx(fw.GetFileDescriptor().Get(), "",
+				  AT_EMPTY_PATH|AT_STATX_SYNC_AS_STAT,
+				  STATX_SIZE, &st) == 0 &&
+			    ExceedsQuota(resource, available, st.stx_size)) {
+				was_simple_status(w, HTTP_STATUS_INSUFFICIENT_STORAGE);
+				return;
+			}
+		}
+
+		/* the inode number and the modification time survive
+		   Commit(), so the hash can be stored before */
+		std::optional<ContentHash> content_hash;
+		if (content_hasher) {
+			content_hash = content_hasher->Final();
+			StoreNewContentHash(fw.GetFileDescriptor(),
+					    *content_hash);
+		}
+
 		fw.Commit();
+
+		/* without a hash (or if this fails), the file is
+		   simply not deduplicated */
+		if (store != nullptr && content_hash) {
+			try {
+				store->Add(resource.GetPath(), *content_hash);
+			} catch (...) {
+				PrintException(std::current_exception());
+			}
+		}
 	} catch (const std::exception &e) {
 		PrintException(e);
 		was_simple_status(w, HTTP_STATUS_INTERNAL_SERVER_ERROR);
@@ -8,8 +8,37 @@
 
 #pragma once
 
+#include <cstdint>
+#include <optional>
+
 struct was_simple;
+struct ETagConfig;
 class FileResource;
+class ContentStore;
+
+struct PutConfig {
+	/**
+	 * Leave holes in uploaded files instead of writing blocks
+	 * which contain only null bytes?
+	 */
+	bool sparse = false;
 
+	/**
+	 * Parse the WAS parameters.
+	 *
+	 * @return false on error (after printing an error message)
+	 */
+	bool Setup(was_simple *w) noexcept;
+};
+
+/**
+ * @param available if set, then the file may grow by at most this
+ * number of bytes (quota)
+ * @param store if set, then the new file is added to this content
+ * store (or replaced by a link to an identical object)
+ */
 void
-handle_put(was_simple *was, const FileResource &resource);
+handle_put(was_simple *was, const FileResource &resource,
+	   const PutConfig &config, const ETagConfig &etag_config,
+	   std::optional<uint64_t> available,
+	   const ContentStore *store=nullptr);
@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Request handlers for chunked upload sessions.
+ */
+
+#include "upload.hxx"
+#include "UploadSession.hxx"
+#include "ParallelTree.hxx"
+#include "Parameter.hxx"
+#include "directory.hxx"
+#include "error.hxx"
+#include "file.hxx"
+#include "other.hxx"
+#include "put.hxx"
+#include "util.hxx"
+#include "system/Error.hxx"
+#include "io/FileAt.hxx"
+#include "io/FileWriter.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <was/simple.h>
+
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+bool
+UploadConfig::Setup(was_simple *w) noexcept
+{
+	if (const char *p = was_simple_get_parameter(w, "DAVOS_UPLOAD_DIRECTORY");
+	    p != nullptr) {
+		std::string_view value{p};
+		while (value.size() > 1 && value.back() == '/')
+			value.remove_suffix(1);
+
+		if (!value.starts_with('/') || value.size() < 2) {
+			fprintf(stderr, "Malformed DAVOS_UPLOAD_DIRECTORY\n");
+			return false;
+		}
+
+		/* copy the string, because this object is reused for
+		   later requests (see #SiteCache) */
+		directory = value;
+	}
+
+	uint64_t value = expire.count();
+	if (!GetUnsignedParameter(w, "DAVOS_UPLOAD_EXPIRE", value))
+		return false;
+
+	if (value == 0) {
+		fprintf(stderr, "Malformed DAVOS_UPLOAD_EXPIRE\n");
+		return false;
+	}
+
+	expire = std::chrono::seconds(value);
+	return true;
+}
+
+/**
+ * Parse the "OC-Total-Length" request header which is sent by
+ * Nextcloud clients.
+ *
+ * @return false if the header is malformed
+ */
+static bool
+GetTotalLength(was_simple *w, std::optional<uint64_t> &result) noexcept
+{
+	const char *p = was_simple_get_header(w, "oc-total-length");
+	if (p == nullptr)
+		return true;
+
+	char *endptr;
+	const uint64_t value = strtoull(p, &endptr, 10);
+	if (endptr == p || *endptr != 0)
+		return false;
+
+	result = value;
+	return true;
+}
+
+/**
+ * Open the directory containing the given file.
+ */
+static UniqueFileDescriptor
+OpenParentDirectory(std::string_view path)
+{
+	const std::string parent{path.substr(0, path.rfind('/'))};
+
+	UniqueFileDescriptor fd;
+	if (!fd.Open(parent.c_str(), O_DIRECTORY|O_RDONLY|O_NOFOLLOW))
+		throw MakeErrno("Failed to open upload session");
+
+	return fd;
+}
+
+void
+handle_upload_mkcol(was_simple *w, const FileResource &session,
+		    const UploadConfig &config, const TreeConfig &tree)
+{
+	/* new sessions are rare (one per file), so this is a good
+	   opportunity to clean up */
+	ExpireSessions(config.directory.c_str(), config.expire, tree.threads);
+
+	handle_mkcol(w, session);
+}
+
+void
+handle_upload_put(was_simple *w, const FileResource &chunk,
+		  const PutConfig &config, const ETagConfig &etag_config,
+		  std::optional<uint64_t> available)
+{
+	std::optional<uint64_t> total_length;
+	if (!GetTotalLength(w, total_length)) {
+		was_simple_status(w, HTTP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	uint64_t session_size;
+
+	try {
+		session_size = GetSessionSize(OpenParentDirectory(chunk.GetPathView()));
+	} catch (const std::system_error &e) {
+		if (e.code().category() != ErrnoCategory())
+			throw;
+
+		const int error = e.code().value();
+		if (error == ENOENT || error == ENOTDIR)
+			/* RFC 4918 9.7.1: the session must be created
+			   first */
+			was_simple_status(w, HTTP_STATUS_CONFLICT);
+		else
+			errno_response(w, error);
+		return;
+	}
+
+	if (available) {
+		/* if the client announces the size of the whole file,
+		   a session which can never be assembled can be
+		   rejected before any data is stored */
+		if (total_length && *total_length > *available) {
+			was_simple_status(w, HTTP_STATUS_INSUFFICIENT_STORAGE);
+			return;
+		}
+
+		/* the session is outside of the document root, so its
+		   chunks are not accounted yet; handle_put() adds the
+		   size of the chunk being replaced (if any) back */
+		available = *available > session_size
+			? *available - session_size
+			: 0;
+	}
+
+	handle_put(w, chunk, config, etag_config, available);
+}
+
+void
+handle_upload_move(was_simple *w, const char *session,
+		   const FileResource &dest, const TreeConfig &tree,
+		   std::optional<uint64_t> available)
+{
+	if (dest.Exists()) {
+		if (!dest.IsFile()) {
+			errno_response(w, EISDIR);
+			return;
+		}
+
+		if (!get_overwrite_header(w)) {
+			was_simple_status(w, HTTP_STATUS_PRECONDITION_FAILED);
+			return;
+		}
+	}
+
+	std::optional<uint64_t> total_length;
+	if (!GetTotalLength(w, total_length)) {
+		was_simple_status(w, HTTP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	UniqueFileDescriptor fd;
+	if (!fd.Open(session, O_DIRECTORY|O_RDONLY|O_NOFOLLOW)) {
+		errno_response(w);
+		return;
+	}
+
+	uint64_t cloned;
+
+	try {
+		const auto chunks = ListChunks(fd);
+
+		uint64_t size = 0;
+		for (const auto &i : chunks)
+			size += i.size;
+
+		if (total_length && *total_length != size) {
+			/* some chunks are missing or incomplete; the
+			   client may upload them again and retry */
+			was_simple_status(w, HTTP_STATUS_BAD_REQUEST);
+			return;
+		}
+
+		/* the old file (if any) is replaced, so its space
+		   becomes available */
+		if (available &&
+		    size > *available + (dest.Exists() ? dest.GetSize() : 0)) {
+			was_simple_status(w, HTTP_STATUS_INSUFFICIENT_STORAGE);
+			return;
+		}
+
+		FileWriter fw(dest.GetPath());
+		cloned = AssembleChunks(fd, chunks, fw.GetFileDescriptor());
+		fw.Commit();
+	} catch (const std::system_error &e) {
+		if (e.code().category() != ErrnoCategory())
+			throw;
+
+		errno_response(w, e.code().value());
+		return;
+	}
+
+	was_simple_metric(w, "davos_upload_cloned_bytes", cloned);
+
+	/* if this fails, the session will expire eventually */
+	std::vector<TreeError> errors;
+	try {
+		ParallelDelete({FileDescriptor{AT_FDCWD}, session},
+			       tree.threads, errors);
+	} catch (const std::system_error &) {
+	}
+
+	was_simple_status(w, dest.Exists()
+			  ? HTTP_STATUS_NO_CONTENT
+			  : HTTP_STATUS_CREATED);
+}
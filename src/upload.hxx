@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Request handlers for chunked upload sessions (see
+ * UploadSession.hxx).
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+struct was_simple;
+struct PutConfig;
+struct ETagConfig;
+struct TreeConfig;
+class FileResource;
+
+/**
+ * The URI (relative to the mount point) which is mapped to the
+ * upload directory instead of the document root.
+ */
+static constexpr std::string_view UPLOAD_URI = ".davos-uploads";
+
+struct UploadConfig {
+	/**
+	 * The directory containing the upload sessions (without a
+	 * trailing slash); empty if chunked uploads are disabled.  It
+	 * must not be inside the document root, and chunks can be
+	 * cloned only if it is on the same filesystem.
+	 */
+	std::string directory;
+
+	/**
+	 * Sessions which have not been modified for this duration
+	 * are deleted.
+	 */
+	std::chrono::seconds expire{24 * 3600};
+
+	bool IsEnabled() const noexcept {
+		return !directory.empty();
+	}
+
+	/**
+	 * Parse the WAS parameters.
+	 *
+	 * @return false on error (after printing an error message)
+	 */
+	bool Setup(was_simple *w) noexcept;
+};
+
+/**
+ * Create a new upload session.  This also deletes expired sessions.
+ */
+void
+handle_upload_mkcol(was_simple *w, const FileResource &session,
+		    const UploadConfig &config, const TreeConfig &tree);
+
+/**
+ * Store a chunk of an upload session.
+ *
+ * @param available if set, then the whole session may grow to at
+ * most this number of bytes (quota)
+ */
+void
+handle_upload_put(was_simple *w, const FileResource &chunk,
+		  const PutConfig &config, const ETagConfig &etag_config,
+		  std::optional<uint64_t> available);
+
+/**
+ * Assemble the chunks of an upload session into the destination
+ * file and delete the session.
+ *
+ * @param session the path of the session directory
+ * @param available if set, then the destination may grow by at
+ * most this number of bytes (quota)
+ */
+void
+handle_upload_move(was_simple *w, const char *session,
+		   const FileResource &dest, const TreeConfig &tree,
+		   std::optional<uint64_t> available);
@@ -14,6 +14,14 @@ extern "C" {
 
 #include <string.h>
 
+using std::string_view_literals::operator""sv;
+
+bool
+HasDotDotSegment(std::string_view path) noexcept
+{
+	return path.contains("/../"sv) || path.ends_with("/.."sv);
+}
+
 bool
 get_boolean_header(was_simple *w, const char *name,
 		   bool default_value) noexcept
@@ -8,8 +8,18 @@
 
 #pragma once
 
+#include <string_view>
+
 struct was_simple;
 
+/**
+ * Does the given (absolute) path contain a ".." segment?  Such paths
+ * are rejected, because they could escape from the document root.
+ */
+[[gnu::pure]]
+bool
+HasDotDotSegment(std::string_view path) noexcept;
+
 [[gnu::pure]]
 bool
 get_boolean_header(was_simple *w, const char *name,
@@ -10,39 +10,200 @@
 
 #include "io/BufferedOutputStream.hxx"
 
-static void
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * A string literal which can be passed as a template argument.  This
+ * allows concatenating constant XML fragments at compile time.
+ */
+template<std::size_t N>
+struct WxmlLiteral {
+	char value[N + 1]{};
+
+	constexpr WxmlLiteral() noexcept = default;
+
+	constexpr WxmlLiteral(const char (&s)[N + 1]) noexcept {
+		std::copy_n(s, N + 1, value);
+	}
+
+	static constexpr std::size_t size() noexcept {
+		return N;
+	}
+
+	constexpr std::string_view view() const noexcept {
+		return {value, N};
+	}
+};
+
+template<std::size_t N>
+WxmlLiteral(const char (&)[N]) -> WxmlLiteral<N - 1>;
+
+template<std::size_t... Ns>
+constexpr auto
+wxml_concat(const WxmlLiteral<Ns> &...parts) noexcept
+{
+	WxmlLiteral<(Ns + ... + 0)> result;
+	char *p = result.value;
+	((p = std::copy_n(parts.value, Ns, p)), ...);
+	return result;
+}
+
+/**
+ * A constant fragment for wxml_write().
+ */
+template<WxmlLiteral s>
+struct WxmlConst {};
+
+template<WxmlLiteral name>
+using WxmlOpen = WxmlConst<wxml_concat(WxmlLiteral{"<"}, name,
+				       WxmlLiteral{">"})>;
+
+template<WxmlLiteral name>
+using WxmlClose = WxmlConst<wxml_concat(WxmlLiteral{"</"}, name,
+					WxmlLiteral{">"})>;
+
+template<WxmlLiteral name>
+using WxmlShort = WxmlConst<wxml_concat(WxmlLiteral{"<"}, name,
+					WxmlLiteral{"/>"})>;
+
+using WxmlDeclaration =
+	WxmlConst<"<?xml version=\"1.0\" encoding=\"utf-8\"?>\n">;
+
+/**
+ * Character data for wxml_write(); it gets escaped.
+ */
+struct WxmlText {
+	std::string_view value;
+};
+
+/**
+ * Data for wxml_write() which is known to contain no special
+ * characters (e.g. a formatted date); it is copied verbatim.
+ */
+struct WxmlRaw {
+	std::string_view value;
+};
+
+/**
+ * A number for wxml_write().
+ */
+struct WxmlUnsigned {
+	uint64_t value;
+};
+
+void
+wxml_cdata(BufferedOutputStream &o, std::string_view data);
+
+namespace WxmlDetail {
+
+template<WxmlLiteral pending>
+inline void
+Flush(BufferedOutputStream &o)
+{
+	if constexpr (pending.size() > 0)
+		o.Write(pending.view());
+}
+
+inline void
+WriteDynamic(BufferedOutputStream &o, WxmlText text)
+{
+	wxml_cdata(o, text.value);
+}
+
+inline void
+WriteDynamic(BufferedOutputStream &o, WxmlRaw raw)
+{
+	o.Write(raw.value);
+}
+
+inline void
+WriteDynamic(BufferedOutputStream &o, WxmlUnsigned number)
+{
+	o.Fmt("{}", number.value);
+}
+
+template<WxmlLiteral pending>
+inline void
+Write(BufferedOutputStream &o)
+{
+	Flush<pending>(o);
+}
+
+template<WxmlLiteral pending, WxmlLiteral s, typename... Rest>
+void
+Write(BufferedOutputStream &o, WxmlConst<s>, Rest... rest);
+
+template<WxmlLiteral pending, typename T, typename... Rest>
+void
+Write(BufferedOutputStream &o, T dynamic, Rest... rest);
+
+template<WxmlLiteral pending, WxmlLiteral s, typename... Rest>
+inline void
+Write(BufferedOutputStream &o, WxmlConst<s>, Rest... rest)
+{
+	Write<wxml_concat(pending, s)>(o, rest...);
+}
+
+template<WxmlLiteral pending, typename T, typename... Rest>
+inline void
+Write(BufferedOutputStream &o, T dynamic, Rest... rest)
+{
+	Flush<pending>(o);
+	WriteDynamic(o, dynamic);
+	Write<WxmlLiteral<0>{}>(o, rest...);
+}
+
+} // namespace WxmlDetail
+
+/**
+ * Write a sequence of constant fragments (#WxmlConst) and dynamic
+ * values (#WxmlText, #WxmlRaw, #WxmlUnsigned).  Adjacent constant
+ * fragments are concatenated at compile time, so each run of them
+ * costs only one BufferedOutputStream::Write() call.
+ */
+template<typename... Parts>
+inline void
+wxml_write(BufferedOutputStream &o, Parts... parts)
+{
+	WxmlDetail::Write<WxmlLiteral<0>{}>(o, parts...);
+}
+
+inline void
 wxml_declaration(BufferedOutputStream &o)
 {
 	o.Write("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
 }
 
-static void
+inline void
 wxml_begin_tag(BufferedOutputStream &o, std::string_view name)
 {
 	o.Write('<');
 	o.Write(name);
 }
 
-static void
+inline void
 wxml_end_tag(BufferedOutputStream &o)
 {
 	o.Write('>');
 }
 
-static void
+inline void
 wxml_end_short_tag(BufferedOutputStream &o)
 {
 	o.Write("/>");
 }
 
-static void
+inline void
 wxml_open_element(BufferedOutputStream &o, std::string_view name)
 {
 	wxml_begin_tag(o, name);
 	wxml_end_tag(o);
 }
 
-static void
+inline void
 wxml_close_element(BufferedOutputStream &o, std::string_view name)
 {
 	o.Write("</");
@@ -57,9 +218,6 @@ wxml_short_element(BufferedOutputStream &o, std::string_view name)
 	wxml_end_short_tag(o);
 }
 
-void
-wxml_cdata(BufferedOutputStream &o, std::string_view data);
-
 inline void
 wxml_string_element(BufferedOutputStream &o, std::string_view name,
 		    std::string_view value)
@@ -70,7 +228,7 @@ wxml_string_element(BufferedOutputStream &o, std::string_view name,
 }
 
 template<typename S, typename... Args>
-static void
+inline void
 wxml_fmt_element(BufferedOutputStream &o, std::string_view name,
 		 const S &fmt, Args&&... args)
 {
@@ -79,7 +237,7 @@ wxml_fmt_element(BufferedOutputStream &o, std::string_view name,
 	wxml_close_element(o, name);
 }
 
-static void
+inline void
 wxml_attribute(BufferedOutputStream &o, std::string_view name, std::string_view value)
 {
 	o.Write(' ');
@@ -92,16 +250,14 @@ wxml_attribute(BufferedOutputStream &o, std::string_view name, std::string_view
 inline void
 begin_multistatus(BufferedOutputStream &o)
 {
-	wxml_declaration(o);
-	wxml_begin_tag(o, "D:multistatus");
-	wxml_attribute(o, "xmlns:D", "DAV:");
-	wxml_end_tag(o);
+	wxml_write(o, WxmlDeclaration{},
+		   WxmlConst<"<D:multistatus xmlns:D=\"DAV:\">">{});
 }
 
 inline void
 end_multistatus(BufferedOutputStream &o)
 {
-	wxml_close_element(o, "D:multistatus");
+	wxml_write(o, WxmlClose<"D:multistatus">{});
 }
 
 /**
@@ -110,31 +266,69 @@ end_multistatus(BufferedOutputStream &o)
 inline void
 href(BufferedOutputStream &o, std::string_view uri)
 {
-	wxml_string_element(o, "D:href", uri);
+	wxml_write(o, WxmlOpen<"D:href">{}, WxmlText{uri},
+		   WxmlClose<"D:href">{});
 }
 
 inline void
 resourcetype_collection(BufferedOutputStream &o)
 {
-	wxml_open_element(o, "D:resourcetype");
-	wxml_short_element(o, "D:collection");
-	wxml_close_element(o, "D:resourcetype");
+	wxml_write(o, WxmlOpen<"D:resourcetype">{},
+		   WxmlShort<"D:collection">{},
+		   WxmlClose<"D:resourcetype">{});
+}
+
+/**
+ * A "response" element with just a status.
+ *
+ * @param uri an escaped URI
+ */
+inline void
+response_status(BufferedOutputStream &o, std::string_view uri,
+		std::string_view status)
+{
+	wxml_write(o, WxmlOpen<"D:response">{},
+		   WxmlOpen<"D:href">{}, WxmlText{uri}, WxmlClose<"D:href">{},
+		   WxmlOpen<"D:status">{}, WxmlRaw{status}, WxmlClose<"D:status">{},
+		   WxmlClose<"D:response">{});
+}
+
+/**
+ * Emit a response element which tells the client that the listing
+ * of this collection was truncated, like RFC 5323 does for SEARCH
+ * results.
+ */
+inline void
+insufficient_storage(BufferedOutputStream &o, std::string_view uri)
+{
+	wxml_write(o, WxmlOpen<"D:response">{},
+		   WxmlOpen<"D:href">{}, WxmlText{uri}, WxmlClose<"D:href">{},
+		   WxmlConst<"<D:status>HTTP/1.1 507 Insufficient Storage</D:status>">{},
+		   WxmlOpen<"D:error">{},
+		   WxmlShort<"D:number-of-matches-within-limits">{},
+		   WxmlClose<"D:error">{},
+		   WxmlClose<"D:response">{});
 }
 
 inline void
 open_response_prop(BufferedOutputStream &o, std::string_view uri, std::string_view status)
 {
-	wxml_open_element(o, "D:response");
-	href(o, uri);
-	wxml_open_element(o, "D:propstat");
-	wxml_string_element(o, "D:status", status);
-	wxml_open_element(o, "D:prop");
+	wxml_write(o, WxmlOpen<"D:response">{},
+		   WxmlOpen<"D:href">{}, WxmlText{uri}, WxmlClose<"D:href">{},
+		   WxmlOpen<"D:propstat">{},
+		   WxmlOpen<"D:status">{}, WxmlText{status}, WxmlClose<"D:status">{},
+		   WxmlOpen<"D:prop">{});
 }
 
+/**
+ * The constant fragments closing what open_response_prop() has
+ * opened, for fusing with other fragments in wxml_write().
+ */
+using WxmlCloseResponseProp =
+	WxmlConst<"</D:prop></D:propstat></D:response>">;
+
 inline void
 close_response_prop(BufferedOutputStream &o)
 {
-	wxml_close_element(o, "D:prop");
-	wxml_close_element(o, "D:propstat");
-	wxml_close_element(o, "D:response");
+	wxml_write(o, WxmlCloseResponseProp{});
 }
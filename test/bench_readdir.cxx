@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Benchmark comparing readdir() with #DirectoryScanner for listing a
+ * directory and calling statx() on each entry, like PROPFIND does.
+ * If possible, the page cache is dropped before each run (this
+ * requires root).
+ */
+
+#include "DirectoryScanner.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Create the directory and fill it with empty files if it is empty.
+ */
+static void
+Populate(const char *path, unsigned n)
+{
+	if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+		perror("Failed to create directory");
+		exit(EXIT_FAILURE);
+	}
+
+	DirectoryScanner scanner;
+	if (!scanner.Scan(path, 0, 1)) {
+		perror("Failed to read directory");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!scanner.empty())
+		return;
+
+	UniqueFileDescriptor dir;
+	if (!dir.Open(path, O_DIRECTORY|O_RDONLY)) {
+		perror("Failed to open directory");
+		exit(EXIT_FAILURE);
+	}
+
+	for (unsigned i = 0; i < n; ++i) {
+		const auto name = "file" + std::to_string(i);
+		UniqueFileDescriptor fd;
+		if (!fd.Open(dir, name.c_str(), O_CREAT|O_WRONLY, 0644)) {
+			perror("Failed to create file");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static bool
+DropCaches() noexcept
+{
+	sync();
+
+	UniqueFileDescriptor fd;
+	return fd.Open("/proc/sys/vm/drop_caches", O_WRONLY) &&
+		write(fd.Get(), "3", 1) == 1;
+}
+
+static std::size_t
+Stat(int dir_fd, const char *name)
+{
+	struct statx st;
+	return statx(dir_fd, name, AT_SYMLINK_NOFOLLOW,
+		     STATX_TYPE|STATX_MTIME|STATX_CTIME|STATX_INO|STATX_SIZE,
+		     &st) == 0;
+}
+
+/**
+ * The old code path: readdir() and a std::string per name.
+ */
+static std::size_t
+ListReaddir(const char *path)
+{
+	DIR *dir = opendir(path);
+	if (dir == nullptr)
+		return 0;
+
+	std::vector<std::string> names;
+	while (const struct dirent *ent = readdir(dir))
+		if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+			names.emplace_back(ent->d_name);
+
+	std::size_t n = 0;
+	for (const auto &i : names)
+		n += Stat(dirfd(dir), i.c_str());
+
+	closedir(dir);
+	return n;
+}
+
+static std::size_t
+ListScanner(const char *path, bool inode_order)
+{
+	UniqueFileDescriptor fd;
+	DirectoryScanner scanner;
+	if (!fd.Open(path, O_DIRECTORY|O_RDONLY) || !scanner.Scan(fd))
+		return 0;
+
+	if (inode_order)
+		scanner.SortByInode();
+
+	std::size_t n = 0;
+	for (const auto &i : scanner.GetEntries())
+		n += Stat(fd.Get(), scanner.GetName(i));
+
+	return n;
+}
+
+template<typename F>
+static void
+Run(const char *name, F &&f)
+{
+	const bool cold = DropCaches();
+
+	const auto start = std::chrono::steady_clock::now();
+	const std::size_t n = f();
+	const std::chrono::duration<double> duration =
+		std::chrono::steady_clock::now() - start;
+
+	printf("%s: %zu entries in %.1f ms (%s cache)\n", name, n,
+	       duration.count() * 1e3, cold ? "cold" : "warm");
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s DIRECTORY [COUNT]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char *const path = argv[1];
+	Populate(path, argc > 2 ? strtoul(argv[2], nullptr, 10) : 10000);
+
+	Run("readdir", [path]{ return ListReaddir(path); });
+	Run("getdents", [path]{ return ListScanner(path, false); });
+	Run("getdents+inode", [path]{ return ListScanner(path, true); });
+	return EXIT_SUCCESS;
+}
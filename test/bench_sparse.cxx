@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Benchmark comparing TransferFromWas() with TransferSparseFromWas()
+ * for synthetic disk images: throughput and allocated disk space.
+ * The libwas functions used by the transfer are replaced with a
+ * plain pipe.
+ */
+
+#include "Transfer.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <was/simple.h>
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct was_simple {
+	int input_fd;
+	int64_t remaining;
+};
+
+int
+was_simple_input_fd(const struct was_simple *w)
+{
+	return w->input_fd;
+}
+
+int64_t
+was_simple_input_remaining(const struct was_simple *w)
+{
+	return w->remaining;
+}
+
+enum was_simple_poll_result
+was_simple_input_poll(struct was_simple *w, int timeout_ms)
+{
+	if (w->remaining == 0)
+		return WAS_SIMPLE_POLL_END;
+
+	struct pollfd pfd{w->input_fd, POLLIN, 0};
+	return poll(&pfd, 1, timeout_ms) > 0
+		? WAS_SIMPLE_POLL_SUCCESS
+		: WAS_SIMPLE_POLL_ERROR;
+}
+
+bool
+was_simple_received(struct was_simple *w, size_t nbytes)
+{
+	w->remaining -= nbytes;
+	return true;
+}
+
+/* the response functions are referenced by TransferToWas() and
+   the io_uring engine, but not used */
+
+bool
+was_simple_set_length(struct was_simple *, uint64_t)
+{
+	abort();
+}
+
+int
+was_simple_output_fd(struct was_simple *)
+{
+	abort();
+}
+
+enum was_simple_poll_result
+was_simple_output_poll(struct was_simple *, int)
+{
+	abort();
+}
+
+bool
+was_simple_sent(struct was_simple *, size_t)
+{
+	abort();
+}
+
+bool
+was_simple_metric(struct was_simple *, const char *, float)
+{
+	abort();
+}
+
+/* referenced by QosConfig and QosScope, but there is no QosScope
+   here */
+
+const char *
+was_simple_get_parameter(const struct was_simple *, const char *)
+{
+	abort();
+}
+
+http_method_t
+was_simple_get_method(const struct was_simple *)
+{
+	abort();
+}
+
+/**
+ * The granularity of the generated image.
+ */
+static constexpr std::size_t EXTENT = 64 * 1024;
+
+/**
+ * Generate the image: each extent is random data with the given
+ * probability (in percent), otherwise null bytes.
+ */
+static std::vector<std::byte>
+Generate(std::size_t size, unsigned percent)
+{
+	std::vector<std::byte> image(size);
+	std::mt19937_64 rng{42};
+
+	for (std::size_t i = 0; i < size; i += EXTENT) {
+		if (rng() % 100 >= percent)
+			continue;
+
+		for (std::size_t j = i; j < std::min(i + EXTENT, size); ++j)
+			image[j] = std::byte(rng());
+	}
+
+	return image;
+}
+
+static void
+Run(const char *name, const char *directory,
+    const std::vector<std::byte> &image, bool sparse)
+{
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC|O_NONBLOCK) < 0) {
+		perror("pipe2() failed");
+		exit(EXIT_FAILURE);
+	}
+
+	UniqueFileDescriptor file;
+	if (!file.Open(directory, O_TMPFILE|O_RDWR, 0600)) {
+		perror("Failed to create file");
+		exit(EXIT_FAILURE);
+	}
+
+	std::thread writer{[&]{
+		const std::byte *p = image.data(), *end = p + image.size();
+		while (p < end) {
+			ssize_t nbytes = write(fds[1], p, end - p);
+			if (nbytes > 0)
+				p += nbytes;
+			else {
+				struct pollfd pfd{fds[1], POLLOUT, 0};
+				poll(&pfd, 1, -1);
+			}
+		}
+	}};
+
+	const auto start = std::chrono::steady_clock::now();
+
+	was_simple w{fds[0], int64_t(image.size())};
+	uint64_t skipped = 0;
+	const bool success = sparse
+		? TransferSparseFromWas(&w, file, nullptr, skipped)
+		: TransferFromWas(&w, file);
+
+	const std::chrono::duration<double> duration =
+		std::chrono::steady_clock::now() - start;
+
+	writer.join();
+	close(fds[0]);
+	close(fds[1]);
+
+	if (!success) {
+		fprintf(stderr, "%s: transfer failed\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	/* verify the contents */
+	std::vector<std::byte> result(image.size());
+	struct stat st;
+	if (fstat(file.Get(), &st) < 0 ||
+	    uint64_t(st.st_size) != image.size() ||
+	    file.ReadAt(0, result) != ssize_t(result.size()) ||
+	    result != image) {
+		fprintf(stderr, "%s: wrong file contents\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%s: %.1f MB/s, %llu kB allocated, %llu kB skipped\n", name,
+	       image.size() / duration.count() / 1e6,
+	       (unsigned long long)st.st_blocks / 2,
+	       (unsigned long long)skipped / 1024);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "Usage: %s DIRECTORY [MIB [PERCENT_DATA]]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const char *const directory = argv[1];
+	const std::size_t size = (argc > 2 ? strtoul(argv[2], nullptr, 10) : 256)
+		* 1024 * 1024;
+	const unsigned percent = argc > 3 ? strtoul(argv[3], nullptr, 10) : 10;
+
+	const auto image = Generate(size, percent);
+
+	Run("splice", directory, image, false);
+	Run("sparse", directory, image, true);
+	return EXIT_SUCCESS;
+}
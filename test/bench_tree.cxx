@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Benchmark for ParallelCopy() and ParallelDelete() with different
+ * numbers of threads.  It generates a tree in the given directory,
+ * copies it and deletes the copy.
+ */
+
+#include "ParallelTree.hxx"
+#include "io/FileAt.hxx"
+#include "io/RecursiveCopy.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void
+Generate(const std::string &path, unsigned n_directories, unsigned n_files)
+{
+	static constexpr char data[4096]{};
+
+	if (mkdir(path.c_str(), 0755) < 0) {
+		perror("Failed to create directory");
+		exit(EXIT_FAILURE);
+	}
+
+	for (unsigned i = 0; i < n_directories; ++i) {
+		const auto dir = path + "/d" + std::to_string(i);
+		if (mkdir(dir.c_str(), 0755) < 0) {
+			perror("Failed to create directory");
+			exit(EXIT_FAILURE);
+		}
+
+		for (unsigned j = 0; j < n_files; ++j) {
+			const auto name = dir + "/f" + std::to_string(j);
+			UniqueFileDescriptor fd;
+			if (!fd.Open(name.c_str(), O_CREAT|O_WRONLY, 0644) ||
+			    write(fd.Get(), data, sizeof(data)) < 0) {
+				perror("Failed to create file");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+}
+
+static double
+Measure(auto &&f)
+{
+	const auto start = std::chrono::steady_clock::now();
+	f();
+	const std::chrono::duration<double> duration =
+		std::chrono::steady_clock::now() - start;
+	return duration.count() * 1e3;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "Usage: %s DIRECTORY [DIRECTORIES [FILES]]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const std::string base = argv[1];
+	const unsigned n_directories = argc > 2 ? strtoul(argv[2], nullptr, 10) : 200;
+	const unsigned n_files = argc > 3 ? strtoul(argv[3], nullptr, 10) : 100;
+
+	const std::string src = base + "/bench_tree.src";
+	const std::string dst = base + "/bench_tree.dst";
+	Generate(src, n_directories, n_files);
+
+	for (const unsigned threads : {1U, 4U, 16U}) {
+		std::vector<TreeError> errors;
+
+		/* don't measure the writeback of the previous run */
+		sync();
+
+		const double copy = Measure([&]{
+			ParallelCopy({FileDescriptor{AT_FDCWD}, src.c_str()},
+				     {FileDescriptor{AT_FDCWD}, dst.c_str()},
+				     RECURSIVE_COPY_ONE_FILESYSTEM,
+				     threads, errors);
+		});
+
+		sync();
+
+		const double del = Measure([&]{
+			ParallelDelete({FileDescriptor{AT_FDCWD}, dst.c_str()},
+				       threads, errors);
+		});
+
+		printf("%2u threads: copy %.1f ms, delete %.1f ms, %zu errors\n",
+		       threads, copy, del, errors.size());
+	}
+
+	std::vector<TreeError> errors;
+	ParallelDelete({FileDescriptor{AT_FDCWD}, src.c_str()}, 1, errors);
+	return EXIT_SUCCESS;
+}
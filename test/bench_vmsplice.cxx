@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Microbenchmark comparing write() with #VmspliceOutputStream for
+ * large generated PROPFIND responses.  The libwas functions used by
+ * the stream are replaced with a plain pipe.
+ */
+
+#include "VmspliceOutputStream.hxx"
+#include "wxml.hxx"
+
+#include <was/simple.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string_view>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using std::string_view_literals::operator""sv;
+
+struct was_simple {
+	int output_fd;
+};
+
+bool
+was_simple_write(struct was_simple *w, const void *data, size_t length)
+{
+	const auto *p = static_cast<const std::byte *>(data);
+	while (length > 0) {
+		ssize_t nbytes = write(w->output_fd, p, length);
+		if (nbytes > 0) {
+			p += nbytes;
+			length -= nbytes;
+		} else if (nbytes < 0 && errno == EAGAIN) {
+			struct pollfd pfd{w->output_fd, POLLOUT, 0};
+			poll(&pfd, 1, -1);
+		} else
+			return false;
+	}
+
+	return true;
+}
+
+int
+was_simple_output_fd(struct was_simple *w)
+{
+	return w->output_fd;
+}
+
+bool
+was_simple_sent(struct was_simple *, size_t)
+{
+	return true;
+}
+
+enum was_simple_poll_result
+was_simple_output_poll(struct was_simple *w, int timeout_ms)
+{
+	struct pollfd pfd{w->output_fd, POLLOUT, 0};
+	return poll(&pfd, 1, timeout_ms) > 0
+		? WAS_SIMPLE_POLL_SUCCESS
+		: WAS_SIMPLE_POLL_ERROR;
+}
+
+/**
+ * The current code path: copy with write().
+ */
+class WriteOutputStream final : public OutputStream {
+	was_simple *const w;
+
+public:
+	explicit WriteOutputStream(was_simple *_w) noexcept:w(_w) {}
+
+	void Write(std::span<const std::byte> src) override {
+		if (!was_simple_write(w, src.data(), src.size()))
+			abort();
+	}
+};
+
+static void
+Generate(OutputStream &os, std::size_t n)
+{
+	BufferedOutputStream bos{os};
+
+	begin_multistatus(bos);
+
+	for (std::size_t i = 0; i < n; ++i) {
+		open_response_prop(bos, "/dav/some%20directory/file.txt"sv,
+				   "HTTP/1.1 200 OK"sv);
+		wxml_write(bos, WxmlOpen<"D:getcontentlength">{},
+			   WxmlUnsigned{i},
+			   WxmlClose<"D:getcontentlength">{},
+			   WxmlOpen<"D:getlastmodified">{},
+			   WxmlRaw{"Mon, 19 Oct 2026 12:00:00 GMT"sv},
+			   WxmlClose<"D:getlastmodified">{});
+		close_response_prop(bos);
+	}
+
+	end_multistatus(bos);
+	bos.Flush();
+}
+
+/**
+ * Drain the pipe like the WAS peer would, and calculate a checksum
+ * to compare the two code paths.
+ */
+static void
+Drain(int fd, bool use_splice, std::size_t &total, uint64_t &hash)
+{
+	total = 0;
+	hash = 14695981039346656037ULL;
+
+	if (use_splice) {
+		const int null_fd = open("/dev/null", O_WRONLY);
+		ssize_t nbytes;
+		while ((nbytes = splice(fd, nullptr, null_fd, nullptr,
+					1024 * 1024, SPLICE_F_MOVE)) > 0)
+			total += nbytes;
+		close(null_fd);
+		return;
+	}
+
+	static std::byte buffer[65536];
+	ssize_t nbytes;
+	while ((nbytes = read(fd, buffer, sizeof(buffer))) > 0) {
+		total += nbytes;
+		for (ssize_t i = 0; i < nbytes; ++i)
+			hash = (hash ^ std::to_integer<uint8_t>(buffer[i]))
+				* 1099511628211ULL;
+	}
+}
+
+template<typename S>
+static void
+Run(const char *name, std::size_t n, bool use_splice)
+{
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		perror("pipe2() failed");
+		exit(EXIT_FAILURE);
+	}
+
+	std::size_t total;
+	uint64_t hash;
+	std::thread reader{[&]{ Drain(fds[0], use_splice, total, hash); }};
+
+	const auto start = std::chrono::steady_clock::now();
+
+	{
+		was_simple w{fds[1]};
+		S os{&w};
+		Generate(os, n);
+		if constexpr (requires { os.Flush(); })
+			os.Flush();
+
+		close(fds[1]);
+		reader.join();
+	}
+
+	const std::chrono::duration<double> duration =
+		std::chrono::steady_clock::now() - start;
+
+	close(fds[0]);
+
+	printf("%s: %.1f MB/s, %zu bytes, hash %016llx\n", name,
+	       total / duration.count() / 1e6, total,
+	       use_splice ? 0ULL : (unsigned long long)hash);
+}
+
+int
+main(int argc, char **argv)
+{
+	const std::size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+	const bool use_splice = argc > 2 && strcmp(argv[2], "splice") == 0;
+	if (n == 0) {
+		fprintf(stderr, "Usage: %s [COUNT [splice]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	Run<WriteOutputStream>("write", n, use_splice);
+	Run<VmspliceOutputStream>("vmsplice", n, use_splice);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+/*
+ * Microbenchmark comparing the primitive XML writer functions with
+ * the compile-time fused wxml_write() for PROPFIND-like responses.
+ */
+
+#include "wxml.hxx"
+#include "io/OutputStream.hxx"
+
+#include <chrono>
+#include <cstdio>
+
+#include <stdlib.h>
+
+/**
+ * Discards all data, but counts the calls so the compiler cannot
+ * optimize them away.
+ */
+class NullOutputStream final : public OutputStream {
+public:
+	std::size_t n_writes = 0, n_bytes = 0;
+
+	void Write(std::span<const std::byte> src) override {
+		++n_writes;
+		n_bytes += src.size();
+	}
+};
+
+static constexpr std::string_view uri = "/dav/some%20directory/file.txt";
+static constexpr std::string_view date = "Mon, 19 Oct 2026 12:00:00 GMT";
+
+static void
+LegacyEntry(BufferedOutputStream &o, uint64_t size)
+{
+	wxml_open_element(o, "D:response");
+	wxml_string_element(o, "D:href", uri);
+	wxml_open_element(o, "D:propstat");
+	wxml_string_element(o, "D:status", "HTTP/1.1 200 OK");
+	wxml_open_element(o, "D:prop");
+	wxml_fmt_element(o, "D:getcontentlength", "{}", size);
+	wxml_string_element(o, "D:getlastmodified", date);
+	wxml_close_element(o, "D:prop");
+	wxml_close_element(o, "D:propstat");
+	wxml_close_element(o, "D:response");
+}
+
+static void
+FusedEntry(BufferedOutputStream &o, uint64_t size)
+{
+	wxml_write(o, WxmlOpen<"D:response">{},
+		   WxmlOpen<"D:href">{}, WxmlText{uri}, WxmlClose<"D:href">{},
+		   WxmlOpen<"D:propstat">{},
+		   WxmlConst<"<D:status>HTTP/1.1 200 OK</D:status>">{},
+		   WxmlOpen<"D:prop">{},
+		   WxmlOpen<"D:getcontentlength">{},
+		   WxmlUnsigned{size},
+		   WxmlClose<"D:getcontentlength">{},
+		   WxmlOpen<"D:getlastmodified">{},
+		   WxmlRaw{date},
+		   WxmlClose<"D:getlastmodified">{},
+		   WxmlCloseResponseProp{});
+}
+
+template<typename F>
+static void
+Run(const char *name, std::size_t n, F &&f)
+{
+	NullOutputStream nos;
+	BufferedOutputStream bos{nos};
+
+	const auto start = std::chrono::steady_clock::now();
+
+	begin_multistatus(bos);
+	for (std::size_t i = 0; i < n; ++i)
+		f(bos, i);
+	end_multistatus(bos);
+	bos.Flush();
+
+	const std::chrono::duration<double, std::nano> duration =
+		std::chrono::steady_clock::now() - start;
+
+	printf("%s: %.1f ns/entry, %zu bytes\n",
+	       name, duration.count() / n, nos.n_bytes);
+}
+
+int
+main(int argc, char **argv)
+{
+	const std::size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+	if (n == 0) {
+		fprintf(stderr, "Usage: %s [COUNT]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	Run("legacy", n, LegacyEntry);
+	Run("fused", n, FusedEntry);
+	return EXIT_SUCCESS;
+}
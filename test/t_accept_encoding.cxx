@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "AcceptEncoding.hxx"
+
+#include <gtest/gtest.h>
+
+TEST(AcceptEncodingTest, Basic)
+{
+	EXPECT_EQ(NegotiateContentEncoding(nullptr, true),
+		  ContentEncoding::IDENTITY);
+	EXPECT_EQ(NegotiateContentEncoding("", true),
+		  ContentEncoding::IDENTITY);
+	EXPECT_EQ(NegotiateContentEncoding("deflate, br", true),
+		  ContentEncoding::IDENTITY);
+	EXPECT_EQ(NegotiateContentEncoding("gzip", true),
+		  ContentEncoding::GZIP);
+	EXPECT_EQ(NegotiateContentEncoding("x-gzip", false),
+		  ContentEncoding::GZIP);
+	EXPECT_EQ(NegotiateContentEncoding("gzip, deflate, zstd", true),
+		  ContentEncoding::ZSTD);
+	EXPECT_EQ(NegotiateContentEncoding("gzip, deflate, zstd", false),
+		  ContentEncoding::GZIP);
+	EXPECT_EQ(NegotiateContentEncoding("zstd", false),
+		  ContentEncoding::IDENTITY);
+}
+
+TEST(AcceptEncodingTest, Quality)
+{
+	EXPECT_EQ(NegotiateContentEncoding("gzip;q=0", true),
+		  ContentEncoding::IDENTITY);
+	EXPECT_EQ(NegotiateContentEncoding("gzip; q=0.000", true),
+		  ContentEncoding::IDENTITY);
+	EXPECT_EQ(NegotiateContentEncoding("gzip;q=0.001", true),
+		  ContentEncoding::GZIP);
+	EXPECT_EQ(NegotiateContentEncoding("zstd;q=0, gzip;q=0.5", true),
+		  ContentEncoding::GZIP);
+}
+
+TEST(AcceptEncodingTest, Wildcard)
+{
+	EXPECT_EQ(NegotiateContentEncoding("*", true),
+		  ContentEncoding::ZSTD);
+	EXPECT_EQ(NegotiateContentEncoding("*", false),
+		  ContentEncoding::GZIP);
+	EXPECT_EQ(NegotiateContentEncoding("zstd;q=0, *", true),
+		  ContentEncoding::GZIP);
+	EXPECT_EQ(NegotiateContentEncoding("gzip, *;q=0", true),
+		  ContentEncoding::GZIP);
+}
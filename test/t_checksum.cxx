@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Checksum.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+static bool
+ValueEquals(const ExpectedChecksum &c, std::initializer_list<uint8_t> expected)
+{
+	return std::ranges::equal(c.GetValue(), expected,
+				  [](std::byte a, uint8_t b){
+					  return std::to_integer<uint8_t>(a) == b;
+				  });
+}
+
+/* the MD5 of the empty string */
+static constexpr std::initializer_list<uint8_t> empty_md5{
+	0xd4, 0x1d, 0x8c, 0xd9, 0x8f, 0x00, 0xb2, 0x04,
+	0xe9, 0x80, 0x09, 0x98, 0xec, 0xf8, 0x42, 0x7e,
+};
+
+TEST(ChecksumTest, Digest)
+{
+	ExpectedChecksum c;
+	EXPECT_TRUE(ParseDigestHeader("UNIXsum=30637", c));
+	EXPECT_FALSE(c.IsDefined());
+
+	c = {};
+	EXPECT_TRUE(ParseDigestHeader("unixsum=30637, md5=1B2M2Y8AsgTpgAmY7PhCfg==", c));
+	EXPECT_EQ(c.algorithm, ChecksumAlgorithm::MD5);
+	EXPECT_TRUE(ValueEquals(c, empty_md5));
+
+	c = {};
+	EXPECT_TRUE(ParseDigestHeader("SHA-256=47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=", c));
+	EXPECT_EQ(c.algorithm, ChecksumAlgorithm::SHA256);
+	EXPECT_EQ(c.size, 32U);
+
+	/* wrong length */
+	c = {};
+	EXPECT_FALSE(ParseDigestHeader("MD5=47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=", c));
+
+	/* invalid base64 */
+	c = {};
+	EXPECT_FALSE(ParseDigestHeader("md5=1B2M2Y8AsgTpgAmY7PhCf!==", c));
+}
+
+TEST(ChecksumTest, ContentMD5)
+{
+	ExpectedChecksum c;
+	EXPECT_TRUE(ParseContentMD5Header("1B2M2Y8AsgTpgAmY7PhCfg==", c));
+	EXPECT_EQ(c.algorithm, ChecksumAlgorithm::MD5);
+	EXPECT_TRUE(ValueEquals(c, empty_md5));
+
+	c = {};
+	EXPECT_FALSE(ParseContentMD5Header("1B2M2Y8Asg", c));
+}
+
+TEST(ChecksumTest, OcChecksum)
+{
+	ExpectedChecksum c;
+	EXPECT_TRUE(ParseOcChecksumHeader("ADLER32:00000001", c));
+	EXPECT_FALSE(c.IsDefined());
+
+	c = {};
+	EXPECT_TRUE(ParseOcChecksumHeader("MD5:d41d8cd98f00b204e9800998ecf8427e", c));
+	EXPECT_EQ(c.algorithm, ChecksumAlgorithm::MD5);
+	EXPECT_TRUE(ValueEquals(c, empty_md5));
+
+	c = {};
+	EXPECT_TRUE(ParseOcChecksumHeader("SHA1:da39a3ee5e6b4b0d3255bfef95601890afd80709", c));
+	EXPECT_EQ(c.algorithm, ChecksumAlgorithm::SHA1);
+
+	c = {};
+	EXPECT_FALSE(ParseOcChecksumHeader("SHA1:da39", c));
+
+	c = {};
+	EXPECT_FALSE(ParseOcChecksumHeader("SHA1", c));
+}
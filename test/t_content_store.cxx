@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ContentStore.hxx"
+#include "file.hxx"
+#include "io/FileAt.hxx"
+#include "ParallelTree.hxx"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void
+WriteFile(const std::string &path, const std::string &contents)
+{
+	std::ofstream{path} << contents;
+}
+
+/**
+ * Write a file with a fixed modification time, so files with the
+ * same contents can be linked.
+ */
+static void
+WriteLinkableFile(const std::string &path, const std::string &contents)
+{
+	WriteFile(path, contents);
+
+	const struct timespec times[2]{{0, UTIME_OMIT}, {1700000000, 0}};
+	utimensat(AT_FDCWD, path.c_str(), times, 0);
+}
+
+static std::string
+ReadFile(const std::string &path)
+{
+	std::ostringstream s;
+	s << std::ifstream{path}.rdbuf();
+	return s.str();
+}
+
+static struct stat
+Stat(const std::string &path)
+{
+	struct stat st{};
+	stat(path.c_str(), &st);
+	return st;
+}
+
+class ContentStoreTest : public ::testing::Test {
+protected:
+	char base[32] = "/tmp/t_content_store.XXXXXX";
+	std::string root, objects;
+	ContentStore store;
+
+	void SetUp() override {
+		ASSERT_NE(mkdtemp(base), nullptr);
+		root = std::string{base} + "/root";
+		objects = std::string{base} + "/store";
+		ASSERT_EQ(mkdir(root.c_str(), 0755), 0);
+		ASSERT_EQ(mkdir(objects.c_str(), 0700), 0);
+		store = ContentStore{objects};
+	}
+
+	void TearDown() override {
+		std::vector<TreeError> errors;
+		ParallelDelete({FileDescriptor{AT_FDCWD}, base}, 1, errors);
+	}
+};
+
+TEST_F(ContentStoreTest, Dedupe)
+{
+	WriteFile(root + "/a", "hello");
+	WriteFile(root + "/c", "world");
+	usleep(10000);
+	WriteFile(root + "/b", "hello");
+	const auto b = Stat(root + "/b");
+
+	store.Ingest((root + "/a").c_str());
+	store.Ingest((root + "/b").c_str());
+	store.Ingest((root + "/c").c_str());
+
+	/* "a" became the object; a link would give "b" the older
+	   modification time of "a", so it keeps its inode (and
+	   shares the data blocks if the filesystem supports
+	   reflinks) */
+	EXPECT_EQ(Stat(root + "/a").st_nlink, 2U);
+	EXPECT_EQ(Stat(root + "/c").st_nlink, 2U);
+	EXPECT_EQ(Stat(root + "/b").st_ino, b.st_ino);
+	EXPECT_EQ(Stat(root + "/b").st_nlink, 1U);
+	EXPECT_EQ(Stat(root + "/b").st_mtim.tv_sec, b.st_mtim.tv_sec);
+	EXPECT_EQ(Stat(root + "/b").st_mtim.tv_nsec, b.st_mtim.tv_nsec);
+	EXPECT_EQ(ReadFile(root + "/b"), "hello");
+
+	const auto hash = store.Lookup(FileResource{root + "/a"});
+	ASSERT_TRUE(hash);
+	EXPECT_EQ(Stat(store.GetObjectPath(*hash)).st_ino,
+		  Stat(root + "/a").st_ino);
+}
+
+TEST_F(ContentStoreTest, Link)
+{
+	WriteLinkableFile(root + "/a", "hello");
+	WriteLinkableFile(root + "/b", "hello");
+	WriteLinkableFile(root + "/c", "world");
+
+	store.Ingest((root + "/a").c_str());
+	store.Ingest((root + "/b").c_str());
+	store.Ingest((root + "/c").c_str());
+
+	EXPECT_EQ(Stat(root + "/a").st_ino, Stat(root + "/b").st_ino);
+	EXPECT_NE(Stat(root + "/a").st_ino, Stat(root + "/c").st_ino);
+	EXPECT_EQ(Stat(root + "/a").st_nlink, 3U);
+	EXPECT_EQ(ReadFile(root + "/b"), "hello");
+
+	/* ingesting again does nothing */
+	store.Ingest((root + "/b").c_str());
+	EXPECT_EQ(Stat(root + "/a").st_nlink, 3U);
+}
+
+TEST_F(ContentStoreTest, Release)
+{
+	WriteLinkableFile(root + "/a", "hello");
+	WriteLinkableFile(root + "/b", "hello");
+	store.Ingest((root + "/a").c_str());
+	store.Ingest((root + "/b").c_str());
+
+	const auto hash = store.Lookup(FileResource{root + "/a"});
+	ASSERT_TRUE(hash);
+	const auto object = store.GetObjectPath(*hash);
+
+	unlink((root + "/a").c_str());
+	store.Release(*hash);
+	EXPECT_EQ(Stat(object).st_nlink, 2U);
+
+	unlink((root + "/b").c_str());
+	store.Release(*hash);
+	EXPECT_EQ(Stat(object).st_nlink, 0U);
+}
+
+TEST_F(ContentStoreTest, BreakLink)
+{
+	WriteLinkableFile(root + "/a", "hello");
+	WriteLinkableFile(root + "/b", "hello");
+	store.Ingest((root + "/a").c_str());
+	store.Ingest((root + "/b").c_str());
+
+	BreakLink((root + "/a").c_str());
+
+	EXPECT_NE(Stat(root + "/a").st_ino, Stat(root + "/b").st_ino);
+	EXPECT_EQ(Stat(root + "/a").st_nlink, 1U);
+	EXPECT_EQ(Stat(root + "/b").st_nlink, 2U);
+	EXPECT_EQ(ReadFile(root + "/a"), "hello");
+	EXPECT_EQ(Stat(root + "/a").st_mtim.tv_sec,
+		  Stat(root + "/b").st_mtim.tv_sec);
+}
+
+TEST_F(ContentStoreTest, CollectGarbage)
+{
+	WriteFile(root + "/a", "hello");
+	WriteFile(root + "/b", "world!");
+	store.Ingest((root + "/a").c_str());
+	store.Ingest((root + "/b").c_str());
+
+	unlink((root + "/b").c_str());
+
+	const auto stats = CollectGarbage(objects.c_str());
+	EXPECT_EQ(stats.objects, 1U);
+	EXPECT_EQ(stats.bytes, 6U);
+
+	EXPECT_EQ(Stat(root + "/a").st_nlink, 2U);
+	EXPECT_EQ(CollectGarbage(objects.c_str()).objects, 0U);
+}
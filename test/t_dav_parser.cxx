@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "DavParser.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using std::string_view_literals::operator""sv;
+
+TEST(DavParserTest, Intern)
+{
+	EXPECT_EQ(InternDavName("DAV:|prop"sv), DavName::PROP);
+	EXPECT_EQ(InternDavName("DAV:|getlastmodified"sv), DavName::GETLASTMODIFIED);
+	EXPECT_EQ(InternDavName("urn:schemas-microsoft-com:|Win32LastModifiedTime"sv),
+		  DavName::WIN32_LAST_MODIFIED_TIME);
+	EXPECT_EQ(InternDavName("DAV:|foo"sv), DavName::UNKNOWN);
+	EXPECT_EQ(InternDavName("prop"sv), DavName::UNKNOWN);
+}
+
+TEST(DavParserTest, Proppatch)
+{
+	DavParser parser;
+	ASSERT_TRUE(parser.Parse(R"(<?xml version="1.0" encoding="utf-8"?>
+<D:propertyupdate xmlns:D="DAV:" xmlns:Z="urn:schemas-microsoft-com:">
+  <D:set>
+    <D:prop>
+      <Z:Win32LastModifiedTime>Mon, 19 Oct 2026 12:00:00 GMT</Z:Win32LastModifiedTime>
+      <D:getlastmodified>a&amp;b</D:getlastmodified>
+      <X:foo xmlns:X="http://example.com/"><X:bar>1</X:bar>2</X:foo>
+    </D:prop>
+  </D:set>
+</D:propertyupdate>
+)"sv));
+
+	const auto p = parser.GetProperties();
+	ASSERT_EQ(p.size(), 3U);
+
+	EXPECT_EQ(p[0].id, DavName::WIN32_LAST_MODIFIED_TIME);
+	EXPECT_EQ(p[0].value, "Mon, 19 Oct 2026 12:00:00 GMT"sv);
+	EXPECT_EQ(p[0].value.data()[p[0].value.size()], '\0');
+
+	/* character data may be split at entities */
+	EXPECT_EQ(p[1].id, DavName::GETLASTMODIFIED);
+	EXPECT_EQ(p[1].value, "a&b"sv);
+
+	EXPECT_EQ(p[2].id, DavName::UNKNOWN);
+	EXPECT_EQ(p[2].name, "http://example.com/|foo"sv);
+	EXPECT_EQ(p[2].name.data()[p[2].name.size()], '\0');
+	EXPECT_EQ(p[2].value, "12"sv);
+
+	EXPECT_TRUE(parser.GetOwnerHref().empty());
+}
+
+TEST(DavParserTest, Lock)
+{
+	DavParser parser;
+	ASSERT_TRUE(parser.Parse(R"(<?xml version="1.0" encoding="utf-8"?>
+<D:lockinfo xmlns:D="DAV:">
+  <D:lockscope><D:exclusive/></D:lockscope>
+  <D:locktype><D:write/></D:locktype>
+  <D:owner><D:href>http://example.com/~user</D:href></D:owner>
+</D:lockinfo>
+)"sv));
+
+	EXPECT_TRUE(parser.GetProperties().empty());
+	EXPECT_EQ(parser.GetOwnerHref(), "http://example.com/~user"sv);
+}
+
+TEST(DavParserTest, Reuse)
+{
+	DavParser parser;
+	ASSERT_TRUE(parser.Parse(R"(<D:propfind xmlns:D="DAV:"><D:prop><D:quota-used-bytes/></D:prop></D:propfind>)"sv));
+	ASSERT_EQ(parser.GetProperties().size(), 1U);
+	EXPECT_EQ(parser.GetProperties()[0].id, DavName::QUOTA_USED_BYTES);
+	EXPECT_TRUE(parser.GetProperties()[0].value.empty());
+
+	EXPECT_FALSE(parser.Parse(R"(<D:propfind xmlns:D="DAV:"><D:prop>)"sv));
+
+	ASSERT_TRUE(parser.Parse(R"(<D:propfind xmlns:D="DAV:"><D:allprop/></D:propfind>)"sv));
+	EXPECT_TRUE(parser.GetProperties().empty());
+}
+
+TEST(DavParserTest, SyncCollection)
+{
+	DavParser parser;
+	ASSERT_TRUE(parser.Parse(R"(<?xml version="1.0" encoding="utf-8"?>
+<D:sync-collection xmlns:D="DAV:">
+  <D:sync-token>http://example.com/sync/1</D:sync-token>
+  <D:sync-level>infinite</D:sync-level>
+  <D:prop><D:getlastmodified/></D:prop>
+</D:sync-collection>
+)"sv));
+
+	EXPECT_EQ(parser.GetRoot(), DavName::SYNC_COLLECTION);
+	EXPECT_EQ(parser.GetSyncToken(), "http://example.com/sync/1"sv);
+	EXPECT_EQ(parser.GetSyncLevel(), "infinite"sv);
+	ASSERT_EQ(parser.GetProperties().size(), 1U);
+	EXPECT_EQ(parser.GetProperties()[0].id, DavName::GETLASTMODIFIED);
+
+	/* the initial sync has an empty token */
+	ASSERT_TRUE(parser.Parse(R"(<D:sync-collection xmlns:D="DAV:"><D:sync-token/><D:sync-level>1</D:sync-level><D:prop/></D:sync-collection>)"sv));
+	EXPECT_EQ(parser.GetRoot(), DavName::SYNC_COLLECTION);
+	EXPECT_TRUE(parser.GetSyncToken().empty());
+	EXPECT_EQ(parser.GetSyncLevel(), "1"sv);
+
+	ASSERT_TRUE(parser.Parse(R"(<D:propfind xmlns:D="DAV:"><D:allprop/></D:propfind>)"sv));
+	EXPECT_EQ(parser.GetRoot(), DavName::UNKNOWN);
+	EXPECT_TRUE(parser.GetSyncToken().empty());
+}
+
+TEST(DavParserTest, Overflow)
+{
+	/* each reference to the long namespace is expanded */
+	std::string body = "<D:prop xmlns:D=\"DAV:\" xmlns:X=\"";
+	body.append(64 * 1024, 'x');
+	body += "\">";
+	for (unsigned i = 0; i < 128; ++i)
+		body += "<X:a/>";
+	body += "</D:prop>";
+
+	DavParser parser;
+	EXPECT_FALSE(parser.Parse(body));
+}
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "DirectoryScanner.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <set>
+#include <string>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class DirectoryScannerTest : public ::testing::Test {
+protected:
+	static constexpr unsigned N_FILES = 1000;
+
+	char path[32] = "/tmp/t_directory_scanner.XXXXXX";
+
+	void SetUp() override {
+		ASSERT_NE(mkdtemp(path), nullptr);
+
+		const std::string p{path};
+		for (unsigned i = 0; i < N_FILES; ++i) {
+			const auto name = p + "/f" + std::to_string(i);
+			UniqueFileDescriptor fd;
+			ASSERT_TRUE(fd.Open(name.c_str(), O_CREAT|O_WRONLY, 0600));
+		}
+
+		ASSERT_EQ(mkdir((p + "/dir").c_str(), 0700), 0);
+		ASSERT_EQ(symlink("f0", (p + "/link").c_str()), 0);
+	}
+
+	void TearDown() override {
+		const std::string p{path};
+		for (unsigned i = 0; i < N_FILES; ++i)
+			unlink((p + "/f" + std::to_string(i)).c_str());
+		rmdir((p + "/dir").c_str());
+		unlink((p + "/link").c_str());
+		rmdir(path);
+	}
+};
+
+TEST_F(DirectoryScannerTest, Full)
+{
+	DirectoryScanner scanner;
+	ASSERT_TRUE(scanner.Scan(path));
+	EXPECT_FALSE(scanner.IsTruncated());
+	EXPECT_EQ(scanner.size(), N_FILES + 2);
+
+	std::set<std::string> names;
+	for (const auto &i : scanner.GetEntries()) {
+		const std::string name{scanner.GetName(i)};
+		EXPECT_NE(name, ".");
+		EXPECT_NE(name, "..");
+		names.insert(name);
+
+		struct stat st;
+		ASSERT_EQ(lstat((path + ("/" + name)).c_str(), &st), 0);
+		EXPECT_EQ(i.ino, st.st_ino);
+
+		if (i.type != DT_UNKNOWN) {
+			if (name == "dir")
+				EXPECT_EQ(i.type, DT_DIR);
+			else if (name == "link")
+				EXPECT_EQ(i.type, DT_LNK);
+			else
+				EXPECT_EQ(i.type, DT_REG);
+		}
+	}
+
+	EXPECT_EQ(names.size(), N_FILES + 2);
+
+	scanner.SortByInode();
+	EXPECT_TRUE(std::ranges::is_sorted(scanner.GetEntries(), {},
+					   &DirectoryScanner::Entry::ino));
+
+	scanner.SortByName();
+	EXPECT_TRUE(std::ranges::is_sorted(scanner.GetEntries(),
+					   [](std::string_view a, std::string_view b){
+						   return a < b;
+					   },
+					   [&scanner](const auto &i){
+						   return std::string_view{scanner.GetName(i)};
+					   }));
+}
+
+TEST_F(DirectoryScannerTest, Pages)
+{
+	UniqueFileDescriptor fd;
+	ASSERT_TRUE(fd.Open(path, O_DIRECTORY|O_RDONLY));
+
+	DirectoryScanner scanner;
+	std::set<std::string> names;
+	off_t start = 0;
+	unsigned n_pages = 0;
+
+	do {
+		ASSERT_TRUE(scanner.Scan(fd, start, 300));
+		EXPECT_LE(scanner.size(), 300U);
+		++n_pages;
+
+		for (const auto &i : scanner.GetEntries())
+			EXPECT_TRUE(names.emplace(scanner.GetName(i)).second);
+
+		start = scanner.GetNext();
+	} while (scanner.IsTruncated());
+
+	EXPECT_EQ(n_pages, 4U);
+	EXPECT_EQ(names.size(), N_FILES + 2);
+}
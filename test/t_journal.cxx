@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Journal.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+class JournalTest : public ::testing::Test {
+protected:
+	char base[32] = "/tmp/t_journal.XXXXXX";
+	JournalConfig config;
+
+	void SetUp() override {
+		ASSERT_NE(mkdtemp(base), nullptr);
+		config.path = std::string{base} + "/journal";
+	}
+
+	void TearDown() override {
+		unlink(config.path.c_str());
+		rmdir(base);
+	}
+};
+
+TEST_F(JournalTest, Basic)
+{
+	const auto start = GetJournalEnd(config);
+
+	std::vector<JournalRecord> records;
+	auto end = ReadJournal(config, start, 100, records);
+	ASSERT_TRUE(end);
+	EXPECT_EQ(end->offset, start.offset);
+	EXPECT_TRUE(records.empty());
+
+	AppendJournal(config, JournalOp::MODIFIED, "a/b");
+	AppendJournal(config, JournalOp::DELETED, "c");
+	AppendJournal(config, JournalOp::TREE, "");
+
+	end = ReadJournal(config, start, 100, records);
+	ASSERT_TRUE(end);
+	EXPECT_EQ(end->id, start.id);
+	EXPECT_EQ(end->offset, GetJournalEnd(config).offset);
+
+	ASSERT_EQ(records.size(), 3U);
+	EXPECT_EQ(records[0].op, JournalOp::MODIFIED);
+	EXPECT_EQ(records[0].path, "a/b");
+	EXPECT_EQ(records[1].op, JournalOp::DELETED);
+	EXPECT_EQ(records[1].path, "c");
+	EXPECT_EQ(records[2].op, JournalOp::TREE);
+	EXPECT_EQ(records[2].path, "");
+
+	/* nothing new */
+	records.clear();
+	EXPECT_EQ(ReadJournal(config, *end, 100, records)->offset, end->offset);
+	EXPECT_TRUE(records.empty());
+}
+
+TEST_F(JournalTest, MaxRecords)
+{
+	const auto start = GetJournalEnd(config);
+
+	for (unsigned i = 0; i < 10; ++i)
+		AppendJournal(config, JournalOp::MODIFIED, std::to_string(i));
+
+	std::vector<JournalRecord> records;
+	const auto middle = ReadJournal(config, start, 4, records);
+	ASSERT_TRUE(middle);
+	ASSERT_EQ(records.size(), 4U);
+	EXPECT_EQ(records.back().path, "3");
+
+	records.clear();
+	ASSERT_TRUE(ReadJournal(config, *middle, 100, records));
+	ASSERT_EQ(records.size(), 6U);
+	EXPECT_EQ(records.front().path, "4");
+}
+
+TEST_F(JournalTest, InvalidPosition)
+{
+	const auto end = GetJournalEnd(config);
+
+	std::vector<JournalRecord> records;
+	EXPECT_FALSE(ReadJournal(config, {end.id + 1, end.offset}, 100, records));
+	EXPECT_FALSE(ReadJournal(config, {end.id, end.offset + 1}, 100, records));
+
+	/* a new journal has a different id */
+	unlink(config.path.c_str());
+	EXPECT_FALSE(ReadJournal(config, end, 100, records));
+	EXPECT_NE(GetJournalEnd(config).id, end.id);
+}
+
+TEST_F(JournalTest, Compact)
+{
+	config.max_size = 4096;
+
+	const auto start = GetJournalEnd(config);
+
+	const std::string padding(90, 'x');
+	JournalPosition recent{};
+	for (unsigned i = 0; i < 200; ++i) {
+		if (i == 190)
+			recent = GetJournalEnd(config);
+
+		AppendJournal(config, JournalOp::MODIFIED,
+			      padding + std::to_string(i));
+	}
+
+	/* the old records have been discarded */
+	std::vector<JournalRecord> records;
+	EXPECT_FALSE(ReadJournal(config, start, 1000, records));
+
+	/* but recent positions are still valid */
+	const auto end = ReadJournal(config, recent, 1000, records);
+	ASSERT_TRUE(end);
+	EXPECT_EQ(end->id, start.id);
+	ASSERT_EQ(records.size(), 10U);
+	EXPECT_EQ(records.front().path, padding + "190");
+	EXPECT_EQ(records.back().path, padding + "199");
+}
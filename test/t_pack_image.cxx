@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "PackImage.hxx"
+#include "io/FileAt.hxx"
+#include "ParallelTree.hxx"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void
+WriteFile(const std::string &path, const std::string &contents)
+{
+	std::ofstream{path} << contents;
+}
+
+static std::string
+ReadEntry(const PackImage &image, const PackEntry &entry)
+{
+	std::string data(entry.size, '\0');
+	pread(image.GetFileDescriptor().Get(), data.data(), data.size(),
+	      entry.data_offset);
+	return data;
+}
+
+class PackImageTest : public ::testing::Test {
+protected:
+	char base[32] = "/tmp/t_pack_image.XXXXXX";
+	std::string root, path;
+
+	void SetUp() override {
+		ASSERT_NE(mkdtemp(base), nullptr);
+		root = std::string{base} + "/root";
+		path = std::string{base} + "/image";
+		ASSERT_EQ(mkdir(root.c_str(), 0755), 0);
+	}
+
+	void TearDown() override {
+		std::vector<TreeError> errors;
+		ParallelDelete({FileDescriptor{AT_FDCWD}, base}, 1, errors);
+	}
+};
+
+TEST_F(PackImageTest, Build)
+{
+	ASSERT_EQ(mkdir((root + "/dir").c_str(), 0755), 0);
+	ASSERT_EQ(mkdir((root + "/dir/sub").c_str(), 0755), 0);
+	ASSERT_EQ(mkdir((root + "/empty").c_str(), 0755), 0);
+	WriteFile(root + "/a.txt", "hello");
+	WriteFile(root + "/dir/b", "world");
+	WriteFile(root + "/dir/sub/c", "");
+	WriteFile(root + "/dir-x", "sibling");
+	ASSERT_EQ(symlink("a.txt", (root + "/link").c_str()), 0);
+
+	/* the symlink is omitted */
+	EXPECT_EQ(BuildPackImage(root.c_str(), path.c_str()), 8U);
+
+	const PackImage image{path.c_str()};
+
+	const auto *r = image.Find("");
+	ASSERT_NE(r, nullptr);
+	EXPECT_EQ(r, &image.GetRoot());
+	EXPECT_TRUE(S_ISDIR(r->mode));
+
+	std::vector<std::string_view> names;
+	for (const auto &i : image.GetChildren(*r))
+		names.push_back(image.GetName(i));
+	EXPECT_EQ(names, (std::vector<std::string_view>{"a.txt", "dir", "dir-x", "empty"}));
+
+	const auto *a = image.Find("a.txt");
+	ASSERT_NE(a, nullptr);
+	EXPECT_TRUE(S_ISREG(a->mode));
+	EXPECT_EQ(ReadEntry(image, *a), "hello");
+	EXPECT_EQ(image.GetContentType(*a).empty(), false);
+	EXPECT_EQ(image.GetETag(*a).front(), '"');
+
+	const auto *d = image.Find("dir");
+	ASSERT_NE(d, nullptr);
+	EXPECT_EQ(d->n_children, 2U);
+
+	const auto *b = image.Find("dir/b");
+	ASSERT_NE(b, nullptr);
+	EXPECT_EQ(image.GetPath(*b), "dir/b");
+	EXPECT_EQ(image.GetName(*b), "b");
+	EXPECT_EQ(ReadEntry(image, *b), "world");
+
+	const auto *c = image.Find("dir/sub/c");
+	ASSERT_NE(c, nullptr);
+	EXPECT_EQ(c->size, 0U);
+
+	EXPECT_EQ(ReadEntry(image, *image.Find("dir-x")), "sibling");
+	EXPECT_EQ(image.Find("empty")->n_children, 0U);
+
+	EXPECT_EQ(image.Find("link"), nullptr);
+	EXPECT_EQ(image.Find("dir/x"), nullptr);
+	EXPECT_EQ(image.Find("dir/"), nullptr);
+	EXPECT_EQ(image.Find("nonexistent/b"), nullptr);
+}
+
+TEST_F(PackImageTest, Shared)
+{
+	WriteFile(root + "/a", "hello");
+	BuildPackImage(root.c_str(), path.c_str());
+
+	const auto image1 = OpenPackImage(path.c_str());
+	const auto image2 = OpenPackImage(path.c_str());
+	EXPECT_EQ(image1, image2);
+
+	/* a new image replacing the old one is detected */
+	const std::string tmp = path + ".new";
+	WriteFile(root + "/b", "world");
+	BuildPackImage(root.c_str(), tmp.c_str());
+	ASSERT_EQ(rename(tmp.c_str(), path.c_str()), 0);
+
+	const auto image3 = OpenPackImage(path.c_str());
+	EXPECT_NE(image1, image3);
+	EXPECT_EQ(image1->Find("b"), nullptr);
+	EXPECT_NE(image3->Find("b"), nullptr);
+}
+
+TEST_F(PackImageTest, Corrupt)
+{
+	WriteFile(path, "this is not a pack image");
+	EXPECT_ANY_THROW(PackImage{path.c_str()});
+
+	WriteFile(root + "/a", "hello");
+	BuildPackImage(root.c_str(), path.c_str());
+
+	/* truncate the index */
+	struct stat st;
+	ASSERT_EQ(stat(path.c_str(), &st), 0);
+	ASSERT_EQ(truncate(path.c_str(), st.st_size - 1), 0);
+	EXPECT_ANY_THROW(PackImage{path.c_str()});
+}
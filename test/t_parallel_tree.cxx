@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "ParallelTree.hxx"
+#include "io/FileAt.hxx"
+#include "io/RecursiveCopy.hxx"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void
+WriteFile(const std::string &path, const std::string &contents)
+{
+	std::ofstream{path} << contents;
+}
+
+static std::string
+ReadFile(const std::string &path)
+{
+	std::ostringstream s;
+	s << std::ifstream{path}.rdbuf();
+	return s.str();
+}
+
+static bool
+Exists(const std::string &path)
+{
+	struct stat st;
+	return lstat(path.c_str(), &st) == 0;
+}
+
+class ParallelTreeTest : public ::testing::TestWithParam<unsigned> {
+protected:
+	char base[32] = "/tmp/t_parallel_tree.XXXXXX";
+	std::string src, dst;
+
+	void SetUp() override {
+		ASSERT_NE(mkdtemp(base), nullptr);
+		src = std::string{base} + "/src";
+		dst = std::string{base} + "/dst";
+
+		/* 20 directories with 50 files each */
+		ASSERT_EQ(mkdir(src.c_str(), 0755), 0);
+		for (unsigned i = 0; i < 20; ++i) {
+			const auto dir = src + "/d" + std::to_string(i);
+			ASSERT_EQ(mkdir(dir.c_str(), 0755), 0);
+			for (unsigned j = 0; j < 50; ++j)
+				WriteFile(dir + "/f" + std::to_string(j),
+					  std::to_string(i * 1000 + j));
+		}
+
+		ASSERT_EQ(symlink("d0/f0", (src + "/link").c_str()), 0);
+	}
+
+	void TearDown() override {
+		std::vector<TreeError> errors;
+		for (const auto &i : {src, dst})
+			if (Exists(i))
+				ParallelDelete({FileDescriptor{AT_FDCWD}, i.c_str()},
+					       1, errors);
+		rmdir(base);
+	}
+
+	void Copy(unsigned options, std::vector<TreeError> &errors) {
+		ParallelCopy({FileDescriptor{AT_FDCWD}, src.c_str()},
+			     {FileDescriptor{AT_FDCWD}, dst.c_str()},
+			     options, GetParam(), errors);
+	}
+};
+
+TEST_P(ParallelTreeTest, CopyDelete)
+{
+	std::vector<TreeError> errors;
+	Copy(RECURSIVE_COPY_ONE_FILESYSTEM, errors);
+	EXPECT_TRUE(errors.empty());
+
+	for (unsigned i = 0; i < 20; ++i)
+		for (unsigned j = 0; j < 50; ++j)
+			EXPECT_EQ(ReadFile(dst + "/d" + std::to_string(i) +
+					   "/f" + std::to_string(j)),
+				  std::to_string(i * 1000 + j));
+
+	char target[64];
+	const auto length = readlink((dst + "/link").c_str(), target,
+				     sizeof(target));
+	EXPECT_EQ(std::string_view(target, std::max<ssize_t>(length, 0)),
+		  "d0/f0");
+
+	ParallelDelete({FileDescriptor{AT_FDCWD}, dst.c_str()},
+		       GetParam(), errors);
+	EXPECT_TRUE(errors.empty());
+	EXPECT_FALSE(Exists(dst));
+}
+
+TEST_P(ParallelTreeTest, NoOverwrite)
+{
+	ASSERT_EQ(mkdir(dst.c_str(), 0755), 0);
+
+	std::vector<TreeError> errors;
+	EXPECT_THROW(Copy(RECURSIVE_COPY_NO_OVERWRITE, errors),
+		     std::system_error);
+}
+
+TEST_P(ParallelTreeTest, MemberErrors)
+{
+	/* a directory where the copy wants to create a file */
+	ASSERT_EQ(mkdir(dst.c_str(), 0755), 0);
+	ASSERT_EQ(mkdir((dst + "/d3").c_str(), 0755), 0);
+	ASSERT_EQ(mkdir((dst + "/d3/f7").c_str(), 0755), 0);
+
+	std::vector<TreeError> errors;
+	Copy(0, errors);
+
+	ASSERT_EQ(errors.size(), 1U);
+	EXPECT_EQ(errors.front().path, "d3/f7");
+	EXPECT_EQ(errors.front().error, EISDIR);
+
+	/* the rest was copied */
+	EXPECT_EQ(ReadFile(dst + "/d3/f8"), "3008");
+	EXPECT_EQ(ReadFile(dst + "/d19/f49"), "19049");
+}
+
+TEST_P(ParallelTreeTest, Link)
+{
+	/* a file with a second link is linked, the others are
+	   copied */
+	ASSERT_EQ(link((src + "/d2/f3").c_str(), (std::string{base} + "/object").c_str()), 0);
+
+	std::vector<TreeError> errors;
+	Copy(PARALLEL_COPY_LINK, errors);
+	EXPECT_TRUE(errors.empty());
+
+	struct stat a, b;
+	ASSERT_EQ(stat((src + "/d2/f3").c_str(), &a), 0);
+	ASSERT_EQ(stat((dst + "/d2/f3").c_str(), &b), 0);
+	EXPECT_EQ(a.st_ino, b.st_ino);
+	EXPECT_EQ(b.st_nlink, 3U);
+
+	ASSERT_EQ(stat((src + "/d2/f4").c_str(), &a), 0);
+	ASSERT_EQ(stat((dst + "/d2/f4").c_str(), &b), 0);
+	EXPECT_NE(a.st_ino, b.st_ino);
+	EXPECT_EQ(ReadFile(dst + "/d2/f4"), "2004");
+
+	unlink((std::string{base} + "/object").c_str());
+}
+
+TEST_P(ParallelTreeTest, DeleteFile)
+{
+	std::vector<TreeError> errors;
+	ParallelDelete({FileDescriptor{AT_FDCWD}, (src + "/d1/f1").c_str()},
+		       GetParam(), errors);
+	EXPECT_TRUE(errors.empty());
+	EXPECT_FALSE(Exists(src + "/d1/f1"));
+	EXPECT_TRUE(Exists(src + "/d1/f2"));
+
+	EXPECT_THROW(ParallelDelete({FileDescriptor{AT_FDCWD},
+				     (src + "/d1/f1").c_str()},
+				    GetParam(), errors),
+		     std::system_error);
+}
+
+INSTANTIATE_TEST_SUITE_P(Threads, ParallelTreeTest,
+			 ::testing::Values(1U, 4U));
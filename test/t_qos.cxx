@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Qos.hxx"
+
+#include <gtest/gtest.h>
+
+using std::chrono_literals::operator""ms;
+using std::chrono_literals::operator""s;
+
+TEST(TokenBucket, ChunkSize)
+{
+	EXPECT_EQ(TokenBucket::GetChunkSize(1), 16U * 1024);
+	EXPECT_EQ(TokenBucket::GetChunkSize(16 * 65536), 65536U);
+	EXPECT_EQ(TokenBucket::GetChunkSize(UINT64_MAX), 1024U * 1024);
+}
+
+TEST(TokenBucket, Consume)
+{
+	const TokenBucket::Clock::time_point t0{};
+	constexpr uint64_t rate = 1024 * 1024;
+	constexpr std::size_t burst = rate / 16;
+
+	TokenBucket bucket{rate, t0};
+
+	/* the initial burst is free */
+	EXPECT_EQ(bucket.Consume(burst, t0), TokenBucket::Clock::duration{});
+
+	/* then each byte costs time */
+	auto delay = bucket.Consume(rate / 2, t0);
+	EXPECT_GE(delay, 499ms);
+	EXPECT_LE(delay, 501ms);
+
+	/* waiting pays the debt */
+	EXPECT_EQ(bucket.Consume(0, t0 + 500ms), TokenBucket::Clock::duration{});
+
+	/* idle time refills only up to the burst size */
+	delay = bucket.Consume(burst + rate, t0 + 10s);
+	EXPECT_GE(delay, 999ms);
+	EXPECT_LE(delay, 1001ms);
+}
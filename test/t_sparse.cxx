@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Sparse.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+TEST(SparseTest, IsAllZero)
+{
+	std::vector<std::byte> buffer(1000);
+	EXPECT_TRUE(IsAllZero({}));
+	EXPECT_TRUE(IsAllZero(buffer));
+
+	/* every position, including the unaligned head and the tail
+	   which is not checked with vectors */
+	for (std::size_t i = 0; i < buffer.size(); ++i) {
+		buffer[i] = std::byte{0x80};
+		EXPECT_FALSE(IsAllZero(buffer));
+		EXPECT_TRUE(IsAllZero(std::span{buffer}.first(i)));
+		EXPECT_TRUE(IsAllZero(std::span{buffer}.subspan(i + 1)));
+		buffer[i] = std::byte{};
+	}
+}
+
+TEST(SparseTest, WriteSparse)
+{
+	UniqueFileDescriptor fd;
+	ASSERT_TRUE(fd.Open("/tmp", O_TMPFILE|O_RDWR, 0600));
+
+	/* block 0 is data, blocks 1 and 2 are zero, block 3 is data,
+	   block 4 is zero */
+	std::vector<std::byte> buffer(5 * SPARSE_BLOCK_SIZE);
+	buffer[0] = std::byte{1};
+	buffer[4 * SPARSE_BLOCK_SIZE - 1] = std::byte{2};
+
+	/* write in two unaligned chunks */
+	const std::size_t split = SPARSE_BLOCK_SIZE + 100;
+	const std::span<const std::byte> src{buffer};
+	uint64_t skipped = 0;
+	ASSERT_TRUE(WriteSparse(fd, src.first(split), 0, skipped));
+	ASSERT_TRUE(WriteSparse(fd, src.subspan(split), split, skipped));
+	EXPECT_EQ(skipped, 3 * SPARSE_BLOCK_SIZE);
+
+	/* the trailing hole is not part of the file yet */
+	EXPECT_EQ(fd.GetSize(), off_t(4 * SPARSE_BLOCK_SIZE));
+	ASSERT_EQ(ftruncate(fd.Get(), buffer.size()), 0);
+
+	std::vector<std::byte> result(buffer.size());
+	ASSERT_EQ(fd.ReadAt(0, result), ssize_t(result.size()));
+	EXPECT_EQ(result, buffer);
+}
@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Tar.hxx"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using Block = std::array<std::byte, TAR_BLOCK_SIZE>;
+
+static void
+SetField(Block &block, std::size_t offset, std::string_view value)
+{
+	std::memcpy(block.data() + offset, value.data(), value.size());
+}
+
+static void
+UpdateChecksum(Block &block)
+{
+	std::memset(block.data() + 148, ' ', 8);
+
+	unsigned sum = 0;
+	for (const std::byte b : block)
+		sum += std::to_integer<unsigned>(b);
+
+	char buffer[8];
+	snprintf(buffer, sizeof(buffer), "%06o", sum);
+	SetField(block, 148, {buffer, 7});
+}
+
+static Block
+MakeHeader(std::string_view name, uint64_t size, char type,
+	   std::string_view prefix={})
+{
+	Block block{};
+	SetField(block, 0, name);
+	SetField(block, 100, "0000644");
+
+	char buffer[16];
+	snprintf(buffer, sizeof(buffer), "%011llo", (unsigned long long)size);
+	SetField(block, 124, buffer);
+	SetField(block, 136, "14473365720");
+	block[156] = std::byte(type);
+	SetField(block, 257, "ustar");
+	SetField(block, 263, "00");
+	SetField(block, 345, prefix);
+
+	UpdateChecksum(block);
+	return block;
+}
+
+TEST(TarTest, Regular)
+{
+	const auto block = MakeHeader("foo/bar.txt", 1234, '0');
+
+	TarEntry entry;
+	ASSERT_EQ(ParseTarHeader(block, entry), TarHeaderResult::ENTRY);
+	EXPECT_EQ(entry.type, TarEntry::Type::REGULAR);
+	EXPECT_EQ(entry.name, "foo/bar.txt");
+	EXPECT_EQ(entry.size, 1234u);
+	EXPECT_EQ(entry.mtime, 014473365720);
+	EXPECT_EQ(entry.GetPadding(), 512u - 1234u % 512u);
+}
+
+TEST(TarTest, Prefix)
+{
+	const auto block = MakeHeader("bar", 0, '5', "foo");
+
+	TarEntry entry;
+	ASSERT_EQ(ParseTarHeader(block, entry), TarHeaderResult::ENTRY);
+	EXPECT_EQ(entry.type, TarEntry::Type::DIRECTORY);
+	EXPECT_EQ(entry.name, "foo/bar");
+	EXPECT_EQ(entry.GetPadding(), 0u);
+}
+
+TEST(TarTest, Types)
+{
+	TarEntry entry;
+
+	ASSERT_EQ(ParseTarHeader(MakeHeader("dir/", 0, '\0'), entry),
+		  TarHeaderResult::ENTRY);
+	EXPECT_EQ(entry.type, TarEntry::Type::DIRECTORY);
+
+	ASSERT_EQ(ParseTarHeader(MakeHeader("link", 0, '2'), entry),
+		  TarHeaderResult::ENTRY);
+	EXPECT_EQ(entry.type, TarEntry::Type::OTHER);
+
+	ASSERT_EQ(ParseTarHeader(MakeHeader("././@LongLink", 300, 'L'), entry),
+		  TarHeaderResult::ENTRY);
+	EXPECT_EQ(entry.type, TarEntry::Type::LONG_NAME);
+
+	ASSERT_EQ(ParseTarHeader(MakeHeader("PaxHeader", 30, 'x'), entry),
+		  TarHeaderResult::ENTRY);
+	EXPECT_EQ(entry.type, TarEntry::Type::PAX);
+}
+
+TEST(TarTest, Base256)
+{
+	auto block = MakeHeader("big", 0, '0');
+	std::memset(block.data() + 124, 0, 12);
+	block[124] = std::byte{0x80};
+	block[131] = std::byte{0x02}; // 2 << 32 = 8 GiB
+	UpdateChecksum(block);
+
+	TarEntry entry;
+	ASSERT_EQ(ParseTarHeader(block, entry), TarHeaderResult::ENTRY);
+	EXPECT_EQ(entry.size, uint64_t{2} << 32);
+}
+
+TEST(TarTest, Malformed)
+{
+	TarEntry entry;
+
+	const Block zero{};
+	EXPECT_EQ(ParseTarHeader(zero, entry), TarHeaderResult::END);
+
+	auto block = MakeHeader("foo", 1, '0');
+	block[0] = std::byte{'g'};
+	EXPECT_EQ(ParseTarHeader(block, entry), TarHeaderResult::MALFORMED);
+
+	block = MakeHeader("foo", 1, '0');
+	SetField(block, 124, "0000000009x");
+	UpdateChecksum(block);
+	EXPECT_EQ(ParseTarHeader(block, entry), TarHeaderResult::MALFORMED);
+}
+
+TEST(TarTest, Pax)
+{
+	TarOverride o;
+	EXPECT_TRUE(ParsePaxHeader("30 mtime=1700000000.123456789\n"
+				   "18 path=long/name\n"
+				   "15 size=123456\n"
+				   "16 uname=nobody\n", o));
+	EXPECT_EQ(o.name, "long/name");
+	EXPECT_EQ(o.size, 123456u);
+	EXPECT_EQ(o.mtime, 1700000000);
+
+	TarEntry entry{
+		.type = TarEntry::Type::REGULAR,
+		.name = "short",
+		.size = 1,
+		.mtime = 0,
+	};
+
+	o.Apply(entry);
+	EXPECT_EQ(entry.name, "long/name");
+	EXPECT_EQ(entry.size, 123456u);
+
+	o.Clear();
+	EXPECT_TRUE(o.IsEmpty());
+
+	EXPECT_FALSE(ParsePaxHeader("99 path=x\n", o));
+	EXPECT_FALSE(ParsePaxHeader("11 path=x\n", o));
+	EXPECT_FALSE(ParsePaxHeader("10 path=x", o));
+	EXPECT_FALSE(ParsePaxHeader("9 pathx\n", o));
+	EXPECT_FALSE(ParsePaxHeader("12 size=x\n", o));
+
+	/* a null byte must not be able to truncate a name to ".." */
+	using namespace std::string_view_literals;
+	EXPECT_FALSE(ParsePaxHeader("18 path=..\0x/file\n"sv, o));
+	EXPECT_FALSE(ParsePaxHeader("22 linkpath=..\0x/file\n"sv, o));
+}
+
+TEST(TarTest, Format)
+{
+	const TarEntry src{
+		.type = TarEntry::Type::REGULAR,
+		.name = "foo/bar.txt",
+		.size = uint64_t{9} << 30,
+		.mtime = 1700000000,
+	};
+
+	Block block;
+	ASSERT_EQ(GetTarHeaderSize(src.name.size()), block.size());
+	FormatTarHeader(block, src);
+
+	TarEntry entry;
+	ASSERT_EQ(ParseTarHeader(block, entry), TarHeaderResult::ENTRY);
+	EXPECT_EQ(entry.type, src.type);
+	EXPECT_EQ(entry.name, src.name);
+	EXPECT_EQ(entry.size, src.size);
+	EXPECT_EQ(entry.mtime, src.mtime);
+}
+
+TEST(TarTest, FormatLongName)
+{
+	const TarEntry src{
+		.type = TarEntry::Type::DIRECTORY,
+		.name = std::string(300, 'x') + "/",
+		.size = 0,
+		.mtime = 42,
+	};
+
+	std::vector<std::byte> buffer(GetTarHeaderSize(src.name.size()));
+	ASSERT_EQ(buffer.size(), 3 * TAR_BLOCK_SIZE);
+	FormatTarHeader(buffer, src);
+
+	const std::span<const std::byte> s{buffer};
+
+	TarEntry entry;
+	ASSERT_EQ(ParseTarHeader(s.first<TAR_BLOCK_SIZE>(), entry),
+		  TarHeaderResult::ENTRY);
+	EXPECT_EQ(entry.type, TarEntry::Type::LONG_NAME);
+	EXPECT_EQ(entry.size, src.name.size() + 1);
+
+	const auto data = s.subspan(TAR_BLOCK_SIZE, entry.size);
+	EXPECT_EQ(std::string_view((const char *)data.data(), data.size() - 1),
+		  src.name);
+
+	ASSERT_EQ(ParseTarHeader(s.last<TAR_BLOCK_SIZE>(), entry),
+		  TarHeaderResult::ENTRY);
+	EXPECT_EQ(entry.type, TarEntry::Type::DIRECTORY);
+	EXPECT_EQ(entry.mtime, 42);
+}
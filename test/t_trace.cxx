@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "Trace.hxx"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static TraceRecord
+MakeRecord(uint32_t connection, const char *uri)
+{
+	TraceRecord record{};
+	record.start = 1234567890123456;
+	record.duration = 4321;
+	record.process = 42;
+	record.connection = connection;
+	record.method = HTTP_METHOD_PUT;
+	record.has_body = true;
+	record.body_length = 65536;
+	record.uri = uri;
+	record.headers.push_back({trace_headers[0], "1"});
+	record.headers.push_back({trace_headers[1], "/dest"});
+	return record;
+}
+
+TEST(TraceTest, RoundTrip)
+{
+	std::string buffer;
+	SerializeTraceRecord(buffer, MakeRecord(1, "/a"));
+	SerializeTraceRecord(buffer, MakeRecord(2, "/b%20c"));
+
+	std::span<const std::byte> src = std::as_bytes(std::span{buffer});
+
+	TraceRecord record;
+	ASSERT_TRUE(ParseTraceRecord(src, record));
+	EXPECT_EQ(record.start, 1234567890123456U);
+	EXPECT_EQ(record.duration, 4321U);
+	EXPECT_EQ(record.process, 42U);
+	EXPECT_EQ(record.connection, 1U);
+	EXPECT_EQ(record.method, HTTP_METHOD_PUT);
+	EXPECT_TRUE(record.has_body);
+	EXPECT_EQ(record.body_length, 65536);
+	EXPECT_EQ(record.uri, "/a");
+	ASSERT_EQ(record.headers.size(), 2U);
+	EXPECT_EQ(record.headers[0].name, "depth");
+	EXPECT_EQ(record.headers[0].value, "1");
+	EXPECT_EQ(record.headers[1].name, "destination");
+	EXPECT_EQ(record.headers[1].value, "/dest");
+
+	ASSERT_TRUE(ParseTraceRecord(src, record));
+	EXPECT_EQ(record.connection, 2U);
+	EXPECT_EQ(record.uri, "/b%20c");
+	EXPECT_TRUE(src.empty());
+}
+
+TEST(TraceTest, Truncated)
+{
+	std::string buffer;
+	SerializeTraceRecord(buffer, MakeRecord(1, "/a"));
+
+	for (std::size_t length = 0; length < buffer.size(); ++length) {
+		std::span<const std::byte> src = std::as_bytes(std::span{buffer}).first(length);
+		TraceRecord record;
+		EXPECT_FALSE(ParseTraceRecord(src, record));
+	}
+}
+
+TEST(TraceTest, File)
+{
+	char path[] = "/tmp/t_trace.XXXXXX";
+	const int fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	close(fd);
+
+	{
+		TraceWriter writer{path};
+		writer.Write(MakeRecord(1, "/a"));
+	}
+
+	{
+		/* appending to an existing trace */
+		TraceWriter writer{path};
+		writer.Write(MakeRecord(2, "/b"));
+	}
+
+	const auto records = LoadTrace(path);
+	unlink(path);
+
+	ASSERT_EQ(records.size(), 2U);
+	EXPECT_EQ(records[0].uri, "/a");
+	EXPECT_EQ(records[1].uri, "/b");
+}
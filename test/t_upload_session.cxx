@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: BSD-2-Clause
+// Copyright CM4all GmbH
+// author: Max Kellermann <max.kellermann@ionos.com>
+
+#include "UploadSession.hxx"
+#include "ParallelTree.hxx"
+#include "io/FileAt.hxx"
+#include "io/UniqueFileDescriptor.hxx"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string_view_literals::operator""sv;
+
+static void
+WriteFile(const std::string &path, const std::string &contents)
+{
+	std::ofstream{path} << contents;
+}
+
+static std::string
+ReadFile(const std::string &path)
+{
+	std::ostringstream s;
+	s << std::ifstream{path}.rdbuf();
+	return s.str();
+}
+
+TEST(UploadSession, Classify)
+{
+	constexpr auto dir = "/var/uploads"sv;
+
+	EXPECT_EQ(ClassifyUploadPath(dir, "/var/www/foo"), UploadPath::NONE);
+	EXPECT_EQ(ClassifyUploadPath(dir, "/var/uploads2/x"), UploadPath::NONE);
+	EXPECT_EQ(ClassifyUploadPath(dir, "/var/uploads"), UploadPath::ROOT);
+	EXPECT_EQ(ClassifyUploadPath(dir, "/var/uploads/abc"), UploadPath::SESSION);
+	EXPECT_EQ(ClassifyUploadPath(dir, "/var/uploads/abc/1"), UploadPath::CHUNK);
+	EXPECT_EQ(ClassifyUploadPath(dir, "/var/uploads/abc/.file"), UploadPath::ASSEMBLE);
+	EXPECT_EQ(ClassifyUploadPath(dir, "/var/uploads/abc/foo"), UploadPath::INVALID);
+	EXPECT_EQ(ClassifyUploadPath(dir, "/var/uploads/abc/1/2"), UploadPath::INVALID);
+	EXPECT_EQ(ClassifyUploadPath(dir, "/var/uploads//1"), UploadPath::INVALID);
+}
+
+TEST(UploadSession, ChunkName)
+{
+	EXPECT_TRUE(IsChunkName("0"));
+	EXPECT_TRUE(IsChunkName("1"));
+	EXPECT_TRUE(IsChunkName("10000"));
+	EXPECT_FALSE(IsChunkName(""));
+	EXPECT_FALSE(IsChunkName("01"));
+	EXPECT_FALSE(IsChunkName("1a"));
+	EXPECT_FALSE(IsChunkName("-1"));
+	EXPECT_FALSE(IsChunkName("1234567890"));
+}
+
+class UploadSessionTest : public ::testing::Test {
+protected:
+	char base[32] = "/tmp/t_upload_session.XXXXXX";
+	std::string session;
+
+	void SetUp() override {
+		ASSERT_NE(mkdtemp(base), nullptr);
+		session = std::string{base} + "/session";
+		ASSERT_EQ(mkdir(session.c_str(), 0755), 0);
+	}
+
+	void TearDown() override {
+		std::vector<TreeError> errors;
+		ParallelDelete({FileDescriptor{AT_FDCWD}, base}, 1, errors);
+	}
+
+	UniqueFileDescriptor OpenSession() {
+		UniqueFileDescriptor fd;
+		EXPECT_TRUE(fd.Open(session.c_str(), O_DIRECTORY|O_RDONLY));
+		return fd;
+	}
+};
+
+TEST_F(UploadSessionTest, Assemble)
+{
+	/* the chunks arrive in random order, and numbers may have
+	   gaps */
+	WriteFile(session + "/10", "ten");
+	WriteFile(session + "/2", "two,");
+	WriteFile(session + "/1", "one,");
+	WriteFile(session + "/foo", "ignored");
+	ASSERT_EQ(mkdir((session + "/3").c_str(), 0755), 0);
+
+	const auto fd = OpenSession();
+	const auto chunks = ListChunks(fd);
+	ASSERT_EQ(chunks.size(), 3U);
+	EXPECT_EQ(chunks[0].name, "1");
+	EXPECT_EQ(chunks[1].name, "2");
+	EXPECT_EQ(chunks[2].name, "10");
+	EXPECT_EQ(GetSessionSize(fd), 11U);
+
+	const auto path = std::string{base} + "/out";
+	UniqueFileDescriptor out;
+	ASSERT_TRUE(out.Open(path.c_str(), O_CREAT|O_WRONLY, 0644));
+	AssembleChunks(fd, chunks, out);
+
+	EXPECT_EQ(ReadFile(path), "one,two,ten");
+}
+
+TEST_F(UploadSessionTest, AssembleLarge)
+{
+	/* block-aligned chunks, which can be cloned on filesystems
+	   with reflinks */
+	std::string expected;
+	for (unsigned i = 1; i <= 4; ++i) {
+		const std::string data(65536, char('a' + i));
+		WriteFile(session + "/" + std::to_string(i), data);
+		expected += data;
+	}
+
+	WriteFile(session + "/5", "tail");
+	expected += "tail";
+
+	const auto fd = OpenSession();
+	const auto chunks = ListChunks(fd);
+
+	const auto path = std::string{base} + "/out";
+	UniqueFileDescriptor out;
+	ASSERT_TRUE(out.Open(path.c_str(), O_CREAT|O_WRONLY, 0644));
+	const uint64_t cloned = AssembleChunks(fd, chunks, out);
+	EXPECT_LE(cloned, expected.size());
+
+	EXPECT_EQ(ReadFile(path), expected);
+}
+
+TEST_F(UploadSessionTest, Modified)
+{
+	WriteFile(session + "/1", "one");
+
+	const auto fd = OpenSession();
+	const auto chunks = ListChunks(fd);
+
+	WriteFile(session + "/1", "changed");
+
+	const auto path = std::string{base} + "/out";
+	UniqueFileDescriptor out;
+	ASSERT_TRUE(out.Open(path.c_str(), O_CREAT|O_WRONLY, 0644));
+	EXPECT_THROW(AssembleChunks(fd, chunks, out), std::system_error);
+}
+
+TEST_F(UploadSessionTest, Expire)
+{
+	const auto old_session = std::string{base} + "/old";
+	ASSERT_EQ(mkdir(old_session.c_str(), 0755), 0);
+	WriteFile(old_session + "/1", "one");
+
+	const struct timespec times[2] = {
+		{time(nullptr) - 7200, 0},
+		{time(nullptr) - 7200, 0},
+	};
+	ASSERT_EQ(utimensat(AT_FDCWD, old_session.c_str(), times, 0), 0);
+
+	EXPECT_EQ(ExpireSessions(base, std::chrono::hours{1}, 1), 1U);
+
+	struct stat st;
+	EXPECT_NE(stat(old_session.c_str(), &st), 0);
+	EXPECT_EQ(stat(session.c_str(), &st), 0);
+}